@@ -23,6 +23,7 @@
 #include <IOKit/hid/IOHIDKeys.h>
 #include <notify.h>
 #include <pthread.h>
+#include <libkern/OSAtomic.h>
 #include <asl.h>
 #include <fcntl.h>
 #include <mach/mach.h>
@@ -48,6 +49,10 @@
 
 #define kStringLength   128
 
+#define kLogEntryCount              64
+#define kServiceStatsInterval       (10 * 60 * NSEC_PER_SEC)
+#define kServiceStatsLeeway         (60 * NSEC_PER_SEC)
+
 extern "C" void * IOHIDEventSystemStatisticsFactory(CFAllocatorRef allocator, CFUUIDRef typeUUID);
 static mach_timebase_info_data_t    sTimebaseInfo;
 
@@ -56,6 +61,75 @@ static const char kButtonVolumeIncrement[]  = "volume_inc";
 static const char kButtonVolumeDecrement[]  = "volume_dec";
 static const char kButtonMenu[]             = "menu/home";
 
+static const char kActionDown[]             = "down";
+static const char kActionFiltered[]         = "filtered";
+
+//------------------------------------------------------------------------------
+// takeCounter
+//------------------------------------------------------------------------------
+static int32_t takeCounter(volatile int32_t * counter)
+{
+    int32_t value;
+    
+    do {
+        value = *counter;
+    } while ( !OSAtomicCompareAndSwap32(value, 0, counter) );
+    
+    return value;
+}
+
+//------------------------------------------------------------------------------
+// absoluteToMicroseconds
+//------------------------------------------------------------------------------
+static uint64_t absoluteToMicroseconds(uint64_t value)
+{
+    return ((value * sTimebaseInfo.numer) / sTimebaseInfo.denom) / NSEC_PER_USEC;
+}
+
+//------------------------------------------------------------------------------
+// getIntervalBucket
+//------------------------------------------------------------------------------
+// Bucket 0 holds sub-microsecond intervals and bucket n holds [2^(n-1), 2^n)
+// microseconds; the last bucket also takes everything longer.
+static uint32_t getIntervalBucket(uint64_t interval, uint32_t bucketCount)
+{
+    uint64_t    us      = absoluteToMicroseconds(interval);
+    uint32_t    bucket  = us ? 64 - __builtin_clzll(us) : 0;
+    
+    return bucket < bucketCount ? bucket : bucketCount - 1;
+}
+
+//------------------------------------------------------------------------------
+// getIntervalPercentile
+//------------------------------------------------------------------------------
+// Returns the upper bound, in microseconds, of the bucket holding the
+// requested percentile.
+static uint64_t getIntervalPercentile(const uint32_t * intervals, uint32_t bucketCount, double percentile)
+{
+    uint64_t    total   = 0;
+    uint64_t    target;
+    uint64_t    seen    = 0;
+    uint32_t    bucket;
+    
+    for ( bucket = 0; bucket < bucketCount; bucket++ )
+        total += intervals[bucket];
+    
+    if ( !total )
+        return 0;
+    
+    target = (uint64_t)((percentile / 100.0) * total);
+    if ( target >= total )
+        target = total - 1;
+    
+    for ( bucket = 0; bucket < bucketCount; bucket++ ) {
+        seen += intervals[bucket];
+        if ( seen > target )
+            break;
+    }
+    
+    return 1ULL << bucket;
+}
+
 //------------------------------------------------------------------------------
 // IOHIDEventSystemStatisticsFactory
 //------------------------------------------------------------------------------
@@ -91,7 +165,7 @@ IOHIDSessionFilterPlugInInterface IOHIDEventSystemStatistics::sIOHIDEventSystemS
     NULL,
     NULL,
     IOHIDEventSystemStatistics::registerService,
-    NULL,
+    IOHIDEventSystemStatistics::unregisterService,
     IOHIDEventSystemStatistics::scheduleWithDispatchQueue,
     IOHIDEventSystemStatistics::unscheduleFromDispatchQueue,
     NULL,
@@ -111,11 +185,21 @@ _displayToken(0),
 _pending_source(0),
 _dispatch_queue(0),
 _logButtonFiltering(false),
-_logStrings(NULL),
+_logEntries(NULL),
+_logHead(0),
+_logTail(0),
+_logDropped(0),
 _logfd(-1),
-_asl(NULL)
+_asl(NULL),
+_stats_source(0),
+_serviceStats(NULL)
 {
     bzero(&_pending_buttons, sizeof(_pending_buttons));
+    
+    if ( sTimebaseInfo.denom == 0 ) {
+        (void) mach_timebase_info(&sTimebaseInfo);
+    }
+    
     CFPlugInAddInstanceForFactory( factoryID );
 }
 //------------------------------------------------------------------------------
@@ -123,6 +207,22 @@ _asl(NULL)
 //------------------------------------------------------------------------------
 IOHIDEventSystemStatistics::~IOHIDEventSystemStatistics()
 {
+    if ( _serviceStats ) {
+        CFIndex         count   = CFDictionaryGetCount(_serviceStats);
+        const void **   values  = (const void **)malloc(count * sizeof(void *));
+        
+        if ( values ) {
+            CFDictionaryGetKeysAndValues(_serviceStats, NULL, values);
+            for ( CFIndex index = 0; index < count; index++ )
+                free((void *)values[index]);
+            free(values);
+        }
+        CFRelease(_serviceStats);
+    }
+    
+    if ( _logEntries )
+        free(_logEntries);
+    
     CFPlugInRemoveInstanceForFactory( _factoryID );
     CFRelease( _factoryID );
 }
@@ -220,7 +320,7 @@ boolean_t IOHIDEventSystemStatistics::open(IOHIDSessionRef session, IOOptionBits
     }
     
     if (_logButtonFiltering) {
-        _logStrings = CFArrayCreateMutable(kCFAllocatorDefault, 0, &kCFTypeArrayCallBacks);
+        _logEntries = (LogEntry *)calloc(kLogEntryCount, sizeof(LogEntry));
         _asl = asl_open("ButtonLogging", "Button Filtering Information", 0);
         
         _logfd = ::open("/var/mobile/Library/Logs/button.log", O_CREAT | O_APPEND | O_RDWR, 0644);
@@ -245,11 +345,8 @@ void IOHIDEventSystemStatistics::close(IOHIDSessionRef session, IOOptionBits opt
     (void) session;
     (void) options;
     
-    if (_logStrings) {
-        CFRelease(_logStrings);
-        _logStrings = NULL;
-    }
-    
+    // The log ring is left for the destructor; a drain can still be running
+    // on the pending source's queue.
     if (_asl) {
         asl_close(_asl);
         if (_logfd != -1) ::close(_logfd);
@@ -269,6 +366,51 @@ void IOHIDEventSystemStatistics::registerService(IOHIDServiceRef service)
     {
         ADClientAddValueForScalarKey(CFSTR(kAggregateDictionaryKeyboardEnumerationCountKey), 1);
     }
+    
+    if ( !_serviceStats ) {
+        _serviceStats = CFDictionaryCreateMutable(kCFAllocatorDefault, 0, NULL, NULL);
+        if ( !_serviceStats )
+            return;
+    }
+    
+    if ( CFDictionaryContainsKey(_serviceStats, service) )
+        return;
+    
+    ServiceStats * stats = (ServiceStats *)calloc(1, sizeof(ServiceStats));
+    if ( !stats )
+        return;
+    
+    CFTypeRef registryID = IOHIDServiceGetRegistryID(service);
+    if ( registryID && CFGetTypeID(registryID) == CFNumberGetTypeID() )
+        CFNumberGetValue((CFNumberRef)registryID, kCFNumberSInt64Type, &stats->registryID);
+    
+    stats->startTime = mach_absolute_time();
+    
+    CFDictionarySetValue(_serviceStats, service, stats);
+}
+
+//------------------------------------------------------------------------------
+// IOHIDEventSystemStatistics::unregisterService
+//------------------------------------------------------------------------------
+void IOHIDEventSystemStatistics::unregisterService(void * self, IOHIDServiceRef service)
+{
+    static_cast<IOHIDEventSystemStatistics *>(self)->unregisterService(service);
+}
+void IOHIDEventSystemStatistics::unregisterService(IOHIDServiceRef service)
+{
+    ServiceStats * stats;
+    
+    if ( !_serviceStats )
+        return;
+    
+    stats = (ServiceStats *)CFDictionaryGetValue(_serviceStats, service);
+    if ( !stats )
+        return;
+    
+    CFDictionaryRemoveValue(_serviceStats, service);
+    
+    logServiceStats(stats, mach_absolute_time());
+    free(stats);
 }
 
 //------------------------------------------------------------------------------
@@ -288,6 +430,16 @@ void IOHIDEventSystemStatistics::scheduleWithDispatchQueue(dispatch_queue_t queu
         dispatch_source_set_event_handler_f(_pending_source, IOHIDEventSystemStatistics::handlePendingStats);
         dispatch_resume(_pending_source);
         
+        // The service histograms are summarized on the session queue itself
+        // so that filter can update them without any synchronization.
+        _stats_source = dispatch_source_create(DISPATCH_SOURCE_TYPE_TIMER, 0, 0, _dispatch_queue);
+        if ( _stats_source ) {
+            dispatch_set_context(_stats_source, this);
+            dispatch_source_set_event_handler_f(_stats_source, IOHIDEventSystemStatistics::handleServiceStats);
+            dispatch_source_set_timer(_stats_source, dispatch_time(DISPATCH_TIME_NOW, kServiceStatsInterval), kServiceStatsInterval, kServiceStatsLeeway);
+            dispatch_resume(_stats_source);
+        }
+        
         notify_register_dispatch( "com.apple.iokit.hid.displayStatus", &_displayToken,_dispatch_queue, ^(__unused int token){
             
             notify_get_state(_displayToken, &_displayState);
@@ -311,6 +463,12 @@ void IOHIDEventSystemStatistics::unscheduleFromDispatchQueue(dispatch_queue_t qu
         dispatch_release(_pending_source);
         _pending_source = NULL;
     }
+    
+    if ( _stats_source ) {
+        dispatch_source_cancel(_stats_source);
+        dispatch_release(_stats_source);
+        _stats_source = NULL;
+    }
 }
 
 //------------------------------------------------------------------------------
@@ -323,18 +481,17 @@ void IOHIDEventSystemStatistics::handlePendingStats(void * self)
 
 void IOHIDEventSystemStatistics::handlePendingStats()
 {
-    __block Buttons     buttons     = {};
-    __block CFArrayRef  logStrings  = NULL;
+    Buttons     buttons     = {};
     
-    dispatch_sync(_dispatch_queue, ^{
-        bcopy(&_pending_buttons, &buttons, sizeof(Buttons));
-        bzero(&_pending_buttons, sizeof(Buttons));
-        
-        if (_logStrings) {
-            logStrings = CFArrayCreateCopy(kCFAllocatorDefault, _logStrings);
-            CFArrayRemoveAllValues(_logStrings);
-        }
-    });
+    buttons.home_wake                   = takeCounter(&_pending_buttons.home_wake);
+    buttons.power_wake                  = takeCounter(&_pending_buttons.power_wake);
+    buttons.power_sleep                 = takeCounter(&_pending_buttons.power_sleep);
+    buttons.power                       = takeCounter(&_pending_buttons.power);
+    buttons.power_filtered              = takeCounter(&_pending_buttons.power_filtered);
+    buttons.volume_increment            = takeCounter(&_pending_buttons.volume_increment);
+    buttons.volume_increment_filtered   = takeCounter(&_pending_buttons.volume_increment_filtered);
+    buttons.volume_decrement            = takeCounter(&_pending_buttons.volume_decrement);
+    buttons.volume_decrement_filtered   = takeCounter(&_pending_buttons.volume_decrement_filtered);
     
     ADClientAddValueForScalarKey(CFSTR(kAggregateDictionaryHomeButtonWakeCountKey), buttons.home_wake);
     ADClientAddValueForScalarKey(CFSTR(kAggregateDictionaryPowerButtonWakeCountKey), buttons.power_wake);
@@ -349,22 +506,135 @@ void IOHIDEventSystemStatistics::handlePendingStats()
     ADClientAddValueForScalarKey(CFSTR(kAggregateDictionaryVolumeDecrementButtonPressedCountKey), buttons.volume_decrement);
     ADClientAddValueForScalarKey(CFSTR(kAggregateDictionaryVolumeDecrementButtonFilteredCountKey), buttons.volume_decrement_filtered);
     
-    if (logStrings) {
-        for (int i = 0; i < CFArrayGetCount(logStrings); i++) {
-            CFStringRef cfstr;
-            const char * cstr;
+    if (_logEntries) {
+        uint32_t    head    = _logHead;
+        int32_t     dropped;
+        
+        OSMemoryBarrier();
+        
+        while ( _logTail != head ) {
+            LogEntry    entry   = _logEntries[_logTail & (kLogEntryCount - 1)];
+            float       secs;
             
-            cfstr = (CFStringRef) CFArrayGetValueAtIndex(logStrings, i);
-            if (!cfstr) continue;
+            OSMemoryBarrier();
+            _logTail++;
             
-            cstr = CFStringGetCStringPtr(cfstr, kCFStringEncodingUTF8);
-            if (!cstr) continue;
+            secs = (float)((entry.timestamp * sTimebaseInfo.numer) / sTimebaseInfo.denom) / NSEC_PER_SEC;
             
-            asl_log(_asl, NULL, ASL_LEVEL_NOTICE, "%s", cstr);
+            asl_log(_asl, NULL, ASL_LEVEL_NOTICE, "ts=%0.9f,action=%s,button=%s", secs, entry.action, entry.button ? entry.button : "unknown");
         }
+        
+        dropped = takeCounter(&_logDropped);
+        if ( dropped )
+            asl_log(_asl, NULL, ASL_LEVEL_NOTICE, "dropped=%d", dropped);
+    }
+}
+
+//------------------------------------------------------------------------------
+// IOHIDEventSystemStatistics::appendLogEntry
+//------------------------------------------------------------------------------
+void IOHIDEventSystemStatistics::appendLogEntry(uint64_t timestamp, const char * action, const char * button)
+{
+    uint32_t    head    = _logHead;
+    LogEntry *  entry;
+    
+    if ( head - _logTail >= kLogEntryCount ) {
+        OSAtomicIncrement32(&_logDropped);
+        return;
+    }
+    
+    entry = &_logEntries[head & (kLogEntryCount - 1)];
+    
+    entry->timestamp    = timestamp;
+    entry->action       = action;
+    entry->button       = button;
+    
+    OSMemoryBarrier();
+    _logHead = head + 1;
+}
+
+//------------------------------------------------------------------------------
+// IOHIDEventSystemStatistics::handleServiceStats
+//------------------------------------------------------------------------------
+void IOHIDEventSystemStatistics::handleServiceStats(void * self)
+{
+    static_cast<IOHIDEventSystemStatistics *>(self)->handleServiceStats();
+}
+
+void IOHIDEventSystemStatistics::handleServiceStats()
+{
+    if ( _serviceStats )
+        CFDictionaryApplyFunction(_serviceStats, IOHIDEventSystemStatistics::logServiceStats, this);
+}
+
+//------------------------------------------------------------------------------
+// IOHIDEventSystemStatistics::logServiceStats
+//------------------------------------------------------------------------------
+void IOHIDEventSystemStatistics::logServiceStats(const void * key __unused, const void * value, void * context)
+{
+    static_cast<IOHIDEventSystemStatistics *>(context)->logServiceStats((ServiceStats *)value, mach_absolute_time());
+}
+
+void IOHIDEventSystemStatistics::logServiceStats(ServiceStats * stats, uint64_t now)
+{
+    double elapsed = (double)((now - stats->startTime) * sTimebaseInfo.numer / sTimebaseInfo.denom) / NSEC_PER_SEC;
     
-        CFRelease(logStrings);
+    for ( uint32_t type = 0; type < kIOHIDEventTypeCount; type++ ) {
+        EventTypeStats *    typeStats = &stats->types[type];
+        char                name[kStringLength];
+        
+        if ( !typeStats->count )
+            continue;
+        
+        if ( !CFStringGetCString(IOHIDEventTypeGetName(type), name, sizeof(name), kCFStringEncodingUTF8) )
+            snprintf(name, sizeof(name), "%d", type);
+        
+        asl_log(NULL, NULL, ASL_LEVEL_DEBUG, "service=0x%llx,type=%s,count=%u,rate=%0.2f,interval_p50_us=%llu,interval_p90_us=%llu,interval_p99_us=%llu",
+                stats->registryID,
+                name,
+                typeStats->count,
+                elapsed > 0 ? typeStats->count / elapsed : 0.0,
+                getIntervalPercentile(typeStats->intervals, kIntervalBucketCount, 50.0),
+                getIntervalPercentile(typeStats->intervals, kIntervalBucketCount, 90.0),
+                getIntervalPercentile(typeStats->intervals, kIntervalBucketCount, 99.0));
+        
+        // Keep lastTimestamp so the next window's first interval is real.
+        typeStats->count = 0;
+        bzero(typeStats->intervals, sizeof(typeStats->intervals));
     }
+    
+    stats->startTime = now;
+}
+
+//------------------------------------------------------------------------------
+// IOHIDEventSystemStatistics::recordServiceEvent
+//------------------------------------------------------------------------------
+void IOHIDEventSystemStatistics::recordServiceEvent(IOHIDServiceRef service, IOHIDEventRef event)
+{
+    ServiceStats *      stats;
+    EventTypeStats *    typeStats;
+    IOHIDEventType      type;
+    uint64_t            ts;
+    
+    if ( !service || !_serviceStats )
+        return;
+    
+    type = IOHIDEventGetType(event);
+    if ( type >= kIOHIDEventTypeCount )
+        return;
+    
+    stats = (ServiceStats *)CFDictionaryGetValue(_serviceStats, service);
+    if ( !stats )
+        return;
+    
+    typeStats   = &stats->types[type];
+    ts          = IOHIDEventGetTimeStamp(event);
+    
+    if ( typeStats->lastTimestamp && ts > typeStats->lastTimestamp )
+        typeStats->intervals[getIntervalBucket(ts - typeStats->lastTimestamp, kIntervalBucketCount)]++;
+    
+    typeStats->lastTimestamp = ts;
+    typeStats->count++;
 }
 
 //------------------------------------------------------------------------------
@@ -377,15 +647,13 @@ IOHIDEventRef IOHIDEventSystemStatistics::filter(void * self, IOHIDServiceRef se
 IOHIDEventRef IOHIDEventSystemStatistics::filter(IOHIDServiceRef sender, IOHIDEventRef event)
 {
     const char *    button;
-    uint64_t        ts;
-    float           secs;
-    
-    (void) sender;
     
     if ( _pending_source ) {
         if ( event ) {
             bool signal = false;
             
+            recordServiceEvent(sender, event);
+            
             if ((IOHIDEventGetType(event) == kIOHIDEventTypeKeyboard)
                 && IOHIDEventGetIntegerValue(event, kIOHIDEventFieldKeyboardDown)
                 && (IOHIDEventGetIntegerValue(event, kIOHIDEventFieldKeyboardUsagePage) == kHIDPage_Consumer)) {
@@ -396,22 +664,22 @@ IOHIDEventRef IOHIDEventSystemStatistics::filter(IOHIDServiceRef sender, IOHIDEv
                     case kHIDUsage_Csmr_Menu:
                         button = kButtonMenu;
                         if ( !_displayState )
-                            _pending_buttons.home_wake++;
+                            OSAtomicIncrement32(&_pending_buttons.home_wake);
                         break;
                     case kHIDUsage_Csmr_Power:
-                        _pending_buttons.power++;
+                        OSAtomicIncrement32(&_pending_buttons.power);
                         button = kButtonPower;
                         if ( !_displayState )
-                            _pending_buttons.power_wake++;
+                            OSAtomicIncrement32(&_pending_buttons.power_wake);
                         else
-                            _pending_buttons.power_sleep++;
+                            OSAtomicIncrement32(&_pending_buttons.power_sleep);
                         break;
                     case kHIDUsage_Csmr_VolumeDecrement:
-                        _pending_buttons.volume_decrement++;
+                        OSAtomicIncrement32(&_pending_buttons.volume_decrement);
                         button = kButtonVolumeDecrement;
                         break;
                     case kHIDUsage_Csmr_VolumeIncrement:
-                        _pending_buttons.volume_increment++;
+                        OSAtomicIncrement32(&_pending_buttons.volume_increment);
                         button = kButtonVolumeIncrement;
                         break;
                     default:
@@ -419,26 +687,8 @@ IOHIDEventRef IOHIDEventSystemStatistics::filter(IOHIDServiceRef sender, IOHIDEv
                         break;
                 }
                 
-                if (signal && _logButtonFiltering) {
-                    if ( sTimebaseInfo.denom == 0 ) {
-                        (void) mach_timebase_info(&sTimebaseInfo);
-                    }
-                    ts = IOHIDEventGetTimeStamp(event);
-                    ts = ts * sTimebaseInfo.numer / sTimebaseInfo.denom;
-                    secs = (float)ts / NSEC_PER_SEC;
-                    
-                    CFStringRef str = CFStringCreateWithFormat(kCFAllocatorDefault,
-                                                               0,
-                                                               CFStringCreateWithCString(kCFAllocatorDefault,
-                                                                                         "ts=%0.9f,action=down,button=%s",
-                                                                                         kCFStringEncodingUTF8),
-                                                               secs,
-                                                               button ? button : "unknown");
-                    
-                    if (str) {
-                        CFArrayAppendValue(_logStrings, str);
-                        CFRelease(str);
-                    }
+                if (signal && _logEntries) {
+                    appendLogEntry(IOHIDEventGetTimeStamp(event), kActionDown, button);
                 }
             }
             else if ((IOHIDEventGetType(event) == kIOHIDEventTypeVendorDefined)
@@ -455,15 +705,15 @@ IOHIDEventRef IOHIDEventSystemStatistics::filter(IOHIDServiceRef sender, IOHIDEv
                         
                         switch ( data->usage ) {
                             case kHIDUsage_Csmr_Power:
-                                _pending_buttons.power_filtered++;
+                                OSAtomicIncrement32(&_pending_buttons.power_filtered);
                                 button = kButtonPower;
                                 break;
                             case kHIDUsage_Csmr_VolumeDecrement:
-                                _pending_buttons.volume_decrement_filtered++;
+                                OSAtomicIncrement32(&_pending_buttons.volume_decrement_filtered);
                                 button = kButtonVolumeDecrement;
                                 break;
                             case kHIDUsage_Csmr_VolumeIncrement:
-                                _pending_buttons.volume_increment_filtered++;
+                                OSAtomicIncrement32(&_pending_buttons.volume_increment_filtered);
                                 button = kButtonVolumeIncrement;
                                 break;
                             default:
@@ -472,27 +722,8 @@ IOHIDEventRef IOHIDEventSystemStatistics::filter(IOHIDServiceRef sender, IOHIDEv
                         }
                     }
                     
-                    if (signal && _logButtonFiltering) {
-                        if ( sTimebaseInfo.denom == 0 ) {
-                            (void) mach_timebase_info(&sTimebaseInfo);
-                        }
-                        
-                        ts = IOHIDEventGetTimeStamp(event);
-                        ts = ts * sTimebaseInfo.numer / sTimebaseInfo.denom;
-                        secs = (float)ts / NSEC_PER_SEC;
-                        
-                        CFStringRef str = CFStringCreateWithFormat(kCFAllocatorDefault,
-                                                                   0,
-                                                                   CFStringCreateWithCString(kCFAllocatorDefault,
-                                                                                             "ts=%0.9f,action=filtered,button=%s",
-                                                                                             kCFStringEncodingUTF8) ,
-                                                                   secs,
-                                                                   button ? button : "unknown");
-                        
-                        if (str) {
-                            CFArrayAppendValue(_logStrings, str);
-                            CFRelease(str);
-                        }
+                    if (signal && _logEntries) {
+                        appendLogEntry(IOHIDEventGetTimeStamp(event), kActionFiltered, button);
                     }
                 }
             }
@@ -26,7 +26,9 @@ public:
     boolean_t open(IOHIDSessionRef session, IOOptionBits options);
     void close(IOHIDSessionRef session, IOOptionBits options);
     void registerService(IOHIDServiceRef service);
+    void unregisterService(IOHIDServiceRef service);
     void handlePendingStats();
+    void handleServiceStats();
     void scheduleWithDispatchQueue(dispatch_queue_t queue);
     void unscheduleFromDispatchQueue(dispatch_queue_t queue);
 private:
@@ -40,26 +42,64 @@ private:
     
     dispatch_queue_t            _dispatch_queue;
     dispatch_source_t           _pending_source;
+    dispatch_source_t           _stats_source;
     
+    // Bumped atomically by filter and swapped back to zero by
+    // handlePendingStats, so neither side has to hop queues.
     typedef struct {
-        uint32_t                    home_wake;
-        uint32_t                    power_wake;
-        uint32_t                    power_sleep;
-        uint32_t                    power;
-        uint32_t                    volume_increment;
-        uint32_t                    volume_decrement;
-        uint32_t                    power_filtered;
-        uint32_t                    volume_increment_filtered;
-        uint32_t                    volume_decrement_filtered;
+        volatile int32_t            home_wake;
+        volatile int32_t            power_wake;
+        volatile int32_t            power_sleep;
+        volatile int32_t            power;
+        volatile int32_t            volume_increment;
+        volatile int32_t            volume_decrement;
+        volatile int32_t            power_filtered;
+        volatile int32_t            volume_increment_filtered;
+        volatile int32_t            volume_decrement_filtered;
     } Buttons;
     
     Buttons _pending_buttons;
     
-    CFMutableArrayRef           _logStrings;
+    // Button log lines are recorded raw into a single producer/single
+    // consumer ring and only formatted when handlePendingStats drains it.
+    typedef struct {
+        uint64_t                    timestamp;
+        const char *                action;
+        const char *                button;
+    } LogEntry;
+    
+    LogEntry *                  _logEntries;
+    volatile uint32_t           _logHead;
+    volatile uint32_t           _logTail;
+    volatile int32_t            _logDropped;
     aslclient                   _asl;
     int                         _logfd;
     bool                        _logButtonFiltering;
     
+    // Per service, per event type counts and inter-arrival histograms.
+    // These are only touched on the session queue.
+    enum {
+        kIntervalBucketCount    = 24
+    };
+    
+    typedef struct {
+        uint64_t                    lastTimestamp;
+        uint32_t                    count;
+        uint32_t                    intervals[kIntervalBucketCount];
+    } EventTypeStats;
+    
+    typedef struct {
+        uint64_t                    registryID;
+        uint64_t                    startTime;
+        EventTypeStats              types[kIOHIDEventTypeCount];
+    } ServiceStats;
+    
+    CFMutableDictionaryRef      _serviceStats;
+    
+    void appendLogEntry(uint64_t timestamp, const char * action, const char * button);
+    void recordServiceEvent(IOHIDServiceRef service, IOHIDEventRef event);
+    void logServiceStats(ServiceStats * stats, uint64_t now);
+    
 private:
     static IOHIDSessionFilterPlugInInterface sIOHIDEventSystemStatisticsFtbl;
     static HRESULT QueryInterface( void *self, REFIID iid, LPVOID *ppv );
@@ -71,10 +111,13 @@ private:
     static boolean_t open(void * self, IOHIDSessionRef inSession, IOOptionBits options);
     static void close(void * self, IOHIDSessionRef inSession, IOOptionBits options);
     static void registerService(void * self, IOHIDServiceRef service);
+    static void unregisterService(void * self, IOHIDServiceRef service);
     
     static void scheduleWithDispatchQueue(void * self, dispatch_queue_t queue);
     static void unscheduleFromDispatchQueue(void * self, dispatch_queue_t queue);
     static void handlePendingStats(void * self);
+    static void handleServiceStats(void * self);
+    static void logServiceStats(const void * key, const void * value, void * context);
     
 private:
     IOHIDEventSystemStatistics();
@@ -30,6 +30,7 @@
 #include <IOKit/hidsystem/IOHIDSystem.h>
 #include <IOKit/IOEventSource.h>
 #include <IOKit/IOMessage.h>
+#include <libkern/OSAtomic.h>
 
 #include "IOHIDFamilyPrivate.h"
 #include "IOHIDDevice.h"
@@ -202,6 +203,7 @@ IOReturn IOHIDAsyncReportQueue::postReport(
         signalWorkAvailable();
     } else {
         IODelete(entry, AsyncReportEntry, 1);
+        return kIOReturnNoMemory;
     }
 
     return kIOReturnSuccess;
@@ -229,10 +231,22 @@ OSDefineMetaClassAndAbstractStructors( IOHIDDevice, IOService )
 #define _asyncReportQueue           _reserved->asyncReportQueue
 #define _workLoop                   _reserved->workLoop
 #define _eventSource                _reserved->eventSource
+#define _handledReportCount         _reserved->handledReportCount
+#define _elementChangeCount         _reserved->elementChangeCount
+#define _queueFullCount             _reserved->queueFullCount
+#define _asyncReportDropCount       _reserved->asyncReportDropCount
+#define _reportIntervals            _reserved->reportIntervals
+#define _reportIntervalCount        _reserved->reportIntervalCount
 
 #define WORKLOOP_LOCK   ((IOHIDEventSource *)_eventSource)->lock()
 #define WORKLOOP_UNLOCK ((IOHIDEventSource *)_eventSource)->unlock()
 
+
+struct IOHIDReportIntervalHistogram {
+    AbsoluteTime                lastTimeStamp;
+    IOHIDReportIntervalStruct   intervals;
+};
+
 #define kIOHIDEventThreshold	10
 
 // Number of slots in the report handler dispatch table.
@@ -289,6 +303,12 @@ bool IOHIDDevice::init( OSDictionary * dict )
 
 	bzero(_reserved, sizeof(ExpansionData));
 
+    // The histograms are only a diagnostic, so carry on without them if
+    // they can't be allocated.
+    _reportIntervals = IONew( IOHIDReportIntervalHistogram, kIOHIDReportIntervalMax );
+    if ( _reportIntervals )
+        bzero(_reportIntervals, sizeof(IOHIDReportIntervalHistogram) * kIOHIDReportIntervalMax);
+
     // Create an OSSet to store client objects. Initial capacity
     // (which can grow) is set at 2 clients.
 
@@ -359,6 +379,9 @@ void IOHIDDevice::free()
 
     if ( _reserved )
     {
+        if ( _reportIntervals )
+            IODelete( _reportIntervals, IOHIDReportIntervalHistogram, kIOHIDReportIntervalMax );
+
         IODelete( _reserved, ExpansionData, 1 );
     }
 
@@ -418,6 +441,8 @@ bool IOHIDDevice::start( IOService * provider )
     OSData *                reportDescriptorData    = NULL;
     OSNumber *              primaryUsagePage        = NULL;
     OSNumber *              primaryUsage            = NULL;
+    OSSerializer *          statistics              = NULL;
+    OSSerializer *          reportIntervals         = NULL;
     IOReturn                ret;
     bool                    result;
 
@@ -495,6 +520,18 @@ bool IOHIDDevice::start( IOService * provider )
         propertyMatch->release();
     }
     
+    statistics = OSSerializer::forTarget(this, OSMemberFunctionCast(OSSerializerCallback, this, &IOHIDDevice::serializeStatistics));
+    if ( statistics ) {
+        setProperty(kIOHIDStatisticsKey, statistics);
+        statistics->release();
+    }
+    
+    reportIntervals = OSSerializer::forTarget(this, OSMemberFunctionCast(OSSerializerCallback, this, &IOHIDDevice::serializeReportIntervals));
+    if ( reportIntervals ) {
+        setProperty(kIOHIDReportIntervalsKey, reportIntervals);
+        reportIntervals->release();
+    }
+    
     registerService();
 
     result = true;
@@ -2130,6 +2167,7 @@ IOReturn IOHIDDevice::handleReportWithTime(
     UInt8                       reportID            = 0;
 
     IOHID_DEBUG(kIOHIDDebugCode_HandleReport, reportType, options, __OSAbsoluteTime(timeStamp), getRegistryEntryID());
+    IOHID_DEBUG_LATENCY(kIOHIDLatencyStage_HandleReport, __OSAbsoluteTime(timeStamp), getRegistryEntryID(), reportType);
 
     if ((reportType == kIOHIDReportTypeInput) && !_readyForInputReports)
         return kIOReturnOffline;
@@ -2160,7 +2198,8 @@ IOReturn IOHIDDevice::handleReportWithTime(
     WORKLOOP_LOCK;
 
     if ( _readyForInputReports ) {
-        IOHIDElementPrivate * element;
+        IOHIDElementPrivate *   element;
+        SInt64                  elementChanges  = 0;
 
         // The first byte in the report, may be the report ID.
         // XXX - Do we need to advance the start of the report data?
@@ -2174,14 +2213,26 @@ IOReturn IOHIDDevice::handleReportWithTime(
 
         while ( element ) {
             shouldTickle |= element->shouldTickleActivity();
-            changed |= element->processReport( reportID,
-                                               reportData,
-                                               reportLength << 3,
-                                               &timeStamp,
-                                               &element,
-                                               options );
+            if ( element->processReport( reportID,
+                                         reportData,
+                                         reportLength << 3,
+                                         &timeStamp,
+                                         &element,
+                                         options ) ) {
+                changed = true;
+                elementChanges++;
+            }
         }
 
+        OSIncrementAtomic64(&_handledReportCount);
+        if ( elementChanges )
+            OSAddAtomic64(elementChanges, &_elementChangeCount);
+
+        // Reports fed back from getReport were polled, not sent by the
+        // device, and would show up as bursts.
+        if ( (options & kIOHIDReportOptionNotInterrupt) == 0 )
+            recordReportInterval(timeStamp, reportType, reportID);
+
         ret = kIOReturnSuccess;
     }
 
@@ -2216,6 +2267,255 @@ IOReturn IOHIDDevice::handleReportWithTime(
     return ret;
 }
 
+//---------------------------------------------------------------------------
+// Publish the hot path counters.  They are only gathered when the
+// registry property is read, so handling a report costs a couple of
+// atomic adds and nothing more.
+
+bool IOHIDDevice::serializeStatistics( void * reference __unused, OSSerialize * serializer )
+{
+    OSDictionary *  dict    = OSDictionary::withCapacity(4);
+    OSNumber *      number;
+    bool            result  = false;
+
+    require(dict, exit);
+
+    number = OSNumber::withNumber((unsigned long long)_handledReportCount, 64);
+    if ( number ) {
+        dict->setObject(kIOHIDStatisticsReportCountKey, number);
+        number->release();
+    }
+
+    number = OSNumber::withNumber((unsigned long long)_elementChangeCount, 64);
+    if ( number ) {
+        dict->setObject(kIOHIDStatisticsElementChangeCountKey, number);
+        number->release();
+    }
+
+    number = OSNumber::withNumber((unsigned long long)_queueFullCount, 64);
+    if ( number ) {
+        dict->setObject(kIOHIDStatisticsQueueFullCountKey, number);
+        number->release();
+    }
+
+    number = OSNumber::withNumber((unsigned long long)_asyncReportDropCount, 64);
+    if ( number ) {
+        dict->setObject(kIOHIDStatisticsAsyncReportDropCountKey, number);
+        number->release();
+    }
+
+    result = dict->serialize(serializer);
+
+exit:
+    OSSafeRelease(dict);
+    return result;
+}
+
+//---------------------------------------------------------------------------
+// Count an element value that a client queue had no room for.  Called by
+// IOHIDElementPrivate from processReport and setArrayElementValue.
+
+void IOHIDDevice::incrementQueueFullCount()
+{
+    OSIncrementAtomic64(&_queueFullCount);
+}
+
+//---------------------------------------------------------------------------
+// Zero the hot path counters.  Subtracting what was read keeps any
+// increments that race with the reset.
+
+void IOHIDDevice::resetStatistics()
+{
+    OSAddAtomic64(-_handledReportCount, &_handledReportCount);
+    OSAddAtomic64(-_elementChangeCount, &_elementChangeCount);
+    OSAddAtomic64(-_queueFullCount, &_queueFullCount);
+    OSAddAtomic64(-_asyncReportDropCount, &_asyncReportDropCount);
+
+    if ( _reportIntervals ) {
+        WORKLOOP_LOCK;
+        _reportIntervalCount = 0;
+        bzero(_reportIntervals, sizeof(IOHIDReportIntervalHistogram) * kIOHIDReportIntervalMax);
+        WORKLOOP_UNLOCK;
+    }
+}
+
+//---------------------------------------------------------------------------
+// Add the time since the last report of the same type and ID to that
+// pair's histogram.  Called from handleReportWithTime with the work loop
+// lock held, which serializes all writers.
+
+void IOHIDDevice::recordReportInterval( AbsoluteTime timeStamp, IOHIDReportType reportType, UInt32 reportID )
+{
+    IOHIDReportIntervalHistogram *  histogram   = NULL;
+    IOHIDReportIntervalStruct *     intervals;
+    AbsoluteTime                    delta;
+    UInt64                          interval;
+    UInt32                          bucket;
+    UInt32                          index;
+
+    if ( !_reportIntervals )
+        return;
+
+    for ( index=0; index<_reportIntervalCount; index++ ) {
+        if ( _reportIntervals[index].intervals.reportType == (UInt32)reportType &&
+             _reportIntervals[index].intervals.reportID == reportID ) {
+            histogram = &_reportIntervals[index];
+            break;
+        }
+    }
+
+    if ( !histogram ) {
+        if ( _reportIntervalCount >= kIOHIDReportIntervalMax )
+            return;
+
+        histogram = &_reportIntervals[_reportIntervalCount];
+        histogram->lastTimeStamp        = timeStamp;
+        histogram->intervals.reportType = reportType;
+        histogram->intervals.reportID   = reportID;
+
+        // Readers don't take the lock; make the entry visible before the
+        // count that covers it.
+        OSMemoryBarrier();
+        _reportIntervalCount++;
+        return;
+    }
+
+    // Reports timestamped by a transport can arrive out of order.
+    if ( CMP_ABSOLUTETIME(&timeStamp, &histogram->lastTimeStamp) < 0 )
+        return;
+
+    delta = timeStamp;
+    SUB_ABSOLUTETIME(&delta, &histogram->lastTimeStamp);
+    histogram->lastTimeStamp = timeStamp;
+
+    absolutetime_to_nanoseconds(delta, &interval);
+    interval /= 1000;
+
+    bucket = 0;
+    while ( bucket < kIOHIDReportIntervalBucketCount - 1 && (interval >> bucket) )
+        bucket++;
+
+    if ( interval > UINT_MAX )
+        interval = UINT_MAX;
+
+    intervals = &histogram->intervals;
+
+    if ( !intervals->count || interval < intervals->minInterval )
+        intervals->minInterval = (UInt32)interval;
+    if ( interval > intervals->maxInterval )
+        intervals->maxInterval = (UInt32)interval;
+
+    intervals->buckets[bucket]++;
+    intervals->count++;
+}
+
+//---------------------------------------------------------------------------
+// Copy as many histograms as fit in buffer and return the bytes copied.
+// This runs without the work loop lock, so a histogram being updated
+// while it is copied may be off by a report; it is only a diagnostic.
+
+UInt32 IOHIDDevice::copyReportIntervals( void * buffer, UInt32 bufferSize )
+{
+    IOHIDReportIntervalStruct * intervals   = (IOHIDReportIntervalStruct *)buffer;
+    UInt32                      count;
+    UInt32                      index;
+
+    if ( !_reportIntervals )
+        return 0;
+
+    count = _reportIntervalCount;
+    OSMemoryBarrier();
+
+    if ( count > bufferSize / sizeof(IOHIDReportIntervalStruct) )
+        count = bufferSize / sizeof(IOHIDReportIntervalStruct);
+
+    for ( index=0; index<count; index++ )
+        bcopy(&_reportIntervals[index].intervals, &intervals[index], sizeof(IOHIDReportIntervalStruct));
+
+    return count * sizeof(IOHIDReportIntervalStruct);
+}
+
+//---------------------------------------------------------------------------
+// Publish the report interval histograms.  Like the statistics, they are
+// only gathered when the registry property is read.  Intervals are in
+// microseconds and histogram entry n counts intervals below 2^n us.
+
+bool IOHIDDevice::serializeReportIntervals( void * reference __unused, OSSerialize * serializer )
+{
+    IOHIDReportIntervalStruct * intervals;
+    OSArray *                   array       = NULL;
+    UInt32                      count;
+    bool                        result      = false;
+
+    intervals = IONew( IOHIDReportIntervalStruct, kIOHIDReportIntervalMax );
+    require(intervals, exit);
+
+    count = copyReportIntervals(intervals, sizeof(IOHIDReportIntervalStruct) * kIOHIDReportIntervalMax) / sizeof(IOHIDReportIntervalStruct);
+
+    array = OSArray::withCapacity(count ? count : 1);
+    require(array, exit);
+
+    for ( UInt32 index=0; index<count; index++ ) {
+        OSDictionary *  dict        = OSDictionary::withCapacity(6);
+        OSArray *       histogram   = OSArray::withCapacity(kIOHIDReportIntervalBucketCount);
+        OSNumber *      number;
+
+        if ( dict && histogram ) {
+            number = OSNumber::withNumber(intervals[index].reportType, 32);
+            if ( number ) {
+                dict->setObject(kIOHIDReportIntervalsReportTypeKey, number);
+                number->release();
+            }
+
+            number = OSNumber::withNumber(intervals[index].reportID, 32);
+            if ( number ) {
+                dict->setObject(kIOHIDReportIntervalsReportIDKey, number);
+                number->release();
+            }
+
+            number = OSNumber::withNumber((unsigned long long)intervals[index].count, 64);
+            if ( number ) {
+                dict->setObject(kIOHIDReportIntervalsCountKey, number);
+                number->release();
+            }
+
+            number = OSNumber::withNumber(intervals[index].minInterval, 32);
+            if ( number ) {
+                dict->setObject(kIOHIDReportIntervalsMinKey, number);
+                number->release();
+            }
+
+            number = OSNumber::withNumber(intervals[index].maxInterval, 32);
+            if ( number ) {
+                dict->setObject(kIOHIDReportIntervalsMaxKey, number);
+                number->release();
+            }
+
+            for ( UInt32 bucket=0; bucket<kIOHIDReportIntervalBucketCount; bucket++ ) {
+                number = OSNumber::withNumber(intervals[index].buckets[bucket], 32);
+                if ( number ) {
+                    histogram->setObject(number);
+                    number->release();
+                }
+            }
+
+            dict->setObject(kIOHIDReportIntervalsHistogramKey, histogram);
+            array->setObject(dict);
+        }
+
+        OSSafeRelease(histogram);
+        OSSafeRelease(dict);
+    }
+
+    result = array->serialize(serializer);
+
+exit:
+    OSSafeRelease(array);
+    if ( intervals )
+        IODelete( intervals, IOHIDReportIntervalStruct, kIOHIDReportIntervalMax );
+    return result;
+}
+
 //---------------------------------------------------------------------------
 // Return the polling interval
 
@@ -2259,6 +2559,9 @@ IOReturn IOHIDDevice::handleReportWithTimeAsync(
         result = _asyncReportQueue->postReport(timeStamp, report, reportType, options, completionTimeout, completion);
     }
 
+    if (result != kIOReturnSuccess)
+        OSIncrementAtomic64(&_asyncReportDropCount);
+
     WORKLOOP_UNLOCK;
 
     return result;
@@ -42,6 +42,7 @@ class   IOHIDInterface;
 class   IOHIDDeviceShim;
 struct  IOHIDReportHandler;
 class   IOHIDAsyncReportQueue;
+struct  IOHIDReportIntervalHistogram;
 
 /*!
     @typedef IOHIDCompletionAction
@@ -106,6 +107,7 @@ class IOHIDDevice : public IOService
 
     friend class IOHIDLibUserClient;
     friend class IOHIDDeviceShim;
+    friend class IOHIDElementPrivate;
 
 private:
     OSArray *                   _elementArray;
@@ -132,6 +134,12 @@ private:
         IOHIDAsyncReportQueue * asyncReportQueue;
         IOWorkLoop *            workLoop;
         IOEventSource *         eventSource;
+        volatile SInt64         handledReportCount;
+        volatile SInt64         elementChangeCount;
+        volatile SInt64         queueFullCount;
+        volatile SInt64         asyncReportDropCount;
+        IOHIDReportIntervalHistogram * reportIntervals;
+        UInt32                  reportIntervalCount;
     };
     /*! @var reserved
         Reserved for future use.  (Internal use only)  */
@@ -184,6 +192,18 @@ private:
                                                   IOService * newService,
                                                   IONotifier * notifier );
 
+    bool serializeStatistics( void * reference, OSSerialize * serializer );
+
+    void resetStatistics();
+
+    void incrementQueueFullCount();
+
+    void recordReportInterval( AbsoluteTime timeStamp, IOHIDReportType reportType, UInt32 reportID );
+
+    bool serializeReportIntervals( void * reference, OSSerialize * serializer );
+
+    UInt32 copyReportIntervals( void * buffer, UInt32 bufferSize );
+
 protected:
 
 /*! @function free
@@ -25,9 +25,11 @@
 #include <AssertMacros.h>
 #include <IOKit/IORegistryEntry.h>
 #include <IOKit/IOLib.h>
+#include <libkern/OSAtomic.h>
 #include "IOHIDElementPrivate.h"
 #include "IOHIDEventQueue.h"
 #include "IOHIDParserPriv.h"
+#include "IOHIDReportBits.h"
 #include "IOHIDPrivateKeys.h"
 
 #define IsRange() \
@@ -936,83 +938,6 @@ UInt32 IOHIDElementPrivate::getElementValueSize() const
 }
 
 //---------------------------------------------------------------------------
-// Not very efficient, will do for now.
-
-#define BIT_MASK(bits)  ((1 << (bits)) - 1)
-
-#define UpdateByteOffsetAndShift(bits, offset, shift)  \
-    do { offset = bits >> 3; shift = bits & 0x07; } while (0)
-
-#define UpdateWordOffsetAndShift(bits, offset, shift)  \
-    do { offset = bits >> 5; shift = bits & 0x1f; } while (0)
-
-static void readReportBits( const UInt8 * src,
-                           UInt32 *      dst,
-                           UInt32        bitsToCopy,
-                           UInt32        srcStartBit = 0,
-                           bool          shouldSignExtend = false,
-                           bool *        valueChanged = 0)
-{
-    UInt32 srcOffset;
-    UInt32 srcShift;
-    UInt32 dstShift      = 0;
-    UInt32 dstStartBit   = 0;
-    UInt32 dstOffset     = 0;
-    UInt32 lastDstOffset = 0;
-    UInt32 word          = 0;
-    UInt8  bitsProcessed;
-	UInt32 totalBitsProcessed = 0;
-
-    while ( bitsToCopy )
-    {
-        UInt32 tmp;
-
-        UpdateByteOffsetAndShift( srcStartBit, srcOffset, srcShift );
-
-        bitsProcessed = min( bitsToCopy,
-                             min( 8 - srcShift, 32 - dstShift ) );
-
-        tmp = (src[srcOffset] >> srcShift) & BIT_MASK(bitsProcessed);
-
-        word |= ( tmp << dstShift );
-
-        dstStartBit += bitsProcessed;
-        srcStartBit += bitsProcessed;
-        bitsToCopy  -= bitsProcessed;
-		totalBitsProcessed += bitsProcessed;
-
-        UpdateWordOffsetAndShift( dstStartBit, dstOffset, dstShift );
-
-        if ( ( dstOffset != lastDstOffset ) || ( bitsToCopy == 0 ) )
-        {
-            // sign extend negative values
-			// if this is the leftmost word of the result
-			if ((lastDstOffset == 0) &&
-				// and the logical min or max is less than zero
-				// so we should sign extend
-				(shouldSignExtend))
-			{
-				// SInt32 temp = word;
-				
-				// is this less than a full word
-				if ((totalBitsProcessed < 32) && 
-					// and the value negative (high bit set)
-					(word & (1 << (totalBitsProcessed - 1))))
-					// or in all 1s above the significant bit
-					word |= ~(BIT_MASK(totalBitsProcessed));
-			}
-
-			
-			if ( dst[lastDstOffset] != word )
-            {
-                dst[lastDstOffset] = word;
-				if (valueChanged) *valueChanged = true;
-            }
-            word = 0;
-            lastDstOffset = dstOffset;
-        }
-    }
-}
 
 static void writeReportBits( const UInt32 * src,
                            UInt8 *        dst,
@@ -1117,8 +1042,11 @@ bool IOHIDElementPrivate::processReport(
         // processing the report.  An odd value tells us
         // that the information is incomplete and should
         // not be trusted.  An even value tells us that
-        // the value is complete.
+        // the value is complete.  The barriers keep the
+        // value writes between the two increments for
+        // readers of the mapped element values.
         _elementValue->generation++;
+        OSMemoryBarrier();
 
         _previousValue = _elementValue->value[0];
 		
@@ -1152,11 +1080,13 @@ bool IOHIDElementPrivate::processReport(
                 
             for ( UInt32 i = 0; (queue = (IOHIDEventQueue *) _queueArray->getObject(i)); i++ )
             {
-                if ( shouldProcess || (queue->getOptions() & kIOHIDQueueOptionsTypeEnqueueAll))
-                    queue->enqueue( (void *) _elementValue, _elementValue->totalSize );
+                if ( (shouldProcess || (queue->getOptions() & kIOHIDQueueOptionsTypeEnqueueAll)) &&
+                     !queue->enqueue( (void *) _elementValue, _elementValue->totalSize ) )
+                    _owner->incrementQueueFullCount();
                 }
         } while ( 0 );
 
+        OSMemoryBarrier();
         _elementValue->generation++;
         
         // If this element is part of a transaction
@@ -1554,11 +1484,13 @@ void IOHIDElementPrivate::setArrayElementValue(UInt32 index, UInt32 value)
     // be trusted.  An even value tells us that the value
     // is complete. 
     element->_elementValue->generation ++;
+    OSMemoryBarrier();
     
     element->_previousValue = element->_elementValue->value[0];
     element->_elementValue->value[0] = value;
     element->_elementValue->timestamp = _elementValue->timestamp;
     
+    OSMemoryBarrier();
     element->_elementValue->generation ++;
 
     if ( element->_queueArray )
@@ -1567,8 +1499,9 @@ void IOHIDElementPrivate::setArrayElementValue(UInt32 index, UInt32 value)
                 (queue = (IOHIDEventQueue *) element->_queueArray->getObject(i));
                 i++ )
         {
-            queue->enqueue( (void *) element->_elementValue,
-                            element->_elementValue->totalSize );
+            if ( !queue->enqueue( (void *) element->_elementValue,
+                                  element->_elementValue->totalSize ) )
+                _owner->incrementQueueFullCount();
         }
     }
         
@@ -1791,7 +1724,7 @@ void IOHIDElementPrivate::setDataBits(OSData *value)
 
     bitsToCopy = min ( (value->getLength() << 3), (_reportBits * _reportCount) );
 	
-    readReportBits((const UInt8*)value->getBytesNoCopy(), _elementValue->value, bitsToCopy);
+    readReportBits((const UInt8*)value->getBytesNoCopy(), _elementValue->value, bitsToCopy, 0, false, 0);
 }
 
 AbsoluteTime IOHIDElementPrivate::getTimeStamp()
@@ -319,6 +319,7 @@ public:
     virtual IOByteCount     readBytes(void *bytes, IOByteCount withLength);
     
     virtual void            setSenderID(uint64_t senderID);
+    inline  uint64_t        getSenderID() { return _senderID; };
     
     virtual uint64_t        getLatency(uint32_t scaleFactor);
     
@@ -23,6 +23,7 @@
  */
 
 #include <AssertMacros.h>
+#include <stdint.h>
 #include "IOHIDEventDriver.h"
 #include "IOHIDInterface.h"
 #include "IOHIDKeys.h"
@@ -491,6 +492,7 @@ bool IOHIDEventDriver::parseElements ( OSArray* elementArray, UInt32 bootProtoco
         }
     }
     
+    processRelativeElements();
     processDigitizerElements();
     processMultiAxisElements();
     processUnicodeElements();
@@ -513,6 +515,100 @@ exit:
     return result || _bootSupport;
 }
 
+//====================================================================================================
+// getRelativeAxisResolution
+//====================================================================================================
+static bool getRelativeAxisResolution(IOHIDElement * element, SInt64 * logicalDiff, SInt64 * physicalDiff)
+{
+    SInt64  logical     = (SInt64)element->getLogicalMax() - element->getLogicalMin();
+    SInt64  physical    = (SInt64)element->getPhysicalMax() - element->getPhysicalMin();
+    SInt32  exponent    = element->getUnitExponent() & 0x0F;
+    
+    // Same conditions and exponent handling as IOHIDEventService::determineResolution,
+    // but kept as a fraction rather than truncated to whole counts
+    if ((element->getPhysicalMin() == element->getLogicalMin()) ||
+        (element->getPhysicalMax() == element->getLogicalMax()))
+        return false;
+    
+    if ( logical <= 0 || physical <= 0 )
+        return false;
+    
+    if ( exponent < 8 ) {
+        for ( int i = exponent; i > 0; i-- )
+            physical *= 10;
+    }
+    else {
+        for ( int i = 0x10 - exponent; i > 0; i-- )
+            logical *= 10;
+    }
+    
+    if ( logical > INT32_MAX || physical > INT32_MAX )
+        return false;
+    
+    *logicalDiff    = logical;
+    *physicalDiff   = physical;
+    
+    return true;
+}
+
+//====================================================================================================
+// IOHIDEventDriver::processRelativeElements
+//====================================================================================================
+void IOHIDEventDriver::processRelativeElements()
+{
+    SInt64  logical[2]  = {0, 0};
+    SInt64  physical[2] = {0, 0};
+    SInt64  resolution;
+    UInt32  index, count, axis;
+    
+    _relative.axisScale[0] = 1LL << 16;
+    _relative.axisScale[1] = 1LL << 16;
+    
+    require(_relative.elements, exit);
+    
+    for ( index=0, count=_relative.elements->getCount(); index<count; index++ ) {
+        IOHIDElement * element = OSDynamicCast(IOHIDElement, _relative.elements->getObject(index));
+        
+        if ( !element || element->getUsagePage() != kHIDPage_GenericDesktop )
+            continue;
+        
+        if ( element->getUsage() == kHIDUsage_GD_X )
+            axis = 0;
+        else if ( element->getUsage() == kHIDUsage_GD_Y )
+            axis = 1;
+        else
+            continue;
+        
+        if ( !getRelativeAxisResolution(element, &logical[axis], &physical[axis]) )
+            logical[axis] = physical[axis] = 0;
+    }
+    
+    // The pointing shim accelerates both axes against the resolution IOHIDEventService
+    // derives from X, rounded down to whole counts per inch.  Scaling each axis by that
+    // over its own exact resolution hands the truncated remainder, and any difference
+    // between the axes, to acceleration as sub-pixel motion.
+    require(logical[0] && physical[0], exit);
+    
+    resolution = logical[0] / physical[0];
+    require(resolution, exit);
+    
+    for ( axis=0; axis<2; axis++ ) {
+        SInt64 scaled;
+        
+        if ( !logical[axis] || !physical[axis] )
+            continue;
+        
+        scaled = resolution * physical[axis];
+        if ( (scaled / logical[axis]) > INT32_MAX )
+            continue;
+        
+        _relative.axisScale[axis] = ((scaled / logical[axis]) << 16) + (((scaled % logical[axis]) << 16) / logical[axis]);
+    }
+    
+exit:
+    return;
+}
+
 //====================================================================================================
 // IOHIDEventDriver::processDigitizerElements
 //====================================================================================================
@@ -1453,6 +1549,7 @@ void IOHIDEventDriver::handleInterruptReport (
         return;
     
     IOHID_DEBUG(kIOHIDDebugCode_InturruptReport, reportType, reportID, getRegistryEntryID(), 0);
+    IOHID_DEBUG_LATENCY(kIOHIDLatencyStage_InterruptReport, __OSAbsoluteTime(timeStamp), getRegistryEntryID(), reportID);
 
     handleBootPointingReport(timeStamp, report, reportID);
     handleRelativeReport(timeStamp, reportID);
@@ -1492,7 +1589,7 @@ void IOHIDEventDriver::handleBootPointingReport(AbsoluteTime timeStamp, IOMemory
 
     dY = _keyboard.bootMouseData[bootOffset + 2];
 
-    dispatchRelativePointerEvent(timeStamp, dX, dY, buttonState);
+    dispatchRelativePointerEventWithFixed(timeStamp, dX * 65536LL, dY * 65536LL, buttonState);
 
 exit:
     return;
@@ -1613,7 +1710,7 @@ void IOHIDEventDriver::handleRelativeReport(AbsoluteTime timeStamp, UInt32 repor
     
     require_quiet(handled, exit);
     
-    dispatchRelativePointerEvent(timeStamp, dX, dY, buttonState);
+    dispatchRelativePointerEventWithFixed(timeStamp, dX * _relative.axisScale[0], dY * _relative.axisScale[1], buttonState);
     
 exit:
     return;
@@ -67,6 +67,7 @@ private:
         struct {
             OSArray *           elements;
             bool                disabled;
+            SInt64              axisScale[2];   // 48.16 fixed point, X then Y
         } relative;
         
         struct {
@@ -112,6 +113,7 @@ private:
     bool                    parseLegacyUnicodeElement(IOHIDElement * element);
     bool                    parseGestureUnicodeElement(IOHIDElement * element);
     
+    void                    processRelativeElements();
     void                    processDigitizerElements();
     void                    processMultiAxisElements();
     void                    processUnicodeElements();
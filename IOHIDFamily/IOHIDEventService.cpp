@@ -49,6 +49,7 @@
 #include "IOHIDevicePrivateKeys.h"
 #include "ev_private.h"
 #include "IOHIDFamilyTrace.h"
+#include "IOFixed64.h"
 
 enum {
     kBootProtocolNone   = 0,
@@ -2391,6 +2392,7 @@ void IOHIDEventService::dispatchEvent(IOHIDEvent * event, IOOptionBits options)
     event->setSenderID(getRegistryEntryID());
 
     IOHID_DEBUG(kIOHIDDebugCode_DispatchHIDEvent, options, 0, 0, 0);
+    IOHID_DEBUG_LATENCY(kIOHIDLatencyStage_DispatchEvent, __OSAbsoluteTime(event->getTimeStamp()), getRegistryEntryID(), event->getType());
 
     if ( !iterator )
         return;
@@ -2503,7 +2505,52 @@ OSMetaClassDefineReservedUnused(IOHIDEventService,  9);
 OSMetaClassDefineReservedUnused(IOHIDEventService, 10);
 OSMetaClassDefineReservedUnused(IOHIDEventService, 11);
 #endif /* TARGET_OS_EMBEDDED */
-OSMetaClassDefineReservedUnused(IOHIDEventService, 12);
+
+//==============================================================================
+// IOHIDEventService::dispatchRelativePointerEventWithFixed
+//==============================================================================
+OSMetaClassDefineReservedUsed(IOHIDEventService, 12);
+void IOHIDEventService::dispatchRelativePointerEventWithFixed(
+                                AbsoluteTime                timeStamp,
+                                SInt64                      dx,
+                                SInt64                      dy,
+                                UInt32                      buttonState,
+                                IOOptionBits                options)
+{
+    IOHID_DEBUG(kIOHIDDebugCode_DispatchRelativePointer, dx, dy, buttonState, options);
+
+    if ( ! _readyForInputReports )
+        return;
+
+    if ( !dx && !dy && buttonState == _relativePointer.buttonState )
+        return;
+
+#if TARGET_OS_EMBEDDED
+
+    IOHIDEvent *event = IOHIDEvent::relativePointerEvent(timeStamp, 0, 0, 0, buttonState, _relativePointer.buttonState);
+
+    if ( event ) {
+        event->setFixedValue(kIOHIDEventFieldPointerX, IOFixed64::withFixed64(dx).asFixed());
+        event->setFixedValue(kIOHIDEventFieldPointerY, IOFixed64::withFixed64(dy).asFixed());
+        dispatchEvent(event);
+        event->release();
+    }
+
+#else
+    NUB_LOCK;
+
+    if ( !_pointingNub )
+        _pointingNub = newPointingShim();
+
+    if ( _pointingNub )
+        _pointingNub->dispatchRelativePointerEventWithFixed(timeStamp, dx, dy, buttonState, options);
+
+    NUB_UNLOCK;
+#endif /* TARGET_OS_EMBEDDED */
+
+    _relativePointer.buttonState = buttonState;
+}
+
 OSMetaClassDefineReservedUnused(IOHIDEventService, 13);
 OSMetaClassDefineReservedUnused(IOHIDEventService, 14);
 OSMetaClassDefineReservedUnused(IOHIDEventService, 15);
@@ -652,7 +652,32 @@ protected:
     OSMetaClassDeclareReservedUnused(IOHIDEventService, 10);
     OSMetaClassDeclareReservedUnused(IOHIDEventService, 11);
 #endif
-    OSMetaClassDeclareReservedUnused(IOHIDEventService, 12);
+
+protected:
+/*!
+    @function dispatchRelativePointerEventWithFixed
+    @abstract Dispatch relative pointer event with sub-pixel deltas
+    @discussion This is meant to be used with high resolution pointing devices whose motion
+                does not map to whole pixels.  The fractional part of each delta is carried
+                through pointer acceleration and cursor positioning instead of being truncated,
+                and the deltas are accelerated using their exact vector magnitude rather than
+                the whole pixel magnitude dispatchRelativePointerEvent uses.
+                The deltas are the raw 48:16 value of an IOFixed64, which is not part of the
+                installed headers, so no motion is lost to 16:16 range limits.
+    @param timeStamp    AbsoluteTime representing origination of event
+    @param dx           Relative motion along the x-axis in 48:16 fixed point.
+    @param dy           Relative motion along the y-axis in 48:16 fixed point.
+    @param buttonState  Button mask where bit0 is the primary button, bit1 secondary and so forth
+    @param options      Additional options to be used when dispatching event.
+*/
+    OSMetaClassDeclareReservedUsed(IOHIDEventService, 12);
+    virtual void            dispatchRelativePointerEventWithFixed(
+                                AbsoluteTime                timeStamp,
+                                SInt64                      dx,
+                                SInt64                      dy,
+                                UInt32                      buttonState,
+                                IOOptionBits                options = 0 );
+
     OSMetaClassDeclareReservedUnused(IOHIDEventService, 13);
     OSMetaClassDeclareReservedUnused(IOHIDEventService, 14);
     OSMetaClassDeclareReservedUnused(IOHIDEventService, 15);
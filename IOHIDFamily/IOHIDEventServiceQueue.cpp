@@ -30,6 +30,7 @@
 #include "IOHIDEventServiceQueue.h"
 #include "IOHIDEventService.h"
 #include "IOHIDEvent.h"
+#include "IOHIDFamilyTrace.h"
 
 #define super IOSharedDataQueue
 OSDefineMetaClassAndStructors( IOHIDEventServiceQueue, super )
@@ -149,6 +150,8 @@ Boolean IOHIDEventServiceQueue::enqueueEvent( IOHIDEvent * event )
         }
     }
     
+    IOHID_DEBUG_LATENCY(kIOHIDLatencyStage_EnqueueEvent, __OSAbsoluteTime(event->getTimeStamp()), event->getSenderID(), result);
+    
     return result;
 }
 
@@ -20,6 +20,7 @@
  * 
  * @APPLE_LICENSE_HEADER_END@
  */
+#include <AssertMacros.h>
 #include "IOHIDEventServiceUserClient.h"
 #include "IOHIDEventServiceQueue.h"
 #include "IOHIDEventData.h"
@@ -81,6 +82,11 @@ const IOExternalMethodDispatch IOHIDEventServiceUserClient::sMethods[kIOHIDEvent
 	3, 0,
     0, 0
     },
+    { //    kIOHIDEventServiceUserClientResetStatistics
+	(IOExternalMethodAction) &IOHIDEventServiceUserClient::_resetStatistics,
+	0, 0,
+    0, 0
+    },
 };
 
 
@@ -205,8 +211,9 @@ bool IOHIDEventServiceUserClient::initWithTask(task_t owningTask, void * securit
 //==============================================================================
 bool IOHIDEventServiceUserClient::start( IOService * provider )
 {
-    OSObject *  object;
-    uint32_t    queueSize = kQueueSizeMax;
+    OSObject *      object;
+    OSSerializer *  statistics;
+    uint32_t        queueSize = kQueueSizeMax;
     
     if ( !super::start(provider) )
         return false;
@@ -232,6 +239,12 @@ bool IOHIDEventServiceUserClient::start( IOService * provider )
     
     if ( !_queue )
         return false;    
+    
+    statistics = OSSerializer::forTarget(this, OSMemberFunctionCast(OSSerializerCallback, this, &IOHIDEventServiceUserClient::serializeStatistics));
+    if ( statistics ) {
+        setProperty(kIOHIDStatisticsKey, statistics);
+        statistics->release();
+    }
             
     return true;
 }
@@ -377,6 +390,58 @@ void IOHIDEventServiceUserClient::setElementValue(UInt32 usagePage, UInt32 usage
         _owner->setElementValue(usagePage, usage, value);
 }
 
+//==============================================================================
+// IOHIDEventServiceUserClient::_resetStatistics
+//==============================================================================
+IOReturn IOHIDEventServiceUserClient::_resetStatistics(
+                                IOHIDEventServiceUserClient *   target, 
+                                void *                          reference, 
+                                IOExternalMethodArguments *     arguments)
+{
+    target->resetStatistics();
+
+    return kIOReturnSuccess;
+}
+
+//==============================================================================
+// IOHIDEventServiceUserClient::resetStatistics
+//==============================================================================
+void IOHIDEventServiceUserClient::resetStatistics()
+{
+    OSAddAtomic64(-_eventCount, &_eventCount);
+    OSAddAtomic64(-_queueFullCount, &_queueFullCount);
+}
+
+//==============================================================================
+// IOHIDEventServiceUserClient::serializeStatistics
+//==============================================================================
+bool IOHIDEventServiceUserClient::serializeStatistics(void * reference, OSSerialize * serializer)
+{
+    OSDictionary *  dict    = OSDictionary::withCapacity(2);
+    OSNumber *      number;
+    bool            result  = false;
+    
+    require(dict, exit);
+    
+    number = OSNumber::withNumber((unsigned long long)_eventCount, 64);
+    if ( number ) {
+        dict->setObject(kIOHIDStatisticsEventCountKey, number);
+        number->release();
+    }
+    
+    number = OSNumber::withNumber((unsigned long long)_queueFullCount, 64);
+    if ( number ) {
+        dict->setObject(kIOHIDStatisticsQueueFullCountKey, number);
+        number->release();
+    }
+    
+    result = dict->serialize(serializer);
+    
+exit:
+    OSSafeRelease(dict);
+    return result;
+}
+
 //==============================================================================
 // IOHIDEventServiceUserClient::didTerminate
 //==============================================================================
@@ -426,5 +491,7 @@ void IOHIDEventServiceUserClient::eventServiceCallback(
         return;
         
     //enqueue the event
-    _queue->enqueueEvent(event);
+    OSIncrementAtomic64(&_eventCount);
+    if ( !_queue->enqueueEvent(event) )
+        OSIncrementAtomic64(&_queueFullCount);
 }
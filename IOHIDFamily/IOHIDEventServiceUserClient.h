@@ -28,6 +28,7 @@ enum IOHIDEventServiceUserClientCommandCodes {
     kIOHIDEventServiceUserClientClose,
     kIOHIDEventServiceUserClientCopyEvent,
     kIOHIDEventServiceUserClientSetElementValue,
+    kIOHIDEventServiceUserClientResetStatistics,
     kIOHIDEventServiceUserClientNumCommands
 };
 
@@ -50,6 +51,8 @@ private:
     IOHIDEventServiceQueue *    _queue;
     IOOptionBits                _options;
     task_t                      _client;
+    volatile SInt64             _eventCount;
+    volatile SInt64             _queueFullCount;
     
     void eventServiceCallback(  IOHIDEventService *             sender, 
                                 void *                          context,
@@ -74,6 +77,13 @@ private:
                                 void *                          reference, 
                                 IOExternalMethodArguments *     arguments);
 
+    static IOReturn _resetStatistics(
+                                IOHIDEventServiceUserClient *   target, 
+                                void *                          reference, 
+                                IOExternalMethodArguments *     arguments);
+
+    bool serializeStatistics(void * reference, OSSerialize * serializer);
+
 protected:
     // IOUserClient methods
     virtual IOReturn clientClose( void );
@@ -110,6 +120,7 @@ public:
     virtual IOReturn close();
     virtual IOHIDEvent * copyEvent(IOHIDEventType type, IOHIDEvent * matching, IOOptionBits options = 0);
     virtual void setElementValue(UInt32 usagePage, UInt32 usage, UInt32 value);
+    virtual void resetStatistics();
 };
 
 #endif /* KERNEL */
@@ -59,7 +59,30 @@ enum kIOHIDDebugCodes {
     kIOHIDDebugCode_PowerStateChangeEvent,
     kIOHIDDebugCode_DispatchDigitizer,          // 28 0x5230070
     kIOHIDDebugCode_Scheduling, 
+    kIOHIDDebugCode_LatencyStage,
     kIOHIDDebugCode_Invalid
 };
 
+// Latency tracing
+//
+// Each stage a report passes through emits kIOHIDDebugCode_LatencyStage with
+// the stage, a correlation ID, the sender's registry ID (0 where it isn't
+// known) and a stage specific value.  The correlation ID is the report's
+// timestamp: it is handed unchanged from IOHIDDevice::handleReportWithTime
+// to the events built from the report, so the stages can be joined from a
+// trace without carrying any extra state down the pipeline.  Cursor motion
+// is coalesced before it's posted, so IOHIDSystem keeps the timestamp of
+// the oldest report folded into it and posts the trace against that.
+enum kIOHIDLatencyStages {
+    kIOHIDLatencyStage_HandleReport,            // arg4: report type
+    kIOHIDLatencyStage_InterruptReport,         // arg4: report ID
+    kIOHIDLatencyStage_DispatchEvent,           // arg4: event type
+    kIOHIDLatencyStage_EnqueueEvent,            // arg4: 1 if queued, 0 if dropped
+    kIOHIDLatencyStage_PostEvent,               // arg4: NX event type
+    kIOHIDLatencyStage_Count
+};
+
+#define IOHID_DEBUG_LATENCY(stage, correlationID, senderID, value)  \
+    IOHID_DEBUG(kIOHIDDebugCode_LatencyStage, stage, correlationID, senderID, value)
+
 #endif // _IOKIT_HID_IOHIDFAMILYTRACE_H }
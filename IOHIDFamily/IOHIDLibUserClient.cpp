@@ -38,6 +38,7 @@
 #include <IOKit/IOWorkLoop.h>
 #include <IOKit/IOKitKeysPrivate.h>
 #include <IOKit/IOUserClient.h>
+#include <libkern/crypto/sha1.h>
 #include "IOHIDLibUserClient.h"
 #include "IOHIDDevice.h"
 #include "IOHIDEventQueue.h"
@@ -149,7 +150,7 @@ sMethods[kIOHIDLibUserClientNumCommands] = {
     { //    kIOHIDLibUserClientGetElementCount
     (IOExternalMethodAction) &IOHIDLibUserClient::_getElementCount,
     0, 0,
-    2, 0
+    kIOUCVariableStructureSize, 0
     },
     { //    kIOHIDLibUserClientGetElements
     (IOExternalMethodAction) &IOHIDLibUserClient::_getElements,
@@ -161,6 +162,16 @@ sMethods[kIOHIDLibUserClientNumCommands] = {
     (IOExternalMethodAction) &IOHIDLibUserClient::_setQueueAsyncPort,
     1, 0,
     0, 0
+    },
+    { //    kIOHIDLibUserClientResetStatistics
+    (IOExternalMethodAction) &IOHIDLibUserClient::_resetStatistics,
+    0, 0,
+    0, 0
+    },
+    { //    kIOHIDLibUserClientGetReportIntervals
+    (IOExternalMethodAction) &IOHIDLibUserClient::_getReportIntervals,
+    0, 0,
+    0, kIOUCVariableStructureSize
     }
 };
 
@@ -844,9 +855,103 @@ IOReturn IOHIDLibUserClient::clientMemoryForTypeGated(
 }
 
 
+IOReturn IOHIDLibUserClient::_resetStatistics(IOHIDLibUserClient * target, void * reference __unused, IOExternalMethodArguments * arguments __unused)
+{
+    return target->resetStatistics();
+}
+
+IOReturn IOHIDLibUserClient::resetStatistics()
+{
+    if (!fNub)
+        return kIOReturnOffline;
+
+    fNub->resetStatistics();
+
+    return kIOReturnSuccess;
+}
+
+IOReturn IOHIDLibUserClient::_getReportIntervals(IOHIDLibUserClient * target, void * reference __unused, IOExternalMethodArguments * arguments)
+{
+    if ( arguments->structureOutputDescriptor )
+        return target->getReportIntervals(arguments->structureOutputDescriptor, &(arguments->structureOutputDescriptorSize));
+    else
+        return target->getReportIntervals(arguments->structureOutput, &(arguments->structureOutputSize));
+}
+
+IOReturn IOHIDLibUserClient::getReportIntervals(void * buffer, uint32_t * bufferSize)
+{
+    if (!buffer || !bufferSize || !*bufferSize)
+        return kIOReturnBadArgument;
+
+    if (!fNub || isInactive())
+        return kIOReturnNotAttached;
+
+    bzero(buffer, *bufferSize);
+
+    *bufferSize = fNub->copyReportIntervals(buffer, *bufferSize);
+
+    return kIOReturnSuccess;
+}
+
+IOReturn IOHIDLibUserClient::getReportIntervals(IOMemoryDescriptor * mem, uint32_t * bufferSize)
+{
+    IOReturn    ret;
+    void *      buffer;
+    uint32_t    bufferLength;
+    uint32_t    length;
+
+    if (!fNub || isInactive())
+        return kIOReturnNotAttached;
+
+    if ( !mem->getLength() )
+        return kIOReturnBadArgument;
+
+    // The device never holds more than this, so don't let the caller's
+    // buffer size decide how much we allocate.
+    bufferLength = kIOHIDReportIntervalMax * sizeof(IOHIDReportIntervalStruct);
+    if ( mem->getLength() < bufferLength )
+        bufferLength = (uint32_t)mem->getLength();
+
+    length = bufferLength;
+
+    ret = mem->prepare();
+    if ( ret != kIOReturnSuccess )
+        return ret;
+
+    buffer = IOMalloc(bufferLength);
+    if ( buffer ) {
+        ret = getReportIntervals(buffer, &length);
+        if ( ret == kIOReturnSuccess ) {
+            mem->writeBytes(0, buffer, length);
+            *bufferSize = length;
+        }
+
+        IOFree(buffer, bufferLength);
+    }
+    else
+        ret = kIOReturnNoMemory;
+
+    mem->complete();
+
+    return ret;
+}
+
 IOReturn IOHIDLibUserClient::_getElementCount(IOHIDLibUserClient * target, void * reference __unused, IOExternalMethodArguments * arguments)
 {
-    return target->getElementCount(&(arguments->scalarOutput[0]), &(arguments->scalarOutput[1]));
+    IOReturn ret;
+    
+    if ( arguments->scalarOutputCount < 2 )
+        return kIOReturnBadArgument;
+        
+    ret = target->getElementCount(&(arguments->scalarOutput[kIOHIDLibUserClientElementCountIndex]), &(arguments->scalarOutput[kIOHIDLibUserClientReportHandlerCountIndex]));
+    
+    // without a key the caller just doesn't use its element cache
+    if ( (ret != kIOReturnSuccess) ||
+         (arguments->scalarOutputCount < kIOHIDLibUserClientElementCountOutputs) ||
+         (target->getElementCacheKey(&(arguments->scalarOutput[kIOHIDLibUserClientElementValuesSizeIndex]), &(arguments->scalarOutput[kIOHIDLibUserClientDescriptorDigestIndex])) != kIOReturnSuccess) )
+        arguments->scalarOutputCount = 2;
+        
+    return ret;
 }
 
 IOReturn IOHIDLibUserClient::getElementCount(uint64_t * pOutElementCount, uint64_t * pOutReportElementCount)
@@ -865,6 +970,40 @@ IOReturn IOHIDLibUserClient::getElementCount(uint64_t * pOutElementCount, uint64
     return kIOReturnSuccess;
 }
 
+//---------------------------------------------------------------------------
+// getElementCacheKey
+//
+// Size of the element values memory and a SHA-1 of the report descriptor,
+// zero padded to three scalars.  IOHIDLib keys and validates its element
+// cache on these instead of mapping the values and copying the descriptor.
+//---------------------------------------------------------------------------
+IOReturn IOHIDLibUserClient::getElementCacheKey(uint64_t * pOutValuesSize, uint64_t * pOutDigest)
+{
+    IOMemoryDescriptor *    values;
+    OSData *                descriptor;
+    SHA1_CTX                context;
+    uint8_t                 digest[kIOHIDLibUserClientDescriptorDigestLength];
+    
+    if (!fNub || isInactive())
+        return kIOReturnNotAttached;
+        
+    values      = fNub->getMemoryWithCurrentElementValues();
+    descriptor  = OSDynamicCast(OSData, fNub->getProperty(kIOHIDReportDescriptorKey));
+    
+    if (!values || !descriptor)
+        return kIOReturnUnsupported;
+        
+    bzero(digest, sizeof(digest));
+    SHA1Init(&context);
+    SHA1Update(&context, descriptor->getBytesNoCopy(), descriptor->getLength());
+    SHA1Final(digest, &context);
+    
+    *pOutValuesSize = values->getLength();
+    bcopy(digest, pOutDigest, sizeof(digest));
+    
+    return kIOReturnSuccess;
+}
+
 IOReturn IOHIDLibUserClient::_getElements(IOHIDLibUserClient * target, void * reference __unused, IOExternalMethodArguments * arguments)
 {
     if ( arguments->structureOutputDescriptor )
@@ -1174,7 +1313,10 @@ IOReturn IOHIDLibUserClient::postElementValues (const uint64_t * lCookies, uint3
 
 IOReturn IOHIDLibUserClient::_getReport(IOHIDLibUserClient * target, void * reference __unused, IOExternalMethodArguments * arguments)
 {
-    if ( arguments->asyncWakePort ) {
+    // An inline structure output is copied out when this call returns, so
+    // an asynchronous answer would have nowhere to go; those requests, and
+    // devices that can't get reports asynchronously, are served below.
+    if ( arguments->asyncWakePort && arguments->structureOutputDescriptor ) {
         IOReturn        ret;
         IOHIDCompletion tap;
         AsyncParam *    pb = (AsyncParam *)IOMalloc(sizeof(AsyncParam));
@@ -1189,16 +1331,14 @@ IOReturn IOHIDLibUserClient::_getReport(IOHIDLibUserClient * target, void * refe
         tap.action = OSMemberFunctionCast(IOHIDCompletionAction, target, &IOHIDLibUserClient::ReqComplete);
         tap.parameter = pb;
 
-        if ( arguments->structureOutputDescriptor )
-            ret = target->getReport(arguments->structureOutputDescriptor, &(arguments->structureOutputDescriptorSize), (IOHIDReportType)arguments->scalarInput[0], (uint32_t)arguments->scalarInput[1], (uint32_t)arguments->scalarInput[2], &tap);
-        else
-            ret = target->getReport(arguments->structureOutput, &(arguments->structureOutputSize), (IOHIDReportType)arguments->scalarInput[0], (uint32_t)arguments->scalarInput[1], (uint32_t)arguments->scalarInput[2], &tap);
+        ret = target->getReport(arguments->structureOutputDescriptor, &(arguments->structureOutputDescriptorSize), (IOHIDReportType)arguments->scalarInput[0], (uint32_t)arguments->scalarInput[1], (uint32_t)arguments->scalarInput[2], &tap);
             
-        if ( ret ) {
-            if ( pb )
-                IOFree(pb, sizeof(*pb));
-            target->release();
-        }
+        if ( ret == kIOReturnSuccess )
+            return ret;
+
+        if ( pb )
+            IOFree(pb, sizeof(*pb));
+        target->release();
     }
     if ( arguments->structureOutputDescriptor )
         return target->getReport(arguments->structureOutputDescriptor, &(arguments->structureOutputDescriptorSize), (IOHIDReportType)arguments->scalarInput[0], (uint32_t)arguments->scalarInput[1]);
@@ -1321,7 +1461,12 @@ IOReturn IOHIDLibUserClient::setReport(const void *reportBuffer, uint32_t report
     IOReturn                ret;
     IOMemoryDescriptor *    mem;
 
-    mem = IOMemoryDescriptor::withAddress((void *)reportBuffer, reportBufferSize, kIODirectionOut);
+    // an async request outlives the inline structure input it came in, so
+    // it gets its own copy of the report
+    if ( completion )
+        mem = IOBufferMemoryDescriptor::withBytes(reportBuffer, reportBufferSize, kIODirectionOut);
+    else
+        mem = IOMemoryDescriptor::withAddress((void *)reportBuffer, reportBufferSize, kIODirectionOut);
     if(mem) {
         ret = setReport(mem, reportType, reportID, timeout, completion);
         mem->release();
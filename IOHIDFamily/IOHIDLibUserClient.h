@@ -65,9 +65,24 @@ enum IOHIDLibUserClientCommandCodes {
 	kIOHIDLibUserClientGetElementCount,
 	kIOHIDLibUserClientGetElements,
 	kIOHIDLibUserClientSetQueueAsyncPort,
+	kIOHIDLibUserClientResetStatistics,
+	kIOHIDLibUserClientGetReportIntervals,
 	kIOHIDLibUserClientNumCommands
 };
 
+// Scalar outputs of kIOHIDLibUserClientGetElementCount.  Callers that ask
+// for more than the two counts also get what IOHIDLib keys its element
+// cache on, so a cache hit needs no other call into the kernel.
+enum IOHIDLibUserClientElementCountOutputs {
+	kIOHIDLibUserClientElementCountIndex,
+	kIOHIDLibUserClientReportHandlerCountIndex,
+	kIOHIDLibUserClientElementValuesSizeIndex,
+	kIOHIDLibUserClientDescriptorDigestIndex,		// SHA-1 of the report descriptor, 8 bytes per scalar
+	kIOHIDLibUserClientElementCountOutputs = kIOHIDLibUserClientDescriptorDigestIndex + 3
+};
+
+#define kIOHIDLibUserClientDescriptorDigestLength	(3 * sizeof(uint64_t))
+
 __BEGIN_DECLS
 
 typedef struct _IOHIDElementValue
@@ -122,6 +137,28 @@ enum {
 	kHIDReportHandlerType
 };
 
+// Bucket 0 counts report intervals under 1us and bucket n those from
+// 2^(n-1)us up to 2^n us.  The last bucket also takes anything longer.
+enum {
+	kIOHIDReportIntervalBucketCount	= 24
+};
+
+// Distinct report type and ID pairs whose intervals are tracked.  Devices
+// rarely use more than a handful; pairs past the limit are not recorded.
+enum {
+	kIOHIDReportIntervalMax			= 16
+};
+
+typedef struct _IOHIDReportIntervalStruct
+{
+	UInt32				reportType;
+	UInt32				reportID;
+	UInt64				count;
+	UInt32				minInterval;
+	UInt32				maxInterval;
+	UInt32				buckets[kIOHIDReportIntervalBucketCount];
+}IOHIDReportIntervalStruct;
+
 __END_DECLS
 
 #if KERNEL
@@ -236,6 +273,7 @@ protected:
 	// Get Element Counts
 	static IOReturn _getElementCount(IOHIDLibUserClient * target, void * reference, IOExternalMethodArguments * arguments);	
 	IOReturn		getElementCount(uint64_t * outElementCount, uint64_t * outReportElementCount);
+	IOReturn		getElementCacheKey(uint64_t * outValuesSize, uint64_t * outDigest);
 
 	// Get Elements
 	static IOReturn _getElements(IOHIDLibUserClient * target, void * reference, IOExternalMethodArguments * arguments);	
@@ -250,6 +288,15 @@ protected:
 	static IOReturn _setQueueAsyncPort(IOHIDLibUserClient * target, void * reference, IOExternalMethodArguments * arguments);
 	IOReturn		setQueueAsyncPort(IOHIDEventQueue * queue, mach_port_t port);
 
+	// Reset the device's HIDStatistics counters
+	static IOReturn _resetStatistics(IOHIDLibUserClient * target, void * reference, IOExternalMethodArguments * arguments);
+	IOReturn		resetStatistics();
+
+	// Copy the device's report interval histograms
+	static IOReturn _getReportIntervals(IOHIDLibUserClient * target, void * reference, IOExternalMethodArguments * arguments);
+	IOReturn		getReportIntervals(void * buffer, uint32_t * bufferSize);
+	IOReturn		getReportIntervals(IOMemoryDescriptor * mem, uint32_t * bufferSize);
+
 	// Create a queue
 	static IOReturn _createQueue(IOHIDLibUserClient * target, void * reference, IOExternalMethodArguments * arguments);
 	IOReturn		createQueue(uint32_t flags, uint32_t depth, uint64_t * outQueue);
@@ -164,6 +164,32 @@ void IOHIDPointing::dispatchRelativePointerEvent(
 	super::dispatchRelativePointerEvent(dx, dy, buttonState, timeStamp);
 }
 
+//====================================================================================================
+// IOHIDPointing::dispatchRelativePointerEventWithFixed
+//====================================================================================================
+void IOHIDPointing::dispatchRelativePointerEventWithFixed(
+                                AbsoluteTime                timeStamp,
+                                SInt64                      dx,
+                                SInt64                      dy,
+                                UInt32                      buttonState,
+                                IOOptionBits                options)
+{
+    bool    accelerate      = ((options & kHIDDispatchOptionPointerNoAcceleration) == 0);
+    UInt32  pointingMode    = getPointingMode();
+    
+    if ( ((pointingMode & kAccelMouse) != 0) != accelerate)
+    {
+        if ( accelerate )
+            pointingMode |= kAccelMouse;
+        else
+            pointingMode &= ~kAccelMouse;
+            
+        setPointingMode(pointingMode);
+    }
+
+	IOHIPointing::dispatchRelativePointerEventWithFixed(dx, dy, buttonState, timeStamp);
+}
+
 //====================================================================================================
 // IOHIDPointing::dispatchScrollWheelEvent
 //====================================================================================================
@@ -78,6 +78,13 @@ public:
 								UInt32                      buttonState,
 								IOOptionBits                options = 0);
 
+	void dispatchRelativePointerEventWithFixed(
+                                AbsoluteTime                timeStamp,
+								SInt64                      dx,
+								SInt64                      dy,
+								UInt32                      buttonState,
+								IOOptionBits                options = 0);
+
 	virtual void dispatchScrollWheelEvent(
                                 AbsoluteTime                timeStamp,
 								SInt32                      deltaAxis1,
@@ -88,6 +88,21 @@ typedef enum {
 #define kIOHIDSetButtonPriorityKey          "SetButtonPriority"
 #define kIOHIDSetButtonDelayKey             "SetButtonDelay"
 
+#define kIOHIDStatisticsKey                 "HIDStatistics"
+#define kIOHIDStatisticsReportCountKey      "ReportCount"
+#define kIOHIDStatisticsElementChangeCountKey   "ElementChangeCount"
+#define kIOHIDStatisticsQueueFullCountKey   "QueueFullCount"
+#define kIOHIDStatisticsAsyncReportDropCountKey "AsyncReportDropCount"
+#define kIOHIDStatisticsEventCountKey       "EventCount"
+
+#define kIOHIDReportIntervalsKey            "HIDReportIntervals"
+#define kIOHIDReportIntervalsReportTypeKey  "ReportType"
+#define kIOHIDReportIntervalsReportIDKey    "ReportID"
+#define kIOHIDReportIntervalsCountKey       "Count"
+#define kIOHIDReportIntervalsMinKey         "MinInterval"
+#define kIOHIDReportIntervalsMaxKey         "MaxInterval"
+#define kIOHIDReportIntervalsHistogramKey   "Histogram"
+
 __END_DECLS
 
 #endif /* !_IOKIT_HID_IOHIDPRIVATEKEYS_H_ */
@@ -0,0 +1,119 @@
+/*
+ * @APPLE_LICENSE_HEADER_START@
+ *
+ * Copyright (c) 1999-2009 Apple Computer, Inc.	 All Rights Reserved.
+ *
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this
+ * file.
+ *
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ *
+ * @APPLE_LICENSE_HEADER_END@
+ */
+
+#ifndef _IOHIDREPORTBITS_H
+#define _IOHIDREPORTBITS_H
+
+//
+// Report bit field extraction shared by IOHIDElementPrivate and
+// tools/IOHIDReportBenchmark.c, so the benchmark's element path does
+// exactly the work the kernel does.  Only depends on the IOKit types.
+//
+
+#include <IOKit/IOTypes.h>
+#ifndef __cplusplus
+#include <stdbool.h>
+#endif
+
+#define BIT_MASK(bits)  ((1 << (bits)) - 1)
+
+#define UpdateByteOffsetAndShift(bits, offset, shift)  \
+    do { offset = bits >> 3; shift = bits & 0x07; } while (0)
+
+#define UpdateWordOffsetAndShift(bits, offset, shift)  \
+    do { offset = bits >> 5; shift = bits & 0x1f; } while (0)
+
+static inline UInt32 ReportBitsMin(UInt32 a, UInt32 b)
+{
+    return (a < b) ? a : b;
+}
+
+//---------------------------------------------------------------------------
+// Not very efficient, will do for now.
+
+static inline void readReportBits( const UInt8 * src,
+                                   UInt32 *      dst,
+                                   UInt32        bitsToCopy,
+                                   UInt32        srcStartBit,
+                                   bool          shouldSignExtend,
+                                   bool *        valueChanged)
+{
+    UInt32 srcOffset;
+    UInt32 srcShift;
+    UInt32 dstShift      = 0;
+    UInt32 dstStartBit   = 0;
+    UInt32 dstOffset     = 0;
+    UInt32 lastDstOffset = 0;
+    UInt32 word          = 0;
+    UInt8  bitsProcessed;
+    UInt32 totalBitsProcessed = 0;
+
+    while ( bitsToCopy )
+    {
+        UInt32 tmp;
+
+        UpdateByteOffsetAndShift( srcStartBit, srcOffset, srcShift );
+
+        bitsProcessed = ReportBitsMin( bitsToCopy,
+                                       ReportBitsMin( 8 - srcShift, 32 - dstShift ) );
+
+        tmp = (src[srcOffset] >> srcShift) & BIT_MASK(bitsProcessed);
+
+        word |= ( tmp << dstShift );
+
+        dstStartBit += bitsProcessed;
+        srcStartBit += bitsProcessed;
+        bitsToCopy  -= bitsProcessed;
+        totalBitsProcessed += bitsProcessed;
+
+        UpdateWordOffsetAndShift( dstStartBit, dstOffset, dstShift );
+
+        if ( ( dstOffset != lastDstOffset ) || ( bitsToCopy == 0 ) )
+        {
+            // sign extend negative values
+            // if this is the leftmost word of the result
+            if ((lastDstOffset == 0) &&
+                // and the logical min or max is less than zero
+                // so we should sign extend
+                (shouldSignExtend))
+            {
+                // is this less than a full word
+                if ((totalBitsProcessed < 32) &&
+                    // and the value negative (high bit set)
+                    (word & (1 << (totalBitsProcessed - 1))))
+                    // or in all 1s above the significant bit
+                    word |= ~(BIT_MASK(totalBitsProcessed));
+            }
+
+            if ( dst[lastDstOffset] != word )
+            {
+                dst[lastDstOffset] = word;
+                if (valueChanged) *valueChanged = true;
+            }
+            word = 0;
+            lastDstOffset = dstOffset;
+        }
+    }
+}
+
+#endif /* _IOHIDREPORTBITS_H */
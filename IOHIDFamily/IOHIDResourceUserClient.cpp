@@ -23,6 +23,7 @@
 
 #include <AssertMacros.h>
 #include <IOKit/IOLib.h>
+#include <libkern/OSAtomic.h>
 
 #ifdef enqueue
     #undef enqueue
@@ -34,6 +35,19 @@
 
 #define kHIDQueueSize           16384
 
+#define kHIDReportRingSize      65536
+
+// Reports delivered per drain before yielding the work loop
+#define kHIDReportRingMaxBatch  256
+
+// Shortest interval a client can ask the ring to be drained at
+#define kHIDReportRingMinIntervalUS 1000
+
+// Pending report tokens carry the slot generation above the slot index
+#define PendingReportToken(index, generation)   ((((uint64_t)(generation)) << 8) | (index))
+#define PendingReportTokenIndex(token)          ((uint32_t)((token) & 0xff))
+#define PendingReportTokenGeneration(token)     ((uint32_t)((token) >> 8))
+
 #define super IOUserClient
 
 
@@ -63,6 +77,16 @@ const IOExternalMethodDispatch IOHIDResourceDeviceUserClient::_methods[kIOHIDRes
         (IOExternalMethodAction) &IOHIDResourceDeviceUserClient::_postReportResult,
         kIOHIDResourceUserClientResponseIndexCount, -1, /* 1 scalar input: the result, 1 struct input : the buffer */
         0, 0
+    },
+    {   // kIOHIDResourceDeviceUserClientMethodDrainReportRing
+        (IOExternalMethodAction) &IOHIDResourceDeviceUserClient::_drainReportRing,
+        1, 0, /* 1 scalar input: the drain interval in us */
+        0, 0
+    },
+    {   // kIOHIDResourceDeviceUserClientMethodHandleReports
+        (IOExternalMethodAction) &IOHIDResourceDeviceUserClient::_handleReports,
+        0, -1, /* 1 struct input : the report records */
+        1, 0   /* 1 scalar output : the number of reports delivered */
     }
 };
 
@@ -82,7 +106,6 @@ bool IOHIDResourceDeviceUserClient::initWithTask(task_t owningTask, void * secur
     result = super::initWithTask(owningTask, security_id, type);
     require_action(result, exit, IOLog("%s failed\n", __FUNCTION__));
     
-    _pending            = OSSet::withCapacity(4);
     _maxClientTimeoutUS = kHIDClientTimeoutUS;
 
 exit:
@@ -110,6 +133,14 @@ bool IOHIDResourceDeviceUserClient::start(IOService * provider)
     require_action(_createDeviceTimer, exit, result=false);
     require_noerr_action(workLoop->addEventSource(_createDeviceTimer), exit, result=false);
     
+    _reportRingTimer = IOTimerEventSource::timerEventSource(this, OSMemberFunctionCast(IOTimerEventSource::Action, this, &IOHIDResourceDeviceUserClient::drainReportRingTimerCallback));
+    require_action(_reportRingTimer, exit, result=false);
+    require_noerr_action(workLoop->addEventSource(_reportRingTimer), exit, result=false);
+    
+    _pendingReportTimer = IOTimerEventSource::timerEventSource(this, OSMemberFunctionCast(IOTimerEventSource::Action, this, &IOHIDResourceDeviceUserClient::pendingReportTimeoutCallback));
+    require_action(_pendingReportTimer, exit, result=false);
+    require_noerr_action(workLoop->addEventSource(_pendingReportTimer), exit, result=false);
+    
     _commandGate = IOCommandGate::commandGate(this);
     require_action(_commandGate, exit, result=false);
     require_noerr_action(workLoop->addEventSource(_commandGate), exit, result=false);
@@ -139,11 +170,21 @@ void IOHIDResourceDeviceUserClient::stop(IOService * provider)
         workLoop->removeEventSource(_createDeviceTimer);
     }
     
+    if ( _reportRingTimer ) {
+        _reportRingTimer->cancelTimeout();
+        workLoop->removeEventSource(_reportRingTimer);
+    }
+    
     if ( _commandGate ) {
         cleanupPendingReports();
 
         workLoop->removeEventSource(_commandGate);
     }
+    
+    if ( _pendingReportTimer ) {
+        _pendingReportTimer->cancelTimeout();
+        workLoop->removeEventSource(_pendingReportTimer);
+    }
 
 exit:
     super::stop(provider);
@@ -164,6 +205,18 @@ void IOHIDResourceDeviceUserClient::free()
     if ( _createDeviceTimer )
         _createDeviceTimer->release();
     
+    if ( _reportRingTimer )
+        _reportRingTimer->release();
+    
+    if ( _pendingReportTimer )
+        _pendingReportTimer->release();
+    
+    if ( _reportRingMemory )
+        _reportRingMemory->release();
+    
+    if ( _reportBuffer )
+        _reportBuffer->release();
+    
     if ( _device )
         _device->release();
 
@@ -211,13 +264,13 @@ exit:
 //----------------------------------------------------------------------------------------------------
 // IOHIDResourceDeviceUserClient::clientMemoryForType
 //----------------------------------------------------------------------------------------------------
-IOReturn IOHIDResourceDeviceUserClient::clientMemoryForType(UInt32 type __unused, IOOptionBits * options, IOMemoryDescriptor ** memory )
+IOReturn IOHIDResourceDeviceUserClient::clientMemoryForType(UInt32 type, IOOptionBits * options, IOMemoryDescriptor ** memory )
 {
     IOReturn result;
     
     require_action(!isInactive(), exit, result=kIOReturnOffline);
 
-    result = _commandGate->runAction(OSMemberFunctionCast(IOCommandGate::Action, this, &IOHIDResourceDeviceUserClient::clientMemoryForTypeGated), options, memory);
+    result = _commandGate->runAction(OSMemberFunctionCast(IOCommandGate::Action, this, &IOHIDResourceDeviceUserClient::clientMemoryForTypeGated), (void *)(uintptr_t)type, options, memory);
     
 exit:
     return result;
@@ -226,13 +279,30 @@ exit:
 //----------------------------------------------------------------------------------------------------
 // IOHIDResourceDeviceUserClient::clientMemoryForTypeGated
 //----------------------------------------------------------------------------------------------------
-IOReturn IOHIDResourceDeviceUserClient::clientMemoryForTypeGated(IOOptionBits * options, IOMemoryDescriptor ** memory )
+IOReturn IOHIDResourceDeviceUserClient::clientMemoryForTypeGated(IOHIDResourceUserClientMemoryType type, IOOptionBits * options, IOMemoryDescriptor ** memory )
 {
     IOReturn ret;
     IOMemoryDescriptor * memoryToShare = NULL;
     
     require_action(!isInactive(), exit, ret=kIOReturnOffline);
     
+    if ( type == kIOHIDResourceUserClientMemoryTypeReportRing ) {
+        if ( !_reportRingMemory ) {
+            _reportRingMemory = IOBufferMemoryDescriptor::withOptions(kIODirectionInOut | kIOMemoryKernelUserShared, sizeof(IOHIDResourceReportRing) + kHIDReportRingSize, page_size);
+            require_action(_reportRingMemory, exit, ret = kIOReturnNoMemory);
+            
+            IOHIDResourceReportRing * ring = (IOHIDResourceReportRing *)_reportRingMemory->getBytesNoCopy();
+            bzero(ring, sizeof(IOHIDResourceReportRing));
+            ring->size = kHIDReportRingSize;
+        }
+        
+        memoryToShare = _reportRingMemory;
+        memoryToShare->retain();
+        
+        ret = kIOReturnSuccess;
+        goto exit;
+    }
+    
     if ( !_queue ) {
         _queue = IOHIDResourceQueue::withCapacity(kHIDQueueSize);
     }
@@ -537,85 +607,300 @@ IOReturn IOHIDResourceDeviceUserClient::_handleReport(IOHIDResourceDeviceUserCli
     return target->handleReport(arguments);
 }
 
-typedef struct {
-    IOReturn                ret;
-    IOMemoryDescriptor *    descriptor;
-} __ReportResult;
-
 //----------------------------------------------------------------------------------------------------
-// IOHIDResourceDeviceUserClient::getReport
+// IOHIDResourceDeviceUserClient::drainReportRing
+//
+// Delivers up to kHIDReportRingMaxBatch reports from the report ring.  The
+// ring is writable by the user process at any time, so the offsets are
+// checked against the size the kernel allocated and deliverReport copies
+// each report before it's handed to the device.  *pMore is set if reports
+// were left over.
 //----------------------------------------------------------------------------------------------------
-IOReturn IOHIDResourceDeviceUserClient::getReport(IOMemoryDescriptor *report, IOHIDReportType reportType, IOOptionBits options)
+IOReturn IOHIDResourceDeviceUserClient::drainReportRing(bool * pMore)
 {
-    ReportGatedArguments    arguments   = {report, reportType, options};
-    IOReturn                result;
+    IOHIDResourceReportRing *   ring;
+    uint32_t                    head;
+    uint32_t                    tail;
+    uint32_t                    count   = 0;
+    IOReturn                    ret     = kIOReturnSuccess;
+    
+    *pMore = false;
+    
+    require_action(_device, exit, ret=kIOReturnNotOpen);
+    require_action(_reportRingMemory, exit, ret=kIOReturnNotReady);
+    
+    ring = (IOHIDResourceReportRing *)_reportRingMemory->getBytesNoCopy();
+    head = ring->head;
+    tail = ring->tail;
+    
+    require_action((head < kHIDReportRingSize) && (tail < kHIDReportRingSize), exit, ret=kIOReturnBadArgument);
+    
+    // don't read entries ahead of the tail that published them
+    OSMemoryBarrier();
+    
+    while ( (head != tail) && (count < kHIDReportRingMaxBatch) ) {
+        IOHIDResourceReportRingEntry *  entry;
+        uint32_t                        length;
+        
+        if ( (kHIDReportRingSize - head) < sizeof(IOHIDResourceReportRingEntry) ) {
+            head = 0;
+            continue;
+        }
+        
+        entry   = (IOHIDResourceReportRingEntry *)(ring->data + head);
+        length  = entry->length;
+        
+        if ( (length == kIOHIDResourceReportRingWrap) && head ) {
+            head = 0;
+            continue;
+        }
+        
+        // a bad entry leaves no way to find the next one, so drop what's queued
+        if ( (length == kIOHIDResourceReportRingWrap) || (length > (kHIDReportRingSize - head - sizeof(IOHIDResourceReportRingEntry))) ) {
+            head    = tail;
+            ret     = kIOReturnBadArgument;
+            break;
+        }
+        
+        deliverReport(entry->timestamp, entry->data, length);
+        
+        head += IOHIDResourceReportRingEntrySize(length);
+        if ( head >= kHIDReportRingSize )
+            head = 0;
+            
+        count++;
+    }
+    
+    // finish reading the entries before the writer may reuse them
+    OSMemoryBarrier();
+    ring->head = head;
+    
+    *pMore = (head != tail);
     
-    require_action(!isInactive(), exit, result=kIOReturnOffline);
-
-    result = _commandGate->runAction(OSMemberFunctionCast(IOCommandGate::Action, this, &IOHIDResourceDeviceUserClient::getReportGated), &arguments);
 exit:
-    return result;
+    return ret;
 }
 
 //----------------------------------------------------------------------------------------------------
-// IOHIDResourceDeviceUserClient::getReport
+// IOHIDResourceDeviceUserClient::deliverReport
+//
+// Hands a report to the device from a buffer that's reused across calls.
+// Reports are copied into it first, which keeps user memory that may still
+// be changing away from the device.  A timestamp of 0 uses the current time.
 //----------------------------------------------------------------------------------------------------
-IOReturn IOHIDResourceDeviceUserClient::getReportGated(ReportGatedArguments * arguments)
+IOReturn IOHIDResourceDeviceUserClient::deliverReport(uint64_t timestamp, const void * report, uint32_t length)
 {
-    IOHIDResourceDataQueueHeader    header;
-    __ReportResult                  result;
-    AbsoluteTime                    ts;
-    IOReturn                        ret;
-    OSData *                        retData = NULL;
+    AbsoluteTime    reportTime;
+    IOReturn        ret;
     
-    require_action(!isInactive(), exit, ret=kIOReturnOffline);
+    require_action(length <= kHIDReportRingSize, exit, ret=kIOReturnBadArgument);
     
-    result.descriptor = arguments->report;
+    if ( !_reportBuffer ) {
+        _reportBuffer = IOBufferMemoryDescriptor::withCapacity(kHIDReportRingSize, kIODirectionOut);
+        require_action(_reportBuffer, exit, ret=kIOReturnNoMemory);
+    }
     
-    retData = OSData::withBytesNoCopy(&result, sizeof(__ReportResult));
-    require_action(retData, exit, ret=kIOReturnNoMemory);
+    bcopy(report, _reportBuffer->getBytesNoCopy(), length);
+    _reportBuffer->setLength(length);
     
-    header.direction   = kIOHIDResourceReportDirectionIn;
-    header.type        = arguments->reportType;
-    header.reportID    = arguments->options&0xff;
-    header.length      = (uint32_t)arguments->report->getLength();
-    header.token       = (intptr_t)retData;
-
-    _pending->setObject(retData);
+    if ( timestamp )
+        AbsoluteTime_to_scalar(&reportTime) = timestamp;
+    else
+        clock_get_uptime(&reportTime);
     
-    require_action(_queue && _queue->enqueueReport(&header), exit, ret=kIOReturnNoMemory);
+    ret = _device->handleReportWithTime(reportTime, _reportBuffer);
     
-    // if we successfully enqueue, let's sleep till we get a result from postReportResult
-    clock_interval_to_deadline(kMicrosecondScale, _maxClientTimeoutUS, &ts);
+exit:
+    return ret;
+}
+
+//----------------------------------------------------------------------------------------------------
+// IOHIDResourceDeviceUserClient::handleReports
+//
+// Delivers a packed buffer of report records within a single command gate
+// entry.  Records are parsed front to back and parsing stops at the first
+// one that doesn't fit in the buffer.
+//----------------------------------------------------------------------------------------------------
+IOReturn IOHIDResourceDeviceUserClient::handleReports(IOExternalMethodArguments * arguments)
+{
+    IOMemoryDescriptor *    descriptor  = NULL;
+    IOMemoryMap *           map         = NULL;
+    const uint8_t *         records;
+    IOByteCount             length;
+    IOByteCount             offset      = 0;
+    uint64_t                count       = 0;
+    bool                    prepared    = false;
+    IOReturn                ret         = kIOReturnSuccess;
+    
+    require_action(_device, exit, ret=kIOReturnNotOpen);
+    
+    // large inputs come in as a descriptor on the caller's memory
+    if ( arguments->structureInputDescriptor ) {
+        descriptor = arguments->structureInputDescriptor;
+        
+        ret = descriptor->prepare();
+        require_noerr(ret, exit);
+        prepared = true;
+        
+        map = descriptor->map();
+        require_action(map, exit, ret=kIOReturnNoMemory);
+        
+        records = (const uint8_t *)map->getVirtualAddress();
+        length  = descriptor->getLength();
+    } else {
+        records = (const uint8_t *)arguments->structureInput;
+        length  = arguments->structureInputSize;
+    }
     
-    switch ( _commandGate->commandSleep(retData, ts, THREAD_ABORTSAFE) ) {
-        case THREAD_AWAKENED:
-            ret = result.ret;
-            break;
-        case THREAD_TIMED_OUT:
-            ret = kIOReturnTimeout;
+    // The last record may come without its padding, so the rounded up
+    // offset can pass length; compare sums rather than subtracting from
+    // length so that can't wrap.
+    while ( (offset + sizeof(IOHIDResourceReportRingEntry)) <= length ) {
+        const IOHIDResourceReportRingEntry *    entry           = (const IOHIDResourceReportRingEntry *)(records + offset);
+        uint32_t                                reportLength    = entry->length;
+        
+        if ( reportLength > (length - offset - sizeof(IOHIDResourceReportRingEntry)) ) {
+            ret = kIOReturnBadArgument;
             break;
-        default:
-            ret = kIOReturnError;
+        }
+        
+        ret = deliverReport(entry->timestamp, entry->data, reportLength);
+        if ( ret != kIOReturnSuccess )
             break;
+            
+        count++;
+        offset += IOHIDResourceReportRingEntrySize(reportLength);
     }
     
 exit:
-    if ( retData ) {
-        _pending->removeObject(retData);
-        _commandGate->commandWakeup(&_pending);
-        retData->release();
-    }
+    if ( map )
+        map->release();
+        
+    if ( prepared )
+        descriptor->complete();
+    
+    if ( arguments->scalarOutputCount )
+        arguments->scalarOutput[0] = count;
     
     return ret;
 }
 
+//----------------------------------------------------------------------------------------------------
+// IOHIDResourceDeviceUserClient::_handleReports
+//----------------------------------------------------------------------------------------------------
+IOReturn IOHIDResourceDeviceUserClient::_handleReports(IOHIDResourceDeviceUserClient    *target, 
+                                             void                        *reference __unused,
+                                             IOExternalMethodArguments    *arguments)
+{
+    return target->handleReports(arguments);
+}
+
+//----------------------------------------------------------------------------------------------------
+// IOHIDResourceDeviceUserClient::scheduleReportRingDrain
+//
+// Leftover reports are picked up from the timer right away, which lets other
+// work on the work loop run in between batches.  A drain that fails stops
+// the periodic drain; the client has to ask again once the ring is usable.
+//----------------------------------------------------------------------------------------------------
+void IOHIDResourceDeviceUserClient::scheduleReportRingDrain(IOReturn status, bool more)
+{
+    if ( status != kIOReturnSuccess )
+        _reportRingIntervalUS = 0;
+    else if ( more )
+        _reportRingTimer->setTimeoutUS(0);
+    else if ( _reportRingIntervalUS )
+        _reportRingTimer->setTimeoutUS(_reportRingIntervalUS);
+}
+
+//----------------------------------------------------------------------------------------------------
+// IOHIDResourceDeviceUserClient::drainReportRingTimerCallback
+//----------------------------------------------------------------------------------------------------
+void IOHIDResourceDeviceUserClient::drainReportRingTimerCallback()
+{
+    IOReturn    ret;
+    bool        more;
+    
+    if ( isInactive() )
+        return;
+        
+    ret = drainReportRing(&more);
+    scheduleReportRingDrain(ret, more);
+}
+
+//----------------------------------------------------------------------------------------------------
+// IOHIDResourceDeviceUserClient::drainReportRing
+//----------------------------------------------------------------------------------------------------
+IOReturn IOHIDResourceDeviceUserClient::drainReportRing(IOExternalMethodArguments * arguments)
+{
+    IOReturn    ret;
+    bool        more;
+    
+    _reportRingTimer->cancelTimeout();
+    _reportRingIntervalUS = (uint32_t)arguments->scalarInput[0];
+    if ( _reportRingIntervalUS && (_reportRingIntervalUS < kHIDReportRingMinIntervalUS) )
+        _reportRingIntervalUS = kHIDReportRingMinIntervalUS;
+    
+    ret = drainReportRing(&more);
+    scheduleReportRingDrain(ret, more);
+        
+    return ret;
+}
+
+//----------------------------------------------------------------------------------------------------
+// IOHIDResourceDeviceUserClient::_drainReportRing
+//----------------------------------------------------------------------------------------------------
+IOReturn IOHIDResourceDeviceUserClient::_drainReportRing(IOHIDResourceDeviceUserClient    *target, 
+                                             void                        *reference __unused,
+                                             IOExternalMethodArguments    *arguments)
+{
+    return target->drainReportRing(arguments);
+}
+
+//----------------------------------------------------------------------------------------------------
+// IOHIDResourceDeviceUserClient::getReport
+//----------------------------------------------------------------------------------------------------
+IOReturn IOHIDResourceDeviceUserClient::getReport(IOMemoryDescriptor *report, IOHIDReportType reportType, IOOptionBits options)
+{
+    return getReport(report, reportType, options, 0, NULL);
+}
+
+//----------------------------------------------------------------------------------------------------
+// IOHIDResourceDeviceUserClient::getReport
+//----------------------------------------------------------------------------------------------------
+IOReturn IOHIDResourceDeviceUserClient::getReport(IOMemoryDescriptor *report, IOHIDReportType reportType, IOOptionBits options, UInt32 completionTimeout, IOHIDCompletion * completion)
+{
+    ReportGatedArguments    arguments   = {report, reportType, options, completionTimeout, completion};
+    IOReturn                result;
+    
+    require_action(!isInactive(), exit, result=kIOReturnOffline);
+
+    result = _commandGate->runAction(OSMemberFunctionCast(IOCommandGate::Action, this, &IOHIDResourceDeviceUserClient::getReportGated), &arguments);
+exit:
+    return result;
+}
+
+//----------------------------------------------------------------------------------------------------
+// IOHIDResourceDeviceUserClient::getReportGated
+//----------------------------------------------------------------------------------------------------
+IOReturn IOHIDResourceDeviceUserClient::getReportGated(ReportGatedArguments * arguments)
+{
+    return transferReportGated(kIOHIDResourceReportDirectionIn, arguments);
+}
+
 //----------------------------------------------------------------------------------------------------
 // IOHIDResourceDeviceUserClient::setReport
 //----------------------------------------------------------------------------------------------------
 IOReturn IOHIDResourceDeviceUserClient::setReport(IOMemoryDescriptor *report, IOHIDReportType reportType, IOOptionBits options)
 {
-    ReportGatedArguments    arguments={report, reportType, options};
+    return setReport(report, reportType, options, 0, NULL);
+}
+
+//----------------------------------------------------------------------------------------------------
+// IOHIDResourceDeviceUserClient::setReport
+//----------------------------------------------------------------------------------------------------
+IOReturn IOHIDResourceDeviceUserClient::setReport(IOMemoryDescriptor *report, IOHIDReportType reportType, IOOptionBits options, UInt32 completionTimeout, IOHIDCompletion * completion)
+{
+    ReportGatedArguments    arguments   = {report, reportType, options, completionTimeout, completion};
     IOReturn                result;
     
     require_action(!isInactive(), exit, result=kIOReturnOffline);
@@ -629,84 +914,250 @@ exit:
 // IOHIDResourceDeviceUserClient::setReportGated
 //----------------------------------------------------------------------------------------------------
 IOReturn IOHIDResourceDeviceUserClient::setReportGated(ReportGatedArguments * arguments)
+{
+    return transferReportGated(kIOHIDResourceReportDirectionOut, arguments);
+}
+
+//----------------------------------------------------------------------------------------------------
+// IOHIDResourceDeviceUserClient::transferReportGated
+//
+// Queues a get or set report request for the user process and tracks it in
+// _pendingReports until postReportResult answers it.  The token sent with
+// the request encodes the table index and the slot's generation, so a
+// result is matched without a search and a late result for a slot that has
+// since been reused is ignored.  Requests with a completion return right
+// away, which lets several of them be in flight at once; the others sleep
+// until they're answered.
+//----------------------------------------------------------------------------------------------------
+IOReturn IOHIDResourceDeviceUserClient::transferReportGated(IOHIDResourceReportDirection direction, ReportGatedArguments * arguments)
 {
     IOHIDResourceDataQueueHeader    header;
-    __ReportResult                  result;
+    PendingReport *                 pending;
     AbsoluteTime                    ts;
+    uint32_t                        index;
     IOReturn                        ret;
-    OSData *                        retData = NULL;
     
     require_action(!isInactive(), exit, ret=kIOReturnOffline);
-
-    bzero(&result, sizeof(result));
     
-    retData = OSData::withBytesNoCopy(&result, sizeof(result));
-    require_action(retData, exit, ret=kIOReturnNoMemory);
+    index = allocPendingReport();
+    require_action(index < kIOHIDResourcePendingReportMax, exit, ret=kIOReturnBusy);
     
-    header.direction   = kIOHIDResourceReportDirectionOut;
+    pending = &_pendingReports[index];
+    pending->report     = arguments->report;
+    pending->direction  = direction;
+    pending->report->retain();
+    
+    header.direction   = direction;
     header.type        = arguments->reportType;
     header.reportID    = arguments->options&0xff;
     header.length      = (uint32_t)arguments->report->getLength();
-    header.token       = (intptr_t)retData;
-
-    _pending->setObject(retData);
+    header.token       = PendingReportToken(index, pending->generation);
+    
+    if ( !_queue || !_queue->enqueueReport(&header, (direction == kIOHIDResourceReportDirectionOut) ? arguments->report : NULL) ) {
+        freePendingReport(index);
+        ret = kIOReturnNoMemory;
+        goto exit;
+    }
+    
+    if ( arguments->completion ) {
+        pending->completion = *arguments->completion;
+        pending->async      = true;
+        
+        if ( arguments->completionTimeout )
+            clock_interval_to_deadline(arguments->completionTimeout, kMillisecondScale, &pending->deadline);
+        else
+            clock_interval_to_deadline(_maxClientTimeoutUS, kMicrosecondScale, &pending->deadline);
+            
+        schedulePendingReportTimeout();
+        
+        ret = kIOReturnSuccess;
+        goto exit;
+    }
     
-    require_action(_queue && _queue->enqueueReport(&header, arguments->report), exit, ret=kIOReturnNoMemory);
-
     // if we successfully enqueue, let's sleep till we get a result from postReportResult
-    clock_interval_to_deadline(kMicrosecondScale, _maxClientTimeoutUS, (uint64_t *)&ts);
+    clock_interval_to_deadline(_maxClientTimeoutUS, kMicrosecondScale, (uint64_t *)&ts);
     
-    switch ( _commandGate->commandSleep(retData, ts, THREAD_ABORTSAFE) ) {
-        case THREAD_AWAKENED:
-            ret = result.ret;
+    while ( !pending->done ) {
+        int sleepResult = _commandGate->commandSleep(pending, ts, THREAD_ABORTSAFE);
+        
+        if ( pending->done )
             break;
-        case THREAD_TIMED_OUT:
-            ret = kIOReturnTimeout;
+            
+        if ( sleepResult == THREAD_TIMED_OUT ) {
+            pending->ret = kIOReturnTimeout;
             break;
-        default:
-            ret = kIOReturnError;
+        } 
+        else if ( sleepResult != THREAD_AWAKENED ) {
+            pending->ret = kIOReturnError;
             break;
+        }
     }
-
+    
+    ret = pending->ret;
+    freePendingReport(index);
+    
 exit:
-    if ( retData ) {
-        _pending->removeObject(retData);
-        _commandGate->commandWakeup(&_pending);
-        retData->release();
+    return ret;
+}
+
+//----------------------------------------------------------------------------------------------------
+// IOHIDResourceDeviceUserClient::allocPendingReport
+//----------------------------------------------------------------------------------------------------
+uint32_t IOHIDResourceDeviceUserClient::allocPendingReport()
+{
+    uint32_t index;
+    
+    for ( index = 0; index < kIOHIDResourcePendingReportMax; index++ ) {
+        PendingReport * pending = &_pendingReports[index];
+        
+        if ( pending->inUse )
+            continue;
+            
+        uint32_t generation = pending->generation + 1;
+        
+        bzero(pending, sizeof(PendingReport));
+        pending->inUse      = true;
+        pending->generation = generation;
+        pending->ret        = kIOReturnError;
+        
+        _pendingCount++;
+        break;
     }
     
-    return ret;
+    return index;
 }
 
 //----------------------------------------------------------------------------------------------------
-// IOHIDResourceDeviceUserClient::postReportResult
+// IOHIDResourceDeviceUserClient::freePendingReport
 //----------------------------------------------------------------------------------------------------
-IOReturn IOHIDResourceDeviceUserClient::postReportResult(IOExternalMethodArguments * arguments)
+void IOHIDResourceDeviceUserClient::freePendingReport(uint32_t index)
 {
-    OSObject * tokenObj = (OSObject*)arguments->scalarInput[kIOHIDResourceUserClientResponseIndexToken];
+    PendingReport * pending = &_pendingReports[index];
+    
+    if ( !pending->inUse )
+        return;
+        
+    if ( pending->report )
+        pending->report->release();
+        
+    pending->report = NULL;
+    pending->inUse  = false;
+    
+    _pendingCount--;
+    _commandGate->commandWakeup(&_pendingCount);
+}
 
-    if ( tokenObj && _pending->containsObject(tokenObj) ) {
-        OSData * data = OSDynamicCast(OSData, tokenObj);
-        if ( data ) {
-            __ReportResult * pResult = (__ReportResult*)data->getBytesNoCopy();
-            
-            // RY: HIGHLY UNLIKELY > 4K
-            if ( pResult->descriptor && arguments->structureInput ) {
-                pResult->descriptor->writeBytes(0, arguments->structureInput, arguments->structureInputSize);
-
-                // 12978252:  If we get an IOBMD passed in, set the length to be the # of bytes that were transferred
-                IOBufferMemoryDescriptor * buffer = OSDynamicCast(IOBufferMemoryDescriptor, pResult->descriptor);
-                if (buffer)
-                    buffer->setLength((vm_size_t)arguments->structureInputSize);
+//----------------------------------------------------------------------------------------------------
+// IOHIDResourceDeviceUserClient::completePendingReport
+//----------------------------------------------------------------------------------------------------
+void IOHIDResourceDeviceUserClient::completePendingReport(uint32_t index, IOReturn status)
+{
+    PendingReport * pending = &_pendingReports[index];
+    
+    if ( !pending->inUse || pending->done )
+        return;
+        
+    pending->ret    = status;
+    pending->done   = true;
+    
+    if ( pending->async ) {
+        IOHIDCompletion     completion  = pending->completion;
+        UInt32              remaining   = (status == kIOReturnSuccess) ? 0 : (UInt32)pending->report->getLength();
+        IOMemoryDescriptor *report      = pending->report;
+        
+        // keep the report around for the completion, but let the slot go first
+        report->retain();
+        freePendingReport(index);
+        
+        if ( completion.action )
+            (*completion.action)(completion.target, completion.parameter, status, remaining);
             
-            }
-                
-            pResult->ret = (IOReturn)arguments->scalarInput[kIOHIDResourceUserClientResponseIndexResult];
+        report->release();
+    } else {
+        _commandGate->commandWakeup(pending);
+    }
+}
 
-            _commandGate->commandWakeup(data);
-        }
-            
+//----------------------------------------------------------------------------------------------------
+// IOHIDResourceDeviceUserClient::schedulePendingReportTimeout
+//----------------------------------------------------------------------------------------------------
+void IOHIDResourceDeviceUserClient::schedulePendingReportTimeout()
+{
+    uint64_t    deadline = 0;
+    uint32_t    index;
+    
+    for ( index = 0; index < kIOHIDResourcePendingReportMax; index++ ) {
+        PendingReport * pending = &_pendingReports[index];
+        
+        if ( pending->inUse && pending->async && !pending->done && (!deadline || pending->deadline < deadline) )
+            deadline = pending->deadline;
     }
+    
+    _pendingReportTimer->cancelTimeout();
+    
+    if ( deadline ) {
+        AbsoluteTime ts;
+        
+        AbsoluteTime_to_scalar(&ts) = deadline;
+        _pendingReportTimer->wakeAtTime(ts);
+    }
+}
+
+//----------------------------------------------------------------------------------------------------
+// IOHIDResourceDeviceUserClient::pendingReportTimeoutCallback
+//----------------------------------------------------------------------------------------------------
+void IOHIDResourceDeviceUserClient::pendingReportTimeoutCallback()
+{
+    AbsoluteTime    ts;
+    uint64_t        now;
+    uint32_t        index;
+    
+    clock_get_uptime(&ts);
+    now = AbsoluteTime_to_scalar(&ts);
+    
+    for ( index = 0; index < kIOHIDResourcePendingReportMax; index++ ) {
+        PendingReport * pending = &_pendingReports[index];
+        
+        if ( pending->inUse && pending->async && !pending->done && (pending->deadline <= now) )
+            completePendingReport(index, kIOReturnTimeout);
+    }
+    
+    schedulePendingReportTimeout();
+}
+
+//----------------------------------------------------------------------------------------------------
+// IOHIDResourceDeviceUserClient::postReportResult
+//----------------------------------------------------------------------------------------------------
+IOReturn IOHIDResourceDeviceUserClient::postReportResult(IOExternalMethodArguments * arguments)
+{
+    uint64_t        token   = arguments->scalarInput[kIOHIDResourceUserClientResponseIndexToken];
+    uint32_t        index   = PendingReportTokenIndex(token);
+    PendingReport * pending;
+
+    if ( index >= kIOHIDResourcePendingReportMax )
+        return kIOReturnSuccess;
+        
+    pending = &_pendingReports[index];
+    
+    if ( !pending->inUse || pending->done || (pending->generation != PendingReportTokenGeneration(token)) )
+        return kIOReturnSuccess;
+        
+    // RY: HIGHLY UNLIKELY > 4K
+    // only a get report has data to hand back; a set report's descriptor
+    // is the caller's outgoing buffer
+    if ( pending->report && (pending->direction == kIOHIDResourceReportDirectionIn) && arguments->structureInput ) {
+        pending->report->writeBytes(0, arguments->structureInput, arguments->structureInputSize);
+
+        // 12978252:  If we get an IOBMD passed in, set the length to be the # of bytes that were transferred
+        IOBufferMemoryDescriptor * buffer = OSDynamicCast(IOBufferMemoryDescriptor, pending->report);
+        if (buffer)
+            buffer->setLength((vm_size_t)arguments->structureInputSize);
+    }
+    
+    completePendingReport(index, (IOReturn)arguments->scalarInput[kIOHIDResourceUserClientResponseIndexResult]);
+    
+    if ( _pendingCount )
+        schedulePendingReportTimeout();
 
     return kIOReturnSuccess;
 }
@@ -726,25 +1177,16 @@ IOReturn IOHIDResourceDeviceUserClient::_postReportResult(IOHIDResourceDeviceUse
 //----------------------------------------------------------------------------------------------------
 void IOHIDResourceDeviceUserClient::cleanupPendingReports()
 {
-    OSCollectionIterator *  iterator;
-    OSObject *              object;
+    uint32_t index;
     
-    iterator = OSCollectionIterator::withCollection(_pending);
-    if ( !iterator )
-        return;
-        
-    while ( (object = iterator->getNextObject()) ) {
-        __ReportResult * pResult = (__ReportResult*)((OSData*)object)->getBytesNoCopy();
-        
-        pResult->ret = kIOReturnAborted;
-        
-        _commandGate->commandWakeup(object);
-    }
+    if ( _pendingReportTimer )
+        _pendingReportTimer->cancelTimeout();
     
-    iterator->release();
+    for ( index = 0; index < kIOHIDResourcePendingReportMax; index++ )
+        completePendingReport(index, kIOReturnAborted);
     
-    while ( _pending->getCount() ) {
-        _commandGate->commandSleep(&_pending);
+    while ( _pendingCount ) {
+        _commandGate->commandSleep(&_pendingCount);
     }
 }
 
@@ -42,6 +42,8 @@ typedef enum {
     @constant kIOHIDResourceDeviceUserClientMethodTerminate Closes the device and releases memory.
     @constant kIOHIDResourceDeviceUserClientMethodHandleReport Sends a report.
     @constant kIOHIDResourceDeviceUserClientMethodPostReportResult Posts a report requested via GetReport and SetReport
+    @constant kIOHIDResourceDeviceUserClientMethodDrainReportRing Delivers the reports written to the report ring.  The scalar input is an interval, in microseconds, at which to keep draining the ring; 0 drains it once.  Intervals under 1 ms are raised to 1 ms, and draining stops at the first drain that fails.
+    @constant kIOHIDResourceDeviceUserClientMethodHandleReports Sends several reports.  The struct input holds IOHIDResourceReportRingEntry records back to back, each IOHIDResourceReportRingEntrySize bytes from the previous one; the scalar output is the number of reports delivered.
     @constant kIOHIDResourceDeviceUserClientMethodCount
 */
 typedef enum {
@@ -49,9 +51,22 @@ typedef enum {
     kIOHIDResourceDeviceUserClientMethodTerminate,
     kIOHIDResourceDeviceUserClientMethodHandleReport,
     kIOHIDResourceDeviceUserClientMethodPostReportResponse,
+    kIOHIDResourceDeviceUserClientMethodDrainReportRing,
+    kIOHIDResourceDeviceUserClientMethodHandleReports,
     kIOHIDResourceDeviceUserClientMethodCount
 } IOHIDResourceDeviceUserClientExternalMethods;
 
+/*!
+    @enum IOHIDResourceUserClientMemoryType
+    @abstract Memory types that can be mapped through IOConnectMapMemory
+    @constant kIOHIDResourceUserClientMemoryTypeQueue Queue of get and set report requests sent to the user process.
+    @constant kIOHIDResourceUserClientMemoryTypeReportRing Ring of input reports written by the user process.
+*/
+typedef enum {
+    kIOHIDResourceUserClientMemoryTypeQueue = 0,
+    kIOHIDResourceUserClientMemoryTypeReportRing
+} IOHIDResourceUserClientMemoryType;
+
 /*!
     @enum IOHIDResourceUserClientResponseIndex
     @abstract reponse indexes for report response
@@ -78,18 +93,55 @@ typedef struct {
     uint64_t                        token;
 } IOHIDResourceDataQueueHeader;
 
+/*!
+    @typedef IOHIDResourceReportRingEntry
+    @abstract Input report written to the report ring or passed to kIOHIDResourceDeviceUserClientMethodHandleReports
+    @discussion Entries start on 8 byte boundaries; IOHIDResourceReportRingEntrySize gives the space an entry takes.  An entry that doesn't fit before the end of the ring is written at offset 0 instead, after marking the skipped space with a length of kIOHIDResourceReportRingWrap if there is room for a header.
+    @field timestamp Time of the report in mach absolute time; 0 uses the time the report is delivered.
+    @field length Length of the report in bytes.
+*/
+typedef struct {
+    uint64_t                        timestamp;
+    uint32_t                        length;
+    uint32_t                        reserved;
+    uint8_t                         data[0];
+} IOHIDResourceReportRingEntry;
+
+#define kIOHIDResourceReportRingWrap                0xffffffff
+#define IOHIDResourceReportRingEntrySize(length)    ((sizeof(IOHIDResourceReportRingEntry) + (length) + 7) & ~7)
+
+/*!
+    @typedef IOHIDResourceReportRing
+    @abstract Layout of the kIOHIDResourceUserClientMemoryTypeReportRing memory
+    @discussion The user process writes entries at tail and then advances it; the kernel delivers entries from head and then advances it.  The ring is empty when head equals tail, so the writer must leave at least 8 bytes unused.
+    @field head Offset of the next entry the kernel will deliver.
+    @field tail Offset past the last entry the user process has written.
+    @field size Size in bytes of the entry area following the header.
+*/
+typedef struct {
+    volatile uint32_t               head;
+    volatile uint32_t               tail;
+    uint32_t                        size;
+    uint32_t                        reserved;
+    uint8_t                         data[0];
+} IOHIDResourceReportRing;
+
 /*
  * Kernel
  */
 #if KERNEL
 
 #include <IOKit/IOUserClient.h>
+#include <IOKit/IOBufferMemoryDescriptor.h>
 #include <IOKit/IOSharedDataQueue.h>
 #include <IOKit/IOCommandGate.h>
 #include <IOKit/IOTimerEventSource.h>
 #include "IOHIDResource.h"
 #include "IOHIDUserDevice.h"
 
+// Get/set report requests that can be outstanding with the user process at once
+#define kIOHIDResourcePendingReportMax  32
+
 
 /*! @class IOHIDResourceDeviceUserClient : public IOUserClient
     @abstract 
@@ -124,21 +176,45 @@ private:
     OSDictionary *          _properties;
     IOHIDUserDevice *       _device;
     IOTimerEventSource *    _createDeviceTimer;
+    IOTimerEventSource *    _reportRingTimer;
+    IOBufferMemoryDescriptor * _reportRingMemory;
+    IOBufferMemoryDescriptor * _reportBuffer;
+    uint32_t                _reportRingIntervalUS;
     IOCommandGate *         _commandGate;
     mach_port_t             _port;
     IOHIDResourceQueue *    _queue;
-    OSSet *                 _pending;
+    IOTimerEventSource *    _pendingReportTimer;
+    uint32_t                _pendingCount;
     uint32_t                _maxClientTimeoutUS;
 
+    // get/set report requests waiting on the user process
+    typedef struct {
+        IOMemoryDescriptor *        report;
+        IOHIDResourceReportDirection direction;
+        IOHIDCompletion             completion;
+        uint64_t                    deadline;
+        IOReturn                    ret;
+        uint32_t                    generation;
+        bool                        inUse;
+        bool                        async;
+        bool                        done;
+    } PendingReport;
+
+    PendingReport           _pendingReports[kIOHIDResourcePendingReportMax];
+
     static const IOExternalMethodDispatch _methods[kIOHIDResourceDeviceUserClientMethodCount];
 
     static IOReturn _createDevice(IOHIDResourceDeviceUserClient *target, void *reference, IOExternalMethodArguments *arguments);
     static IOReturn _terminateDevice(IOHIDResourceDeviceUserClient *target, void *reference, IOExternalMethodArguments *arguments);
     static IOReturn _handleReport(IOHIDResourceDeviceUserClient *target,  void *reference, IOExternalMethodArguments *arguments);
     static IOReturn _postReportResult(IOHIDResourceDeviceUserClient *target,  void *reference, IOExternalMethodArguments *arguments);
+    static IOReturn _drainReportRing(IOHIDResourceDeviceUserClient *target,  void *reference, IOExternalMethodArguments *arguments);
+    static IOReturn _handleReports(IOHIDResourceDeviceUserClient *target,  void *reference, IOExternalMethodArguments *arguments);
 
 
     void createAndStartDeviceAsyncCallback();
+    void drainReportRingTimerCallback();
+    void pendingReportTimeoutCallback();
 
     typedef struct {
         uint32_t                    selector;
@@ -150,22 +226,34 @@ private:
 
     IOReturn externalMethodGated(ExternalMethodGatedArguments * arguments);
     IOReturn registerNotificationPortGated(mach_port_t port);
-    IOReturn clientMemoryForTypeGated(IOOptionBits * options, IOMemoryDescriptor ** memory);
+    IOReturn clientMemoryForTypeGated(IOHIDResourceUserClientMemoryType type, IOOptionBits * options, IOMemoryDescriptor ** memory);
     
     typedef struct {
         IOMemoryDescriptor *        report;
         IOHIDReportType             reportType;
         IOOptionBits                options;
+        UInt32                      completionTimeout;
+        IOHIDCompletion *           completion;
     } ReportGatedArguments;
     
     IOReturn getReportGated(ReportGatedArguments * arguments);
     IOReturn setReportGated(ReportGatedArguments * arguments);
+    IOReturn transferReportGated(IOHIDResourceReportDirection direction, ReportGatedArguments * arguments);
+    uint32_t allocPendingReport();
+    void freePendingReport(uint32_t index);
+    void completePendingReport(uint32_t index, IOReturn status);
+    void schedulePendingReportTimeout();
     
     IOReturn createAndStartDevice();
     IOReturn createAndStartDeviceAsync();
     IOReturn createDevice(IOExternalMethodArguments *arguments);
     IOReturn handleReport(IOExternalMethodArguments *arguments);
     IOReturn postReportResult(IOExternalMethodArguments *arguments);
+    IOReturn drainReportRing(IOExternalMethodArguments *arguments);
+    IOReturn drainReportRing(bool * pMore);
+    IOReturn handleReports(IOExternalMethodArguments *arguments);
+    IOReturn deliverReport(uint64_t timestamp, const void * report, uint32_t length);
+    void scheduleReportRingDrain(IOReturn status, bool more);
     IOReturn terminateDevice();
     void cleanupPendingReports();
 
@@ -222,6 +310,10 @@ public:
 
     virtual IOReturn setReport(IOMemoryDescriptor *report, IOHIDReportType reportType, IOOptionBits options);
 
+    virtual IOReturn getReport(IOMemoryDescriptor *report, IOHIDReportType reportType, IOOptionBits options, UInt32 completionTimeout, IOHIDCompletion * completion);
+
+    virtual IOReturn setReport(IOMemoryDescriptor *report, IOHIDReportType reportType, IOOptionBits options, UInt32 completionTimeout, IOHIDCompletion * completion);
+
 };
 
 
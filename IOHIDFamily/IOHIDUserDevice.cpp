@@ -316,3 +316,29 @@ IOReturn IOHIDUserDevice::setReport(IOMemoryDescriptor    *report,
 }
 
 
+//----------------------------------------------------------------------------------------------------
+// IOHIDUserDevice::getReport
+//----------------------------------------------------------------------------------------------------
+IOReturn IOHIDUserDevice::getReport(IOMemoryDescriptor    *report,
+                                    IOHIDReportType        reportType,
+                                    IOOptionBits        options,
+                                    UInt32              completionTimeout,
+                                    IOHIDCompletion     *completion)
+{
+    return _provider->getReport(report, reportType, options, completionTimeout, completion);
+}
+
+
+//----------------------------------------------------------------------------------------------------
+// IOHIDUserDevice::setReport
+//----------------------------------------------------------------------------------------------------
+IOReturn IOHIDUserDevice::setReport(IOMemoryDescriptor    *report,
+                                    IOHIDReportType        reportType,
+                                    IOOptionBits        options,
+                                    UInt32              completionTimeout,
+                                    IOHIDCompletion     *completion)
+{
+    return _provider->setReport(report, reportType, options, completionTimeout, completion);
+}
+
+
@@ -198,6 +198,48 @@ public:
 					   IOHIDReportType		reportType,
 					   IOOptionBits			options);
 
+/*! @function getReport
+    @abstract Get a report from the HID device.
+    @discussion With a completion the request is queued to the user
+    process and this returns right away, so several requests may be
+    outstanding at once.
+    @param report A memory descriptor that describes the memory to store
+    the report read from the HID device.
+    @param reportType The report type.
+    @param options The lower 8 bits will represent the Report ID.  The
+    other 24 bits are options to specify the request.
+    @param completionTimeout Specifies an amount of time (in ms) after which
+    the command will be aborted if the entire command has not been completed.
+    @param completion Function to call when request completes. If omitted then
+    getReport() executes synchronously, blocking until the request is complete.
+    @result kIOReturnSuccess on success, or an error return otherwise. */
+	IOReturn getReport(IOMemoryDescriptor	*report,
+					   IOHIDReportType		reportType,
+					   IOOptionBits			options,
+					   UInt32				completionTimeout,
+					   IOHIDCompletion		*completion = 0);
+
+/*! @function setReport
+    @abstract Send a report to the HID device.
+    @discussion With a completion the request is queued to the user
+    process and this returns right away, so several requests may be
+    outstanding at once.
+    @param report A memory descriptor that describes the report to send
+    to the HID device.
+    @param reportType The report type.
+    @param options The lower 8 bits will represent the Report ID.  The
+    other 24 bits are options to specify the request.
+    @param completionTimeout Specifies an amount of time (in ms) after which
+    the command will be aborted if the entire command has not been completed.
+    @param completion Function to call when request completes. If omitted then
+    setReport() executes synchronously, blocking until the request is complete.
+    @result kIOReturnSuccess on success, or an error return otherwise. */
+	IOReturn setReport(IOMemoryDescriptor	*report,
+					   IOHIDReportType		reportType,
+					   IOOptionBits			options,
+					   UInt32				completionTimeout,
+					   IOHIDCompletion		*completion = 0);
+
 };
 
 
@@ -33,6 +33,8 @@
 #include "IOHIDTransactionClass.h"
 #include "IOHIDPrivateKeys.h"
 #include "IOHIDParserPriv.h"
+#include "IOHIDElementCache.h"
+#include "IOHIDValueSlab.h"
 
 __BEGIN_DECLS
 #include <asl.h>
@@ -41,8 +43,12 @@ __BEGIN_DECLS
 #include <IOKit/iokitmig.h>
 #include <IOKit/IOMessage.h>
 #include <IOKit/IODataQueueClient.h>
+#include <IOKit/kext/KextManager.h>
 #include <System/libkern/OSCrossEndian.h>
+#include <libkern/OSAtomic.h>
+#include <pthread.h>
 #include <syslog.h>
+#include <unistd.h>
 __END_DECLS
 
 #define connectCheck() do {	    \
@@ -83,6 +89,11 @@ __END_DECLS
 #endif
 
 #define kInputReportQueueDeptch_8ms 8
+#define kElementLookupMaxCookie     0xffff
+#define kReportHandlerDequeueBatch  16
+#define kReportSnapshotMaxRetries   64
+#define kFamilyBundleIdentifier     "com.apple.iokit.IOHIDFamily"
+#define kFamilyVersionMaxLength     64
 
 typedef struct _IOHIDObsoleteCallbackArgs {
     IOHIDObsoleteDeviceClass * self;
@@ -96,6 +107,256 @@ enum {
     kCreateMatchingHIDElementsWithDictionaries = 0x1000
 };
 
+//---------------------------------------------------------------------------
+// Element matching
+//
+// copyMatchingElements reads the matching dictionary once into an
+// IOHIDElementMatching and then tests element structs against it.
+//---------------------------------------------------------------------------
+enum {
+    kElementMatchCookie,
+    kElementMatchCookieMin,
+    kElementMatchCookieMax,
+    kElementMatchCollectionCookie,
+    kElementMatchType,
+    kElementMatchCollectionType,
+    kElementMatchReportID,
+    kElementMatchUsage,
+    kElementMatchUsageMin,
+    kElementMatchUsageMax,
+    kElementMatchUsagePage,
+    kElementMatchMin,
+    kElementMatchMax,
+    kElementMatchScaledMin,
+    kElementMatchScaledMax,
+    kElementMatchSize,
+    kElementMatchReportSize,
+    kElementMatchReportCount,
+    kElementMatchIsRelative,
+    kElementMatchIsWrapping,
+    kElementMatchIsNonLinear,
+    kElementMatchHasPreferredState,
+    kElementMatchHasNullState,
+    kElementMatchIsArray,
+    kElementMatchUnit,
+    kElementMatchUnitExponent,
+    kElementMatchDuplicateIndex,
+    kElementMatchKeyCount
+};
+
+static const CFStringRef kElementMatchKeys[kElementMatchKeyCount] = {
+    CFSTR(kIOHIDElementCookieKey),
+    CFSTR(kIOHIDElementCookieMinKey),
+    CFSTR(kIOHIDElementCookieMaxKey),
+    CFSTR(kIOHIDElementCollectionCookieKey),
+    CFSTR(kIOHIDElementTypeKey),
+    CFSTR(kIOHIDElementCollectionTypeKey),
+    CFSTR(kIOHIDElementReportIDKey),
+    CFSTR(kIOHIDElementUsageKey),
+    CFSTR(kIOHIDElementUsageMinKey),
+    CFSTR(kIOHIDElementUsageMaxKey),
+    CFSTR(kIOHIDElementUsagePageKey),
+    CFSTR(kIOHIDElementMinKey),
+    CFSTR(kIOHIDElementMaxKey),
+    CFSTR(kIOHIDElementScaledMinKey),
+    CFSTR(kIOHIDElementScaledMaxKey),
+    CFSTR(kIOHIDElementSizeKey),
+    CFSTR(kIOHIDElementReportSizeKey),
+    CFSTR(kIOHIDElementReportCountKey),
+    CFSTR(kIOHIDElementIsRelativeKey),
+    CFSTR(kIOHIDElementIsWrappingKey),
+    CFSTR(kIOHIDElementIsNonLinearKey),
+    CFSTR(kIOHIDElementHasPreferredStateKey),
+    CFSTR(kIOHIDElementHasNullStateKey),
+    CFSTR(kIOHIDElementIsArrayKey),
+    CFSTR(kIOHIDElementUnitKey),
+    CFSTR(kIOHIDElementUnitExponentKey),
+    CFSTR(kIOHIDElementDuplicateIndexKey)
+};
+
+typedef struct IOHIDElementMatching {
+    uint32_t    keys;                               // bit per kElementMatch key present
+    uint32_t    values[kElementMatchKeyCount];
+} IOHIDElementMatching;
+
+#define ElementMatchHas(m, key)     (((m)->keys & (1 << (key))) != 0)
+#define ElementMatchValue(m, key)   ((m)->values[(key)])
+
+#define ElementMatchEqual(m, key, field) \
+    (!ElementMatchHas(m, key) || (ElementMatchValue(m, key) == (uint32_t)(field)))
+
+static bool ElementStructMatches(const IOHIDElementStruct * element, const IOHIDElementMatching * matching)
+{
+    if ( ElementMatchHas(matching, kElementMatchCookie) )
+    {
+        if ( (ElementMatchValue(matching, kElementMatchCookie) < element->cookieMin) || 
+             (ElementMatchValue(matching, kElementMatchCookie) > element->cookieMax) )
+            return false;
+    }
+    else
+    {
+        if ( ElementMatchHas(matching, kElementMatchCookieMin) && 
+             (ElementMatchValue(matching, kElementMatchCookieMin) < element->cookieMin) )
+            return false;
+            
+        if ( ElementMatchHas(matching, kElementMatchCookieMax) && 
+             (ElementMatchValue(matching, kElementMatchCookieMax) > element->cookieMax) )
+            return false;
+    }
+    
+    if ( !ElementMatchEqual(matching, kElementMatchCollectionCookie, element->parentCookie) ||
+         !ElementMatchEqual(matching, kElementMatchType, element->type) ||
+         !ElementMatchEqual(matching, kElementMatchCollectionType, element->collectionType) ||
+         !ElementMatchEqual(matching, kElementMatchReportID, element->reportID) )
+        return false;
+        
+    if ( ElementMatchHas(matching, kElementMatchUsage) )
+    {
+        if ( (ElementMatchValue(matching, kElementMatchUsage) < element->usageMin) || 
+             (ElementMatchValue(matching, kElementMatchUsage) > element->usageMax) )
+            return false;
+    }
+    else
+    {
+        if ( ElementMatchHas(matching, kElementMatchUsageMin) && 
+             (ElementMatchValue(matching, kElementMatchUsageMin) < element->usageMin) )
+            return false;
+            
+        if ( ElementMatchHas(matching, kElementMatchUsageMax) && 
+             (ElementMatchValue(matching, kElementMatchUsageMax) > element->usageMax) )
+            return false;
+    }
+    
+    if ( !ElementMatchEqual(matching, kElementMatchUsagePage, element->usagePage) ||
+         !ElementMatchEqual(matching, kElementMatchMin, element->min) ||
+         !ElementMatchEqual(matching, kElementMatchMax, element->max) ||
+         !ElementMatchEqual(matching, kElementMatchScaledMin, element->scaledMin) ||
+         !ElementMatchEqual(matching, kElementMatchScaledMax, element->scaledMax) ||
+         !ElementMatchEqual(matching, kElementMatchSize, element->size) ||
+         !ElementMatchEqual(matching, kElementMatchReportSize, element->reportSize) ||
+         !ElementMatchEqual(matching, kElementMatchReportCount, element->reportCount) ||
+         !ElementMatchEqual(matching, kElementMatchIsRelative, ((element->flags & kHIDDataRelativeBit) == kHIDDataRelative)) ||
+         !ElementMatchEqual(matching, kElementMatchIsWrapping, ((element->flags & kHIDDataWrapBit) == kHIDDataWrap)) ||
+         !ElementMatchEqual(matching, kElementMatchIsNonLinear, ((element->flags & kHIDDataNonlinearBit) == kHIDDataNonlinear)) ||
+         !ElementMatchEqual(matching, kElementMatchHasPreferredState, ((element->flags & kHIDDataNoPreferredBit) != kHIDDataNoPreferred)) ||
+         !ElementMatchEqual(matching, kElementMatchHasNullState, ((element->flags & kHIDDataNullStateBit) == kHIDDataNullState)) ||
+         !ElementMatchEqual(matching, kElementMatchIsArray, ((element->flags & kHIDDataArrayBit) == kHIDDataArray)) ||
+         !ElementMatchEqual(matching, kElementMatchUnit, element->unit) ||
+         !ElementMatchEqual(matching, kElementMatchUnitExponent, element->unitExponent) )
+        return false;
+        
+    // only duplicate roots can be matched on a duplicate index
+    if ( ElementMatchHas(matching, kElementMatchDuplicateIndex) && !element->duplicateValueSize )
+        return false;
+        
+    return true;
+}
+
+// fElements candidates of a matching query: either the index entries
+// merged in fElements order with the ranged list, or a slice of fElements
+typedef struct IOHIDElementCandidates {
+    const IOHIDElementIndexEntry *  entries;
+    uint32_t                        entryCount;
+    uint32_t                        entry;
+    const uint32_t *                ranged;
+    uint32_t                        rangedCount;
+    uint32_t                        rangedEntry;
+    uint32_t                        first;
+} IOHIDElementCandidates;
+
+static inline uint32_t ElementCandidatesCount(const IOHIDElementCandidates * candidates)
+{
+    return candidates->entryCount + candidates->rangedCount;
+}
+
+static bool ElementCandidatesNext(IOHIDElementCandidates * candidates, uint32_t * pIndex)
+{
+    if ( !candidates->entries )
+    {
+        if ( candidates->entry >= candidates->entryCount )
+            return false;
+            
+        *pIndex = candidates->first + candidates->entry++;
+    }
+    else if ( (candidates->entry < candidates->entryCount) && 
+              ((candidates->rangedEntry >= candidates->rangedCount) || 
+               (candidates->entries[candidates->entry].index < candidates->ranged[candidates->rangedEntry])) )
+    {
+        *pIndex = candidates->entries[candidates->entry++].index;
+    }
+    else if ( candidates->rangedEntry < candidates->rangedCount )
+    {
+        *pIndex = candidates->ranged[candidates->rangedEntry++];
+    }
+    else
+    {
+        return false;
+    }
+    
+    return true;
+}
+
+static int ElementIndexEntryCompare(const void * a, const void * b)
+{
+    const IOHIDElementIndexEntry * entryA = (const IOHIDElementIndexEntry *)a;
+    const IOHIDElementIndexEntry * entryB = (const IOHIDElementIndexEntry *)b;
+    
+    if ( entryA->key != entryB->key )
+        return (entryA->key < entryB->key) ? -1 : 1;
+        
+    if ( entryA->index != entryB->index )
+        return (entryA->index < entryB->index) ? -1 : 1;
+        
+    return 0;
+}
+
+//---------------------------------------------------------------------------
+// GetFamilyVersion
+//
+// Element tables are laid out by IOHIDFamily, so element cache entries are
+// keyed by the version of it that's loaded.  Returns NULL if it isn't known.
+//---------------------------------------------------------------------------
+static pthread_once_t   sFamilyVersionOnce = PTHREAD_ONCE_INIT;
+static char             sFamilyVersion[kFamilyVersionMaxLength];
+
+static void InitFamilyVersion()
+{
+    CFStringRef     bundleID    = CFSTR(kFamilyBundleIdentifier);
+    CFStringRef     key         = kCFBundleVersionKey;
+    CFArrayRef      bundleIDs   = CFArrayCreate(kCFAllocatorDefault, (const void **)&bundleID, 1, &kCFTypeArrayCallBacks);
+    CFArrayRef      keys        = CFArrayCreate(kCFAllocatorDefault, (const void **)&key, 1, &kCFTypeArrayCallBacks);
+    CFDictionaryRef loadedInfo  = NULL;
+    
+    if ( bundleIDs && keys )
+        loadedInfo = KextManagerCopyLoadedKextInfo(bundleIDs, keys);
+    
+    if ( loadedInfo ) {
+        CFDictionaryRef kextInfo    = (CFDictionaryRef)CFDictionaryGetValue(loadedInfo, bundleID);
+        CFStringRef     version     = NULL;
+        
+        if ( kextInfo && (CFGetTypeID(kextInfo) == CFDictionaryGetTypeID()) )
+            version = (CFStringRef)CFDictionaryGetValue(kextInfo, key);
+        
+        if ( !version || (CFGetTypeID(version) != CFStringGetTypeID()) ||
+             !CFStringGetCString(version, sFamilyVersion, sizeof(sFamilyVersion), kCFStringEncodingUTF8) )
+            sFamilyVersion[0] = 0;
+            
+        CFRelease(loadedInfo);
+    }
+    
+    if ( bundleIDs )
+        CFRelease(bundleIDs);
+    if ( keys )
+        CFRelease(keys);
+}
+
+static const char * GetFamilyVersion()
+{
+    pthread_once(&sFamilyVersionOnce, InitFamilyVersion);
+    
+    return sFamilyVersion[0] ? sFamilyVersion : NULL;
+}
+
 static void ElementCacheApplierFunction(const void *key __unused, const void *value, void *context)
 {
     _IOHIDElementSetDeviceInterface((IOHIDElementRef)value, (IOHIDDeviceDeviceInterface**)context);
@@ -117,6 +378,8 @@ IOHIDDeviceClass::IOHIDDeviceClass()
 {
     fHIDDevice.pseudoVTable = (IUnknownVTbl *)  &sHIDDeviceInterfaceV2;
     fHIDDevice.obj = this;
+    fHIDDevicePrivate.pseudoVTable = (IUnknownVTbl *)  &sHIDDevicePrivateInterface;
+    fHIDDevicePrivate.obj = this;
 
     fService 			= MACH_PORT_NULL;
     fConnection 		= MACH_PORT_NULL;
@@ -147,8 +410,23 @@ IOHIDDeviceClass::IOHIDDeviceClass()
     fReportHandlerElementCount	= 0;
     fReportHandlerElementData	= NULL;
     fReportHandlerElements      = NULL;
+    fElementLookupCount = 0;
+    fElementLookupData  = NULL;
+    fElementLookup      = NULL;
+    fElementIndexData   = NULL;
+    fElementsByParent   = NULL;
+    fElementsByUsagePage= NULL;
+    fElementsByType     = NULL;
+    fElementsByUsage    = NULL;
+    fElementsByUsageCount           = 0;
+    fElementsWithUsageRange         = NULL;
+    fElementsWithUsageRangeCount    = 0;
+    fElementsCookieOrdered          = false;
+    fValueAllocator     = NULL;
+    fValueSlab          = NULL;
     fReportHandlerQueue = NULL; 
     fInputReportCallback= NULL;
+    fInputReportBatchCallback = NULL;
     fInputReportRefcon  = NULL;
     fInputReportBuffer  = NULL;
 	fInputReportBufferSize = 0;
@@ -183,6 +461,15 @@ IOHIDDeviceClass::~IOHIDDeviceClass()
         CFRelease(fElementCache);
     }
     
+    if (fElementLookupData)
+        CFRelease(fElementLookupData);
+    
+    if (fElementIndexData)
+        CFRelease(fElementIndexData);
+    
+    if (fValueAllocator)
+        CFRelease(fValueAllocator);
+    
     if (fReportHandlerElementData)
         CFRelease(fReportHandlerElementData);
     
@@ -348,6 +635,11 @@ HRESULT IOHIDDeviceClass::queryInterface(REFIID iid, void **ppv)
         *ppv = &fHIDDevice;
         addRef();
     }
+    else if (CFEqual(uuid, kIOHIDDevicePrivateInterfaceID))
+    {
+        *ppv = &fHIDDevicePrivate;
+        addRef();
+    }
     else {
         *ppv = 0;
         HIDLog ("not found\n");
@@ -419,21 +711,35 @@ IOReturn IOHIDDeviceClass::start(CFDictionaryRef propertyTable __unused, io_serv
     if (kr != kIOReturnSuccess)
         return kr;
     
-    uint64_t output[2];
-    uint32_t len = 2;
+    // The element tables only depend on the report descriptor, so devices
+    // of a model we've seen before can skip fetching them from the kernel.
+    // When the cache is in use the count call also returns its key.
+    uint64_t output[kIOHIDLibUserClientElementCountOutputs];
+    bool     useCache = IOHIDElementCacheIsEnabled(kIOHIDElementCacheDefaultDirectory);
+    uint32_t len = useCache ? kIOHIDLibUserClientElementCountOutputs : 2;
 
     kr = IOConnectCallScalarMethod(fConnection, kIOHIDLibUserClientGetElementCount, 0, 0, output, &len); 
     if (kr != kIOReturnSuccess)
         return kr;
+        
+    if ( len < kIOHIDLibUserClientElementCountOutputs )
+        useCache = false;
 
     HIDLog("IOHIDDeviceClass::start: elementCount=%lld reportHandlerCount=%lld\n", output[0], output[1]);
 
-    fElementCount               = output[0];
-    fReportHandlerElementCount  = output[1];
+    fElementCount               = output[kIOHIDLibUserClientElementCountIndex];
+    fReportHandlerElementCount  = output[kIOHIDLibUserClientReportHandlerCountIndex];
     
+    if ( !useCache || (loadCachedElements(output[kIOHIDLibUserClientElementValuesSizeIndex], &output[kIOHIDLibUserClientDescriptorDigestIndex]) != kIOReturnSuccess) ) {
+        buildElements(kHIDElementType, &fElementData, &fElements, &fElementCount);
+        buildElements(kHIDReportHandlerType, &fReportHandlerElementData, &fReportHandlerElements, &fReportHandlerElementCount);
+        if ( useCache )
+            storeCachedElements(&output[kIOHIDLibUserClientDescriptorDigestIndex]);
+    }
     
-    buildElements(kHIDElementType, &fElementData, &fElements, &fElementCount);
-    buildElements(kHIDReportHandlerType, &fReportHandlerElementData, &fReportHandlerElements, &fReportHandlerElementCount);
+    buildElementLookup();
+    buildElementIndex();
+    createValueAllocator();
 
 	fElementCache = CFDictionaryCreateMutable(
                                             kCFAllocatorDefault, 
@@ -826,7 +1132,7 @@ IOReturn IOHIDDeviceClass::getCurrentElementValueAndGeneration(IOHIDElementRef e
         
         if ( !valueRef || (IOHIDValueGetTimeStamp(valueRef) < timeStamp) )
         {
-            valueRef = _IOHIDValueCreateWithElementValuePtr(kCFAllocatorDefault, element, elementValue);
+            valueRef = _IOHIDValueCreateWithElementValuePtr(fValueAllocator ? fValueAllocator : kCFAllocatorDefault, element, elementValue);
 
             if (valueRef) {
                 _IOHIDElementSetValue(element, valueRef);
@@ -1147,12 +1453,10 @@ IOHIDDeviceClass::copyMatchingElements(CFDictionaryRef matchingDict, CFArrayRef
    if (!elements)
         return kIOReturnBadArgument;
      
-    IOHIDElementStruct      element;
+    IOHIDElementMatching    matching;
+    IOHIDElementCandidates  candidates;
     CFMutableArrayRef       tempElements        = 0;
-    CFMutableArrayRef       subElements         = 0;
     CFTypeRef               elementType         = 0;
-    CFTypeRef               object              = 0;
-    uint32_t                number              = 0;
     uint32_t                index               = 0;
     uint32_t                matchingCookieMin   = 0;
     uint32_t                matchingCookieMax   = 0;
@@ -1173,168 +1477,124 @@ IOHIDDeviceClass::copyMatchingElements(CFDictionaryRef matchingDict, CFArrayRef
         *elements = 0;
         return kIOReturnNoMemory;
     }
+    
+    bzero(&matching, sizeof(IOHIDElementMatching));
+    bzero(&candidates, sizeof(IOHIDElementCandidates));
+    candidates.entryCount = fElementCount;
+    
+    if ( matchingDict )
+    {
+        for (index = 0; index < kElementMatchKeyCount; index++)
+            if ( getElementDictIntValue(matchingDict, kElementMatchKeys[index], &matching.values[index]) )
+                matching.keys |= (1 << index);
+                
+        if ( ElementMatchHas(&matching, kElementMatchCookie) )
+        {
+            matchingCookieMin   = ElementMatchValue(&matching, kElementMatchCookie);
+            matchingCookieMax   = matchingCookieMin;
+            isMatchingCookieMin = true;
+            isMatchingCookieMax = true;
+        }
+        else
+        {
+            matchingCookieMin   = ElementMatchValue(&matching, kElementMatchCookieMin);
+            matchingCookieMax   = ElementMatchValue(&matching, kElementMatchCookieMax);
+            isMatchingCookieMin = ElementMatchHas(&matching, kElementMatchCookieMin);
+            isMatchingCookieMax = ElementMatchHas(&matching, kElementMatchCookieMax);
+        }
         
-    for (index=0; index<fElementCount; index++)
-    {        
-        isMatchingCookieMin = isMatchingCookieMax = false;
-        isMatchingUsageMax = isMatchingUsageMin = false;
-        matchingCookieMin = matchingCookieMax = 0;
-        matchingUsageMin = matchingUsageMax = 0;
-        isDuplicateRoot = (fElements[index].duplicateValueSize != 0);
+        if ( ElementMatchHas(&matching, kElementMatchUsage) )
+        {
+            matchingUsageMin    = ElementMatchValue(&matching, kElementMatchUsage);
+            matchingUsageMax    = matchingUsageMin;
+            isMatchingUsageMin  = true;
+            isMatchingUsageMax  = true;
+        }
+        else
+        {
+            matchingUsageMin    = ElementMatchValue(&matching, kElementMatchUsageMin);
+            matchingUsageMax    = ElementMatchValue(&matching, kElementMatchUsageMax);
+            isMatchingUsageMin  = ElementMatchHas(&matching, kElementMatchUsageMin);
+            isMatchingUsageMax  = ElementMatchHas(&matching, kElementMatchUsageMax);
+        }
+        
+        matchingDupIndex    = ElementMatchValue(&matching, kElementMatchDuplicateIndex);
+        isMatchingDupIndex  = ElementMatchHas(&matching, kElementMatchDuplicateIndex);
         
-        if ( matchingDict )
+        // only visit the elements sharing the most selective indexed key
+        if ( fElementIndexData )
         {
-            if ( getElementDictIntValue(matchingDict, CFSTR(kIOHIDElementCookieKey), &number) ) 
-            {
-                if ((number < fElements[index].cookieMin) || (number > fElements[index].cookieMax))
-                    continue;
-
-                matchingCookieMin = number;
-                matchingCookieMax = number;
-                isMatchingCookieMin = true;
-                isMatchingCookieMax = true;
-            }
-            else
+            IOHIDElementIndexEntry *    first;
+            uint32_t                    firstIndex;
+            uint32_t                    count;
+            
+            if ( ElementMatchHas(&matching, kElementMatchCollectionCookie) )
             {
-                if ( getElementDictIntValue(matchingDict, CFSTR(kIOHIDElementCookieMinKey), &number) ) 
-                {
-                    if ( number < fElements[index].cookieMin )
-                        continue;
-                    
-                    matchingCookieMin = number;
-                    isMatchingCookieMin = true;
-                }
-                
-                if ( getElementDictIntValue(matchingDict, CFSTR(kIOHIDElementCookieMaxKey), &number) ) 
+                count = getElementIndexRange(fElementsByParent, fElementCount, ElementMatchValue(&matching, kElementMatchCollectionCookie), &first);
+                if ( count < ElementCandidatesCount(&candidates) ) 
                 {
-                    if ( number > fElements[index].cookieMax )
-                        continue;
-                    
-                    matchingCookieMax = number;
-                    isMatchingCookieMax = true;
+                    bzero(&candidates, sizeof(IOHIDElementCandidates));
+                    candidates.entries      = first;
+                    candidates.entryCount   = count;
                 }
             }
-
-            if ( getElementDictIntValue(matchingDict, CFSTR(kIOHIDElementCollectionCookieKey), &number) &&
-                (number != fElements[index].parentCookie))
-                continue;
-                
-            if ( getElementDictIntValue(matchingDict, CFSTR(kIOHIDElementTypeKey), &number) &&
-                (number != fElements[index].type))
-                continue;
-
-            if ( getElementDictIntValue(matchingDict, CFSTR(kIOHIDElementCollectionTypeKey), &number) &&
-                (number != fElements[index].collectionType))
-                continue;
-
-            if ( getElementDictIntValue(matchingDict, CFSTR(kIOHIDElementReportIDKey), &number) &&
-                (number != fElements[index].reportID))
-                continue;
-
-            if ( getElementDictIntValue(matchingDict, CFSTR(kIOHIDElementUsageKey), &number) ) 
+            
+            if ( ElementMatchHas(&matching, kElementMatchUsagePage) )
             {
-                if ((number < fElements[index].usageMin) || (number > fElements[index].usageMax))
-                    continue;
-                
-                matchingUsageMin    = number;
-                matchingUsageMax    = number;
-                isMatchingUsageMin  = true;
-                isMatchingUsageMax  = true;
+                count = getElementIndexRange(fElementsByUsagePage, fElementCount, ElementMatchValue(&matching, kElementMatchUsagePage), &first);
+                if ( count < ElementCandidatesCount(&candidates) ) 
+                {
+                    bzero(&candidates, sizeof(IOHIDElementCandidates));
+                    candidates.entries      = first;
+                    candidates.entryCount   = count;
+                }
             }
-            else
+            
+            if ( ElementMatchHas(&matching, kElementMatchType) )
             {
-                if ( getElementDictIntValue(matchingDict, CFSTR(kIOHIDElementUsageMinKey), &number) ) 
+                count = getElementIndexRange(fElementsByType, fElementCount, ElementMatchValue(&matching, kElementMatchType), &first);
+                if ( count < ElementCandidatesCount(&candidates) ) 
                 {
-                    if ( number < fElements[index].usageMin )
-                        continue;
-                    
-                    matchingUsageMin = number;
-                    isMatchingUsageMin = true;
+                    bzero(&candidates, sizeof(IOHIDElementCandidates));
+                    candidates.entries      = first;
+                    candidates.entryCount   = count;
                 }
-                
-                if ( getElementDictIntValue(matchingDict, CFSTR(kIOHIDElementUsageMaxKey), &number) ) 
+            }
+            
+            // an element with a usage range can match any usage, so those
+            // are always visited along with the single usage entries
+            if ( ElementMatchHas(&matching, kElementMatchUsage) )
+            {
+                count = getElementIndexRange(fElementsByUsage, fElementsByUsageCount, ElementMatchValue(&matching, kElementMatchUsage), &first);
+                if ( (count + fElementsWithUsageRangeCount) < ElementCandidatesCount(&candidates) ) 
                 {
-                    if ( number > fElements[index].usageMax )
-                        continue;
-                    
-                    matchingUsageMax = number;
-                    isMatchingUsageMax = true;
+                    bzero(&candidates, sizeof(IOHIDElementCandidates));
+                    candidates.entries      = first;
+                    candidates.entryCount   = count;
+                    candidates.ranged       = fElementsWithUsageRange;
+                    candidates.rangedCount  = fElementsWithUsageRangeCount;
                 }
             }
-
-            if ( getElementDictIntValue(matchingDict, CFSTR(kIOHIDElementUsagePageKey), &number) &&
-                (number != fElements[index].usagePage))
-                continue;
-
-            if ( getElementDictIntValue(matchingDict, CFSTR(kIOHIDElementMinKey), &number) &&
-                ((int32_t)number != fElements[index].min))
-                continue;
-
-            if ( getElementDictIntValue(matchingDict, CFSTR(kIOHIDElementMaxKey), &number) &&
-                ((int32_t)number != fElements[index].max))
-                continue;
-
-            if ( getElementDictIntValue(matchingDict, CFSTR(kIOHIDElementScaledMinKey), &number) &&
-                ((int32_t)number != fElements[index].scaledMin))
-                continue;
-
-            if ( getElementDictIntValue(matchingDict, CFSTR(kIOHIDElementScaledMaxKey), &number) &&
-                ((int32_t)number != fElements[index].scaledMax))
-                continue;
-
-            if ( getElementDictIntValue(matchingDict, CFSTR(kIOHIDElementSizeKey), &number) &&
-                (number != fElements[index].size))
-                continue;
-
-            if ( getElementDictIntValue(matchingDict, CFSTR(kIOHIDElementReportSizeKey), &number) &&
-                (number != fElements[index].reportSize))
-                continue;
-
-            if ( getElementDictIntValue(matchingDict, CFSTR(kIOHIDElementReportCountKey), &number) &&
-                (number != fElements[index].reportCount))
-                continue;
-                
-            if ( getElementDictIntValue(matchingDict, CFSTR(kIOHIDElementIsRelativeKey), &number) &&
-                (number != ((fElements[index].flags & kHIDDataRelativeBit) == kHIDDataRelative)))
-                continue;
-
-            if ( getElementDictIntValue(matchingDict, CFSTR(kIOHIDElementIsWrappingKey), &number) &&
-                (number != ((fElements[index].flags & kHIDDataWrapBit) == kHIDDataWrap)))
-                continue;
-
-            if ( getElementDictIntValue(matchingDict, CFSTR(kIOHIDElementIsNonLinearKey), &number) &&
-                (number != ((fElements[index].flags & kHIDDataNonlinearBit) == kHIDDataNonlinear)))
-                continue;
-
-            if ( getElementDictIntValue(matchingDict, CFSTR(kIOHIDElementHasPreferredStateKey), &number) &&
-                (number != ((fElements[index].flags & kHIDDataNoPreferredBit) != kHIDDataNoPreferred)))
-                continue;
-
-            if ( getElementDictIntValue(matchingDict, CFSTR(kIOHIDElementHasNullStateKey), &number) &&
-                (number != ((fElements[index].flags & kHIDDataNullStateBit) == kHIDDataNullState)))
-                continue;
-
-            if ( getElementDictIntValue(matchingDict, CFSTR(kIOHIDElementIsArrayKey), &number) &&
-                (number != ((fElements[index].flags & kHIDDataArrayBit) == kHIDDataArray)))
-                continue;
-
-            if ( getElementDictIntValue(matchingDict, CFSTR(kIOHIDElementUnitKey), &number) &&
-                (number != fElements[index].unit))
-                continue;
-
-            if ( getElementDictIntValue(matchingDict, CFSTR(kIOHIDElementUnitExponentKey), &number) &&
-                (number != fElements[index].unitExponent))
-                continue;
-
-            if ( getElementDictIntValue(matchingDict, CFSTR(kIOHIDElementDuplicateIndexKey), &number) )
+            
+            if ( isMatchingCookieMin || isMatchingCookieMax )
             {
-                if ( !isDuplicateRoot )
-                    continue;
-                    
-                matchingDupIndex   = number;
-                isMatchingDupIndex = true;
+                count = getElementCookieRange(matchingCookieMin, isMatchingCookieMin, matchingCookieMax, isMatchingCookieMax, &firstIndex);
+                if ( count < ElementCandidatesCount(&candidates) ) 
+                {
+                    bzero(&candidates, sizeof(IOHIDElementCandidates));
+                    candidates.first        = firstIndex;
+                    candidates.entryCount   = count;
+                }
             }
         }
+    }
+        
+    while ( ElementCandidatesNext(&candidates, &index) )
+    {        
+        isDuplicateRoot = (fElements[index].duplicateValueSize != 0);
+        
+        if ( !ElementStructMatches(&fElements[index], &matching) )
+            continue;
             
         uint32_t rangeIndex = 0;
         uint32_t usageIndex = 0;
@@ -1445,6 +1705,7 @@ IOReturn IOHIDDeviceClass::setInterruptReportCallback(uint8_t * report, CFIndex
     fInputReportBuffer                  = report;
     fInputReportBufferSize              = reportLength;
     fInputReportOptions                 = options;
+    fInputReportBatchCallback           = NULL;
     
     // Lazy set up of the queue.
     if ( !fReportHandlerQueue ) {
@@ -1490,6 +1751,25 @@ SET_REPORT_HANDLER_CLEANUP:
 }
 
 
+//---------------------------------------------------------------------------
+// setInterruptReportBatchCallback
+//
+// Reports are handed to the callback in batches straight out of the
+// report handler queue, without an IOHIDValueRef or a copy into a client
+// buffer.  Replaces any callback set through setInterruptReportCallback.
+//---------------------------------------------------------------------------
+IOReturn IOHIDDeviceClass::setInterruptReportBatchCallback(IOHIDReportBatchCallback callback, void * refcon, IOOptionBits options)
+{
+    IOReturn ret;
+    
+    ret = setInterruptReportCallback(NULL, 0, NULL, NULL, refcon, options | kHIDReportNoCopyCallback);
+    
+    if ( ret == kIOReturnSuccess )
+        fInputReportBatchCallback = callback;
+        
+    return ret;
+}
+
 IOReturn IOHIDDeviceClass::finishReportHandlerQueueSetup()
 {
 	IOReturn ret = kIOReturnError;
@@ -1530,43 +1810,67 @@ void IOHIDDeviceClass::_cfmachPortCallback(CFMachPortRef cfPort, mach_msg_header
 
 void IOHIDDeviceClass::_hidReportHandlerCallback(void * refcon, IOReturn result, void * sender __unused)
 {
+    IOHIDValueRef           events[kReportHandlerDequeueBatch];
     IOHIDValueRef           event;
     IOHIDDeviceClass *		self = (IOHIDDeviceClass *)refcon;
-    IOHIDQueueClass *		queue = self->fReportHandlerQueue;
-    uint32_t                value, size = 0;
+    IOHIDQueueClass *		queue;
+    uint32_t                size = 0;
+    CFIndex                 count = 0, index;
 
     if (!self || !self->fIsOpen)
         return;
             
-    while ((result = queue->copyNextEventValue( &event, 0, 0)) == kIOReturnSuccess) 
+    if ( self->fInputReportOptions & kHIDReportNoCopyCallback )
+    {
+        self->deliverInputReportsNoCopy();
+        return;
+    }
+    
+    queue = self->fReportHandlerQueue;
+    
+    while ((result = queue->copyNextEventValues(events, kReportHandlerDequeueBatch, &count)) == kIOReturnSuccess && count) 
     {
-        if (IOHIDValueGetBytePtr(event) && IOHIDValueGetLength(event))
+        for (index = 0; index < count; index++)
         {
-            size = min(self->fInputReportBufferSize, IOHIDValueGetLength(event));
-            bcopy(IOHIDValueGetBytePtr(event), self->fInputReportBuffer, size);
-        }
+            event = events[index];
         
-        if (self->fInputReportCallback)
-            (self->fInputReportCallback)(
-                                        self->fInputReportRefcon, 
-                                        result, 
-                                        &(self->fHIDDevice),
-                                        kIOHIDReportTypeInput,
-                                        IOHIDElementGetReportID(IOHIDValueGetElement(event)),
-                                        self->fInputReportBuffer,
-                                        size);
-        if (self->fInputReportWithTimeStampCallback)
-            (self->fInputReportWithTimeStampCallback)(
-                                        self->fInputReportRefcon,
-                                        result, 
-                                        &(self->fHIDDevice),
-                                        kIOHIDReportTypeInput,
-                                        IOHIDElementGetReportID(IOHIDValueGetElement(event)),
-                                        self->fInputReportBuffer,
-                                        size,
-                                        IOHIDValueGetTimeStamp(event));
+            if (IOHIDValueGetBytePtr(event) && IOHIDValueGetLength(event))
+            {
+                size = min(self->fInputReportBufferSize, IOHIDValueGetLength(event));
+                bcopy(IOHIDValueGetBytePtr(event), self->fInputReportBuffer, size);
+            }
         
-        CFRelease(event);
+            if (self->fInputReportCallback)
+                (self->fInputReportCallback)(
+                                            self->fInputReportRefcon, 
+                                            result, 
+                                            &(self->fHIDDevice),
+                                            kIOHIDReportTypeInput,
+                                            IOHIDElementGetReportID(IOHIDValueGetElement(event)),
+                                            self->fInputReportBuffer,
+                                            size);
+            if (self->fInputReportWithTimeStampCallback)
+                (self->fInputReportWithTimeStampCallback)(
+                                            self->fInputReportRefcon,
+                                            result, 
+                                            &(self->fHIDDevice),
+                                            kIOHIDReportTypeInput,
+                                            IOHIDElementGetReportID(IOHIDValueGetElement(event)),
+                                            self->fInputReportBuffer,
+                                            size,
+                                            IOHIDValueGetTimeStamp(event));
+        
+            CFRelease(event);
+            
+            // the callbacks may have closed the device or torn down the queue
+            if ( !self->fIsOpen || (queue != self->fReportHandlerQueue) )
+            {
+                while ( ++index < count )
+                    CFRelease(events[index]);
+                    
+                return;
+            }
+        }
     }
 }
 
@@ -1590,6 +1894,90 @@ IOHIDDeviceClass::_hidReportCallback(void *refcon, IOReturn result, uint32_t buf
     free(hidRefcon);
 }
 
+//---------------------------------------------------------------------------
+// deliverInputReportsNoCopy
+//
+// Hands reports to the client in place.  A batch of queue entries is held
+// for the duration of the callbacks and released to the kernel afterwards,
+// so the report pointers stay valid until the callbacks return.
+//---------------------------------------------------------------------------
+void IOHIDDeviceClass::deliverInputReportsNoCopy()
+{
+    IOHIDElementValue *     values[kReportHandlerDequeueBatch];
+    IOHIDReportRecord       records[kReportHandlerDequeueBatch];
+    IOHIDQueueClass *       queue;
+    CFIndex                 count, index, recordCount;
+    uint32_t                nextHead;
+    
+    while ( fIsOpen && (queue = fReportHandlerQueue) && 
+            (queue->peekElementValues(values, kReportHandlerDequeueBatch, &count, &nextHead) == kIOReturnSuccess) )
+    {
+        for ( index = 0, recordCount = 0; index < count; index++ )
+        {
+            IOHIDElementValue *     elementValue = values[index];
+            IOHIDElementStruct *    elementStruct;
+            IOHIDElementCookie      cookie      = elementValue->cookie;
+            uint32_t                totalSize   = elementValue->totalSize;
+            uint64_t                timeStamp   = *((uint64_t *)&(elementValue->timestamp));
+            uint32_t                valueSize;
+            
+            ROSETTA_ONLY(
+                cookie      = (IOHIDElementCookie)OSSwapInt32((uint32_t)cookie);
+                totalSize   = OSSwapInt32(totalSize);
+                timeStamp   = OSSwapInt64(timeStamp);
+            );
+            
+            if ( !getElementStructPtr(cookie, &elementStruct) )
+                continue;
+                
+            valueSize = (totalSize > offsetof(IOHIDElementValue, value)) ? totalSize - offsetof(IOHIDElementValue, value) : 0;
+                
+            records[recordCount].reportID       = elementStruct->reportID;
+            records[recordCount].report         = (uint8_t *)elementValue->value;
+            records[recordCount].reportLength   = min(valueSize, (elementStruct->size + 7) / 8);
+            records[recordCount].timeStamp      = timeStamp;
+            recordCount++;
+        }
+        
+        if ( fInputReportBatchCallback )
+        {
+            if ( recordCount )
+                (fInputReportBatchCallback)(fInputReportRefcon, kIOReturnSuccess, &fHIDDevice, records, recordCount);
+        }
+        else
+        {
+            for ( index = 0; index < recordCount; index++ )
+            {
+                if (fInputReportCallback)
+                    (fInputReportCallback)(
+                                            fInputReportRefcon, 
+                                            kIOReturnSuccess, 
+                                            &fHIDDevice,
+                                            kIOHIDReportTypeInput,
+                                            records[index].reportID,
+                                            records[index].report,
+                                            records[index].reportLength);
+                if (fInputReportWithTimeStampCallback)
+                    (fInputReportWithTimeStampCallback)(
+                                            fInputReportRefcon,
+                                            kIOReturnSuccess, 
+                                            &fHIDDevice,
+                                            kIOHIDReportTypeInput,
+                                            records[index].reportID,
+                                            records[index].report,
+                                            records[index].reportLength,
+                                            records[index].timeStamp);
+            }
+        }
+        
+        // the callbacks may have torn down the queue
+        if ( queue != fReportHandlerQueue )
+            break;
+            
+        queue->releaseElementValues(nextHead);
+    }
+}
+
 IOReturn IOHIDDeviceClass::startAllQueues()
 {
     IOReturn ret = kIOReturnSuccess;
@@ -1673,6 +2061,16 @@ IOHIDDeviceTimeStampedDeviceInterface IOHIDDeviceClass::sHIDDeviceInterfaceV2 =
     &IOHIDDeviceClass::_setInterruptReportWithTimeStampCallback
 };
 
+IOHIDDevicePrivateInterface IOHIDDeviceClass::sHIDDevicePrivateInterface =
+{
+    0,
+    &IOHIDIUnknown::genericQueryInterface,
+    &IOHIDIUnknown::genericAddRef,
+    &IOHIDIUnknown::genericRelease,
+    &IOHIDDeviceClass::_setInterruptReportBatchCallback,
+    &IOHIDDeviceClass::_copyReportSnapshot
+};
+
 // Methods for routing iocfplugin interface
 IOReturn IOHIDDeviceClass:: _probe(void *self, CFDictionaryRef propertyTable, io_service_t inService, SInt32 *order)
     { return getThis(self)->probe(propertyTable, inService, order); }
@@ -1733,6 +2131,13 @@ IOReturn IOHIDDeviceClass::_setElementValue(void * self, IOHIDElementRef element
                                 uint32_t timeout, IOHIDValueCallback callback, void * refcon, IOOptionBits options)
 { return getThis(self)->setElementValue(element, event, timeout, callback, refcon, options);};
 
+IOReturn IOHIDDeviceClass::_setInterruptReportBatchCallback(void * self, IOHIDReportBatchCallback callback, void * refcon, IOOptionBits options)
+{ return getThis(self)->setInterruptReportBatchCallback(callback, refcon, options); }
+
+IOReturn IOHIDDeviceClass::_copyReportSnapshot(void * self, IOHIDReportType reportType, uint32_t reportID, IOHIDElementSnapshot * snapshots,
+                            CFIndex * pCount, uint8_t * values, CFIndex * pValuesLength)
+{ return getThis(self)->copyReportSnapshot(reportType, reportID, snapshots, pCount, values, pValuesLength); }
+
 
 #define SWAP_KERNEL_ELEMENT(element)                                        \
 {                                                                           \
@@ -1804,6 +2209,417 @@ IOReturn IOHIDDeviceClass::buildElements( uint32_t type, CFMutableDataRef * pDat
     return kr;
 }
 
+//---------------------------------------------------------------------------
+// loadCachedElements
+//
+// Fills in the element tables from the element cache.  The cache is opt in:
+// it's only used when kIOHIDElementCacheDefaultDirectory exists, and
+// entries are keyed by the IOHIDFamily version and the descriptor digest
+// from kIOHIDLibUserClientGetElementCount.  The counts from that call must
+// still match, and every record must pass validateCachedElements against
+// the element values size it returned before it's used.
+//---------------------------------------------------------------------------
+IOReturn IOHIDDeviceClass::loadCachedElements(uint64_t valuesSize, const uint64_t * digest)
+{
+    IOHIDElementCacheEntry  entry;
+    const char *            version;
+    size_t                  elementSize;
+    size_t                  reportHandlerSize;
+    
+    if ( !(version = GetFamilyVersion()) )
+        return kIOReturnUnsupported;
+        
+    if ( IOHIDElementCacheCopyEntry(kIOHIDElementCacheDefaultDirectory, 
+                                    version,
+                                    digest, 
+                                    kIOHIDLibUserClientDescriptorDigestLength, 
+                                    sizeof(IOHIDElementStruct), 
+                                    &entry) )
+        return kIOReturnNotFound;
+        
+    if ( (entry.elementCount != fElementCount) || (entry.reportHandlerCount != fReportHandlerElementCount) ) {
+        IOHIDElementCacheReleaseEntry(&entry);
+        return kIOReturnNotFound;
+    }
+    
+    elementSize         = sizeof(IOHIDElementStruct) * entry.elementCount;
+    reportHandlerSize   = sizeof(IOHIDElementStruct) * entry.reportHandlerCount;
+    
+    if ( !validateCachedElements((IOHIDElementStruct *)entry.records, entry.elementCount, valuesSize) ||
+         !validateCachedElements((IOHIDElementStruct *)((uint8_t *)entry.records + elementSize), entry.reportHandlerCount, valuesSize) ) {
+        IOHIDElementCacheReleaseEntry(&entry);
+        return kIOReturnNotFound;
+    }
+    
+    fElementData                = CFDataCreateMutable(kCFAllocatorDefault, elementSize);
+    fReportHandlerElementData   = CFDataCreateMutable(kCFAllocatorDefault, reportHandlerSize);
+    
+    if ( !fElementData || !fReportHandlerElementData ) {
+        if ( fElementData ) {
+            CFRelease(fElementData);
+            fElementData = NULL;
+        }
+        if ( fReportHandlerElementData ) {
+            CFRelease(fReportHandlerElementData);
+            fReportHandlerElementData = NULL;
+        }
+        IOHIDElementCacheReleaseEntry(&entry);
+        return kIOReturnNoMemory;
+    }
+    
+    CFDataSetLength(fElementData, elementSize);
+    CFDataSetLength(fReportHandlerElementData, reportHandlerSize);
+    
+    fElements               = (IOHIDElementStruct*)CFDataGetMutableBytePtr(fElementData);
+    fReportHandlerElements  = (IOHIDElementStruct*)CFDataGetMutableBytePtr(fReportHandlerElementData);
+    
+    bcopy(entry.records, fElements, elementSize);
+    bcopy((uint8_t *)entry.records + elementSize, fReportHandlerElements, reportHandlerSize);
+    
+    IOHIDElementCacheReleaseEntry(&entry);
+    
+    HIDLog("IOHIDDeviceClass::loadCachedElements: elementCount=%d reportHandlerCount=%d\n", fElementCount, fReportHandlerElementCount);
+    
+    return kIOReturnSuccess;
+}
+
+//---------------------------------------------------------------------------
+// validateCachedElements
+//
+// Cache entries come from disk, so every record is checked the way the
+// kernel would have built it before the cookies and value locations in it
+// are trusted: cookies must fit the lookup table and every cookie's value,
+// which sits below valueLocation for ranges and duplicates, must lie within
+// the element values memory.
+//---------------------------------------------------------------------------
+bool IOHIDDeviceClass::validateCachedElements(const IOHIDElementStruct * elements, uint32_t count, uint64_t valuesSize)
+{
+    uint32_t index;
+    
+    for ( index = 0; index < count; index++ )
+    {
+        const IOHIDElementStruct *  element = &elements[index];
+        uint64_t                    valueBytes;
+        uint64_t                    step;
+        
+        if ( (element->cookieMin > element->cookieMax) || 
+             (element->cookieMax > kElementLookupMaxCookie) || 
+             (element->parentCookie > kElementLookupMaxCookie) )
+            return false;
+            
+        if ( element->valueSize < sizeof(IOHIDElementValue) )
+            return false;
+            
+        if ( ((uint64_t)element->valueLocation + element->valueSize) > valuesSize )
+            return false;
+            
+        valueBytes = element->valueSize - offsetof(IOHIDElementValue, value);
+        
+        if ( ((uint64_t)element->reportSize * element->reportCount != element->size) ||
+             ((((uint64_t)element->size + 7) / 8) > valueBytes) ||
+             (element->bytes > valueBytes) )
+            return false;
+            
+        if ( element->duplicateValueSize ) {
+            if ( (element->duplicateValueSize < sizeof(IOHIDElementValue)) ||
+                 ((((uint64_t)element->reportSize + 7) / 8) > (element->duplicateValueSize - offsetof(IOHIDElementValue, value))) )
+                return false;
+                
+            step = element->duplicateValueSize;
+        }
+        else {
+            step = element->valueSize;
+        }
+        
+        if ( ((uint64_t)(element->cookieMax - element->cookieMin) * step) > element->valueLocation )
+            return false;
+    }
+    
+    return true;
+}
+
+//---------------------------------------------------------------------------
+// storeCachedElements
+//---------------------------------------------------------------------------
+void IOHIDDeviceClass::storeCachedElements(const uint64_t * digest)
+{
+    IOHIDElementCacheEntry  entry;
+    const char *            version;
+    uint8_t *               records;
+    size_t                  elementSize         = sizeof(IOHIDElementStruct) * fElementCount;
+    size_t                  reportHandlerSize   = sizeof(IOHIDElementStruct) * fReportHandlerElementCount;
+    
+    // only root can write entries that will be trusted
+    if ( geteuid() != 0 )
+        return;
+        
+    if ( !(version = GetFamilyVersion()) )
+        return;
+        
+    records = (uint8_t *)malloc(elementSize + reportHandlerSize);
+    if ( !records )
+        return;
+        
+    if ( elementSize )
+        bcopy(fElements, records, elementSize);
+    if ( reportHandlerSize )
+        bcopy(fReportHandlerElements, records + elementSize, reportHandlerSize);
+        
+    entry.records               = records;
+    entry.recordSize            = sizeof(IOHIDElementStruct);
+    entry.elementCount          = fElementCount;
+    entry.reportHandlerCount    = fReportHandlerElementCount;
+    
+    IOHIDElementCacheStoreEntry(kIOHIDElementCacheDefaultDirectory, version, digest, kIOHIDLibUserClientDescriptorDigestLength, &entry);
+    
+    free(records);
+}
+
+//---------------------------------------------------------------------------
+// buildElementLookup
+//
+// Cookies handed out by the kernel are indices into its element array, so a
+// table with one entry per cookie stays small and lets getElementStructPtr
+// resolve a cookie without scanning the element arrays.  Entries are filled
+// in reverse so that, as with the scan, the first element covering a cookie
+// wins and the leaf elements take precedence over the report handlers.  If
+// the table can't be built, getElementStructPtr falls back to the scan.
+//---------------------------------------------------------------------------
+IOReturn IOHIDDeviceClass::buildElementLookup()
+{
+    uint32_t    maxCookie = 0;
+    uint32_t    index;
+    uint32_t    cookie;
+    size_t      size;
+    
+    if (!fElementCount && !fReportHandlerElementCount)
+        return kIOReturnSuccess;
+        
+    for (index = 0; index < fElementCount; index++)
+        maxCookie = max(maxCookie, fElements[index].cookieMax);
+        
+    for (index = 0; index < fReportHandlerElementCount; index++)
+        maxCookie = max(maxCookie, fReportHandlerElements[index].cookieMax);
+
+    if (maxCookie > kElementLookupMaxCookie)
+        return kIOReturnUnsupported;
+        
+    size = sizeof(IOHIDElementLookup) * (maxCookie + 1);
+    
+    fElementLookupData = CFDataCreateMutable(kCFAllocatorDefault, size);
+    
+    if (!fElementLookupData)
+        return kIOReturnNoMemory;
+        
+    CFDataSetLength(fElementLookupData, size);
+    
+    fElementLookup = (IOHIDElementLookup *)CFDataGetMutableBytePtr(fElementLookupData);
+    
+    bzero(fElementLookup, size);
+    
+    for (index = fReportHandlerElementCount; index > 0; index--)
+    {
+        IOHIDElementStruct * element = &fReportHandlerElements[index-1];
+        
+        for (cookie = element->cookieMin; cookie <= element->cookieMax; cookie++)
+        {
+            fElementLookup[cookie].element  = element;
+            fElementLookup[cookie].data     = fReportHandlerElementData;
+        }
+    }
+
+    for (index = fElementCount; index > 0; index--)
+    {
+        IOHIDElementStruct * element = &fElements[index-1];
+        
+        for (cookie = element->cookieMin; cookie <= element->cookieMax; cookie++)
+        {
+            fElementLookup[cookie].element  = element;
+            fElementLookup[cookie].data     = fElementData;
+        }
+    }
+    
+    fElementLookupCount = maxCookie + 1;
+    
+    return kIOReturnSuccess;
+}
+
+//---------------------------------------------------------------------------
+// buildElementIndex
+//
+// Sorts the fElements indexes by parent cookie, usage page, type and usage
+// so that copyMatchingElements only has to look at the elements sharing
+// the most selective of those keys.  Each list stays in fElements order
+// within a key, which keeps the matching results in the order of a full
+// scan.  Cookie queries slice fElements directly when it is in cookie
+// order, which is how the kernel hands it out.
+//---------------------------------------------------------------------------
+IOReturn IOHIDDeviceClass::buildElementIndex()
+{
+    size_t      size;
+    uint32_t    index;
+    
+    if (!fElementCount)
+        return kIOReturnSuccess;
+        
+    size = (sizeof(IOHIDElementIndexEntry) * 4 + sizeof(uint32_t)) * fElementCount;
+    
+    fElementIndexData = CFDataCreateMutable(kCFAllocatorDefault, size);
+    
+    if (!fElementIndexData)
+        return kIOReturnNoMemory;
+        
+    CFDataSetLength(fElementIndexData, size);
+    
+    fElementsByParent       = (IOHIDElementIndexEntry *)CFDataGetMutableBytePtr(fElementIndexData);
+    fElementsByUsagePage    = fElementsByParent + fElementCount;
+    fElementsByType         = fElementsByUsagePage + fElementCount;
+    fElementsByUsage        = fElementsByType + fElementCount;
+    fElementsWithUsageRange = (uint32_t *)(fElementsByUsage + fElementCount);
+    
+    fElementsByUsageCount           = 0;
+    fElementsWithUsageRangeCount    = 0;
+    fElementsCookieOrdered          = true;
+    
+    for (index = 0; index < fElementCount; index++)
+    {
+        fElementsByParent[index].key        = fElements[index].parentCookie;
+        fElementsByParent[index].index      = index;
+        fElementsByUsagePage[index].key     = fElements[index].usagePage;
+        fElementsByUsagePage[index].index   = index;
+        fElementsByType[index].key          = fElements[index].type;
+        fElementsByType[index].index        = index;
+        
+        if ( fElements[index].usageMin == fElements[index].usageMax )
+        {
+            fElementsByUsage[fElementsByUsageCount].key     = fElements[index].usageMin;
+            fElementsByUsage[fElementsByUsageCount].index   = index;
+            fElementsByUsageCount++;
+        }
+        else
+        {
+            fElementsWithUsageRange[fElementsWithUsageRangeCount++] = index;
+        }
+        
+        if ( index && ((fElements[index].cookieMin < fElements[index-1].cookieMin) || 
+                       (fElements[index].cookieMax < fElements[index-1].cookieMax)) )
+            fElementsCookieOrdered = false;
+    }
+    
+    qsort(fElementsByParent, fElementCount, sizeof(IOHIDElementIndexEntry), ElementIndexEntryCompare);
+    qsort(fElementsByUsagePage, fElementCount, sizeof(IOHIDElementIndexEntry), ElementIndexEntryCompare);
+    qsort(fElementsByType, fElementCount, sizeof(IOHIDElementIndexEntry), ElementIndexEntryCompare);
+    qsort(fElementsByUsage, fElementsByUsageCount, sizeof(IOHIDElementIndexEntry), ElementIndexEntryCompare);
+    
+    return kIOReturnSuccess;
+}
+
+uint32_t IOHIDDeviceClass::getElementIndexRange(IOHIDElementIndexEntry * entries, uint32_t count, uint32_t key, IOHIDElementIndexEntry ** pFirst)
+{
+    uint32_t low, high, mid, first;
+    
+    // lower bound of key
+    for (low = 0, high = count; low < high; )
+    {
+        mid = low + ((high - low) / 2);
+        if (entries[mid].key < key)
+            low = mid + 1;
+        else
+            high = mid;
+    }
+    first = low;
+    
+    // upper bound of key
+    for (high = count; low < high; )
+    {
+        mid = low + ((high - low) / 2);
+        if (entries[mid].key <= key)
+            low = mid + 1;
+        else
+            high = mid;
+    }
+    
+    *pFirst = &entries[first];
+    
+    return low - first;
+}
+
+//---------------------------------------------------------------------------
+// getElementCookieRange
+//
+// A cookie min only matches elements starting at or below it and a cookie
+// max only those ending at or above it, so with fElements in cookie order
+// the elements a cookie query can match are one contiguous slice.  Returns
+// fElementCount for the whole array if fElements is out of order.
+//---------------------------------------------------------------------------
+uint32_t IOHIDDeviceClass::getElementCookieRange(uint32_t cookieMin, bool isMatchingCookieMin, uint32_t cookieMax, bool isMatchingCookieMax, uint32_t * pFirst)
+{
+    uint32_t low, high, mid, first;
+    
+    *pFirst = 0;
+    
+    if ( !fElementsCookieOrdered )
+        return fElementCount;
+    
+    // first element ending at or above cookieMax
+    for (low = 0, high = fElementCount; isMatchingCookieMax && (low < high); )
+    {
+        mid = low + ((high - low) / 2);
+        if (fElements[mid].cookieMax < cookieMax)
+            low = mid + 1;
+        else
+            high = mid;
+    }
+    first = low;
+    
+    // past the last element starting at or below cookieMin
+    for (high = fElementCount; isMatchingCookieMin && (low < high); )
+    {
+        mid = low + ((high - low) / 2);
+        if (fElements[mid].cookieMin <= cookieMin)
+            low = mid + 1;
+        else
+            high = mid;
+    }
+    
+    if ( !isMatchingCookieMin )
+        low = fElementCount;
+    
+    *pFirst = first;
+    
+    return low - first;
+}
+
+//---------------------------------------------------------------------------
+// createValueAllocator
+//
+// Sizes the value slab for the largest element value of this device.  On
+// failure values keep coming from the default allocator.
+//---------------------------------------------------------------------------
+IOReturn IOHIDDeviceClass::createValueAllocator()
+{
+    CFAllocatorContext  context;
+    uint32_t            maxValueSize = 0;
+    uint32_t            index;
+    
+    for (index = 0; index < fElementCount; index++)
+        maxValueSize = max(maxValueSize, fElements[index].valueSize);
+        
+    for (index = 0; index < fReportHandlerElementCount; index++)
+        maxValueSize = max(maxValueSize, fReportHandlerElements[index].valueSize);
+        
+    if (IOHIDValueSlabInitContext(maxValueSize, &context))
+        return kIOReturnNoMemory;
+        
+    fValueAllocator = CFAllocatorCreate(kCFAllocatorDefault, &context);
+    fValueSlab      = fValueAllocator ? context.info : NULL;
+    
+    // the allocator holds its own reference on the slab
+    context.release(context.info);
+    
+    return fValueAllocator ? kIOReturnSuccess : kIOReturnNoMemory;
+}
+
 IOHIDElementRef IOHIDDeviceClass::getElement(IOHIDElementCookie cookie)
 {
     IOHIDElementStruct *elementStruct = 0;
@@ -1836,6 +2652,33 @@ bool IOHIDDeviceClass::getElementStructPtr(IOHIDElementCookie elementCookie, IOH
 {
     uint32_t cookieIndex = 0;
     uint32_t index = 0;
+    
+    if ( fElementLookup )
+    {
+        IOHIDElementLookup * lookup;
+        
+        if ( (uint32_t) elementCookie >= fElementLookupCount )
+            return false;
+            
+        lookup = &fElementLookup[(uint32_t) elementCookie];
+        
+        if ( !lookup->element )
+            return false;
+            
+        if ( lookup->data == fElementData )
+            cookieIndex = (uint32_t) elementCookie - lookup->element->cookieMin;
+            
+        if ( ppElementStruct )
+            *ppElementStruct = lookup->element;
+            
+        if ( pIndex )
+            *pIndex = cookieIndex;
+            
+        if ( pData )
+            *pData = lookup->data;
+        return true;
+    }
+    
     for (index = 0; index < fElementCount; index++)
     {
         if ( ((uint32_t) elementCookie >= fElements[index].cookieMin) && ((uint32_t) elementCookie <= fElements[index].cookieMax) )
@@ -1874,6 +2717,150 @@ bool IOHIDDeviceClass::getElementStructPtr(IOHIDElementCookie elementCookie, IOH
     return false;
 }
 
+static bool ElementTypeMatchesReportType(uint32_t elementType, IOHIDReportType reportType)
+{
+    switch ( reportType ) {
+        case kIOHIDReportTypeInput:
+            return (elementType >= kIOHIDElementTypeInput_Misc) && (elementType <= kIOHIDElementTypeInput_ScanCodes);
+        case kIOHIDReportTypeOutput:
+            return (elementType == kIOHIDElementTypeOutput);
+        case kIOHIDReportTypeFeature:
+            return (elementType == kIOHIDElementTypeFeature);
+        default:
+            return false;
+    }
+}
+
+//---------------------------------------------------------------------------
+// copyReportSnapshot
+//
+// Copies every element value of a report out of the mapped element values.
+// The kernel bumps an element's generation before and after it writes the
+// value, so the copy is a seqlock read: it's retried until all generations
+// were even and unchanged across the whole copy.  On kIOReturnNoSpace,
+// *pCount and *pValuesLength hold the sizes needed.
+//---------------------------------------------------------------------------
+IOReturn IOHIDDeviceClass::copyReportSnapshot(IOHIDReportType           reportType, 
+                                              uint32_t                  reportID, 
+                                              IOHIDElementSnapshot *    snapshots, 
+                                              CFIndex *                 pCount, 
+                                              uint8_t *                 values, 
+                                              CFIndex *                 pValuesLength)
+{
+    CFIndex     count;
+    CFIndex     valuesLength;
+    uint32_t    retries;
+    uint32_t    index;
+    bool        consistent;
+    
+    allChecks();
+    
+    if ( !pCount || !pValuesLength || (*pCount && !snapshots) || (*pValuesLength && !values) )
+        return kIOReturnBadArgument;
+        
+    if ( !fCurrentValuesMappedMemory )
+        return kIOReturnNoMemory;
+        
+    for ( retries = 0; retries < kReportSnapshotMaxRetries; retries++ )
+    {
+        count           = 0;
+        valuesLength    = 0;
+        consistent      = true;
+        
+        // first pass copies the values and their generations
+        for ( index = 0; index < fElementCount; index++ )
+        {
+            IOHIDElementStruct *    element = &fElements[index];
+            uint32_t                step    = element->duplicateValueSize ? element->duplicateValueSize : element->valueSize;
+            uint32_t                cookie;
+            
+            if ( (element->reportID != reportID) || !ElementTypeMatchesReportType(element->type, reportType) )
+                continue;
+                
+            for ( cookie = element->cookieMin; cookie <= element->cookieMax; cookie++ )
+            {
+                uint32_t            location        = element->valueLocation - ((cookie - element->cookieMin) * step);
+                uint32_t            valueSize       = element->valueSize;
+                IOHIDElementValue * elementValue;
+                uint32_t            generation;
+                uint32_t            valueLength;
+                
+                // duplicates past the root only hold their own value, as in getElementStruct
+                if ( element->duplicateValueSize && (cookie != element->cookieMin) )
+                    valueSize = element->duplicateValueSize;
+                    
+                if ( (location + valueSize) > fCurrentValuesMappedMemorySize )
+                    continue;
+                    
+                elementValue    = (IOHIDElementValue *)(fCurrentValuesMappedMemory + location);
+                valueLength     = valueSize - offsetof(IOHIDElementValue, value);
+                
+                if ( (count < *pCount) && ((valuesLength + (CFIndex)valueLength) <= *pValuesLength) )
+                {
+                    generation = elementValue->generation;
+                    OSMemoryBarrier();
+                    
+                    snapshots[count].cookie         = (IOHIDElementCookie)cookie;
+                    snapshots[count].generation     = generation;
+                    snapshots[count].timeStamp      = *((uint64_t *)&(elementValue->timestamp));
+                    snapshots[count].valueOffset    = valuesLength;
+                    snapshots[count].valueLength    = valueLength;
+                    bcopy(elementValue->value, values + valuesLength, valueLength);
+                    
+                    if ( generation & 1 )
+                        consistent = false;
+                }
+                
+                count++;
+                valuesLength += valueLength;
+            }
+        }
+        
+        if ( (count > *pCount) || (valuesLength > *pValuesLength) )
+        {
+            *pCount         = count;
+            *pValuesLength  = valuesLength;
+            return kIOReturnNoSpace;
+        }
+        
+        OSMemoryBarrier();
+        
+        // second pass makes sure nothing was written while copying
+        for ( index = 0; consistent && (index < count); index++ )
+        {
+            IOHIDElementStruct *    element;
+            uint32_t                step;
+            uint32_t                location;
+            
+            if ( !getElementStructPtr(snapshots[index].cookie, &element) )
+                continue;
+                
+            step        = element->duplicateValueSize ? element->duplicateValueSize : element->valueSize;
+            location    = element->valueLocation - (((uint32_t)snapshots[index].cookie - element->cookieMin) * step);
+            
+            if ( ((IOHIDElementValue *)(fCurrentValuesMappedMemory + location))->generation != snapshots[index].generation )
+                consistent = false;
+        }
+        
+        if ( consistent )
+        {
+            ROSETTA_ONLY(
+                for ( index = 0; index < count; index++ )
+                {
+                    snapshots[index].generation = OSSwapInt32(snapshots[index].generation);
+                    snapshots[index].timeStamp  = OSSwapInt64(snapshots[index].timeStamp);
+                }
+            );
+            
+            *pCount         = count;
+            *pValuesLength  = valuesLength;
+            return kIOReturnSuccess;
+        }
+    }
+    
+    return kIOReturnBusy;
+}
+
 bool IOHIDDeviceClass::getElementStruct(IOHIDElementCookie elementCookie, IOHIDElementStruct * elementStruct)
 {    
     IOHIDElementStruct * pElementStruct = 0;
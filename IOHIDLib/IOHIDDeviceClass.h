@@ -31,6 +31,7 @@
 #include <IOKit/hid/IOHIDLibPrivate.h>
 
 #include "IOHIDIUnknown.h"
+#include "IOHIDLibPlugInPrivate.h"
 
 #define HIDLog(fmt, args...) {}
 
@@ -38,12 +39,19 @@ enum {
     kHIDSetElementValuePendEvent    = 0x00010000,
     kHIDGetElementValueForcePoll    = 0x00020000,
     kHIDGetElementValuePreventPoll  = 0x00040000,
-    kHIDReportObsoleteCallback      = 0x00080000
+    kHIDReportObsoleteCallback      = 0x00080000,
+    kHIDReportNoCopyCallback        = 0x00100000
 };
 
 class IOHIDQueueClass;
 class IOHIDTransactionClass;
 
+// entry of the sorted element indexes used by copyMatchingElements
+typedef struct IOHIDElementIndexEntry {
+    uint32_t                        key;
+    uint32_t                        index;
+} IOHIDElementIndexEntry;
+
 class IOHIDDeviceClass : public IOHIDIUnknown
 {
     // friends with queue class
@@ -60,13 +68,21 @@ protected:
         IOHIDDeviceClass *		self;
     } MyPrivateData;
 
+    // entry of the cookie indexed element lookup table
+    typedef struct IOHIDElementLookup {
+        IOHIDElementStruct *    element;
+        CFDataRef               data;
+    } IOHIDElementLookup;
+
     IOHIDDeviceClass();
     virtual ~IOHIDDeviceClass();
 
     static IOCFPlugInInterface                      sIOCFPlugInInterfaceV1;
     static IOHIDDeviceTimeStampedDeviceInterface	sHIDDeviceInterfaceV2;
+    static IOHIDDevicePrivateInterface              sHIDDevicePrivateInterface;
 
     struct InterfaceMap             fHIDDevice;
+    struct InterfaceMap             fHIDDevicePrivate;
     io_service_t                    fService;
     io_connect_t                    fConnection;
     CFRunLoopRef                    fRunLoop;
@@ -112,10 +128,33 @@ protected:
     CFMutableDataRef                fReportHandlerElementData;
     IOHIDElementStruct *            fReportHandlerElements;
     
+    // element structs of both arrays above indexed by cookie
+    uint32_t                        fElementLookupCount;
+    CFMutableDataRef                fElementLookupData;
+    IOHIDElementLookup *            fElementLookup;
+    
+    // fElements indexes sorted by parent cookie, usage page, type and usage.
+    // Only elements with a single usage are in fElementsByUsage, the ones
+    // with a usage range are listed in fElements order instead.
+    CFMutableDataRef                fElementIndexData;
+    IOHIDElementIndexEntry *        fElementsByParent;
+    IOHIDElementIndexEntry *        fElementsByUsagePage;
+    IOHIDElementIndexEntry *        fElementsByType;
+    IOHIDElementIndexEntry *        fElementsByUsage;
+    uint32_t                        fElementsByUsageCount;
+    uint32_t *                      fElementsWithUsageRange;
+    uint32_t                        fElementsWithUsageRangeCount;
+    bool                            fElementsCookieOrdered;
+    
+    // recycles the IOHIDValueRefs created from element values
+    CFAllocatorRef                  fValueAllocator;
+    void *                          fValueSlab;         // held by fValueAllocator
+    
     IOHIDQueueClass *               fReportHandlerQueue;
     
     IOHIDReportCallback                 fInputReportCallback;
     IOHIDReportWithTimeStampCallback    fInputReportWithTimeStampCallback;
+    IOHIDReportBatchCallback            fInputReportBatchCallback;
     void *                              fInputReportRefcon;
     uint8_t *                           fInputReportBuffer;
     CFIndex                             fInputReportBufferSize;
@@ -133,6 +172,14 @@ protected:
     virtual HRESULT queryInterfaceTransaction (CFUUIDRef uuid, void **ppv);
 
     IOReturn buildElements(uint32_t type, CFMutableDataRef * pDataRef, IOHIDElementStruct ** buffer, uint32_t * count );
+    IOReturn loadCachedElements(uint64_t valuesSize, const uint64_t * digest);
+    void     storeCachedElements(const uint64_t * digest);
+    bool     validateCachedElements(const IOHIDElementStruct * elements, uint32_t count, uint64_t valuesSize);
+    IOReturn buildElementLookup();
+    IOReturn buildElementIndex();
+    uint32_t getElementIndexRange(IOHIDElementIndexEntry * entries, uint32_t count, uint32_t key, IOHIDElementIndexEntry ** pFirst);
+    uint32_t getElementCookieRange(uint32_t cookieMin, bool isMatchingCookieMin, uint32_t cookieMax, bool isMatchingCookieMax, uint32_t * pFirst);
+    IOReturn createValueAllocator();
 
     // helper function for copyMatchingElements
     bool getElementDictIntValue(CFDictionaryRef element, CFStringRef key, uint32_t * value);
@@ -153,6 +200,7 @@ protected:
     static void _hidReportCallback(void *refcon, IOReturn result, uint32_t bufferSize);
     static void _deviceNotification(void *refCon, io_service_t service, natural_t messageType, void *messageArgument );
     static void _hidReportHandlerCallback(void * refcon, IOReturn result, void * sender);
+    void deliverInputReportsNoCopy();
                            
 /*
  * Routing gumf for CFPlugIn interfaces
@@ -187,6 +235,11 @@ protected:
     static IOReturn _setElementValue(void * self, IOHIDElementRef element, IOHIDValueRef event,
                             uint32_t timeout, IOHIDValueCallback callback, void * refcon, IOOptionBits options);
 
+    // IOHIDDevicePrivateInterface
+    static IOReturn _setInterruptReportBatchCallback(void * self, IOHIDReportBatchCallback callback, void * refcon, IOOptionBits options);
+    static IOReturn _copyReportSnapshot(void * self, IOHIDReportType reportType, uint32_t reportID, IOHIDElementSnapshot * snapshots,
+                            CFIndex * pCount, uint8_t * values, CFIndex * pValuesLength);
+
 public:
     void * getInterfaceMap () { return &fHIDDevice; };
 
@@ -203,6 +256,9 @@ public:
     bool getElementStructPtr(IOHIDElementCookie elementCookie, IOHIDElementStruct ** ppElementStruct, uint32_t * pIndex=0, CFDataRef * pData =0);
     bool getElementStruct(IOHIDElementCookie elementCookie, IOHIDElementStruct * pElementStruct);
     uint32_t getElementByteSize (IOHIDElementCookie elementCookie);
+    
+    // consistent copy of all element values of a report, without a syscall
+    IOReturn copyReportSnapshot(IOHIDReportType reportType, uint32_t reportID, IOHIDElementSnapshot * snapshots, CFIndex * pCount, uint8_t * values, CFIndex * pValuesLength);
     IOHIDElementRef getElement(IOHIDElementCookie elementCookie);
 
     // IOCFPlugin stuff
@@ -231,6 +287,7 @@ public:
                                 uint32_t timeout, IOHIDReportCallback callback, void * refcon, IOOptionBits options = 0);
     virtual IOReturn copyMatchingElements(CFDictionaryRef matchingDict, CFArrayRef * elements, CFTypeRef parentElement=0, CFMutableDictionaryRef elementCache=0, IOOptionBits options=0);
     virtual IOReturn setInterruptReportCallback(uint8_t * report, CFIndex reportLength, IOHIDReportCallback callback, IOHIDReportWithTimeStampCallback callbackWithTimeStamp, void * refcon, IOOptionBits options = 0);
+    IOReturn setInterruptReportBatchCallback(IOHIDReportBatchCallback callback, void * refcon, IOOptionBits options = 0);
     
     virtual IOReturn getElementValue(IOHIDElementRef element,
                                      IOHIDValueRef * pEvent, 
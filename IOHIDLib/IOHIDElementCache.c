@@ -0,0 +1,343 @@
+/*
+ *
+ * @APPLE_LICENSE_HEADER_START@
+ *
+ * Copyright (c) 1999-2003 Apple Computer, Inc.  All Rights Reserved.
+ *
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this
+ * file.
+ *
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ *
+ * @APPLE_LICENSE_HEADER_END@
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "IOHIDElementCache.h"
+
+#define kIOHIDElementCacheMagic         0x48494445  /* 'HIDE' */
+#define kIOHIDElementCacheVersion       2
+#define kIOHIDElementCacheMaxRecords    0x10000
+#define kIOHIDElementCacheMaxDescriptor 0x10000
+#define kIOHIDElementCacheMaxVersion    0x100
+
+/*
+ * On-disk layout, in host byte order since the cache never leaves the
+ * machine: header, kernel version string, descriptor bytes, element
+ * records, report handler records.
+ */
+typedef struct IOHIDElementCacheHeader {
+    uint32_t    magic;
+    uint32_t    version;
+    uint64_t    descriptorHash;
+    uint32_t    descriptorLength;
+    uint32_t    recordSize;
+    uint32_t    elementCount;
+    uint32_t    reportHandlerCount;
+    uint32_t    kernelVersionLength;
+    uint32_t    reserved;
+} IOHIDElementCacheHeader;
+
+// Anyone who can write to the cache could hand every client forged
+// element tables, so only root may own the entries and the directory.
+static int __IOHIDElementCacheIsTrusted(const struct stat * info)
+{
+    return (info->st_uid == 0) && !(info->st_mode & (S_IWGRP | S_IWOTH));
+}
+
+static int __IOHIDElementCacheCheckDirectory(const char * directory)
+{
+    struct stat info;
+
+    if ( stat(directory, &info) || !S_ISDIR(info.st_mode) || !__IOHIDElementCacheIsTrusted(&info) )
+        return -1;
+
+    return 0;
+}
+
+static int __IOHIDElementCacheCopyPath(const char * directory, uint64_t hash, char * path, size_t pathLength)
+{
+    int length = snprintf(path, pathLength, "%s/%016llx.hidelements", directory, (unsigned long long)hash);
+
+    return ((length > 0) && ((size_t)length < pathLength)) ? 0 : -1;
+}
+
+static int __IOHIDElementCacheRead(int fd, void * buffer, size_t length)
+{
+    uint8_t * next = (uint8_t *)buffer;
+
+    while ( length ) {
+        ssize_t count = read(fd, next, length);
+
+        if ( count < 0 && errno == EINTR )
+            continue;
+        if ( count <= 0 )
+            return -1;
+
+        next    += count;
+        length  -= count;
+    }
+
+    return 0;
+}
+
+static int __IOHIDElementCacheWrite(int fd, const void * buffer, size_t length)
+{
+    const uint8_t * next = (const uint8_t *)buffer;
+
+    while ( length ) {
+        ssize_t count = write(fd, next, length);
+
+        if ( count < 0 && errno == EINTR )
+            continue;
+        if ( count <= 0 )
+            return -1;
+
+        next    += count;
+        length  -= count;
+    }
+
+    return 0;
+}
+
+//---------------------------------------------------------------------------
+// IOHIDElementCacheIsEnabled
+//---------------------------------------------------------------------------
+int IOHIDElementCacheIsEnabled(const char * directory)
+{
+    return !__IOHIDElementCacheCheckDirectory(directory);
+}
+
+//---------------------------------------------------------------------------
+// IOHIDElementCacheHashDescriptor
+//
+// 64 bit FNV-1a over the version string, its terminator and the
+// descriptor.  It only selects the file; the version and descriptor stored
+// in the entry are what decide a hit.
+//---------------------------------------------------------------------------
+uint64_t IOHIDElementCacheHashDescriptor(const char * version, const void * descriptor, size_t length)
+{
+    const uint8_t * bytes   = (const uint8_t *)version;
+    uint64_t        hash    = 0xcbf29ce484222325ULL;
+    size_t          index;
+
+    do {
+        hash ^= *bytes;
+        hash *= 0x100000001b3ULL;
+    } while ( *bytes++ );
+
+    bytes = (const uint8_t *)descriptor;
+
+    for ( index = 0; index < length; index++ ) {
+        hash ^= bytes[index];
+        hash *= 0x100000001b3ULL;
+    }
+
+    return hash;
+}
+
+//---------------------------------------------------------------------------
+// IOHIDElementCacheCopyEntry
+//---------------------------------------------------------------------------
+int IOHIDElementCacheCopyEntry(const char * directory, const char * version, const void * descriptor, size_t length, uint32_t recordSize, IOHIDElementCacheEntry * entry)
+{
+    IOHIDElementCacheHeader header;
+    struct stat             info;
+    char                    path[PATH_MAX];
+    uint8_t *               cachedDescriptor    = NULL;
+    void *                  records             = NULL;
+    size_t                  recordsLength;
+    size_t                  versionLength;
+    uint64_t                hash;
+    int                     fd                  = -1;
+    int                     result              = -1;
+
+    if ( !directory || !version || !descriptor || !length || !recordSize || !entry )
+        return -1;
+
+    versionLength = strlen(version);
+
+    if ( (versionLength > kIOHIDElementCacheMaxVersion) || (length > kIOHIDElementCacheMaxDescriptor) )
+        return -1;
+
+    if ( __IOHIDElementCacheCheckDirectory(directory) )
+        return -1;
+
+    hash = IOHIDElementCacheHashDescriptor(version, descriptor, length);
+
+    if ( __IOHIDElementCacheCopyPath(directory, hash, path, sizeof(path)) )
+        return -1;
+
+    fd = open(path, O_RDONLY | O_NOFOLLOW);
+    if ( fd < 0 )
+        return -1;
+
+    do {
+        if ( fstat(fd, &info) || !S_ISREG(info.st_mode) || !__IOHIDElementCacheIsTrusted(&info) )
+            break;
+
+        if ( __IOHIDElementCacheRead(fd, &header, sizeof(header)) )
+            break;
+
+        if ( (header.magic != kIOHIDElementCacheMagic) ||
+             (header.version != kIOHIDElementCacheVersion) ||
+             (header.descriptorHash != hash) ||
+             (header.descriptorLength != length) ||
+             (header.kernelVersionLength != versionLength) ||
+             (header.recordSize != recordSize) ||
+             (header.elementCount > kIOHIDElementCacheMaxRecords) ||
+             (header.reportHandlerCount > kIOHIDElementCacheMaxRecords) )
+            break;
+
+        recordsLength = (size_t)recordSize * (header.elementCount + header.reportHandlerCount);
+
+        // a truncated or padded file isn't one we wrote
+        if ( (uint64_t)info.st_size != sizeof(header) + versionLength + length + recordsLength )
+            break;
+
+        cachedDescriptor = (uint8_t *)malloc(versionLength + length);
+        if ( !cachedDescriptor )
+            break;
+
+        if ( __IOHIDElementCacheRead(fd, cachedDescriptor, versionLength + length) ||
+             memcmp(cachedDescriptor, version, versionLength) ||
+             memcmp(cachedDescriptor + versionLength, descriptor, length) )
+            break;
+
+        records = malloc(recordsLength ? recordsLength : 1);
+        if ( !records )
+            break;
+
+        if ( __IOHIDElementCacheRead(fd, records, recordsLength) )
+            break;
+
+        entry->records              = records;
+        entry->recordSize           = recordSize;
+        entry->elementCount         = header.elementCount;
+        entry->reportHandlerCount   = header.reportHandlerCount;
+
+        records = NULL;
+        result  = 0;
+
+    } while ( 0 );
+
+    if ( records )
+        free(records);
+
+    if ( cachedDescriptor )
+        free(cachedDescriptor);
+
+    close(fd);
+
+    return result;
+}
+
+//---------------------------------------------------------------------------
+// IOHIDElementCacheStoreEntry
+//
+// The entry is written to a temporary file and renamed into place so that
+// concurrent readers only ever see a complete entry.
+//---------------------------------------------------------------------------
+int IOHIDElementCacheStoreEntry(const char * directory, const char * version, const void * descriptor, size_t length, const IOHIDElementCacheEntry * entry)
+{
+    IOHIDElementCacheHeader header;
+    char                    path[PATH_MAX];
+    char                    tempPath[PATH_MAX];
+    size_t                  recordsLength;
+    size_t                  versionLength;
+    int                     fd;
+    int                     result  = -1;
+
+    if ( !directory || !version || !descriptor || !length || !entry || !entry->recordSize )
+        return -1;
+
+    // entries written by anyone else would be ignored
+    if ( geteuid() != 0 )
+        return -1;
+
+    versionLength = strlen(version);
+
+    if ( (versionLength > kIOHIDElementCacheMaxVersion) ||
+         (length > kIOHIDElementCacheMaxDescriptor) ||
+         (entry->elementCount > kIOHIDElementCacheMaxRecords) ||
+         (entry->reportHandlerCount > kIOHIDElementCacheMaxRecords) )
+        return -1;
+
+    recordsLength = (size_t)entry->recordSize * (entry->elementCount + entry->reportHandlerCount);
+
+    if ( recordsLength && !entry->records )
+        return -1;
+
+    if ( __IOHIDElementCacheCheckDirectory(directory) )
+        return -1;
+
+    memset(&header, 0, sizeof(header));
+    header.magic                = kIOHIDElementCacheMagic;
+    header.version              = kIOHIDElementCacheVersion;
+    header.descriptorHash       = IOHIDElementCacheHashDescriptor(version, descriptor, length);
+    header.descriptorLength     = (uint32_t)length;
+    header.recordSize           = entry->recordSize;
+    header.elementCount         = entry->elementCount;
+    header.reportHandlerCount   = entry->reportHandlerCount;
+    header.kernelVersionLength  = (uint32_t)versionLength;
+
+    if ( __IOHIDElementCacheCopyPath(directory, header.descriptorHash, path, sizeof(path)) )
+        return -1;
+
+    if ( snprintf(tempPath, sizeof(tempPath), "%s.XXXXXX", path) >= (int)sizeof(tempPath) )
+        return -1;
+
+    fd = mkstemp(tempPath);
+    if ( fd < 0 )
+        return -1;
+
+    fchmod(fd, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+
+    if ( !__IOHIDElementCacheWrite(fd, &header, sizeof(header)) &&
+         !__IOHIDElementCacheWrite(fd, version, versionLength) &&
+         !__IOHIDElementCacheWrite(fd, descriptor, length) &&
+         !__IOHIDElementCacheWrite(fd, entry->records, recordsLength) )
+        result = 0;
+
+    if ( close(fd) )
+        result = -1;
+
+    if ( !result && rename(tempPath, path) )
+        result = -1;
+
+    if ( result )
+        unlink(tempPath);
+
+    return result;
+}
+
+//---------------------------------------------------------------------------
+// IOHIDElementCacheReleaseEntry
+//---------------------------------------------------------------------------
+void IOHIDElementCacheReleaseEntry(IOHIDElementCacheEntry * entry)
+{
+    if ( !entry )
+        return;
+
+    if ( entry->records )
+        free(entry->records);
+
+    memset(entry, 0, sizeof(*entry));
+}
@@ -0,0 +1,73 @@
+/*
+ *
+ * @APPLE_LICENSE_HEADER_START@
+ *
+ * Copyright (c) 1999-2003 Apple Computer, Inc.  All Rights Reserved.
+ *
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this
+ * file.
+ *
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ *
+ * @APPLE_LICENSE_HEADER_END@
+ */
+
+#ifndef _IOKIT_HID_IOHIDELEMENTCACHE_H
+#define _IOKIT_HID_IOHIDELEMENTCACHE_H
+
+#include <sys/cdefs.h>
+#include <stddef.h>
+#include <stdint.h>
+
+__BEGIN_DECLS
+
+/*
+ * Persistent cache of the element tables the kernel builds for a report
+ * descriptor.  Entries are keyed by a hash of the kernel version string
+ * (the IOHIDFamily bundle version) and the descriptor, and hold both, so
+ * devices of the same model share one entry, a kext update invalidates
+ * it, and a hash collision can never return another model's elements.
+ * The descriptor can be passed as a digest of it (IOHIDLib uses the SHA-1
+ * the kernel returns), which saves copying it out of the registry.
+ * The records are opaque to the cache; only their size is checked, so
+ * callers must validate their contents.  Entries and the directory must
+ * be owned by root and not writable by group or others.  This file only
+ * depends on POSIX so that it can be built and exercised off-device.
+ */
+
+/* Cache is only used when this directory exists */
+#define kIOHIDElementCacheDefaultDirectory  "/Library/Caches/com.apple.iokit.IOHIDLib"
+
+typedef struct IOHIDElementCacheEntry {
+    void *      records;            /* elementCount records, then reportHandlerCount records */
+    uint32_t    recordSize;
+    uint32_t    elementCount;
+    uint32_t    reportHandlerCount;
+} IOHIDElementCacheEntry;
+
+/* Non-zero if directory exists and is trusted; check this before gathering a key */
+int         IOHIDElementCacheIsEnabled(const char * directory);
+
+uint64_t    IOHIDElementCacheHashDescriptor(const char * version, const void * descriptor, size_t length);
+
+/* Returns 0 and fills in entry on a hit; release it with IOHIDElementCacheReleaseEntry */
+int         IOHIDElementCacheCopyEntry(const char * directory, const char * version, const void * descriptor, size_t length, uint32_t recordSize, IOHIDElementCacheEntry * entry);
+
+/* Returns 0 once the entry is written; an existing entry is replaced atomically.  Only root can store entries. */
+int         IOHIDElementCacheStoreEntry(const char * directory, const char * version, const void * descriptor, size_t length, const IOHIDElementCacheEntry * entry);
+
+void        IOHIDElementCacheReleaseEntry(IOHIDElementCacheEntry * entry);
+
+__END_DECLS
+
+#endif /* _IOKIT_HID_IOHIDELEMENTCACHE_H */
@@ -26,6 +26,7 @@
 #include "IOHIDEventServiceUserClient.h"
 #include "IOHIDEventData.h"
 #include <dispatch/private.h>
+#include <libkern/OSAtomic.h>
 #include <IOKit/hid/IOHIDUsageTables.h>
 #include <IOKit/hid/IOHIDServiceKeys.h>
 #include <IOKit/hid/IOHIDKeys.h>
@@ -81,6 +82,21 @@ IOHIDServiceInterface2 IOHIDEventServiceClass::sIOHIDServiceInterface2 =
     &IOHIDEventServiceClass::_setOutputEvent
 };
 
+IOHIDServicePrivateInterface IOHIDEventServiceClass::sIOHIDServicePrivateInterface =
+{
+    0,
+    &IOHIDIUnknown::genericQueryInterface,
+    &IOHIDIUnknown::genericAddRef,
+    &IOHIDIUnknown::genericRelease,
+    &IOHIDEventServiceClass::_setEventBatchCallback,
+    &IOHIDEventServiceClass::_setEventViewCallback,
+    &IOHIDEventServiceClass::_getEventViewTimeStamp,
+    &IOHIDEventServiceClass::_getEventViewSenderID,
+    &IOHIDEventServiceClass::_getEventViewEventData,
+    &IOHIDEventServiceClass::_getEventViewIntegerValue,
+    &IOHIDEventServiceClass::_copyEventFromView
+};
+
 //===========================================================================
 // CONSTRUCTOR / DESTRUCTOR methods
 //===========================================================================
@@ -91,6 +107,8 @@ IOHIDEventServiceClass::IOHIDEventServiceClass() : IOHIDIUnknown(&sIOCFPlugInInt
 {
     _hidService.pseudoVTable    = NULL;
     _hidService.obj             = this;
+    _hidServicePrivate.pseudoVTable = (IUnknownVTbl *)  &sIOHIDServicePrivateInterface;
+    _hidServicePrivate.obj          = this;
     
     _service                    = MACH_PORT_NULL;
     _connect                    = MACH_PORT_NULL;
@@ -105,8 +123,18 @@ IOHIDEventServiceClass::IOHIDEventServiceClass() : IOHIDIUnknown(&sIOCFPlugInInt
     _eventTarget                = NULL;
     _eventRefcon                = NULL;
     
+    _eventBatchCallback         = NULL;
+    _eventBatchTarget           = NULL;
+    _eventBatchRefcon           = NULL;
+    
+    _eventViewCallback          = NULL;
+    _eventViewTarget            = NULL;
+    _eventViewRefcon            = NULL;
+    
     _queueMappedMemory          = NULL;
     _queueMappedMemorySize      = 0;    
+    
+    _dispatchQueue              = NULL;
 }
 
 //---------------------------------------------------------------------------
@@ -218,6 +246,41 @@ void IOHIDEventServiceClass::_unscheduleFromDispatchQueue(void *self, dispatch_q
     return getThis(self)->unscheduleFromDispatchQueue(queue);
 }
 
+void IOHIDEventServiceClass::_setEventBatchCallback(void * self, IOHIDServiceEventBatchCallback callback, void * target, void * refcon)
+{
+    getThis(self)->setEventBatchCallback(callback, target, refcon);
+}
+
+void IOHIDEventServiceClass::_setEventViewCallback(void * self, IOHIDServiceEventViewCallback callback, void * target, void * refcon)
+{
+    getThis(self)->setEventViewCallback(callback, target, refcon);
+}
+
+uint64_t IOHIDEventServiceClass::_getEventViewTimeStamp(void * self __unused, const IOHIDEventView * view)
+{
+    return IOHIDEventViewGetTimeStamp(view);
+}
+
+uint64_t IOHIDEventServiceClass::_getEventViewSenderID(void * self __unused, const IOHIDEventView * view)
+{
+    return IOHIDEventViewGetSenderID(view);
+}
+
+const IOHIDEventData * IOHIDEventServiceClass::_getEventViewEventData(void * self __unused, const IOHIDEventView * view, IOHIDEventType type)
+{
+    return IOHIDEventViewGetEventData(view, type);
+}
+
+CFIndex IOHIDEventServiceClass::_getEventViewIntegerValue(void * self __unused, const IOHIDEventView * view, IOHIDEventField field)
+{
+    return IOHIDEventViewGetIntegerValue(view, field);
+}
+
+IOHIDEventRef IOHIDEventServiceClass::_copyEventFromView(void * self __unused, CFAllocatorRef allocator, const IOHIDEventView * view)
+{
+    return IOHIDEventViewCopyEvent(allocator, view);
+}
+
 //++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
 // IOHIDEventServiceClass::_queueEventSourceCallback
 //++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
@@ -247,8 +310,29 @@ user_exit:
     CFAllocatorDeallocate(kCFAllocatorSystemDefault, msg);
 }
 
+//------------------------------------------------------------------------------
+// IOHIDEventServiceClass::_dequeueHIDEventsContinuation
+//------------------------------------------------------------------------------
+void IOHIDEventServiceClass::_dequeueHIDEventsContinuation(void * info)
+{
+    IOHIDEventServiceClass * self = (IOHIDEventServiceClass*)info;
+    
+    // don't pick the queue back up once we've been unscheduled
+    if ( self->_asyncEventSource )
+        self->dequeueHIDEvents();
+        
+    // drop the reference taken when the continuation was queued
+    self->release();
+}
+
 //------------------------------------------------------------------------------
 // IOHIDEventServiceClass::dequeueHIDEvents
+//
+// Events are parsed into a batch on the stack and delivered kHIDEventBatchMax
+// at a time.  When scheduled on a dispatch queue, a full pass yields the
+// queue and picks up the remaining entries from a continuation so that a
+// busy service can't hold the queue indefinitely.  The batch isn't shared
+// with other dequeues, e.g. the one close() runs to drain the queue.
 //------------------------------------------------------------------------------
 void IOHIDEventServiceClass::dequeueHIDEvents(boolean_t suppress)
 {
@@ -259,25 +343,117 @@ void IOHIDEventServiceClass::dequeueHIDEvents(boolean_t suppress)
         // check entry size
         IODataQueueEntry *  nextEntry;
         uint32_t            dataSize;
+        CFIndex             count;
+        IOHIDEventRef       events[kHIDEventBatchMax];
 
-        // if queue empty, then stop
-        while ((nextEntry = IODataQueuePeek(_queueMappedMemory))) {
-            if ( !suppress ) {
-                IOHIDEventRef event = IOHIDEventCreateWithBytes(kCFAllocatorDefault, (const UInt8*)&(nextEntry->data), nextEntry->size);
-
-                if ( event ) {
-                    dispatchHIDEvent(event);
-                    CFRelease(event);
+        do {
+            count = 0;
+            
+            // views read the events in place and skip the copy entirely
+            if ( !suppress && _eventViewCallback ) {
+                count = dispatchHIDEventViews();
+            }
+            
+            // if queue empty, then stop
+            else while ((count < kHIDEventBatchMax) && (nextEntry = IODataQueuePeek(_queueMappedMemory))) {
+                if ( !suppress ) {
+                    IOHIDEventRef event = IOHIDEventCreateWithBytes(kCFAllocatorDefault, (const UInt8*)&(nextEntry->data), nextEntry->size);
+
+                    if ( event )
+                        events[count++] = event;
+                } 
+                else {
+                    count++;
                 }
+                
+                // dequeue the item
+                dataSize = 0;
+                IODataQueueDequeue(_queueMappedMemory, NULL, &dataSize);
             }
             
-            // dequeue the item
-            dataSize = 0;
-            IODataQueueDequeue(_queueMappedMemory, NULL, &dataSize);
-        }
+            if ( !suppress && count )
+                dispatchHIDEventBatch(events, count);
+                
+            if ( (count == kHIDEventBatchMax) && !suppress && _dispatchQueue && IODataQueueDataAvailable(_queueMappedMemory) ) {
+                // keep this object alive until the continuation has run
+                addRef();
+                dispatch_async_f(_dispatchQueue, this, _dequeueHIDEventsContinuation);
+                break;
+            }
+            
+        } while ( count == kHIDEventBatchMax );
+        
     } while ( 0 );
 }
 
+//------------------------------------------------------------------------------
+// IOHIDEventServiceClass::dispatchHIDEventViews
+//
+// Hands up to kHIDEventBatchMax events to the view callback without copying
+// them out of the queue.  The head only moves past them once the callback
+// returns, so the kernel can't overwrite an entry that's being read.
+//------------------------------------------------------------------------------
+CFIndex IOHIDEventServiceClass::dispatchHIDEventViews()
+{
+    uint32_t        head        = _queueMappedMemory->head;
+    uint32_t        tail        = _queueMappedMemory->tail;
+    uint32_t        queueSize   = _queueMappedMemory->queueSize;
+    CFIndex         count       = 0;
+    IOHIDEventView  views[kHIDEventBatchMax];
+    
+    // don't read entry contents ahead of the tail that published them
+    OSMemoryBarrier();
+    
+    while ( (count < kHIDEventBatchMax) && (head != tail) ) {
+        IODataQueueEntry * entry = (IODataQueueEntry *)((uint8_t *)_queueMappedMemory->queue + head);
+        
+        // the producer wraps to the start when an entry doesn't fit at the end
+        if ( (head + DATA_QUEUE_ENTRY_HEADER_SIZE > queueSize) || 
+             (head + entry->size + DATA_QUEUE_ENTRY_HEADER_SIZE > queueSize) ) {
+            entry   = _queueMappedMemory->queue;
+            head    = 0;
+        }
+        
+        views[count].bytes  = (const uint8_t *)&(entry->data);
+        views[count].length = entry->size;
+        count++;
+        
+        head += entry->size + DATA_QUEUE_ENTRY_HEADER_SIZE;
+    }
+    
+    if ( count ) {
+        (*_eventViewCallback)(_eventViewTarget, _eventViewRefcon, (void *)&_hidService, views, count, 0);
+        
+        // finish reading the entries before the kernel may overwrite them
+        OSMemoryBarrier();
+        _queueMappedMemory->head = head;
+    }
+    
+    return count;
+}
+
+//------------------------------------------------------------------------------
+// IOHIDEventServiceClass::dispatchHIDEventBatch
+//
+// Hands count events to the batch callback, or to the event callback one at
+// a time if there isn't one, and releases them.
+//------------------------------------------------------------------------------
+void IOHIDEventServiceClass::dispatchHIDEventBatch(IOHIDEventRef * events, CFIndex count)
+{
+    CFIndex index;
+    
+    if ( _eventBatchCallback ) {
+        (*_eventBatchCallback)(_eventBatchTarget, _eventBatchRefcon, (void *)&_hidService, events, count, 0);
+    } 
+    else {
+        for ( index = 0; index < count; index++ )
+            dispatchHIDEvent(events[index]);
+    }
+    
+    for ( index = 0; index < count; index++ )
+        CFRelease(events[index]);
+}
+
 
 //------------------------------------------------------------------------------
 // IOHIDEventServiceClass::dispatchHIDEvent
@@ -323,6 +499,11 @@ HRESULT IOHIDEventServiceClass::queryInterface(REFIID iid, void **ppv)
         *ppv = &_hidService;
         addRef();
     }
+    else if (CFEqual(uuid, kIOHIDServicePrivateInterfaceID))
+    {
+        *ppv = &_hidServicePrivate;
+        addRef();
+    }
     else {
         *ppv = 0;
     }
@@ -677,6 +858,26 @@ void IOHIDEventServiceClass::setEventCallback(IOHIDServiceEventCallback callback
     _eventRefcon    = refcon;
 }
 
+//---------------------------------------------------------------------------
+// IOHIDEventServiceClass::setEventBatchCallback
+//---------------------------------------------------------------------------
+void IOHIDEventServiceClass::setEventBatchCallback(IOHIDServiceEventBatchCallback callback, void * target, void * refcon)
+{
+    _eventBatchCallback = callback;
+    _eventBatchTarget   = target;
+    _eventBatchRefcon   = refcon;
+}
+
+//---------------------------------------------------------------------------
+// IOHIDEventServiceClass::setEventViewCallback
+//---------------------------------------------------------------------------
+void IOHIDEventServiceClass::setEventViewCallback(IOHIDServiceEventViewCallback callback, void * target, void * refcon)
+{
+    _eventViewCallback  = callback;
+    _eventViewTarget    = target;
+    _eventViewRefcon    = refcon;
+}
+
 //---------------------------------------------------------------------------
 // IOHIDEventServiceClass::scheduleWithDispatchQueue
 //---------------------------------------------------------------------------
@@ -704,6 +905,8 @@ void IOHIDEventServiceClass::scheduleWithDispatchQueue(dispatch_queue_t dispatch
     }
     dispatch_resume(_asyncEventSource);
     
+    _dispatchQueue = dispatchQueue;
+    
     dispatch_async(dispatchQueue, ^{
         dequeueHIDEvents();
     });    
@@ -718,6 +921,102 @@ void IOHIDEventServiceClass::unscheduleFromDispatchQueue(dispatch_queue_t queue
         dispatch_release(_asyncEventSource);
         _asyncEventSource = NULL;
     }
+    
+    _dispatchQueue = NULL;
+}
+
+//===========================================================================
+// IOHIDEventView Accessors
+//===========================================================================
+static const IOHIDSystemQueueElement * IOHIDEventViewGetQueueElement(const IOHIDEventView * view)
+{
+    if ( !view || !view->bytes || (view->length < sizeof(IOHIDSystemQueueElement)) )
+        return NULL;
+        
+    return (const IOHIDSystemQueueElement *)view->bytes;
+}
+
+uint64_t IOHIDEventViewGetTimeStamp(const IOHIDEventView * view)
+{
+    const IOHIDSystemQueueElement * element = IOHIDEventViewGetQueueElement(view);
+    
+    return element ? element->timeStamp : 0;
+}
+
+uint64_t IOHIDEventViewGetSenderID(const IOHIDEventView * view)
+{
+    const IOHIDSystemQueueElement * element = IOHIDEventViewGetQueueElement(view);
+    
+    return element ? element->senderID : 0;
+}
+
+//---------------------------------------------------------------------------
+// IOHIDEventViewGetEventData
+//
+// Returns the first event of the given type in the view, walking the
+// primary event and its children in place.
+//---------------------------------------------------------------------------
+const IOHIDEventData * IOHIDEventViewGetEventData(const IOHIDEventView * view, IOHIDEventType type)
+{
+    const IOHIDSystemQueueElement * element = IOHIDEventViewGetQueueElement(view);
+    const uint8_t *                 end;
+    const uint8_t *                 next;
+    uint32_t                        index;
+    
+    if ( !element )
+        return NULL;
+        
+    end     = view->bytes + view->length;
+    next    = element->payload + element->attributeLength;
+    
+    for ( index = 0; index < element->eventCount; index++ ) {
+        const IOHIDEventData * eventData = (const IOHIDEventData *)next;
+        
+        if ( (next + sizeof(IOHIDEventData) > end) || (eventData->size < sizeof(IOHIDEventData)) || (next + eventData->size > end) )
+            break;
+            
+        if ( eventData->type == type )
+            return eventData;
+            
+        next += eventData->size;
+    }
+    
+    return NULL;
+}
+
+CFIndex IOHIDEventViewGetIntegerValue(const IOHIDEventView * view, IOHIDEventField field)
+{
+    IOHIDEventType          fieldEvType = IOHIDEventFieldEventType(field);
+    uint32_t                fieldOffset = IOHIDEventFieldOffset(field);
+    const IOHIDEventData *  eventData;
+    CFIndex                 value       = 0;
+    
+    // field type NULL refers to the primary event
+    if ( fieldEvType == kIOHIDEventTypeNULL ) {
+        const IOHIDSystemQueueElement * element = IOHIDEventViewGetQueueElement(view);
+        
+        if ( !element || !element->eventCount || (element->payload + element->attributeLength + sizeof(IOHIDEventData) > view->bytes + view->length) )
+            return 0;
+            
+        eventData = (const IOHIDEventData *)(element->payload + element->attributeLength);
+    } 
+    else {
+        eventData = IOHIDEventViewGetEventData(view, fieldEvType);
+    }
+    
+    if ( eventData ) {
+        GET_EVENTDATA_VALUE(eventData, fieldEvType, fieldOffset, value, false);
+    }
+    
+    return value;
+}
+
+IOHIDEventRef IOHIDEventViewCopyEvent(CFAllocatorRef allocator, const IOHIDEventView * view)
+{
+    if ( !view || !view->bytes )
+        return NULL;
+        
+    return IOHIDEventCreateWithBytes(allocator, view->bytes, view->length);
 }
 
 //===========================================================================
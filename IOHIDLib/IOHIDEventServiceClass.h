@@ -28,6 +28,17 @@
 #include <IOKit/hid/IOHIDServicePlugIn.h>
 #include <IOKit/IODataQueueClient.h>
 #include "IOHIDIUnknown.h"
+#include "IOHIDLibPlugInPrivate.h"
+#include "IOHIDEventData.h"
+
+// Maximum number of events parsed and delivered by one dequeue pass
+#define kHIDEventBatchMax   32
+
+uint64_t                IOHIDEventViewGetTimeStamp(const IOHIDEventView * view);
+uint64_t                IOHIDEventViewGetSenderID(const IOHIDEventView * view);
+const IOHIDEventData *  IOHIDEventViewGetEventData(const IOHIDEventView * view, IOHIDEventType type);
+CFIndex                 IOHIDEventViewGetIntegerValue(const IOHIDEventView * view, IOHIDEventField field);
+IOHIDEventRef           IOHIDEventViewCopyEvent(CFAllocatorRef allocator, const IOHIDEventView * view);
 
 class IOHIDEventServiceClass : public IOHIDIUnknown
 {
@@ -42,8 +53,10 @@ protected:
 
     static IOCFPlugInInterface          sIOCFPlugInInterfaceV1;
     static IOHIDServiceInterface2       sIOHIDServiceInterface2;
+    static IOHIDServicePrivateInterface sIOHIDServicePrivateInterface;
 
     struct InterfaceMap                 _hidService;
+    struct InterfaceMap                 _hidServicePrivate;
     io_service_t                        _service;
     io_connect_t                        _connect;
     bool                                _isOpen;
@@ -59,6 +72,14 @@ protected:
     void *                              _eventTarget;
     void *                              _eventRefcon;
 
+    IOHIDServiceEventBatchCallback      _eventBatchCallback;
+    void *                              _eventBatchTarget;
+    void *                              _eventBatchRefcon;
+
+    IOHIDServiceEventViewCallback       _eventViewCallback;
+    void *                              _eventViewTarget;
+    void *                              _eventViewRefcon;
+
     IODataQueueMemory *                 _queueMappedMemory;
     vm_size_t                           _queueMappedMemorySize;
         
@@ -82,10 +103,22 @@ protected:
     static void             _setEventCallback(void *self, IOHIDServiceEventCallback callback, void * target, void * refcon);
     static void             _scheduleWithDispatchQueue(void *self, dispatch_queue_t queue);
     static void             _unscheduleFromDispatchQueue(void *self, dispatch_queue_t queue);
+
+    // IOHIDServicePrivateInterface methods
+    static void             _setEventBatchCallback(void *self, IOHIDServiceEventBatchCallback callback, void * target, void * refcon);
+    static void             _setEventViewCallback(void *self, IOHIDServiceEventViewCallback callback, void * target, void * refcon);
+    static uint64_t         _getEventViewTimeStamp(void *self, const IOHIDEventView * view);
+    static uint64_t         _getEventViewSenderID(void *self, const IOHIDEventView * view);
+    static const IOHIDEventData * _getEventViewEventData(void *self, const IOHIDEventView * view, IOHIDEventType type);
+    static CFIndex          _getEventViewIntegerValue(void *self, const IOHIDEventView * view, IOHIDEventField field);
+    static IOHIDEventRef    _copyEventFromView(void *self, CFAllocatorRef allocator, const IOHIDEventView * view);
     
     // Support methods
     static void             _queueEventSourceCallback(void * info);
+    static void             _dequeueHIDEventsContinuation(void * info);
     void                    dequeueHIDEvents(boolean_t suppress=false);
+    void                    dispatchHIDEventBatch(IOHIDEventRef * events, CFIndex count);
+    CFIndex                 dispatchHIDEventViews();
     void                    dispatchHIDEvent(IOHIDEventRef event, IOOptionBits options=0);
 
     CFDictionaryRef         createFixedProperties(CFDictionaryRef floatProperties);
@@ -105,6 +138,8 @@ public:
     virtual IOHIDEventRef   copyEvent(IOHIDEventType type, IOHIDEventRef matching, IOOptionBits options);
     virtual IOReturn        setOutputEvent(IOHIDEventRef event);
     virtual void            setEventCallback(IOHIDServiceEventCallback callback, void * target, void * refcon);
+    virtual void            setEventBatchCallback(IOHIDServiceEventBatchCallback callback, void * target, void * refcon);
+    virtual void            setEventViewCallback(IOHIDServiceEventViewCallback callback, void * target, void * refcon);
     virtual void            scheduleWithDispatchQueue(dispatch_queue_t queue);
     virtual void            unscheduleFromDispatchQueue(dispatch_queue_t queue);
 };
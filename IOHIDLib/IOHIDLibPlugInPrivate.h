@@ -0,0 +1,294 @@
+/*
+ *
+ * @APPLE_LICENSE_HEADER_START@
+ *
+ * Copyright (c) 1999-2003 Apple Computer, Inc.  All Rights Reserved.
+ *
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this
+ * file.
+ *
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ *
+ * @APPLE_LICENSE_HEADER_END@
+ */
+
+#ifndef _IOKIT_HID_IOHIDLIBPLUGINPRIVATE_H_
+#define _IOKIT_HID_IOHIDLIBPLUGINPRIVATE_H_
+
+#include <sys/cdefs.h>
+
+__BEGIN_DECLS
+#include <CoreFoundation/CoreFoundation.h>
+#if COREFOUNDATION_CFPLUGINCOM_SEPARATE
+#include <CoreFoundation/CFPlugInCOM.h>
+#endif
+
+#include <IOKit/IOTypes.h>
+#include <IOKit/IOReturn.h>
+
+#include <IOKit/hid/IOHIDKeys.h>
+#include <IOKit/hid/IOHIDServicePlugIn.h>
+
+/* 19805470-B723-49D0-957B-7452D9011861 */
+/*! @defined kIOHIDDevicePrivateInterfaceID
+    @discussion Interface ID for the IOHIDDevicePrivateInterface.  Obtained
+                with QueryInterface on an IOHIDDeviceDeviceInterface. */
+#define kIOHIDDevicePrivateInterfaceID CFUUIDGetConstantUUIDWithBytes(NULL, \
+    0x19, 0x80, 0x54, 0x70, 0xB7, 0x23, 0x49, 0xD0,			\
+    0x95, 0x7B, 0x74, 0x52, 0xD9, 0x01, 0x18, 0x61)
+
+/*! @typedef IOHIDReportRecord
+    @discussion Input report delivered in place from the report handler
+                queue.  The report pointer is only valid until the callback
+                returns.
+*/
+typedef struct IOHIDReportRecord {
+    uint32_t                        reportID;
+    uint8_t *                       report;
+    CFIndex                         reportLength;
+    uint64_t                        timeStamp;
+} IOHIDReportRecord;
+
+/*! @typedef IOHIDReportBatchCallback
+    @discussion Type and arguments of callout C function that is used when
+                a batch of input reports is available, see
+                setInterruptReportBatchCallback().
+    @param context void * pointer to your data.
+    @param result Completion result of desired operation.
+    @param sender Interface instance sending the reports.
+    @param records Reports in arrival order.
+    @param count Number of records.
+*/
+typedef void (*IOHIDReportBatchCallback)(void * context, IOReturn result, void * sender,
+                                         IOHIDReportRecord * records, CFIndex count);
+
+/*! @typedef IOHIDElementSnapshot
+    @discussion Element value captured by copyReportSnapshot.  The value
+                bytes are at valueOffset in the caller's value buffer.
+*/
+typedef struct IOHIDElementSnapshot {
+    IOHIDElementCookie              cookie;
+    uint32_t                        generation;
+    uint64_t                        timeStamp;
+    uint32_t                        valueOffset;
+    uint32_t                        valueLength;
+} IOHIDElementSnapshot;
+
+typedef struct IOHIDDevicePrivateInterface
+{
+    IUNKNOWN_C_GUTS;
+
+/*! @function setInterruptReportBatchCallback
+    @abstract Sets the input report callback to a batched, zero copy one.
+    @discussion Reports are handed to the callback straight out of the
+        report handler queue.  Replaces any callback set through
+        setInterruptReportCallback.
+    @param callback Function called with each batch of reports.
+    @param refcon void * pointer passed to the callback.
+    @param options Reserved, pass 0.
+    @result Returns an IOReturn code.
+*/
+    IOReturn (*setInterruptReportBatchCallback)(void *                     self,
+                                                IOHIDReportBatchCallback   callback,
+                                                void *                     refcon,
+                                                IOOptionBits               options);
+
+/*! @function copyReportSnapshot
+    @abstract Copies every element value of a report without a syscall.
+    @discussion The values are read from the element memory shared with
+        the kernel and are retried until they are consistent with each
+        other.  The device must be open.
+    @param reportType Type of the report.
+    @param reportID ID of the report.
+    @param snapshots Array that receives one entry per element.
+    @param pCount On input, the capacity of snapshots.  On output, the
+        number of entries filled in, or needed on kIOReturnNoSpace.
+    @param values Buffer that receives the value bytes.
+    @param pValuesLength On input, the size of values.  On output, the
+        bytes used, or needed on kIOReturnNoSpace.
+    @result Returns an IOReturn code.
+*/
+    IOReturn (*copyReportSnapshot)(void *                     self,
+                                   IOHIDReportType            reportType,
+                                   uint32_t                   reportID,
+                                   IOHIDElementSnapshot *     snapshots,
+                                   CFIndex *                  pCount,
+                                   uint8_t *                  values,
+                                   CFIndex *                  pValuesLength);
+} IOHIDDevicePrivateInterface;
+
+/* 7DBE5D98-50CB-485C-AACB-BE587146B066 */
+/*! @defined kIOHIDQueuePrivateInterfaceID
+    @discussion Interface ID for the IOHIDQueuePrivateInterface.  Obtained
+                with QueryInterface on an IOHIDDeviceQueueInterface. */
+#define kIOHIDQueuePrivateInterfaceID CFUUIDGetConstantUUIDWithBytes(NULL, \
+    0x7D, 0xBE, 0x5D, 0x98, 0x50, 0xCB, 0x48, 0x5C,			\
+    0xAA, 0xCB, 0xBE, 0x58, 0x71, 0x46, 0xB0, 0x66)
+
+/*! @typedef IOHIDQueueValueBatchCallback
+    @discussion Type and arguments of callout C function that is used when
+                a batch of values is dequeued, see setValueBatchCallback().
+    @param context void * pointer to your data.
+    @param result Completion result of desired operation.
+    @param sender Interface instance sending the values.
+    @param values Values in queue order.  They are released once the
+                callback returns; retain any that are kept.
+    @param count Number of values.
+*/
+typedef void (*IOHIDQueueValueBatchCallback)(void * context, IOReturn result, void * sender,
+                                             IOHIDValueRef * values, CFIndex count);
+
+typedef struct IOHIDQueuePrivateInterface
+{
+    IUNKNOWN_C_GUTS;
+
+/*! @function copyNextEventValues
+    @abstract Dequeues up to maxCount values in one call.
+    @discussion The values of a batch are created together, so draining a
+        queue this way costs one call and one allocator round trip per
+        batch instead of per value.  The caller releases each value.
+    @param pValues Array that receives the values.
+    @param maxCount Capacity of pValues.
+    @param pCount Number of values returned.
+    @param options Reserved, pass 0.
+    @result Returns kIOReturnUnderrun if the queue was empty.
+*/
+    IOReturn (*copyNextEventValues)(void *                 self,
+                                    IOHIDValueRef *        pValues,
+                                    CFIndex                maxCount,
+                                    CFIndex *              pCount,
+                                    IOOptionBits           options);
+
+/*! @function setValueBatchCallback
+    @abstract Sets a callback that drains the queue in batches.
+    @discussion While set, the queue's event source dequeues the values
+        itself and hands them to this callback instead of calling the one
+        set through setEventCallback.  Pass NULL to go back to that one.
+    @param callback Function called with each batch of values.
+    @param refcon void * pointer passed to the callback.
+*/
+    IOReturn (*setValueBatchCallback)(void *                         self,
+                                      IOHIDQueueValueBatchCallback   callback,
+                                      void *                         refcon);
+} IOHIDQueuePrivateInterface;
+
+/* 42185EA7-99E1-414A-8D15-39B490BF53B4 */
+/*! @defined kIOHIDServicePrivateInterfaceID
+    @discussion Interface ID for the IOHIDServicePrivateInterface.  Obtained
+                with QueryInterface on an IOHIDServiceInterface2. */
+#define kIOHIDServicePrivateInterfaceID CFUUIDGetConstantUUIDWithBytes(NULL, \
+    0x42, 0x18, 0x5E, 0xA7, 0x99, 0xE1, 0x41, 0x4A,			\
+    0x8D, 0x15, 0x39, 0xB4, 0x90, 0xBF, 0x53, 0xB4)
+
+/*! @typedef IOHIDServiceEventBatchCallback
+    @discussion Type and arguments of callout C function that is used when
+                a batch of events is dequeued, see setEventBatchCallback().
+    @param target void * pointer to your data, often a pointer to an object.
+    @param refcon void * pointer to more data.
+    @param sender Interface instance sending the events.
+    @param events Events in queue order.  They are released once the
+                callback returns; retain any that are kept.
+    @param count Number of events.
+    @param options Reserved.
+*/
+typedef void (*IOHIDServiceEventBatchCallback)(void * target, void * refcon, void * sender, IOHIDEventRef * events, CFIndex count, IOOptionBits options);
+
+/*! @typedef IOHIDEventView
+    @discussion Zero copy view of an event in the service's mapped event
+                queue.  A view is only valid for the duration of the
+                callback it was passed to; copyEventFromView materializes
+                an event that can be kept past it.
+*/
+typedef struct IOHIDEventView {
+    const uint8_t *                     bytes;
+    uint32_t                            length;
+} IOHIDEventView;
+
+/*! @typedef IOHIDServiceEventViewCallback
+    @discussion Type and arguments of callout C function that is used when
+                events are dequeued, see setEventViewCallback().
+    @param target void * pointer to your data, often a pointer to an object.
+    @param refcon void * pointer to more data.
+    @param sender Interface instance sending the events.
+    @param views Views of the events in queue order.
+    @param count Number of views.
+    @param options Reserved.
+*/
+typedef void (*IOHIDServiceEventViewCallback)(void * target, void * refcon, void * sender, const IOHIDEventView * views, CFIndex count, IOOptionBits options);
+
+typedef struct IOHIDServicePrivateInterface
+{
+    IUNKNOWN_C_GUTS;
+
+/*! @function setEventBatchCallback
+    @abstract Sets a callback that receives dequeued events in batches.
+    @discussion While set, it's used in place of the callback set through
+        setEventCallback.  Pass NULL to go back to that one.
+    @param callback Function called with each batch of events.
+    @param target void * pointer passed to the callback.
+    @param refcon void * pointer passed to the callback.
+*/
+    void (*setEventBatchCallback)(void *                           self,
+                                  IOHIDServiceEventBatchCallback   callback,
+                                  void *                           target,
+                                  void *                           refcon);
+
+/*! @function setEventViewCallback
+    @abstract Sets a callback that reads events in place in the queue.
+    @discussion No event objects are created while it's set, and it takes
+        precedence over the batch and event callbacks.  Pass NULL to go
+        back to those.
+    @param callback Function called with each batch of views.
+    @param target void * pointer passed to the callback.
+    @param refcon void * pointer passed to the callback.
+*/
+    void (*setEventViewCallback)(void *                            self,
+                                 IOHIDServiceEventViewCallback     callback,
+                                 void *                            target,
+                                 void *                            refcon);
+
+/*! @function getEventViewTimeStamp
+    @abstract Returns the time stamp of the event in a view.
+*/
+    uint64_t (*getEventViewTimeStamp)(void * self, const IOHIDEventView * view);
+
+/*! @function getEventViewSenderID
+    @abstract Returns the sender ID of the event in a view.
+*/
+    uint64_t (*getEventViewSenderID)(void * self, const IOHIDEventView * view);
+
+/*! @function getEventViewEventData
+    @abstract Returns the first event of a type in a view.
+    @discussion Looks at the primary event and its children.  The data is
+        in the queue and shares the view's lifetime.
+    @result Returns NULL if there isn't an event of that type.
+*/
+    const struct IOHIDEventData * (*getEventViewEventData)(void * self, const IOHIDEventView * view, IOHIDEventType type);
+
+/*! @function getEventViewIntegerValue
+    @abstract Returns an integer field of the event in a view.
+    @discussion Equivalent to IOHIDEventGetIntegerValue on the event
+        copyEventFromView would create.
+*/
+    CFIndex (*getEventViewIntegerValue)(void * self, const IOHIDEventView * view, IOHIDEventField field);
+
+/*! @function copyEventFromView
+    @abstract Creates an event from a view that can be kept past the
+        callback.
+*/
+    IOHIDEventRef (*copyEventFromView)(void * self, CFAllocatorRef allocator, const IOHIDEventView * view);
+} IOHIDServicePrivateInterface;
+
+__END_DECLS
+
+#endif /* !_IOKIT_HID_IOHIDLIBPLUGINPRIVATE_H_ */
@@ -29,6 +29,7 @@
 #include <IOKit/hid/IOHIDValue.h>
 #include "IOHIDQueueClass.h"
 #include "IOHIDLibUserClient.h"
+#include "IOHIDValueSlab.h"
 
 __BEGIN_DECLS
 #include <asl.h>
@@ -37,6 +38,7 @@ __BEGIN_DECLS
 #include <mach/mach_interface.h>
 #include <IOKit/iokitmig.h>
 #include <System/libkern/OSCrossEndian.h>
+#include <libkern/OSAtomic.h>
 __END_DECLS
 
 #define ownerCheck() do {		\
@@ -79,11 +81,15 @@ __END_DECLS
     openCheck();			\
 } while (0)
 
+#define kQueueDequeueBatch  16
+
 
 IOHIDQueueClass::IOHIDQueueClass() : IOHIDIUnknown(NULL)
 {
     fHIDQueue.pseudoVTable  = (IUnknownVTbl *)  &sHIDQueueInterfaceV2;
     fHIDQueue.obj           = this;
+    fHIDQueuePrivate.pseudoVTable   = (IUnknownVTbl *)  &sHIDQueuePrivateInterface;
+    fHIDQueuePrivate.obj            = this;
     
     fAsyncPort              = MACH_PORT_NULL;
     fCFMachPort             = NULL;
@@ -99,6 +105,8 @@ IOHIDQueueClass::IOHIDQueueClass() : IOHIDIUnknown(NULL)
     fEventCallback          = NULL;
     fEventRefcon            = NULL;
     fElements               = NULL;
+    fValueBatchCallback     = NULL;
+    fValueBatchRefcon       = NULL;
 }
 
 IOHIDQueueClass::~IOHIDQueueClass()
@@ -136,6 +144,11 @@ HRESULT IOHIDQueueClass::queryInterface(REFIID iid, void **	ppv)
         *ppv = getInterfaceMap();
         addRef();
     }
+    else if (CFEqual(uuid, kIOHIDQueuePrivateInterfaceID))
+    {
+        *ppv = &fHIDQueuePrivate;
+        addRef();
+    }
     else {
         res = fOwningDevice->queryInterface(iid, ppv);
     }
@@ -202,12 +215,44 @@ void IOHIDQueueClass::queueEventSourceCallback(CFMachPortRef        cfPort __unu
     IOHIDQueueClass *queue = (IOHIDQueueClass *)info;
     
     if ( queue ) {
-        if ( queue->fEventCallback ) {
+        // the callbacks may release the last reference to the queue
+        queue->addRef();
+        
+        if ( queue->fValueBatchCallback )
+            queue->dispatchValueBatches();
+        
+        // also covers a batch callback that was cleared with values still queued
+        if ( !queue->fValueBatchCallback && queue->fEventCallback ) {
                 
             (queue->fEventCallback)(queue->fEventRefcon, 
                             kIOReturnSuccess, 
                             (void *)&queue->fHIDQueue);
         }
+        
+        queue->release();
+    }
+}
+
+//---------------------------------------------------------------------------
+// dispatchValueBatches
+//
+// Drains the queue into the batch callback kQueueDequeueBatch values at a
+// time.  The callback is looked up again for every batch since it may
+// clear itself.
+//---------------------------------------------------------------------------
+void IOHIDQueueClass::dispatchValueBatches()
+{
+    IOHIDValueRef                   values[kQueueDequeueBatch];
+    IOHIDQueueValueBatchCallback    callback;
+    CFIndex                         count, index;
+    
+    while ( (callback = fValueBatchCallback) && 
+            (copyNextEventValues(values, kQueueDequeueBatch, &count) == kIOReturnSuccess) && count )
+    {
+        (*callback)(fValueBatchRefcon, kIOReturnSuccess, (void *)&fHIDQueue, values, count);
+        
+        for ( index = 0; index < count; index++ )
+            CFRelease(values[index]);
     }
 }
 
@@ -555,6 +600,7 @@ IOReturn IOHIDQueueClass::copyNextEventValue (IOHIDValueRef     *pEvent,
     // if we got an entry
     if (ret == kIOReturnSuccess && nextEntry)
     {
+        CFAllocatorRef      valueAllocator = fOwningDevice->fValueAllocator ? fOwningDevice->fValueAllocator : kCFAllocatorDefault;
         IOHIDElementValue * nextElementValue = (IOHIDElementValue *) &(nextEntry->data);
         IOHIDElementCookie  cookie = nextElementValue->cookie;
         
@@ -563,12 +609,175 @@ IOReturn IOHIDQueueClass::copyNextEventValue (IOHIDValueRef     *pEvent,
         );
         
         if ( pEvent )
-            *pEvent = _IOHIDValueCreateWithElementValuePtr(kCFAllocatorDefault, fOwningDevice->getElement(cookie), nextElementValue);
+            *pEvent = _IOHIDValueCreateWithElementValuePtr(valueAllocator, fOwningDevice->getElement(cookie), nextElementValue);
     }
     
     return ret;
 }
 
+//---------------------------------------------------------------------------
+// copyNextEventValues
+//
+// Drains up to maxCount entries in one pass.  The checks and the COM
+// dispatch are paid once per batch instead of once per value, the blocks
+// for the values are taken from the device's value slab in one go, and
+// each value is created from the shared entry before its slot is handed
+// back to the kernel.  Entries whose element can't be resolved are
+// dropped.  Returns kIOReturnUnderrun if the queue was empty.
+//---------------------------------------------------------------------------
+IOReturn IOHIDQueueClass::copyNextEventValues (IOHIDValueRef *   pEvents,
+                                               CFIndex           maxCount,
+                                               CFIndex *         pCount,
+                                               IOOptionBits      options __unused)
+{
+    IOReturn        ret     = kIOReturnSuccess;
+    CFIndex         count   = 0;
+    CFAllocatorRef  valueAllocator;
+    int             batched;
+    
+    if ( !pEvents || !pCount )
+        return kIOReturnBadArgument;
+        
+    *pCount = 0;
+    
+    allChecks();
+    
+    if ( !fQueueMappedMemory )
+        return kIOReturnNoMemory;
+
+    valueAllocator  = fOwningDevice->fValueAllocator ? fOwningDevice->fValueAllocator : kCFAllocatorDefault;
+    batched         = IOHIDValueSlabBeginBatch(fOwningDevice->fValueSlab, (maxCount < UINT32_MAX) ? (uint32_t)maxCount : UINT32_MAX);
+    
+    while ( count < maxCount )
+    {
+        IODataQueueEntry *  nextEntry = IODataQueuePeek(fQueueMappedMemory);
+        IOHIDElementValue * nextElementValue;
+        IOHIDElementCookie  cookie;
+        IOHIDValueRef       event;
+        uint32_t            dataSize = sizeof(IOHIDElementValue);
+
+        // if queue empty, then stop
+        if (nextEntry == NULL)
+        {
+            ret = kIOReturnUnderrun;
+            break;
+        }
+        
+        nextElementValue    = (IOHIDElementValue *) &(nextEntry->data);
+        cookie              = nextElementValue->cookie;
+        
+        ROSETTA_ONLY(
+            cookie = (IOHIDElementCookie)OSSwapInt32((uint32_t)cookie);
+        );
+        
+        event = _IOHIDValueCreateWithElementValuePtr(valueAllocator, fOwningDevice->getElement(cookie), nextElementValue);
+
+        ret = IODataQueueDequeue(fQueueMappedMemory, NULL, &dataSize);
+        if (ret != kIOReturnSuccess)
+        {
+            if ( event )
+                CFRelease(event);
+            break;
+        }
+        
+        if ( event )
+            pEvents[count++] = event;
+    }
+    
+    if ( batched )
+        IOHIDValueSlabEndBatch(fOwningDevice->fValueSlab);
+    
+    *pCount = count;
+    
+    return (count || (ret == kIOReturnSuccess)) ? kIOReturnSuccess : ret;
+}
+
+//---------------------------------------------------------------------------
+// peekElementValues
+//
+// Walks up to maxCount entries from the head of the queue without moving
+// the head, so the kernel can't reuse their space while the caller reads
+// them in place.  pNextHead receives the head offset that releases all of
+// the returned entries.
+//---------------------------------------------------------------------------
+IOReturn IOHIDQueueClass::peekElementValues (IOHIDElementValue **  pValues,
+                                             CFIndex               maxCount,
+                                             CFIndex *             pCount,
+                                             uint32_t *            pNextHead)
+{
+    uint32_t    head, tail, queueSize;
+    CFIndex     count = 0;
+    
+    if ( !pValues || !pCount || !pNextHead )
+        return kIOReturnBadArgument;
+        
+    *pCount = 0;
+    
+    allChecks();
+    
+    if ( !fQueueMappedMemory )
+        return kIOReturnNoMemory;
+        
+    head        = fQueueMappedMemory->head;
+    tail        = fQueueMappedMemory->tail;
+    queueSize   = fQueueMappedMemory->queueSize;
+    
+    ROSETTA_ONLY(
+        head        = OSSwapInt32(head);
+        tail        = OSSwapInt32(tail);
+        queueSize   = OSSwapInt32(queueSize);
+    );
+    
+    // don't read entry contents ahead of the tail that published them
+    OSMemoryBarrier();
+    
+    while ( (count < maxCount) && (head != tail) )
+    {
+        IODataQueueEntry *  entry = (IODataQueueEntry *)((uint8_t *)fQueueMappedMemory->queue + head);
+        uint32_t            entrySize;
+        
+        // the producer wraps to the start when an entry doesn't fit at the end
+        if ( (head + DATA_QUEUE_ENTRY_HEADER_SIZE > queueSize) || 
+             (head + entry->size + DATA_QUEUE_ENTRY_HEADER_SIZE > queueSize) )
+        {
+            entry   = fQueueMappedMemory->queue;
+            head    = 0;
+        }
+        
+        entrySize = entry->size;
+        ROSETTA_ONLY(
+            entrySize = OSSwapInt32(entrySize);
+        );
+        
+        pValues[count++]    = (IOHIDElementValue *) &(entry->data);
+        head                += entrySize + DATA_QUEUE_ENTRY_HEADER_SIZE;
+    }
+    
+    *pCount     = count;
+    *pNextHead  = head;
+    
+    return count ? kIOReturnSuccess : kIOReturnUnderrun;
+}
+
+IOReturn IOHIDQueueClass::releaseElementValues (uint32_t nextHead)
+{
+    allChecks();
+    
+    if ( !fQueueMappedMemory )
+        return kIOReturnNoMemory;
+        
+    ROSETTA_ONLY(
+        nextHead = OSSwapInt32(nextHead);
+    );
+    
+    // finish reading the entries before the kernel may overwrite them
+    OSMemoryBarrier();
+    
+    fQueueMappedMemory->head = nextHead;
+    
+    return kIOReturnSuccess;
+}
+
 IOReturn IOHIDQueueClass::setEventCallback (IOHIDCallback callback, void * refcon)
 {
     fEventCallback = callback;
@@ -577,6 +786,14 @@ IOReturn IOHIDQueueClass::setEventCallback (IOHIDCallback callback, void * refco
     return kIOReturnSuccess;
 }
 
+IOReturn IOHIDQueueClass::setValueBatchCallback (IOHIDQueueValueBatchCallback callback, void * refcon)
+{
+    fValueBatchCallback = callback;
+    fValueBatchRefcon   = refcon;
+    
+    return kIOReturnSuccess;
+}
+
 IOHIDDeviceQueueInterface IOHIDQueueClass::sHIDQueueInterfaceV2 =
 {
     0,
@@ -595,6 +812,16 @@ IOHIDDeviceQueueInterface IOHIDQueueClass::sHIDQueueInterfaceV2 =
     &IOHIDQueueClass::_copyNextEventValue
 };
 
+IOHIDQueuePrivateInterface IOHIDQueueClass::sHIDQueuePrivateInterface =
+{
+    0,
+    &IOHIDIUnknown::genericQueryInterface,
+    &IOHIDIUnknown::genericAddRef,
+    &IOHIDIUnknown::genericRelease,
+    &IOHIDQueueClass::_copyNextEventValues,
+    &IOHIDQueueClass::_setValueBatchCallback
+};
+
 IOReturn IOHIDQueueClass::_getAsyncEventSource(void *self, CFTypeRef *source)
     { return getThis(self)->getAsyncEventSource(source); }
 
@@ -628,6 +855,12 @@ IOReturn IOHIDQueueClass::_copyNextEventValue (void * self, IOHIDValueRef * pEve
 IOReturn IOHIDQueueClass::_setEventCallback (void * self, IOHIDCallback callback, void * refcon)
     { return getThis(self)->setEventCallback(callback, refcon); }
 
+IOReturn IOHIDQueueClass::_copyNextEventValues (void * self, IOHIDValueRef * pValues, CFIndex maxCount, CFIndex * pCount, IOOptionBits options)
+    { return getThis(self)->copyNextEventValues(pValues, maxCount, pCount, options); }
+
+IOReturn IOHIDQueueClass::_setValueBatchCallback (void * self, IOHIDQueueValueBatchCallback callback, void * refcon)
+    { return getThis(self)->setValueBatchCallback(callback, refcon); }
+
     
     
 //****************************************************************************************************
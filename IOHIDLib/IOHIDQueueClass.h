@@ -36,8 +36,10 @@ class IOHIDQueueClass : public IOHIDIUnknown
 
 protected:
     static IOHIDDeviceQueueInterface	sHIDQueueInterfaceV2;
+    static IOHIDQueuePrivateInterface	sHIDQueuePrivateInterface;
 
     struct InterfaceMap fHIDQueue;
+    struct InterfaceMap fHIDQueuePrivate;
     mach_port_t         fAsyncPort;
     CFMachPortRef       fCFMachPort;
     CFRunLoopSourceRef  fCFSource;
@@ -61,6 +63,9 @@ protected:
     IOHIDCallback       fEventCallback;
     void *              fEventRefcon;
     CFMutableSetRef     fElements;
+    
+    IOHIDQueueValueBatchCallback    fValueBatchCallback;
+    void *                          fValueBatchRefcon;
 
     static IOReturn _getAsyncEventSource(void *self, CFTypeRef *source);
     static IOReturn _getAsyncPort(void *self, mach_port_t *port);
@@ -74,6 +79,12 @@ protected:
     static IOReturn _copyNextEventValue (void * self, IOHIDValueRef * pEvent, uint32_t timeout, IOOptionBits options);
     static IOReturn _setEventCallback ( void * self, IOHIDCallback callback, void * refcon);
     
+    // IOHIDQueuePrivateInterface methods
+    static IOReturn _copyNextEventValues (void * self, IOHIDValueRef * pValues, CFIndex maxCount, CFIndex * pCount, IOOptionBits options);
+    static IOReturn _setValueBatchCallback (void * self, IOHIDQueueValueBatchCallback callback, void * refcon);
+    
+    void dispatchValueBatches ();
+    
 public:
     IOHIDQueueClass();
     virtual ~IOHIDQueueClass();
@@ -95,7 +106,14 @@ public:
     virtual IOReturn start (IOOptionBits options = 0);
     virtual IOReturn stop (IOOptionBits options = 0);
     virtual IOReturn copyNextEventValue (IOHIDValueRef * pEvent, uint32_t timeout, IOOptionBits options = 0);
+    IOReturn copyNextEventValues (IOHIDValueRef * pEvents, CFIndex maxCount, CFIndex * pCount, IOOptionBits options = 0);
+    
+    // zero copy access to the queued element values; entries stay valid
+    // until they are handed back with releaseElementValues
+    IOReturn peekElementValues (IOHIDElementValue ** pValues, CFIndex maxCount, CFIndex * pCount, uint32_t * pNextHead);
+    IOReturn releaseElementValues (uint32_t nextHead);
     virtual IOReturn setEventCallback (IOHIDCallback callback, void * refcon);
+    IOReturn setValueBatchCallback (IOHIDQueueValueBatchCallback callback, void * refcon);
 
     static void queueEventSourceCallback(CFMachPortRef cfPort, mach_msg_header_t *msg, CFIndex size, void *info);
 
@@ -91,6 +91,12 @@ IOHIDTransactionClass::IOHIDTransactionClass() : IOHIDIUnknown(NULL)
     fEventCallback                  = NULL;
     fEventRefcon                    = NULL;
     fElementDictionaryRef           = NULL;
+    fCommitElementRefs              = NULL;
+    fCommitCookies                  = NULL;
+    fCommitPostCookies              = NULL;
+    fCommitCapacity                 = 0;
+    fCommitCount                    = 0;
+    fCommitElementsValid            = false;
 }
 
 IOHIDTransactionClass::~IOHIDTransactionClass()
@@ -101,6 +107,14 @@ IOHIDTransactionClass::~IOHIDTransactionClass()
     if( fOwningDevice ) 
         fOwningDevice->detachTransaction(this);
 
+    if (fCommitElementRefs)
+        free(fCommitElementRefs);
+        
+    if (fCommitCookies)
+        free(fCommitCookies);
+        
+    if (fCommitPostCookies)
+        free(fCommitPostCookies);
 }
 
 HRESULT IOHIDTransactionClass::queryInterface(REFIID iid, void ** ppv)
@@ -236,6 +250,8 @@ IOReturn IOHIDTransactionClass::dispose()
         fElementDictionaryRef = NULL;
     }
     
+    fCommitElementsValid = false;
+    
     return ret;
 }
 
@@ -267,6 +283,8 @@ IOReturn IOHIDTransactionClass::addElement (IOHIDElementRef element, IOOptionBit
     else 
         CFDictionarySetValue(fElementDictionaryRef, element, transactionElement);
 
+    fCommitElementsValid = false;
+
     if (transactionElement) CFRelease(transactionElement);
     
     return kIOReturnSuccess;
@@ -286,6 +304,8 @@ IOReturn IOHIDTransactionClass::removeElement (IOHIDElementRef element, IOOption
 
     CFDictionaryRemoveValue(fElementDictionaryRef, element);
     
+    fCommitElementsValid = false;
+    
     return kIOReturnSuccess;
 }
 
@@ -353,6 +373,62 @@ IOReturn IOHIDTransactionClass::getElementValue(IOHIDElementRef element, IOHIDVa
     return kIOReturnSuccess;
 }
 
+//---------------------------------------------------------------------------
+// prepareCommitElements
+//
+// The transaction elements and their cookies only change when elements are
+// added or removed, so commit reuses them from buffers that grow as needed
+// instead of allocating and refilling them every time.
+//---------------------------------------------------------------------------
+IOReturn IOHIDTransactionClass::prepareCommitElements()
+{
+    CFIndex numElements;
+    
+    if (fCommitElementsValid)
+        return kIOReturnSuccess;
+        
+    numElements = CFDictionaryGetCount(fElementDictionaryRef);
+    
+    if (numElements > fCommitCapacity)
+    {
+        IOHIDTransactionElementRef *    elementRefs;
+        uint64_t *                      cookies;
+        uint64_t *                      postCookies;
+        
+        elementRefs = (IOHIDTransactionElementRef *)realloc(fCommitElementRefs, sizeof(IOHIDTransactionElementRef) * numElements);
+        if (elementRefs)
+            fCommitElementRefs = elementRefs;
+            
+        cookies = (uint64_t *)realloc(fCommitCookies, sizeof(uint64_t) * numElements);
+        if (cookies)
+            fCommitCookies = cookies;
+            
+        postCookies = (uint64_t *)realloc(fCommitPostCookies, sizeof(uint64_t) * numElements);
+        if (postCookies)
+            fCommitPostCookies = postCookies;
+            
+        if (!elementRefs || !cookies || !postCookies)
+            return kIOReturnNoMemory;
+            
+        fCommitCapacity = numElements;
+    }
+    
+    CFDictionaryGetKeysAndValues(fElementDictionaryRef, NULL, (const void **)fCommitElementRefs);
+    
+    for (CFIndex i=0; i<numElements; i++)
+    {
+        fCommitCookies[i] = (uint32_t)IOHIDElementGetCookie(IOHIDTransactionElementGetElement(fCommitElementRefs[i]));
+        ROSETTA_ONLY(
+            fCommitCookies[i] = OSSwapInt32(fCommitCookies[i]);
+        );
+    }
+    
+    fCommitCount            = numElements;
+    fCommitElementsValid    = true;
+    
+    return kIOReturnSuccess;
+}
+
 /* start/stop data delivery to a queue */
 IOReturn IOHIDTransactionClass::commit(uint32_t timeoutMS __unused, IOHIDCallback callback __unused, void * callbackRefcon __unused, IOOptionBits options __unused)
 {
@@ -368,66 +444,61 @@ IOReturn IOHIDTransactionClass::commit(uint32_t timeoutMS __unused, IOHIDCallbac
     
     require_action(fIsCreated && fElementDictionaryRef, exit, ret = kIOReturnError);
 
-    numElements = CFDictionaryGetCount(fElementDictionaryRef);
+    require_noerr_action(prepareCommitElements(), exit, ret = kIOReturnNoMemory);
     
-    require_action(numElements, exit, ret = kIOReturnError);
+    numElements = fCommitCount;
     
-    cookies     = (uint64_t *)malloc(sizeof(uint64_t) * numElements);
-    elementRefs = (IOHIDTransactionElementRef *)malloc(sizeof(IOHIDTransactionElementRef) * numElements);
+    require_action(numElements, exit, ret = kIOReturnError);
     
-    CFDictionaryGetKeysAndValues(fElementDictionaryRef, NULL, (const void **)elementRefs);
+    elementRefs = fCommitElementRefs;
+    cookies     = fCommitCookies;
         
     // run through and call setElementValue w/o device push
     // *** we definitely have to hold a lock here. ***
-    for (int i=0;i<numElements && elementRefs[i]; i++)
-    {        
-        if ( fDirection == kIOHIDTransactionDirectionTypeOutput )
-        {
-            if ((event = IOHIDTransactionElementGetValue(elementRefs[i])))
-            {
-                fOwningDevice->setElementValue(IOHIDTransactionElementGetElement(elementRefs[i]), event, 0, NULL, NULL, kHIDSetElementValuePendEvent);                
-            }
-            else if ((event = IOHIDTransactionElementGetDefaultValue(elementRefs[i])))
-            {
-                fOwningDevice->setElementValue(IOHIDTransactionElementGetElement(elementRefs[i]), event, 0, NULL, NULL, kHIDSetElementValuePendEvent);
-            }
-            else 
-                continue;
-        }
-        
-        IOHIDTransactionElementSetValue(elementRefs[i], NULL);
-            
-        cookies[numValidElements] = (uint32_t)IOHIDElementGetCookie(IOHIDTransactionElementGetElement(elementRefs[i]));
-        ROSETTA_ONLY(
-            cookies[numValidElements] = OSSwapInt32(cookies[numValidElements]);
-        );
-
-        numValidElements++;
-    }
-    
-    
     switch ( fDirection ) {
         case kIOHIDTransactionDirectionTypeOutput:
-            ret = IOConnectCallScalarMethod(fOwningDevice->fConnection, kIOHIDLibUserClientPostElementValues, cookies, numValidElements, 0, &outputCount);
+            for (int i=0;i<numElements && elementRefs[i]; i++)
+            {        
+                if ((event = IOHIDTransactionElementGetValue(elementRefs[i])))
+                {
+                    fOwningDevice->setElementValue(IOHIDTransactionElementGetElement(elementRefs[i]), event, 0, NULL, NULL, kHIDSetElementValuePendEvent);                
+                }
+                else if ((event = IOHIDTransactionElementGetDefaultValue(elementRefs[i])))
+                {
+                    fOwningDevice->setElementValue(IOHIDTransactionElementGetElement(elementRefs[i]), event, 0, NULL, NULL, kHIDSetElementValuePendEvent);
+                }
+                else 
+                    continue;
+                
+                IOHIDTransactionElementSetValue(elementRefs[i], NULL);
+                
+                fCommitPostCookies[numValidElements++] = cookies[i];
+            }
+            
+            ret = IOConnectCallScalarMethod(fOwningDevice->fConnection, kIOHIDLibUserClientPostElementValues, fCommitPostCookies, numValidElements, 0, &outputCount);
             break;
+            
         case kIOHIDTransactionDirectionTypeInput:
+            for (int i=0;i<numElements && elementRefs[i]; i++)
+            {
+                IOHIDTransactionElementSetValue(elementRefs[i], NULL);
+                numValidElements++;
+            }
+            
             // put together an ioconnect here
             ret = IOConnectCallScalarMethod(fOwningDevice->fConnection, kIOHIDLibUserClientUpdateElementValues, cookies, numValidElements, 0, &outputCount); 
+            
+            // read every updated value straight from the element value memory
             for (int i=0;i<numElements && elementRefs[i]; i++)
             {        
-                fOwningDevice->getElementValue(IOHIDTransactionElementGetElement(elementRefs[i]), &event, 0, NULL, NULL, kHIDGetElementValuePreventPoll);
+                event = NULL;
+                fOwningDevice->getCurrentElementValueAndGeneration(IOHIDTransactionElementGetElement(elementRefs[i]), &event);
                 IOHIDTransactionElementSetValue(elementRefs[i], event);
             }
             break;
         default:
             break;
     }
-            
-    if (elementRefs)  
-        free(elementRefs);
-    
-    if ( cookies ) 
-        free(cookies);
 
 exit:
     return ret;
@@ -443,21 +514,19 @@ IOReturn IOHIDTransactionClass::clear (IOOptionBits options __unused)
     if (!fIsCreated || !fElementDictionaryRef) 
         return kIOReturnError;
      
-    numElements = CFDictionaryGetCount(fElementDictionaryRef);
+    if (prepareCommitElements() != kIOReturnSuccess)
+        return kIOReturnNoMemory;
+        
+    numElements = fCommitCount;
     
     if (!numElements) 
         return kIOReturnError;
         
-    elementRefs = (IOHIDTransactionElementRef *)malloc(sizeof(IOHIDTransactionElementRef) * numElements);
-    
-    CFDictionaryGetKeysAndValues(fElementDictionaryRef, NULL, (const void **)elementRefs);
+    elementRefs = fCommitElementRefs;
     
     for (int i=0;i<numElements && elementRefs[i]; i++)
         IOHIDTransactionElementSetValue(elementRefs[i], NULL);
 
-    if (elementRefs) 
-        free(elementRefs);
-    
     return kIOReturnSuccess;
 }
 
@@ -53,6 +53,16 @@ protected:
     // The transaction linked list
     CFMutableDictionaryRef	fElementDictionaryRef;
     
+    // commit buffers, refilled only after elements are added or removed
+    IOHIDTransactionElementRef *    fCommitElementRefs;
+    uint64_t *                      fCommitCookies;
+    uint64_t *                      fCommitPostCookies;
+    CFIndex                         fCommitCapacity;
+    CFIndex                         fCommitCount;
+    bool                            fCommitElementsValid;
+    
+    IOReturn prepareCommitElements();
+    
     // CFMachPortCallBack routine
     static void _eventSourceCallback(CFMachPortRef *cfPort, mach_msg_header_t *msg, CFIndex size, void *info);
 
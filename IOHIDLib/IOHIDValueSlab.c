@@ -0,0 +1,266 @@
+/*
+ *
+ * @APPLE_LICENSE_HEADER_START@
+ *
+ * Copyright (c) 1999-2003 Apple Computer, Inc.  All Rights Reserved.
+ *
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this
+ * file.
+ *
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ *
+ * @APPLE_LICENSE_HEADER_END@
+ */
+
+#include <libkern/OSAtomic.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include "IOHIDValueSlab.h"
+
+#define kIOHIDValueSlabBlocksPerChunk   64
+
+typedef struct IOHIDValueSlabHeader {
+    struct IOHIDValueSlabHeader *   next;           // free list link
+    uint64_t                        fromSlab;       // also keeps blocks 16 byte aligned
+} IOHIDValueSlabHeader;
+
+typedef struct IOHIDValueSlabChunk {
+    struct IOHIDValueSlabChunk *    next;
+    uint64_t                        reserved;
+} IOHIDValueSlabChunk;
+
+typedef struct IOHIDValueSlab {
+    pthread_mutex_t                 lock;
+    volatile int32_t                refCount;
+    size_t                          blockSize;      // usable bytes per block
+    IOHIDValueSlabHeader *          freeList;
+    IOHIDValueSlabChunk *           chunks;
+} IOHIDValueSlab;
+
+// Blocks IOHIDValueSlabBeginBatch reserved for the calling thread
+static __thread IOHIDValueSlab *        sBatchSlab      = NULL;
+static __thread IOHIDValueSlabHeader *  sBatchBlocks    = NULL;
+
+static const void * ValueSlabRetain(const void * info)
+{
+    OSAtomicIncrement32Barrier(&((IOHIDValueSlab *)info)->refCount);
+    return info;
+}
+
+static void ValueSlabRelease(const void * info)
+{
+    IOHIDValueSlab *        slab = (IOHIDValueSlab *)info;
+    IOHIDValueSlabChunk *   chunk;
+    
+    if ( OSAtomicDecrement32Barrier(&slab->refCount) )
+        return;
+        
+    while ( (chunk = slab->chunks) )
+    {
+        slab->chunks = chunk->next;
+        free(chunk);
+    }
+    
+    pthread_mutex_destroy(&slab->lock);
+    free(slab);
+}
+
+// Called with the lock held.  Returns NULL if the slab is out of memory.
+static IOHIDValueSlabHeader * ValueSlabTakeBlock(IOHIDValueSlab * slab)
+{
+    IOHIDValueSlabHeader * header;
+    
+    if ( !slab->freeList )
+    {
+        size_t                  stride = sizeof(IOHIDValueSlabHeader) + slab->blockSize;
+        IOHIDValueSlabChunk *   chunk;
+        uint8_t *               block;
+        uint32_t                index;
+        
+        chunk = (IOHIDValueSlabChunk *)malloc(sizeof(IOHIDValueSlabChunk) + (stride * kIOHIDValueSlabBlocksPerChunk));
+        if ( !chunk )
+            return NULL;
+        
+        chunk->next     = slab->chunks;
+        slab->chunks    = chunk;
+        
+        block = (uint8_t *)(chunk + 1);
+        for ( index = 0; index < kIOHIDValueSlabBlocksPerChunk; index++, block += stride )
+        {
+            header              = (IOHIDValueSlabHeader *)block;
+            header->fromSlab    = 1;
+            header->next        = slab->freeList;
+            slab->freeList      = header;
+        }
+    }
+    
+    header          = slab->freeList;
+    slab->freeList  = header->next;
+    
+    return header;
+}
+
+static void * ValueSlabAllocate(CFIndex size, CFOptionFlags hint __unused, void * info)
+{
+    IOHIDValueSlab *        slab = (IOHIDValueSlab *)info;
+    IOHIDValueSlabHeader *  header;
+    
+    if ( size < 0 )
+        return NULL;
+        
+    if ( (size_t)size > slab->blockSize )
+    {
+        header = (IOHIDValueSlabHeader *)malloc(sizeof(IOHIDValueSlabHeader) + size);
+        if ( !header )
+            return NULL;
+            
+        header->fromSlab = 0;
+        return header + 1;
+    }
+    
+    if ( (sBatchSlab == slab) && sBatchBlocks )
+    {
+        header          = sBatchBlocks;
+        sBatchBlocks    = header->next;
+        return header + 1;
+    }
+    
+    pthread_mutex_lock(&slab->lock);
+    header = ValueSlabTakeBlock(slab);
+    pthread_mutex_unlock(&slab->lock);
+    
+    return header ? header + 1 : NULL;
+}
+
+static void ValueSlabDeallocate(void * ptr, void * info)
+{
+    IOHIDValueSlab *        slab    = (IOHIDValueSlab *)info;
+    IOHIDValueSlabHeader *  header  = (IOHIDValueSlabHeader *)ptr - 1;
+    
+    if ( !header->fromSlab )
+    {
+        free(header);
+        return;
+    }
+    
+    pthread_mutex_lock(&slab->lock);
+    header->next    = slab->freeList;
+    slab->freeList  = header;
+    pthread_mutex_unlock(&slab->lock);
+}
+
+static void * ValueSlabReallocate(void * ptr, CFIndex newSize, CFOptionFlags hint, void * info)
+{
+    IOHIDValueSlab *        slab    = (IOHIDValueSlab *)info;
+    IOHIDValueSlabHeader *  header  = (IOHIDValueSlabHeader *)ptr - 1;
+    void *                  newPtr;
+    
+    if ( newSize < 0 )
+        return NULL;
+        
+    if ( !header->fromSlab )
+    {
+        header = (IOHIDValueSlabHeader *)realloc(header, sizeof(IOHIDValueSlabHeader) + newSize);
+        return header ? header + 1 : NULL;
+    }
+    
+    if ( (size_t)newSize <= slab->blockSize )
+        return ptr;
+        
+    newPtr = ValueSlabAllocate(newSize, hint, info);
+    if ( newPtr )
+    {
+        memcpy(newPtr, ptr, slab->blockSize);
+        ValueSlabDeallocate(ptr, info);
+    }
+    
+    return newPtr;
+}
+
+int IOHIDValueSlabBeginBatch(void * info, uint32_t count)
+{
+    IOHIDValueSlab *        slab = (IOHIDValueSlab *)info;
+    IOHIDValueSlabHeader *  header;
+    
+    if ( !slab || sBatchSlab || !count )
+        return 0;
+        
+    if ( count > kIOHIDValueSlabBlocksPerChunk )
+        count = kIOHIDValueSlabBlocksPerChunk;
+        
+    // the blocks keep the slab alive until they're handed back
+    ValueSlabRetain(slab);
+    
+    pthread_mutex_lock(&slab->lock);
+    
+    while ( count-- && (header = ValueSlabTakeBlock(slab)) )
+    {
+        header->next    = sBatchBlocks;
+        sBatchBlocks    = header;
+    }
+    
+    pthread_mutex_unlock(&slab->lock);
+    
+    sBatchSlab = slab;
+    
+    return 1;
+}
+
+void IOHIDValueSlabEndBatch(void * info)
+{
+    IOHIDValueSlab *        slab = (IOHIDValueSlab *)info;
+    IOHIDValueSlabHeader *  last;
+    
+    if ( !slab || (sBatchSlab != slab) )
+        return;
+        
+    if ( sBatchBlocks )
+    {
+        for ( last = sBatchBlocks; last->next; last = last->next )
+            ;
+            
+        pthread_mutex_lock(&slab->lock);
+        last->next      = slab->freeList;
+        slab->freeList  = sBatchBlocks;
+        pthread_mutex_unlock(&slab->lock);
+    }
+    
+    sBatchSlab      = NULL;
+    sBatchBlocks    = NULL;
+    
+    ValueSlabRelease(slab);
+}
+
+int IOHIDValueSlabInitContext(uint32_t maxValueSize, CFAllocatorContext * context)
+{
+    IOHIDValueSlab * slab;
+    
+    slab = (IOHIDValueSlab *)calloc(1, sizeof(IOHIDValueSlab));
+    if ( !slab )
+        return -1;
+        
+    pthread_mutex_init(&slab->lock, NULL);
+    slab->refCount  = 1;
+    slab->blockSize = (kIOHIDValueSlabObjectOverhead + (size_t)maxValueSize + 15) & ~(size_t)15;
+    
+    memset(context, 0, sizeof(CFAllocatorContext));
+    context->info       = slab;
+    context->retain     = ValueSlabRetain;
+    context->release    = ValueSlabRelease;
+    context->allocate   = ValueSlabAllocate;
+    context->reallocate = ValueSlabReallocate;
+    context->deallocate = ValueSlabDeallocate;
+    
+    return 0;
+}
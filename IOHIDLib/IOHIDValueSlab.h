@@ -0,0 +1,68 @@
+/*
+ *
+ * @APPLE_LICENSE_HEADER_START@
+ *
+ * Copyright (c) 1999-2003 Apple Computer, Inc.  All Rights Reserved.
+ *
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this
+ * file.
+ *
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ *
+ * @APPLE_LICENSE_HEADER_END@
+ */
+
+#ifndef _IOKIT_HID_IOHIDVALUESLAB_H
+#define _IOKIT_HID_IOHIDVALUESLAB_H
+
+#include <sys/cdefs.h>
+#include <stdint.h>
+#include <CoreFoundation/CFBase.h>
+
+__BEGIN_DECLS
+
+/*
+ * CFAllocator backing for the IOHIDValueRefs a device creates from its
+ * element values.  Every such value fits in a block sized for the device's
+ * largest element value plus the CF object overhead, so those are carved
+ * out of chunks of fixed size blocks and recycled through a free list once
+ * the value is released.  Anything larger goes to malloc.  This file only
+ * depends on CFBase types so that it can be built and measured off-device.
+ */
+
+/* Allowance for the CF object header in front of the element value */
+#define kIOHIDValueSlabObjectOverhead   64
+
+/*
+ * Fills in context for CFAllocatorCreate with a new slab for values of up
+ * to maxValueSize bytes.  Returns 0 on success.  The caller owns one
+ * reference on context->info and drops it with context->release once the
+ * allocator is created (or failed to be), so the slab lives until the
+ * allocator and every object created with it are gone.
+ */
+int         IOHIDValueSlabInitContext(uint32_t maxValueSize, CFAllocatorContext * context);
+
+/*
+ * Takes up to count blocks off the free list in one lock round trip and
+ * parks them with the calling thread, so the values it creates next with
+ * the slab's allocator don't take the lock.  info is the context->info of
+ * the slab.  Returns nonzero if the batch was started; only then must it
+ * be closed with IOHIDValueSlabEndBatch on the same thread, which hands
+ * back the blocks that weren't used.  A thread runs one batch at a time.
+ */
+int         IOHIDValueSlabBeginBatch(void * info, uint32_t count);
+void        IOHIDValueSlabEndBatch(void * info);
+
+__END_DECLS
+
+#endif /* _IOKIT_HID_IOHIDVALUESLAB_H */
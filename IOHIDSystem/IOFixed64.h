@@ -115,6 +115,11 @@ public:
         return *this;
     }
     
+    static IOFixed64 withFixed64(SInt64 x) {
+        IOFixed64 result;
+        return result.fromFixed64(x);
+    }
+    
     IOFixed64& fromFixed24x8(SInt32 x) {
         value = x * 256LL;
         return *this;
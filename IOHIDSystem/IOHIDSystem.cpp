@@ -258,8 +258,8 @@ typedef struct _CachedMouseEventStruct {
     UInt64                      eventDeadline;
     UInt64                      reportInterval_ns;
     SInt32                      lastButtons;
-    SInt32                      accumX;
-    SInt32                      accumY;
+    IOFixed64                   accumX;
+    IOFixed64                   accumY;
     bool                        proximity;
     UInt32                      state;
     UInt8                       subType;
@@ -657,6 +657,7 @@ struct IOHIDSystem::ExpansionData
     UInt64                  cursorEventLast;
     UInt64                  cursorMoveLast;
     UInt64                  cursorMoveDelta;
+    UInt64                  cursorMoveOrigin;   // oldest report folded into unposted motion
     UInt64                  cursorWaitLast;
     UInt64                  cursorWaitDelta;
 
@@ -698,6 +699,7 @@ struct IOHIDSystem::ExpansionData
 #define _cursorEventLast            (_privateData->cursorEventLast)
 #define _cursorMoveLast             (_privateData->cursorMoveLast)
 #define _cursorMoveDelta            (_privateData->cursorMoveDelta)
+#define _cursorMoveOrigin           (_privateData->cursorMoveOrigin)
 #define _cursorWaitLast             (_privateData->cursorWaitLast)
 #define _cursorWaitDelta            (_privateData->cursorWaitDelta)
 
@@ -2329,6 +2331,12 @@ void IOHIDSystem::postEvent(int           what,
     if ( processKEQ )
         processKeyboardEQ(this, &ts);
 
+    // Cursor motion is coalesced and posted with the time it is applied, so
+    // it is traced against the oldest report folded into it instead
+    IOHID_DEBUG_LATENCY(kIOHIDLatencyStage_PostEvent,
+                        ((EventCodeMask(what) & MOVEDEVENTMASK) && _cursorMoveOrigin) ? _cursorMoveOrigin : __OSAbsoluteTime(ts),
+                        OSDynamicCast(IOService, sender) ? ((IOService *)sender)->getRegistryEntryID() : 0, what);
+
     NXEQElement * theHead = (NXEQElement *) &evg->lleq[evg->LLEHead];
     NXEQElement * theLast = (NXEQElement *) &evg->lleq[evg->LLELast];
     NXEQElement * theTail = (NXEQElement *) &evg->lleq[evg->LLETail];
@@ -3068,6 +3076,9 @@ bool IOHIDSystem::registerEventSource(IOService * source)
                         (AbsolutePointerEventCallback) _absolutePointerEvent,
                         (ScrollWheelEventCallback)     _scrollWheelEvent);
         }
+        if ( success )
+            ((IOHIPointing*)source)->setRelativePointerEventFixedCallback(
+                        (RelativePointerEventFixedCallback) _relativePointerEventFixed);
         source->setProperty(kIOHIDResetPointerKey, kOSBooleanTrue);
     } else {
         success = source->open(this, kIOServiceSeize, 0);
@@ -3227,6 +3238,17 @@ void IOHIDSystem::_relativePointerEvent(IOHIDSystem * self,
     self->relativePointerEvent(buttons, dx, dy, ts, sender);
 }
 
+void IOHIDSystem::_relativePointerEventFixed(IOHIDSystem * self,
+                    int        buttons,
+                       /* deltaX */ SInt64     dx,
+                       /* deltaY */ SInt64     dy,
+                       /* atTime */ AbsoluteTime ts,
+                                    OSObject * sender,
+                                    void *     refcon __unused)
+{
+    self->relativePointerEventFixed(buttons, IOFixed64::withFixed64(dx), IOFixed64::withFixed64(dy), ts, sender);
+}
+
 void IOHIDSystem::relativePointerEvent(int        buttons,
                           /* deltaX */ int        dx,
                           /* deltaY */ int        dy,
@@ -3240,6 +3262,15 @@ void IOHIDSystem::relativePointerEvent(int        buttons,
                           /* deltaY */   int        dy,
                           /* atTime */   AbsoluteTime ts,
                           /* sender */   OSObject * sender)
+{
+    relativePointerEventFixed(buttons, IOFixed64::withIntFloor(dx), IOFixed64::withIntFloor(dy), ts, sender);
+}
+
+void IOHIDSystem::relativePointerEventFixed(int        buttons,
+                          /* deltaX */   IOFixed64  dx,
+                          /* deltaY */   IOFixed64  dy,
+                          /* atTime */   AbsoluteTime ts,
+                          /* sender */   OSObject * sender)
 {
     IOHIDCmdGateActionArgs args;
     args.arg0 = &buttons;
@@ -3256,8 +3287,8 @@ IOReturn IOHIDSystem::doRelativePointerEvent(IOHIDSystem *self, void * args)
                         /* IOCommandGate::Action */
 {
     int             buttons = *(int *)((IOHIDCmdGateActionArgs *)args)->arg0;
-    int             dx  = *(int *)((IOHIDCmdGateActionArgs *)args)->arg1;
-    int             dy  = *(int *)((IOHIDCmdGateActionArgs *)args)->arg2;
+    IOFixed64       dx  = *(IOFixed64 *)((IOHIDCmdGateActionArgs *)args)->arg1;
+    IOFixed64       dy  = *(IOFixed64 *)((IOHIDCmdGateActionArgs *)args)->arg2;
     SInt64          ts  = *(SInt64 *)((IOHIDCmdGateActionArgs *)args)->arg3;
     OSObject *          sender  = (OSObject *)((IOHIDCmdGateActionArgs *)args)->arg4;
 
@@ -3297,7 +3328,7 @@ static bool vblForScreen(IOGraphicsDevice *io_gd_I, uint64_t &delta_O)
     return (nextVBL != 0);
 }
 
-void IOHIDSystem::relativePointerEventGated(int buttons, int dx_I, int dy_I, SInt64 ts, OSObject * sender)
+void IOHIDSystem::relativePointerEventGated(int buttons, IOFixed64 dx_I, IOFixed64 dy_I, SInt64 ts, OSObject * sender)
 {
     bool movementEvent = false;
 
@@ -3316,15 +3347,17 @@ void IOHIDSystem::relativePointerEventGated(int buttons, int dx_I, int dy_I, SIn
 
         if (ts_nano > cachedMouseEvent->eventDeadline) {
             cachedMouseEvent->eventDeadline = ts_nano + kIOHIDChattyMouseSuppressionDelayNS;
-            cachedMouseEvent->accumX = 0;
-            cachedMouseEvent->accumY = 0;
+            cachedMouseEvent->accumX.fromIntFloor(0);
+            cachedMouseEvent->accumY.fromIntFloor(0);
         }
 
         cachedMouseEvent->accumX += dx_I;
         cachedMouseEvent->accumY += dy_I;
 
-        if ((abs(cachedMouseEvent->accumX) >= kIOHIDRelativeTickleThresholdPixel) ||
-            (abs(cachedMouseEvent->accumY) >= kIOHIDRelativeTickleThresholdPixel))
+        if ((cachedMouseEvent->accumX >= (SInt64)kIOHIDRelativeTickleThresholdPixel) ||
+            (cachedMouseEvent->accumX <= (SInt64)-kIOHIDRelativeTickleThresholdPixel) ||
+            (cachedMouseEvent->accumY >= (SInt64)kIOHIDRelativeTickleThresholdPixel) ||
+            (cachedMouseEvent->accumY <= (SInt64)-kIOHIDRelativeTickleThresholdPixel))
         {
             movementEvent = true;
         }
@@ -3375,7 +3408,7 @@ void IOHIDSystem::relativePointerEventGated(int buttons, int dx_I, int dy_I, SIn
 
     _cursorHelper.incrementEventCount();
     IOFixedPoint64 scratch;
-    if ( scratch.fromIntFloor(dx_I, dy_I) ) {
+    if ( scratch.fromFixed64(dx_I, dy_I) ) {
         UInt64              uptime = 0;
         bool                haveVBL = vblForScreen(((EvScreen*)evScreen)[cursorPinScreen].instance, _cursorMoveDelta);
 
@@ -3391,12 +3424,14 @@ void IOHIDSystem::relativePointerEventGated(int buttons, int dx_I, int dy_I, SIn
         }
 
         IOHID_DEBUG(kIOHIDDebugCode_RelativePointerEventTiming, _cursorMoveDelta, 0,
-                    dx_I, dy_I);
+                    dx_I.asFixed(), dy_I.asFixed());
 
         _cursorHelper.desktopLocationAccumulated() += scratch;
 
         scratch = _cursorHelper.desktopLocationAccumulated(); // for ease of reference
         _cursorEventLast = uptime;
+        if (!_cursorMoveOrigin)
+            _cursorMoveOrigin = ts;
 
         if (!haveVBL) {
             // no VBL
@@ -3637,6 +3672,8 @@ void IOHIDSystem::absolutePointerEventGated(
         _cursorHelper.desktopLocation() = newLoc;
         _cursorLog(_cursorEventLast);
 
+        if (!_cursorMoveOrigin)
+            _cursorMoveOrigin = AbsoluteTime_to_scalar(&ts);
         _setCursorPosition(false, proximityChange, sender);
         vblForScreen(((EvScreen*)evScreen)[cursorPinScreen].instance, _cursorMoveDelta);
         _cursorMoveLast = _cursorEventLast;
@@ -5530,6 +5567,7 @@ void IOHIDSystem::_setCursorPosition(bool external, bool proximityChange, OSObje
             _postMouseMoveEvent(NX_MOUSEMOVED, uptime, sender);
         }
     }
+    _cursorMoveOrigin = 0;
 
     /* check new cursor position for leaving evg->mouseRect */
     if (cursorMoved && evg->mouseRectValid && _cursorHelper.desktopLocation().inRect(evg->mouseRect))
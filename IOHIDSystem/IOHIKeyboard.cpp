@@ -43,12 +43,19 @@
 //
 // RY: The following was added because the IOHIKeyboard class doesn't have
 // a reserved field defined.  Essentially what this does is create a
-// static dictionary that stores OSData objects for each keyboard.  These
-// OSData objects will be added and removed as each keyboard enters and
+// static table that stores a KeyboardReserved struct for each keyboard.
+// These structs will be added and removed as each keyboard enters and
 // leaves the system.
+//
+// The table is hashed on the service pointer and guarded by a read/write
+// lock, since it is only modified at start/stop but read on every key
+// event.
+
+#define kKeyboardReservedHashSize   64
 
 struct KeyboardReserved
 {
+    KeyboardReserved *  next;
     IOHIKeyboard *  service;
 	thread_call_t	repeat_thread_call;
     bool			dispatchEventCalled;
@@ -59,79 +66,74 @@ struct KeyboardReserved
     IOHIDKeyboardDevice *	keyboardNub;
 };
 
-static OSArray  *gKeyboardReservedArray = OSArray::withCapacity(4);
-IOLock          *gKeyboardReservedArrayLock = IOLockAlloc();
+static KeyboardReserved *   gKeyboardReservedHash[kKeyboardReservedHashSize];
+static IORWLock *           gKeyboardReservedLock = IORWLockAlloc();
 
-static KeyboardReserved * GetKeyboardReservedStructEventForService(IOHIKeyboard *service, UInt32 * index = 0)
+static inline UInt32 KeyboardReservedHashIndex(IOHIKeyboard *service)
+{
+    uintptr_t key = (uintptr_t)service;
+
+    return (UInt32)((key >> 4) ^ (key >> 10)) & (kKeyboardReservedHashSize - 1);
+}
+
+static KeyboardReserved * GetKeyboardReservedStructEventForService(IOHIKeyboard *service)
 {
     KeyboardReserved 	* retVal    = 0;
-    if (gKeyboardReservedArray) {
-        OSCollectionIterator    * iterator  = 0;
-        iterator = OSCollectionIterator::withCollection(gKeyboardReservedArray);
-        if (iterator) {
-            bool done = false;
-            while (!done) {
-                OSObject * obj = 0;
-                IOLockLock(gKeyboardReservedArrayLock);
-                while (!done && (NULL != (obj = iterator->getNextObject()))) {
-                    obj->retain();
-                    IOLockUnlock(gKeyboardReservedArrayLock);
-                    
-                    OSData * data = OSDynamicCast(OSData, obj);
-                    if (data) {
-                        retVal = (KeyboardReserved *)data->getBytesNoCopy();
-                        if (retVal && (retVal->service == service)) {
-                            if (index)
-                                *index = gKeyboardReservedArray->getNextIndexOfObject(obj, 0);
-                            done = true;
-                        }
-                        else {
-                            retVal = 0;
-                        }
-                    }
-                    IOLockLock(gKeyboardReservedArrayLock);
-                }
-                IOLockUnlock(gKeyboardReservedArrayLock);
-                if (iterator->isValid()) {
-                    done = true;
-                }
-                else {
-                    iterator->reset();
-                }
-            }
-            iterator->release();
-        }
+
+    if (gKeyboardReservedLock) {
+        IORWLockRead(gKeyboardReservedLock);
+        for (retVal = gKeyboardReservedHash[KeyboardReservedHashIndex(service)];
+             retVal && (retVal->service != service);
+             retVal = retVal->next) {}
+        IORWLockUnlock(gKeyboardReservedLock);
     }
     return retVal;
 }
 
 static void AppendNewKeyboardReservedStructForService(IOHIKeyboard *service)
 {
-    KeyboardReserved 	temp;
-    OSData 		* data		= 0;
-    
-    if (gKeyboardReservedArray)
+    KeyboardReserved 	* reserved  = 0;
+    UInt32              index       = KeyboardReservedHashIndex(service);
+
+    if (gKeyboardReservedLock && (reserved = IONew(KeyboardReserved, 1)))
     {
-        bzero(&temp, sizeof(KeyboardReserved));
-        temp.repeatMode = true;
-        temp.service = service;
-        data = OSData::withBytes(&temp, sizeof(KeyboardReserved));
-        IOLockLock(gKeyboardReservedArrayLock);
-        gKeyboardReservedArray->setObject(data);
-        IOLockUnlock(gKeyboardReservedArrayLock);
-        data->release();
+        bzero(reserved, sizeof(KeyboardReserved));
+        reserved->repeatMode = true;
+        reserved->service = service;
+        IORWLockWrite(gKeyboardReservedLock);
+        reserved->next = gKeyboardReservedHash[index];
+        gKeyboardReservedHash[index] = reserved;
+        IORWLockUnlock(gKeyboardReservedLock);
     }
 }
 
+// Lookups hand the struct out after dropping the read lock, so it is only
+// unlinked and freed from IOHIKeyboard::free, once nothing can be running
+// on the service any more.
 static void RemoveKeyboardReservedStructForService(IOHIKeyboard *service)
 {
-    UInt32 index = 0;
-    
-    if (gKeyboardReservedArray && GetKeyboardReservedStructEventForService(service, &index) )
+    KeyboardReserved 	** link     = 0;
+    KeyboardReserved 	* reserved  = 0;
+
+    if (gKeyboardReservedLock)
     {
-        IOLockLock(gKeyboardReservedArrayLock);
-        gKeyboardReservedArray->removeObject(index);
-        IOLockUnlock(gKeyboardReservedArrayLock);
+        IORWLockWrite(gKeyboardReservedLock);
+        for (link = &gKeyboardReservedHash[KeyboardReservedHashIndex(service)]; *link; link = &(*link)->next) {
+            if ((*link)->service == service) {
+                reserved = *link;
+                *link = reserved->next;
+                break;
+            }
+        }
+
+        if (reserved) {
+            if (reserved->repeat_thread_call) {
+                thread_call_cancel(reserved->repeat_thread_call);
+                thread_call_free(reserved->repeat_thread_call);
+            }
+            IODelete(reserved, KeyboardReserved, 1);
+        }
+        IORWLockUnlock(gKeyboardReservedLock);
     }
 }
 
@@ -196,10 +198,10 @@ void IOHIKeyboard::stop(IOService * provider)
 
 	KeyboardReserved *tempReservedStruct = GetKeyboardReservedStructEventForService(this);        
 
+	// the struct and the repeat call stay around until free() since
+	// event paths may still be looking at them
 	if (tempReservedStruct) {
 		thread_call_cancel(tempReservedStruct->repeat_thread_call);
-		thread_call_free(tempReservedStruct->repeat_thread_call);
-		tempReservedStruct->repeat_thread_call = NULL;
 
 		if ( tempReservedStruct->keyboardNub )
 			tempReservedStruct->keyboardNub->release();
@@ -207,8 +209,6 @@ void IOHIKeyboard::stop(IOService * provider)
         
 		if ( tempReservedStruct->hasSecurePrompt )
             tempReservedStruct->hasSecurePrompt = false;
-		
-		RemoveKeyboardReservedStructForService(this);
 	}
 }
 
@@ -232,6 +232,8 @@ void IOHIKeyboard::free()
     if( _keyState )
         IOFree( _keyState, _keyStateSize);
 
+    RemoveKeyboardReservedStructForService(this);
+
     // RY: MENTAL NOTE Do this last
     if ( lock )
     {
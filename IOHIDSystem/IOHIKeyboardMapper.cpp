@@ -47,6 +47,7 @@
 #include <IOKit/hidsystem/IOHIDSystem.h>
 #include <libkern/OSByteOrder.h>
 #include "IOHIDKeyboardDevice.h"
+#include "IOHIKeyboardMapperCompiled.h"
 #include "IOHIDevicePrivateKeys.h"
 #include "IOHIDFamilyPrivate.h"
 
@@ -69,6 +70,7 @@
 #define _supportsF12Eject			_reserved->supportsF12Eject
 #define _modifierSwap_Modifiers		_reserved->modifierSwap_Modifiers
 #define _cachedAlphaLockModDefs		_reserved->cachedAlphaLockModDefs
+#define _compiledKeyMapping			_reserved->compiledKeyMapping
 
 #define super OSObject
 OSDefineMetaClassAndStructors(IOHIKeyboardMapper, OSObject);
@@ -216,6 +218,10 @@ bool IOHIKeyboardMapper::init(	IOHIKeyboard *delegate,
 
 	_cachedAlphaLockModDefs = 0;
 
+	_compiledKeyMapping = 0;
+
+	compileKeyMapping();
+
 	// If there are right hand modifiers defined, set a property
 	if (_delegate && (_parsedMapping.maxMod > 0))
 	{
@@ -334,6 +340,11 @@ void IOHIKeyboardMapper::free()
             _slowKeysTimerEventSource->release();
             _slowKeysTimerEventSource = 0;
         }
+
+        if (_compiledKeyMapping) {
+            IOFree(_compiledKeyMapping, _compiledKeyMapping->size);
+            _compiledKeyMapping = 0;
+        }
         
         IODelete(_reserved, ExpansionData, 1);
     }
@@ -764,22 +775,33 @@ UInt8 IOHIKeyboardMapper::getParsedSpecialKey(UInt8 logical)
 }
 
 
-static inline int NEXTNUM(unsigned char ** mapping, short shorts)
+//
+// Decode every key definition of the parsed keymapping into the flat
+// table used by doCharGen.  Keys that cannot be decoded within the bounds
+// of the mapping are left to the original walk.
+//
+bool IOHIKeyboardMapper::compileKeyMapping()
 {
-	int returnValue;
+	CompiledKeyMapping *	compiled;
+	IOByteCount				size;
+	UInt32					count;
 
-	if (shorts)
-	{
-		returnValue = OSSwapBigToHostInt16(*((unsigned short *)*mapping));
-		*mapping += sizeof(unsigned short);
-	}
-	else
-	{
-		returnValue = **((unsigned char	 **)mapping);
-		*mapping += sizeof(unsigned char);
-	}
+	/* First pass sizes the table, the second decodes each key's entries */
+	count = CompileKeyDefs(&_parsedMapping, NULL);
 
-	return returnValue;
+	size = sizeof(CompiledKeyMapping) + (count ? (count - 1) : 0) * sizeof(CompiledCharDef);
+	compiled = (CompiledKeyMapping *) IOMalloc(size);
+	if (!compiled)
+		return false;
+
+	bzero(compiled, size);
+	compiled->size = size;
+
+	CompileKeyDefs(&_parsedMapping, compiled);
+
+	_compiledKeyMapping = compiled;
+
+	return true;
 }
 
 bool IOHIKeyboardMapper::modifierSwapFilterKey(UInt8 * key)
@@ -965,7 +987,7 @@ void IOHIKeyboardMapper::doModCalc(int key, kbdBitVector keyBits)
 //
 void IOHIKeyboardMapper::doCharGen(int keyCode, bool down)
 {
-	int i, n, eventType, adjust, thisMask, modifiers, saveModifiers;
+	int i, n, eventType, modifiers, saveModifiers;
 	short shorts;
 	unsigned charSet, origCharSet;
 	unsigned charCode, origCharCode;
@@ -987,44 +1009,14 @@ void IOHIKeyboardMapper::doCharGen(int keyCode, bool down)
     map = _parsedMapping.keyDefs[keyCode];
 	modifiers = saveModifiers;
     if ( map ) {
-
-
-	/* Build offset for this key */
-        thisMask = NEXTNUM(&map, shorts);
-        if (thisMask && modifiers) {
-		adjust = (shorts ? sizeof(short) : sizeof(char))*2;
-            for ( i = 0; i <= _parsedMapping.maxMod; ++i) {
-                if (thisMask & 0x01) {
-			if (modifiers & 0x01)
-                        map += adjust;
-			adjust *= 2;
-		}
-		thisMask >>= 1;
-		modifiers >>= 1;
-		}
-	}
-        charSet = NEXTNUM(&map, shorts);
-        charCode = NEXTNUM(&map, shorts);
-
-	/* construct "unmodified" character */
-        map = _parsedMapping.keyDefs[keyCode];
-		modifiers = saveModifiers & ((NX_ALPHASHIFTMASK | NX_SHIFTMASK) >> 16);
-
-        thisMask = NEXTNUM(&map, shorts);
-        if (thisMask && modifiers) {
-		adjust = (shorts ? sizeof(short) : sizeof(char)) * 2;
-            for ( i = 0; i <= _parsedMapping.maxMod; ++i) {
-                if (thisMask & 0x01) {
-			if (modifiers & 0x01)
-                        map += adjust;
-			adjust *= 2;
-		}
-		thisMask >>= 1;
-		modifiers >>= 1;
-		}
-	}
-        origCharSet = NEXTNUM(&map, shorts);
-        origCharCode = NEXTNUM(&map, shorts);
+        /* Precompiled by compileKeyMapping unless the key has to be walked */
+        if ( !CompiledKeyDefCharDef(_compiledKeyMapping, keyCode, modifiers, &charSet, &charCode) )
+            KeyDefCharDef(&_parsedMapping, keyCode, modifiers, &charSet, &charCode);
+
+        /* construct "unmodified" character */
+        modifiers = saveModifiers & ((NX_ALPHASHIFTMASK | NX_SHIFTMASK) >> 16);
+        if ( !CompiledKeyDefCharDef(_compiledKeyMapping, keyCode, modifiers, &origCharSet, &origCharCode) )
+            KeyDefCharDef(&_parsedMapping, keyCode, modifiers, &origCharSet, &origCharCode);
 
         if (charSet == (unsigned)(shorts ? 0xFFFF : 0x00FF)) {
 		// Process as a character sequence
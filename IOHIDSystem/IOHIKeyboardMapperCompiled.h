@@ -0,0 +1,221 @@
+/*
+ * @APPLE_LICENSE_HEADER_START@
+ *
+ * Copyright (c) 1999-2009 Apple Computer, Inc.	 All Rights Reserved.
+ *
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this
+ * file.
+ *
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ *
+ * @APPLE_LICENSE_HEADER_END@
+ */
+
+#ifndef _IOHIKEYBOARDMAPPERCOMPILED_H
+#define _IOHIKEYBOARDMAPPERCOMPILED_H
+
+//
+// Key definition decoding shared by IOHIKeyboardMapper::doCharGen and
+// compileKeyMapping.  Only depends on the keymap types, so that
+// tools/IOHIKeyboardMapperTest.c can check the compiled table against
+// the keymapping walk off-device.
+//
+
+#include <IOKit/IOTypes.h>
+#include <IOKit/hidsystem/ev_keymap.h>
+#include <libkern/OSByteOrder.h>
+
+//
+// Flattened form of the keyDefs in NXParsedKeyMapping, built once by
+// compileKeyMapping.  Each character generating key gets a contiguous run
+// of (charSet, charCode) pairs, one per combination of the modifier bits
+// in its mask, in the same order as the packed keymapping.
+//
+typedef struct _CompiledCharDef {
+	UInt16		charSet;
+	UInt16		charCode;
+} CompiledCharDef;
+
+typedef struct _CompiledKeyDef {
+	UInt16		modMask;		// modifier bits this key's definition depends on
+	UInt16		compiled;		// zero if doCharGen must walk the keymapping
+	UInt32		firstCharDef;	// index of the key's first entry in charDefs
+} CompiledKeyDef;
+
+struct _CompiledKeyMapping {
+	// size of this allocation
+	IOByteCount		size;
+
+	CompiledKeyDef	keyDefs[NX_NUMKEYCODES];
+
+	// this array will actually be of the size needed by all keyDefs
+	CompiledCharDef	charDefs[1];
+};
+
+typedef struct _CompiledKeyMapping CompiledKeyMapping;
+
+static inline int NEXTNUM(unsigned char ** mapping, short shorts)
+{
+	int returnValue;
+
+	if (shorts)
+	{
+		returnValue = OSSwapBigToHostInt16(*((unsigned short *)*mapping));
+		*mapping += sizeof(unsigned short);
+	}
+	else
+	{
+		returnValue = **((unsigned char	 **)mapping);
+		*mapping += sizeof(unsigned char);
+	}
+
+	return returnValue;
+}
+
+//
+// Position of a modifier combination among the entries of a key whose
+// definition depends on the bits in modMask.
+//
+static inline UInt32 CompiledCharDefIndex(UInt32 modMask, UInt32 modifiers)
+{
+	UInt32 index = 0;
+	UInt32 bit = 1;
+
+	for ( ; modMask; modMask >>= 1, modifiers >>= 1) {
+		if (modMask & 0x01) {
+			if (modifiers & 0x01)
+				index |= bit;
+			bit <<= 1;
+		}
+	}
+	return index;
+}
+
+//
+// Look up the character a key generates under the given modifiers by
+// walking its definition in the packed keymapping.
+//
+static inline void KeyDefCharDef(const NXParsedKeyMapping * parsedMapping,
+								 int keyCode,
+								 int modifiers,
+								 unsigned * charSet,
+								 unsigned * charCode)
+{
+	short			shorts	= parsedMapping->shorts;
+	unsigned char *	map		= parsedMapping->keyDefs[keyCode];
+	int				thisMask, adjust, i;
+
+	/* Build offset for this key */
+	thisMask = NEXTNUM(&map, shorts);
+	if (thisMask && modifiers) {
+		adjust = (shorts ? sizeof(short) : sizeof(char)) * 2;
+		for ( i = 0; i <= parsedMapping->maxMod; ++i) {
+			if (thisMask & 0x01) {
+				if (modifiers & 0x01)
+					map += adjust;
+				adjust *= 2;
+			}
+			thisMask >>= 1;
+			modifiers >>= 1;
+		}
+	}
+	*charSet = NEXTNUM(&map, shorts);
+	*charCode = NEXTNUM(&map, shorts);
+}
+
+//
+// Same lookup from the compiled table.  Returns false if the key wasn't
+// compiled and has to be walked instead.
+//
+static inline bool CompiledKeyDefCharDef(const CompiledKeyMapping * compiled,
+										 int keyCode,
+										 int modifiers,
+										 unsigned * charSet,
+										 unsigned * charCode)
+{
+	const CompiledKeyDef *	keyDef;
+	const CompiledCharDef *	charDef;
+
+	if (!compiled || !compiled->keyDefs[keyCode].compiled)
+		return false;
+
+	keyDef = &compiled->keyDefs[keyCode];
+	charDef = &compiled->charDefs[keyDef->firstCharDef + CompiledCharDefIndex(keyDef->modMask, modifiers)];
+
+	*charSet = charDef->charSet;
+	*charCode = charDef->charCode;
+
+	return true;
+}
+
+//
+// Decode every key definition of the parsed keymapping.  Returns the
+// number of charDefs the table needs, and fills it in if compiled isn't
+// NULL.  Keys that cannot be decoded within the bounds of the mapping
+// are left to the walk.
+//
+static inline UInt32 CompileKeyDefs(const NXParsedKeyMapping * parsedMapping,
+									CompiledKeyMapping * compiled)
+{
+	UInt32					count		= 0;
+	UInt32					entries		= 0;
+	UInt32					modMask		= 0;
+	short					shorts		= parsedMapping->shorts;
+	unsigned				noop		= shorts ? 0xFFFF : 0x00FF;
+	unsigned				numSize		= shorts ? sizeof(short) : sizeof(char);
+	const unsigned char *	endPtr		= parsedMapping->mapping + parsedMapping->mappingLen;
+	unsigned char *			map;
+	unsigned				keyMask;
+	int						i;
+	UInt32					j;
+
+	if (parsedMapping->maxMod >= 0)
+		modMask = (1 << (parsedMapping->maxMod + 1)) - 1;
+
+	for (i = 0; i < NX_NUMKEYCODES; i++)
+	{
+		if ((map = parsedMapping->keyDefs[i]) == 0)
+			continue;
+		if ((map + numSize) > endPtr)
+			continue;
+		if ((keyMask = NEXTNUM(&map, shorts)) == noop)
+			continue;
+
+		keyMask &= modMask;
+		for (entries = 1, j = keyMask; j; j >>= 1)
+			if (j & 0x01)
+				entries *= 2;
+
+		if ((map + (entries * 2 * numSize)) > endPtr)
+			continue;
+
+		if (compiled)
+		{
+			compiled->keyDefs[i].modMask		= keyMask;
+			compiled->keyDefs[i].compiled		= 1;
+			compiled->keyDefs[i].firstCharDef	= count;
+
+			for (j = 0; j < entries; j++)
+			{
+				compiled->charDefs[count + j].charSet	= NEXTNUM(&map, shorts);
+				compiled->charDefs[count + j].charCode	= NEXTNUM(&map, shorts);
+			}
+		}
+
+		count += entries;
+	}
+
+	return count;
+}
+
+#endif /* _IOHIKEYBOARDMAPPERCOMPILED_H */
@@ -124,6 +124,7 @@
 #define _isSeized                           _reserved->isSeized
 #define _openClient                         _reserved->openClient
 #define _accelerateMode                     _reserved->accelerateMode
+#define _relativePointerEventFixedAction    _reserved->relativePointerEventFixedAction
 
 #define DEVICE_LOCK     IOLockLock( _deviceLock )
 #define DEVICE_UNLOCK   IOLockUnlock( _deviceLock )
@@ -146,8 +147,11 @@ typedef struct CursorDeviceSegment CursorDeviceSegment;
 struct ScaleDataState
 {
     UInt8           deltaIndex;
+    UInt8           deltaCount;     // samples in the averaging window
     IOFixed         deltaTime[SCROLL_TIME_DELTA_COUNT];
     IOFixed         deltaAxis[SCROLL_TIME_DELTA_COUNT];
+    IOFixed         deltaTimeSum;   // running sums over the window
+    IOFixed         deltaAxisSum;
     IOFixed         fraction;
 };
 typedef ScaleDataState ScaleDataState;
@@ -206,7 +210,8 @@ struct ScrollAccelInfo
 typedef ScrollAccelInfo ScrollAccelInfo;
 
 static bool SetupAcceleration (OSData * data, IOFixed desired, IOFixed devScale, IOFixed crsrScale, void ** scaleSegments, IOItemCount * scaleSegCount);
-static void ScaleAxes (void * scaleSegments, int * axis1p, IOFixed *axis1Fractp, int * axis2p, IOFixed *axis2Fractp);
+static void ScaleAxes (void * scaleSegments, IOItemCount scaleSegCount, int * axis1p, IOFixed *axis1Fractp, int * axis2p, IOFixed *axis2Fractp);
+static CursorDeviceSegment * FindScaleSegment (void * scaleSegments, IOItemCount scaleSegCount, SInt64 mag);
 static IOFixed64 OSObjectToIOFixed64(OSObject *in);
 static bool PACurvesFillParamsFromDict(OSDictionary *parameters, const IOFixed64 devScale, const IOFixed64 crsrScale, IOHIPointing__PAParameters &outParams);
 static bool PACurvesSetupAccelParams (OSArray *parametricCurves, IOFixed64 desired, IOFixed64 devScale, IOFixed64 crsrScale, IOHIPointing__PAParameters &primaryParams, IOHIPointing__PASecondaryParameters &secondaryParams);
@@ -237,6 +242,7 @@ struct IOHIPointing::ExpansionData
 
     UInt32      accelerateMode;
     UInt32      scrollZoomMask;
+    RelativePointerEventFixedCallback   relativePointerEventFixedAction;
     bool		isSeized;
     bool        lastScrollWasZoom;
     bool        scrollOff;
@@ -466,8 +472,20 @@ bool IOHIPointing::open(IOService *			client,
     return true;
 }
 
+bool IOHIPointing::setRelativePointerEventFixedCallback(
+                      RelativePointerEventFixedCallback	rpeFixedCallback)
+{
+    if (!_relativePointerEventTarget)
+        return false;
+
+    _relativePointerEventFixedAction = rpeFixedCallback;
+
+    return true;
+}
+
 void IOHIPointing::close(IOService * client, IOOptionBits)
 {
+  _relativePointerEventFixedAction = NULL;
   _relativePointerEventAction = NULL;
   _relativePointerEventTarget = 0;
   _absolutePointerEventAction = NULL;
@@ -514,6 +532,18 @@ IOHIDKind IOHIPointing::hidKind()
   return kHIRelativePointingDevice;
 }
 
+// A sample whose time delta is out of range ends the averaging window
+// and counts as SCROLL_EVENT_THRESHOLD_MS.
+static inline bool ScrollDeltaTimeEndsWindow(IOFixed deltaTime)
+{
+    return ((deltaTime <= 0) || (deltaTime >= SCROLL_EVENT_THRESHOLD_MS));
+}
+
+static inline IOFixed ScrollDeltaTimeWeight(IOFixed deltaTime)
+{
+    return ScrollDeltaTimeEndsWindow(deltaTime) ? SCROLL_EVENT_THRESHOLD_MS : deltaTime;
+}
+
 static void AccelerateScrollAxis(   IOFixed *               axisp,
                                     ScrollAxisAccelInfo *   scaleInfo,
                                     AbsoluteTime            timeStamp,
@@ -521,7 +551,7 @@ static void AccelerateScrollAxis(   IOFixed *               axisp,
                                     bool                    clear = false)
 {
     IOFixed absAxis             = 0;
-    int     avgIndex            = 0;
+    int     oldIndex            = 0;
     IOFixed	avgCount            = 0;
     IOFixed avgAxis             = 0;
     IOFixed	timeDeltaMS         = 0;
@@ -557,33 +587,56 @@ static void AccelerateScrollAxis(   IOFixed *               axisp,
 
     timeDeltaMS = ((UInt32) timeDeltaMSLL) * kIOFixedOne;
 
+    // The slot about to be reused still holds the oldest sample of a
+    // full window, so retire it from the running sums first.
+    if (scaleInfo->state.deltaCount == SCROLL_TIME_DELTA_COUNT) {
+        oldIndex = scaleInfo->state.deltaIndex;
+        scaleInfo->state.deltaTimeSum -= ScrollDeltaTimeWeight(scaleInfo->state.deltaTime[oldIndex]);
+        scaleInfo->state.deltaAxisSum -= scaleInfo->state.deltaAxis[oldIndex];
+        scaleInfo->state.deltaCount--;
+    }
+
     scaleInfo->state.deltaTime[scaleInfo->state.deltaIndex] = timeDeltaMS;
     scaleInfo->state.deltaAxis[scaleInfo->state.deltaIndex] = absAxis;
 
     // RY: To eliminate jerkyness associated with the scroll acceleration,
     // we scroll based on the average of the last n events.  This has the
     // effect of make acceleration smoother with accel and decel.
-    for (int index=0; index < SCROLL_TIME_DELTA_COUNT; index++)
-    {
-        avgIndex = (scaleInfo->state.deltaIndex + SCROLL_TIME_DELTA_COUNT - index) % SCROLL_TIME_DELTA_COUNT;
-        avgAxis         += scaleInfo->state.deltaAxis[avgIndex];
-        avgCount ++;
-        
-        if ((scaleInfo->state.deltaTime[avgIndex] <= 0) ||
-            (scaleInfo->state.deltaTime[avgIndex] >= SCROLL_EVENT_THRESHOLD_MS)) {
-            // the previous event was too long before this one. stop looking.
-            avgTimeDeltaMS += SCROLL_EVENT_THRESHOLD_MS;
-            break;
-        }
-        
-        avgTimeDeltaMS  += scaleInfo->state.deltaTime[avgIndex];
+    //
+    // The window runs back from this event to the first one that came too
+    // long after its predecessor, or until SCROLL_CLEAR_THRESHOLD_MS_LL
+    // worth of events is covered.  Since new events only ever shorten how
+    // far back that reaches, the sums are kept up to date incrementally.
+    if (ScrollDeltaTimeEndsWindow(timeDeltaMS)) {
+        // the previous event was too long before this one. start over.
+        scaleInfo->state.deltaTimeSum   = SCROLL_EVENT_THRESHOLD_MS;
+        scaleInfo->state.deltaAxisSum   = absAxis;
+        scaleInfo->state.deltaCount     = 1;
+    }
+    else {
+        scaleInfo->state.deltaTimeSum   += timeDeltaMS;
+        scaleInfo->state.deltaAxisSum   += absAxis;
+        scaleInfo->state.deltaCount++;
 
-        if (avgTimeDeltaMS >= (SCROLL_CLEAR_THRESHOLD_MS_LL * kIOFixedOne)) {
-            // the previous event was too long ago. stop looking.
-            break;
+        // drop the oldest events once the newer ones cover enough time
+        while (scaleInfo->state.deltaCount > 1) {
+            oldIndex = (scaleInfo->state.deltaIndex + SCROLL_TIME_DELTA_COUNT + 1 - scaleInfo->state.deltaCount) % SCROLL_TIME_DELTA_COUNT;
+
+            IOFixed oldWeight = ScrollDeltaTimeWeight(scaleInfo->state.deltaTime[oldIndex]);
+
+            if ((scaleInfo->state.deltaTimeSum - oldWeight) < (IOFixed)(SCROLL_CLEAR_THRESHOLD_MS_LL * kIOFixedOne))
+                break;
+
+            scaleInfo->state.deltaTimeSum -= oldWeight;
+            scaleInfo->state.deltaAxisSum -= scaleInfo->state.deltaAxis[oldIndex];
+            scaleInfo->state.deltaCount--;
         }
     }
 
+    avgCount        = scaleInfo->state.deltaCount;
+    avgAxis         = scaleInfo->state.deltaAxisSum;
+    avgTimeDeltaMS  = scaleInfo->state.deltaTimeSum;
+
     // Bump the next index
     scaleInfo->state.deltaIndex = (scaleInfo->state.deltaIndex + 1) % SCROLL_TIME_DELTA_COUNT;
 
@@ -637,10 +690,7 @@ static void AccelerateScrollAxis(   IOFixed *               axisp,
         CursorDeviceSegment	*segment;
         
         // scale
-        for(segment = (CursorDeviceSegment *) scaleInfo->scaleSegments;
-            scrollMultiplier > IOFixed64::withFixed(segment->devUnits);
-            segment++)
-        {}
+        segment = FindScaleSegment(scaleInfo->scaleSegments, scaleInfo->scaleSegCount, scrollMultiplier.asFixed64());
         
         if (avgCount > 2) {
             // Continuous scrolling in one direction indicates a desire to go faster.
@@ -721,8 +771,44 @@ void IOHIPointing::scalePointer(int * dxp, int * dyp)
             _fractY &= 0x0000ffff;
     }
     else {
-        ScaleAxes(_scaleSegments, dxp, &_fractX, dyp, &_fractY);
+        ScaleAxes(_scaleSegments, _scaleSegCount, dxp, &_fractX, dyp, &_fractY);
+    }
+}
+
+void IOHIPointing::scalePointerFixed(IOFixed64 * dxp, IOFixed64 * dyp)
+// Description:	Fixed point counterpart of scalePointer, used for motion
+//		with a sub-pixel fraction.  The deltas keep their fraction,
+//		so unlike scalePointer no remainder is carried between
+//		events here.  The curves are looked up with the exact
+//		vector magnitude; scalePointer floors it to whole pixels,
+//		which would leave slow sub-pixel motion unaccelerated.
+// Preconditions:
+// *	_deviceLock should be held on entry
+{
+    SInt64      x = dxp->asFixed64();
+    SInt64      y = dyp->asFixed64();
+    IOFixed64   mag;
+    IOFixed64   mult;
+
+    // the root of the 32.32 squared magnitude is already 16.16
+    mag.fromFixed64(llsqrt((UInt64)(x * x) + (UInt64)(y * y)));
+    if (!mag)
+        return;
+
+    if (_paraAccelParams && _paraAccelSecondaryParams) {
+        mult = PACurvesGetAccelerationMultiplier(mag, *_paraAccelParams, *_paraAccelSecondaryParams);
+    }
+    else if (_scaleSegments && _scaleSegCount) {
+        CursorDeviceSegment * segment = FindScaleSegment(_scaleSegments, _scaleSegCount, mag.asFixed64());
+
+        mult = (IOFixed64::withFixed(segment->intercept) + mag * IOFixed64::withFixed(segment->slope)) / mag;
+    }
+    else {
+        return;
     }
+
+    *dxp *= mult;
+    *dyp *= mult;
 }
 
 /*
@@ -1100,6 +1186,23 @@ void IOHIPointing::dispatchRelativePointerEvent(int        dx,
                                                 int        dy,
                                                 UInt32     buttonState,
                                                 AbsoluteTime ts)
+{
+    dispatchRelativePointerEventFixed64(IOFixed64::withIntFloor(dx), IOFixed64::withIntFloor(dy), true, buttonState, ts);
+}
+
+void IOHIPointing::dispatchRelativePointerEventWithFixed(SInt64      dx,
+                                                         SInt64      dy,
+                                                         UInt32      buttonState,
+                                                         AbsoluteTime ts)
+{
+    dispatchRelativePointerEventFixed64(IOFixed64::withFixed64(dx), IOFixed64::withFixed64(dy), false, buttonState, ts);
+}
+
+void IOHIPointing::dispatchRelativePointerEventFixed64(IOFixed64   dx,
+                                                       IOFixed64   dy,
+                                                       bool        integerDeltas,
+                                                       UInt32      buttonState,
+                                                       AbsoluteTime ts)
 {
     int buttons;
 
@@ -1107,7 +1210,7 @@ void IOHIPointing::dispatchRelativePointerEvent(int        dx,
 
     // post the raw event to the IOHIDPointingDevice
     if (_hidPointingNub)
-        _hidPointingNub->postMouseEvent(buttonState, dx, dy, 0);
+        _hidPointingNub->postMouseEvent(buttonState, dx.as32(), dy.as32(), 0);
 
     if (_isSeized)
     {
@@ -1136,28 +1239,53 @@ void IOHIPointing::dispatchRelativePointerEvent(int        dx,
 
         DEVICE_UNLOCK;
 
-        dispatchScrollWheelEventWithAccelInfo(-dy, -dx, 0, _scrollPointerInfo, ts);
+        dispatchScrollWheelEventWithAccelInfo(-dy.as32(), -dx.as32(), 0, _scrollPointerInfo, ts);
 
         return;
     }
 
     // Perform pointer acceleration computations
     if ( _accelerateMode & kAccelMouse ) {
-        int oldDx = dx;
-        int oldDy = dy;
+        IOFixed64 oldDx = dx;
+        IOFixed64 oldDy = dy;
 
-        scalePointer(&dx, &dy);
+        // Integer deltas are accelerated by scalePointer exactly as before,
+        // so subclasses overriding it keep working.  Fixed point deltas go
+        // straight to scalePointerFixed without being rounded to pixels.
+        if ( integerDeltas ) {
+            int intDx = dx.as32();
+            int intDy = dy.as32();
 
-        if (((oldDx < 0) && (dx > 0)) || ((oldDx > 0) && (dx < 0))) {
-            IOLog("IOHIPointing::dispatchRelativePointerEvent: Unwanted Direction Change X: oldDx=%d dx=%d\n", oldDy, dy);
+            scalePointer(&intDx, &intDy);
+
+            dx.fromIntFloor(intDx);
+            dy.fromIntFloor(intDy);
+        }
+        else {
+            scalePointerFixed(&dx, &dy);
+        }
+
+        if (((oldDx < 0LL) && (dx > 0LL)) || ((oldDx > 0LL) && (dx < 0LL))) {
+            IOLog("IOHIPointing::dispatchRelativePointerEvent: Unwanted Direction Change X: oldDx=%016llx dx=%016llx\n", oldDx.asFixed64(), dx.asFixed64());
         }
 
 
-        if (((oldDy < 0) && (dy > 0)) || ((oldDy > 0) && (dy < 0))) {
-            IOLog("IOHIPointing::dispatchRelativePointerEvent: Unwanted Direction Change Y: oldDy=%d dy=%d\n", oldDy, dy);
+        if (((oldDy < 0LL) && (dy > 0LL)) || ((oldDy > 0LL) && (dy < 0LL))) {
+            IOLog("IOHIPointing::dispatchRelativePointerEvent: Unwanted Direction Change Y: oldDy=%016llx dy=%016llx\n", oldDy.asFixed64(), dy.asFixed64());
         }
     }
 
+    // scalePointer carries the remainder of integer motion itself.
+    // Otherwise clients that only take integer deltas get the sub-pixel
+    // remainder carried over to the next event instead.
+    if ( !integerDeltas && !_relativePointerEventFixedAction ) {
+        dx += IOFixed64::withFixed(_fractX);
+        dy += IOFixed64::withFixed(_fractY);
+
+        _fractX = (IOFixed)(dx.asFixed64() - (dx.as64() * 65536LL));
+        _fractY = (IOFixed)(dy.asFixed64() - (dy.as64() * 65536LL));
+    }
+
     // Perform button tying and mapping.  This
     // stuff applies to relative posn devices (mice) only.
     if ( _buttonMode == NX_OneButton )
@@ -1181,7 +1309,7 @@ void IOHIPointing::dispatchRelativePointerEvent(int        dx,
     }
     DEVICE_UNLOCK;
 
-    _relativePointerEvent(this,
+    _relativePointerEventFixed(this,
             /* buttons */ buttons,
             /* deltaX */  dx,
             /* deltaY */  dy,
@@ -1746,6 +1874,8 @@ bool SetupAcceleration (OSData * data, IOFixed desired, IOFixed devScale, IOFixe
     CursorDeviceSegment *	segments;
     CursorDeviceSegment *	segment;
     SInt32			segCount;
+    SInt32			usedCount;
+    SInt32			maxDevUnits = 0;
 
     if( !data || !devScale || !crsrScale)
         return false;
@@ -1877,8 +2007,12 @@ bool SetupAcceleration (OSData * data, IOFixed desired, IOFixed devScale, IOFixe
         scaledY2 = IOFixedMultiply( crsrScale,
                       /* newY */    Interpolate( x1, y1, x2, y2, x3, y3,
                                             scale, lower ) );
+        // devUnits is kept non-decreasing so the table can be binary
+        // searched; the first segment at or above a magnitude is unchanged
+        if( scaledX2 > maxDevUnits)
+            maxDevUnits = scaledX2;
         if( lowPoints || highPoints)
-            segment->devUnits = scaledX2;
+            segment->devUnits = maxDevUnits;
         else
             segment->devUnits = MAX_DEVICE_THRESHOLD;
 
@@ -1918,6 +2052,19 @@ bool SetupAcceleration (OSData * data, IOFixed desired, IOFixed devScale, IOFixe
 
     } while( lowPoints || highPoints );
 
+    // segCount is an upper bound; trim the table to the segments
+    // actually emitted so lookups never see uninitialized entries
+    usedCount = segment - segments;
+    if( usedCount < segCount) {
+        CursorDeviceSegment * compact = IONew( CursorDeviceSegment, usedCount );
+        if( compact) {
+            bcopy( segments, compact, usedCount * sizeof(CursorDeviceSegment) );
+            IODelete( segments, CursorDeviceSegment, segCount );
+            segments = compact;
+            segCount = usedCount;
+        }
+    }
+
     if( *scaleSegCount && *scaleSegments)
         IODelete( *scaleSegments,
                     CursorDeviceSegment, *scaleSegCount );
@@ -2145,17 +2292,35 @@ PACurvesGetAccelerationMultiplier(const IOFixed64 device_speed_mickeys,
     return result;
 }
 
+// Returns the first segment whose devUnits is at or above mag.  The
+// tables built by SetupAcceleration are sorted by devUnits and end
+// with a MAX_DEVICE_THRESHOLD segment, which also catches overflow.
+CursorDeviceSegment * FindScaleSegment (void * scaleSegments, IOItemCount scaleSegCount, SInt64 mag)
+{
+    CursorDeviceSegment *	segments = (CursorDeviceSegment *) scaleSegments;
+    IOItemCount			low = 0;
+    IOItemCount			count = scaleSegCount;
+
+    while( count > 1) {
+        IOItemCount half = count / 2;
+        low = (mag > segments[low + half - 1].devUnits) ? (low + half) : low;
+        count -= half;
+    }
+
+    return &segments[low];
+}
+
 // RY: This function contains the original portions of
 // scalePointer.  This was separated out to accomidate
 // the acceleration of other axes
-void ScaleAxes (void * scaleSegments, int * axis1p, IOFixed *axis1Fractp, int * axis2p, IOFixed *axis2Fractp)
+void ScaleAxes (void * scaleSegments, IOItemCount scaleSegCount, int * axis1p, IOFixed *axis1Fractp, int * axis2p, IOFixed *axis2Fractp)
 {
     SInt32			dx, dy;
     SInt32			mag;
     IOFixed			scale;
     CursorDeviceSegment	*	segment;
 
-    if( !scaleSegments)
+    if( !scaleSegments || !scaleSegCount)
         return;
 
     dx = (*axis1p) << 16;
@@ -2167,10 +2332,7 @@ void ScaleAxes (void * scaleSegments, int * axis1p, IOFixed *axis1Fractp, int *
         return;
 
     // scale
-    for(
-        segment = (CursorDeviceSegment *) scaleSegments;
-        mag > segment->devUnits;
-        segment++)	{}
+    segment = FindScaleSegment(scaleSegments, scaleSegCount, mag);
 
     scale = IOFixedDivide(
             segment->intercept + IOFixedMultiply( mag, segment->slope ),
@@ -2216,6 +2378,29 @@ void IOHIPointing::_relativePointerEvent( IOHIPointing * self,
                                     0);
 }
 
+void IOHIPointing::_relativePointerEventFixed( IOHIPointing * self,
+				    int        buttons,
+                       /* deltaX */ IOFixed64  dx,
+                       /* deltaY */ IOFixed64  dy,
+                       /* atTime */ AbsoluteTime ts)
+{
+    RelativePointerEventFixedCallback rpeFixedCallback;
+    rpeFixedCallback = self->_relativePointerEventFixedAction;
+
+    if (!rpeFixedCallback) {
+        _relativePointerEvent(self, buttons, dx.as32(), dy.as32(), ts);
+        return;
+    }
+
+    (*rpeFixedCallback)(self->_relativePointerEventTarget,
+                                    buttons,
+                                    dx.asFixed64(),
+                                    dy.asFixed64(),
+                                    ts,
+                                    self,
+                                    0);
+}
+
   /* Tablet event reporting */
 void IOHIPointing::_absolutePointerEvent(IOHIPointing * self,
 				    int        buttons,
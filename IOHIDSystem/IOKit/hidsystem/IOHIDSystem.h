@@ -75,6 +75,7 @@ class IOGraphicsDevice;
 class IOHIDKeyboardDevice;
 class IOHIDPointingDevice;
 class IOHIDEvent;
+class IOFixed64;
 class IOFixedPoint64;
 
 class IOHIDSystem : public IOService
@@ -458,6 +459,14 @@ private:
                                     OSObject * sender,
                                     void *     refcon);
 
+  static void _relativePointerEventFixed(IOHIDSystem * self,
+				    int        buttons,
+                       /* deltaX */ SInt64     dx,
+                       /* deltaY */ SInt64     dy,
+                       /* atTime */ AbsoluteTime ts,
+                                    OSObject * sender,
+                                    void *     refcon);
+
   /* Tablet event reporting */
   static void _absolutePointerEvent(IOHIDSystem * self,
 				    int        buttons,
@@ -599,6 +608,12 @@ void relativePointerEvent(          int        buttons,
                  /* atTime */       AbsoluteTime ts,
                  /* senderID */     OSObject * sender);
 
+void relativePointerEventFixed(     int        buttons,
+                 /* deltaX */       IOFixed64  dx,
+                 /* deltaY */       IOFixed64  dy,
+                 /* atTime */       AbsoluteTime ts,
+                 /* senderID */     OSObject * sender);
+
   /* Tablet event reporting */
 void absolutePointerEvent(          int        buttons,
                  /* at */           IOGPoint *    newLoc,
@@ -697,8 +712,8 @@ static	IOReturn	doUnregisterEventQueue (IOHIDSystem *self, void * arg0);
 
 static	IOReturn	doRelativePointerEvent (IOHIDSystem *self, void * args);
         void		relativePointerEventGated(int buttons,
-                                                    int dx,
-                                                    int dy,
+                                                    IOFixed64 dx,
+                                                    IOFixed64 dy,
                                                     SInt64 ts,
                                                     OSObject * sender);
 
@@ -114,6 +114,8 @@ typedef struct _stickyKeys_ModifierInfo
 
 class IOHIDKeyboardDevice;
 
+typedef struct _CompiledKeyMapping CompiledKeyMapping;
+
 class IOHIKeyboardMapper : public OSObject
 {
   OSDeclareDefaultStructors(IOHIKeyboardMapper);
@@ -158,6 +160,9 @@ private:
         SInt32      modifierSwap_Modifiers[NX_NUMMODIFIERS];
 		
 		unsigned char * cachedAlphaLockModDefs;
+
+		// flattened keyDefs used by doCharGen
+		CompiledKeyMapping * compiledKeyMapping;
     };
     ExpansionData * _reserved;				    // Reserved for future use.  (Internal use only)
     
@@ -208,6 +213,7 @@ private:
 	// original translateKeyCode
 	void rawTranslateKeyCode (UInt8 key, bool keyDown, kbdBitVector keyBits);
     bool modifierSwapFilterKey(UInt8 * key);
+	bool compileKeyMapping (void);
 
 	// the current state of stickyKeys
 	UInt32            	_stickyKeys_State; 
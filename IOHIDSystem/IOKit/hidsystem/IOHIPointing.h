@@ -66,6 +66,22 @@ typedef void (*RelativePointerEventCallback)(
                         /* sender */       OSObject * sender,
                         /* refcon */       void *     refcon);
 
+/*
+ * Relative pointer callback carrying 48.16 fixed point deltas, the raw
+ * value of an IOFixed64.  Clients that register one through
+ * setRelativePointerEventFixedCallback receive accelerated motion with its
+ * sub-pixel fraction intact instead of the integer deltas passed to
+ * RelativePointerEventCallback.
+ */
+typedef void (*RelativePointerEventFixedCallback)(
+                        /* target */       OSObject * target,
+                        /* buttons */      int        buttons,
+                        /* deltaX */       SInt64     dx,
+                        /* deltaY */       SInt64     dy,
+                        /* atTime */       AbsoluteTime ts,
+                        /* sender */       OSObject * sender,
+                        /* refcon */       void *     refcon);
+
 typedef void (*AbsolutePointerEventCallback)(
                         /* target */       OSObject * target,
                         /* buttons */      int        buttons,
@@ -101,6 +117,7 @@ typedef void (*ScrollWheelEventCallback)(
 #define EV_DEFAULTSCROLLACCELLEVEL  0x00005000
 
 class IOHIDPointingDevice;
+class IOFixed64;
 struct ScrollAccelInfo;
 
 class IOHIPointing : public IOHIDevice
@@ -146,6 +163,19 @@ private:
                                 SInt32              deltaAxis3,
                                 ScrollAccelInfo *   info,
                                 AbsoluteTime        ts);
+
+    void dispatchRelativePointerEventWithFixed(
+                                SInt64              dx,
+                                SInt64              dy,
+                                UInt32              buttonState,
+                                AbsoluteTime        ts);
+
+    void dispatchRelativePointerEventFixed64(
+                                IOFixed64           dx,
+                                IOFixed64           dy,
+                                bool                integerDeltas,
+                                UInt32              buttonState,
+                                AbsoluteTime        ts);
     
     
 protected:
@@ -187,6 +217,11 @@ public:
                     AbsolutePointerEventCallback	apeCallback,
                     ScrollWheelEventCallback		sweCallback);
 
+  // Non-virtual; registers the fixed point relative pointer callback for
+  // the client that currently has the device open.
+  bool setRelativePointerEventFixedCallback(
+                    RelativePointerEventFixedCallback rpeFixedCallback);
+
   virtual void close(IOService * client, IOOptionBits );
   virtual IOReturn message( UInt32 type, IOService * provider,
                               void * argument = 0 );
@@ -213,6 +248,7 @@ private:
   virtual bool resetPointer();
   virtual void scalePointer(int * dxp, int * dyp);
     virtual void setupForAcceleration(IOFixed accl);
+  /*virtual*/ void scalePointerFixed(IOFixed64 * dxp, IOFixed64 * dyp);
   
   // RY: Adding methods to support scroll wheel accel.
   // Unfortunately, we don't have any padding, so these
@@ -234,6 +270,12 @@ private:
                        /* deltaY */ int        dy,
                        /* atTime */ AbsoluteTime ts);
 
+  static void _relativePointerEventFixed( IOHIPointing * self,
+				    int        buttons,
+                       /* deltaX */ IOFixed64  dx,
+                       /* deltaY */ IOFixed64  dy,
+                       /* atTime */ AbsoluteTime ts);
+
   /* Tablet event reporting */
   static void _absolutePointerEvent(IOHIPointing * self,
 				    int        buttons,
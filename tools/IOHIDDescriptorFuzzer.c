@@ -0,0 +1,1014 @@
+//
+//  IOHIDDescriptorFuzzer.c
+//  IOHIDFamily
+//
+//  Generates and mutates report descriptors, runs them through the steps of
+//  HIDOpenReportDescriptor and the capability queries IOHIDDevice makes at
+//  attach, and measures the time and parser memory each one takes.  Scaling
+//  runs flag descriptor shapes whose cost grows faster than their size, and
+//  the most expensive mutants can be kept as a regression corpus.  Like
+//  hidReportBenchmark it builds without IOKit:
+//
+//      cc -O2 -I tools/hosted -I IOHIDSystem -I IOHIDSystem/IOHIDDescriptorParser
+//          -o hidDescriptorFuzzer tools/IOHIDDescriptorFuzzer.c
+//          IOHIDSystem/IOHIDDescriptorParser/HID*.c -lm
+//
+//  tools/corpus/descriptors holds the boot mouse and keyboard descriptors
+//  and the worst offenders of "-fuzz 20000 -worst 8 -o"; re-measure them
+//  after parser changes with:
+//
+//      hidDescriptorFuzzer -r tools/corpus/descriptors
+//
+
+#include <dirent.h>
+#include <errno.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "HIDLib.h"
+
+#define kMaxDescriptorLength        0x10000
+#define kMaxMutantLength            8192
+#define kMaxMutations               4
+#define kPoolCapacity               256
+#define kMinMeasureDuration         5000000     /* ns */
+#define kMaxMeasureRepeats          1000
+#define kDefaultScaleLimit          4096
+#define kDefaultWorstCount          16
+#define kDefaultIterations          100000
+#define kSuperLinearThreshold       1.25
+
+// Short item prefixes with the size bits clear.
+#define kItemInput                  0x80
+#define kItemCollection             0xA0
+#define kItemEndCollection          0xC0
+#define kItemUsagePage              0x04
+#define kItemLogicalMinimum         0x14
+#define kItemLogicalMaximum         0x24
+#define kItemReportSize             0x74
+#define kItemReportID               0x84
+#define kItemReportCount            0x94
+#define kItemPush                   0xA4
+#define kItemPop                    0xB4
+#define kItemUsage                  0x08
+#define kItemUsageMinimum           0x18
+#define kItemUsageMaximum           0x28
+
+#define kCollectionLogical          0x02
+#define kCollectionApplication      0x01
+#define kInputVariable              0x02
+
+enum {
+    kPhaseCount,
+    kPhaseAllocate,
+    kPhaseProcessItems,
+    kPhasePostProcess,
+    kPhaseTotal,
+    kPhaseCountMax
+};
+
+typedef struct {
+    uint8_t *   bytes;
+    size_t      length;
+    size_t      capacity;
+} Descriptor;
+
+typedef struct {
+    OSStatus    status;
+    uint64_t    phases[kPhaseCountMax];
+    uint64_t    peakBytes;
+    uint64_t    allocations;
+    uint64_t    elements;
+} ParseResult;
+
+typedef struct {
+    Descriptor  descriptor;
+    ParseResult result;
+    double      score;
+    uint64_t    iteration;
+} Offender;
+
+typedef bool (*DescriptorGenerator)(Descriptor * descriptor, uint32_t size);
+
+typedef struct {
+    const char *        name;
+    DescriptorGenerator generator;
+} Shape;
+
+static const char * __phaseNames[kPhaseCountMax] = {
+    "count",
+    "allocate",
+    "process",
+    "post",
+    "total",
+};
+
+static uint64_t     __allocationCount   = 0;
+static uint64_t     __liveBytes         = 0;
+static uint64_t     __peakBytes         = 0;
+static uint64_t     __allocateTime      = 0;
+static bool         __verbose           = false;
+static ParseResult  __baseline          = {};
+
+static uint64_t getNanoseconds()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ((uint64_t)ts.tv_sec * 1000000000ULL) + ts.tv_nsec;
+}
+
+static uint64_t nextRandom(uint64_t * state)
+{
+    uint64_t x = *state;
+
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    *state = x;
+
+    return x * 0x2545F4914F6CDD1DULL;
+}
+
+//------------------------------------------------------------------------------
+// Parser allocator
+//
+// Stands in for PoolAlloc.c.  The time spent here is the allocate phase and
+// the high water mark of live bytes is the parse's peak memory.  The size
+// is stashed ahead of each block so PoolDeallocate can keep the books even
+// when callers pass a different size.
+//------------------------------------------------------------------------------
+void * PoolAllocateResident(vm_size_t size, unsigned char clear)
+{
+    uint64_t    start   = getNanoseconds();
+    uint64_t *  block   = (uint64_t *)(clear ? calloc(1, size + sizeof(uint64_t)) : malloc(size + sizeof(uint64_t)));
+
+    if ( block ) {
+        block[0] = size;
+
+        __allocationCount++;
+        __liveBytes += size;
+        if ( __liveBytes > __peakBytes )
+            __peakBytes = __liveBytes;
+    }
+
+    __allocateTime += getNanoseconds() - start;
+
+    return block ? &block[1] : NULL;
+}
+
+OSStatus PoolDeallocate(void * ptr, vm_size_t size __attribute__((unused)))
+{
+    uint64_t * block = (uint64_t *)ptr - 1;
+
+    if ( ptr ) {
+        __liveBytes -= block[0];
+        free(block);
+    }
+
+    return 0;
+}
+
+//------------------------------------------------------------------------------
+// Descriptor
+//------------------------------------------------------------------------------
+static bool descriptorAppend(Descriptor * descriptor, const uint8_t * bytes, size_t length)
+{
+    if ( descriptor->length + length > descriptor->capacity ) {
+        size_t      capacity    = descriptor->capacity ? descriptor->capacity : 256;
+        uint8_t *   buffer;
+
+        while ( capacity < descriptor->length + length )
+            capacity *= 2;
+
+        buffer = (uint8_t *)realloc(descriptor->bytes, capacity);
+        if ( !buffer )
+            return false;
+
+        descriptor->bytes       = buffer;
+        descriptor->capacity    = capacity;
+    }
+
+    memcpy(descriptor->bytes + descriptor->length, bytes, length);
+    descriptor->length += length;
+
+    return true;
+}
+
+static bool descriptorAppendItem(Descriptor * descriptor, uint8_t prefix, uint32_t value)
+{
+    uint8_t item[5];
+    size_t  length;
+
+    if ( value <= 0xff ) {
+        item[0] = prefix | 1;
+        length  = 1;
+    } else if ( value <= 0xffff ) {
+        item[0] = prefix | 2;
+        length  = 2;
+    } else {
+        item[0] = prefix | 3;
+        length  = 4;
+    }
+
+    for ( size_t index=0; index<length; index++ )
+        item[index + 1] = (uint8_t)(value >> (index * 8));
+
+    return descriptorAppend(descriptor, item, length + 1);
+}
+
+static bool descriptorAppendEmptyItem(Descriptor * descriptor, uint8_t prefix)
+{
+    return descriptorAppend(descriptor, &prefix, 1);
+}
+
+static bool descriptorCopy(Descriptor * descriptor, const Descriptor * source)
+{
+    descriptor->length = 0;
+    return descriptorAppend(descriptor, source->bytes, source->length);
+}
+
+static void descriptorRelease(Descriptor * descriptor)
+{
+    free(descriptor->bytes);
+    memset(descriptor, 0, sizeof(*descriptor));
+}
+
+//------------------------------------------------------------------------------
+// Shapes
+//
+// Each generator builds a well formed descriptor whose size grows linearly
+// with size, stressing one dimension of the parser.
+//------------------------------------------------------------------------------
+static bool appendButtonInput(Descriptor * descriptor)
+{
+    return descriptorAppendItem(descriptor, kItemUsagePage, kHIDPage_Button)
+        && descriptorAppendItem(descriptor, kItemUsageMinimum, 1)
+        && descriptorAppendItem(descriptor, kItemUsageMaximum, 8)
+        && descriptorAppendItem(descriptor, kItemLogicalMinimum, 0)
+        && descriptorAppendItem(descriptor, kItemLogicalMaximum, 1)
+        && descriptorAppendItem(descriptor, kItemReportSize, 1)
+        && descriptorAppendItem(descriptor, kItemReportCount, 8)
+        && descriptorAppendItem(descriptor, kItemInput, kInputVariable);
+}
+
+static bool beginApplication(Descriptor * descriptor)
+{
+    descriptor->length = 0;
+
+    return descriptorAppendItem(descriptor, kItemUsagePage, kHIDPage_GenericDesktop)
+        && descriptorAppendItem(descriptor, kItemUsage, kHIDUsage_GD_Mouse)
+        && descriptorAppendItem(descriptor, kItemCollection, kCollectionApplication);
+}
+
+static bool generateDeepCollections(Descriptor * descriptor, uint32_t size)
+{
+    bool result = beginApplication(descriptor);
+
+    for ( uint32_t index=0; result && index<size; index++ ) {
+        result = descriptorAppendItem(descriptor, kItemUsage, kHIDUsage_GD_Pointer)
+              && descriptorAppendItem(descriptor, kItemCollection, kCollectionLogical);
+    }
+
+    result = result && appendButtonInput(descriptor);
+
+    for ( uint32_t index=0; result && index<=size; index++ )
+        result = descriptorAppendEmptyItem(descriptor, kItemEndCollection);
+
+    return result;
+}
+
+static bool generateSiblingCollections(Descriptor * descriptor, uint32_t size)
+{
+    bool result = beginApplication(descriptor);
+
+    for ( uint32_t index=0; result && index<size; index++ ) {
+        result = descriptorAppendItem(descriptor, kItemUsage, kHIDUsage_GD_Pointer)
+              && descriptorAppendItem(descriptor, kItemCollection, kCollectionLogical)
+              && appendButtonInput(descriptor)
+              && descriptorAppendEmptyItem(descriptor, kItemEndCollection);
+    }
+
+    return result && descriptorAppendEmptyItem(descriptor, kItemEndCollection);
+}
+
+// The descriptor barely grows; the usage range and report do.
+static bool generateUsageRange(Descriptor * descriptor, uint32_t size)
+{
+    return beginApplication(descriptor)
+        && descriptorAppendItem(descriptor, kItemUsagePage, kHIDPage_Button)
+        && descriptorAppendItem(descriptor, kItemUsageMinimum, 1)
+        && descriptorAppendItem(descriptor, kItemUsageMaximum, size)
+        && descriptorAppendItem(descriptor, kItemLogicalMinimum, 0)
+        && descriptorAppendItem(descriptor, kItemLogicalMaximum, 1)
+        && descriptorAppendItem(descriptor, kItemReportSize, 1)
+        && descriptorAppendItem(descriptor, kItemReportCount, size)
+        && descriptorAppendItem(descriptor, kItemInput, kInputVariable)
+        && descriptorAppendEmptyItem(descriptor, kItemEndCollection);
+}
+
+static bool generateUsages(Descriptor * descriptor, uint32_t size)
+{
+    bool result = beginApplication(descriptor)
+               && descriptorAppendItem(descriptor, kItemUsagePage, kHIDPage_KeyboardOrKeypad);
+
+    for ( uint32_t index=0; result && index<size; index++ )
+        result = descriptorAppendItem(descriptor, kItemUsage, index + 1);
+
+    return result
+        && descriptorAppendItem(descriptor, kItemLogicalMinimum, 0)
+        && descriptorAppendItem(descriptor, kItemLogicalMaximum, 1)
+        && descriptorAppendItem(descriptor, kItemReportSize, 1)
+        && descriptorAppendItem(descriptor, kItemReportCount, size)
+        && descriptorAppendItem(descriptor, kItemInput, kInputVariable)
+        && descriptorAppendEmptyItem(descriptor, kItemEndCollection);
+}
+
+static bool generateMainItems(Descriptor * descriptor, uint32_t size)
+{
+    bool result = beginApplication(descriptor);
+
+    for ( uint32_t index=0; result && index<size; index++ )
+        result = appendButtonInput(descriptor);
+
+    return result && descriptorAppendEmptyItem(descriptor, kItemEndCollection);
+}
+
+static bool generateReportIDs(Descriptor * descriptor, uint32_t size)
+{
+    bool result = beginApplication(descriptor);
+
+    for ( uint32_t index=0; result && index<size; index++ ) {
+        result = descriptorAppendItem(descriptor, kItemReportID, (index % 255) + 1)
+              && appendButtonInput(descriptor);
+    }
+
+    return result && descriptorAppendEmptyItem(descriptor, kItemEndCollection);
+}
+
+static bool generatePushPop(Descriptor * descriptor, uint32_t size)
+{
+    bool result = beginApplication(descriptor);
+
+    for ( uint32_t index=0; result && index<size; index++ )
+        result = descriptorAppendEmptyItem(descriptor, kItemPush);
+
+    result = result && appendButtonInput(descriptor);
+
+    for ( uint32_t index=0; result && index<size; index++ )
+        result = descriptorAppendEmptyItem(descriptor, kItemPop);
+
+    return result && descriptorAppendEmptyItem(descriptor, kItemEndCollection);
+}
+
+static const Shape __shapes[] = {
+    {"deep-collections",    generateDeepCollections},
+    {"sibling-collections", generateSiblingCollections},
+    {"usage-range",         generateUsageRange},
+    {"usages",              generateUsages},
+    {"main-items",          generateMainItems},
+    {"report-ids",          generateReportIDs},
+    {"push-pop",            generatePushPop},
+};
+
+//------------------------------------------------------------------------------
+// postProcess
+//
+// The queries IOHIDDevice::createElementHierarchy makes.  Returns the number
+// of elements the kernel would create, counting one per usage in a range
+// since that is how ranges are split into sub elements.
+//------------------------------------------------------------------------------
+static uint64_t countElements(bool isRange, HIDUsage usageMin, HIDUsage usageMax)
+{
+    return (isRange && usageMax >= usageMin) ? (uint64_t)(usageMax - usageMin) + 1 : 1;
+}
+
+static void postProcess(HIDPreparsedDataRef parseData, ParseResult * result)
+{
+    static const HIDReportType  reportTypes[] = {kHIDInputReport, kHIDOutputReport, kHIDFeatureReport};
+    HIDCapabilities             caps;
+    HIDCollectionNodePtr        nodes;
+    UInt32                      count;
+
+    if ( HIDGetCapabilities(parseData, &caps) != kHIDSuccess )
+        return;
+
+    count = caps.numberCollectionNodes;
+    nodes = (HIDCollectionNodePtr)PoolAllocateResident((count + 1) * sizeof(HIDCollectionNode), true);
+    if ( nodes ) {
+        HIDGetCollectionNodes(nodes, &count, parseData);
+        result->elements += count;
+        PoolDeallocate(nodes, 0);
+    }
+
+    for ( uint32_t index=0; index<sizeof(reportTypes)/sizeof(reportTypes[0]); index++ ) {
+        HIDButtonCapabilitiesPtr    buttons;
+        HIDValueCapabilitiesPtr     values;
+        UInt32                      buttonCount;
+        UInt32                      valueCount;
+
+        switch ( reportTypes[index] ) {
+            case kHIDInputReport:
+                buttonCount = caps.numberInputButtonCaps;
+                valueCount  = caps.numberInputValueCaps;
+                break;
+            case kHIDOutputReport:
+                buttonCount = caps.numberOutputButtonCaps;
+                valueCount  = caps.numberOutputValueCaps;
+                break;
+            default:
+                buttonCount = caps.numberFeatureButtonCaps;
+                valueCount  = caps.numberFeatureValueCaps;
+                break;
+        }
+
+        buttons = (HIDButtonCapabilitiesPtr)PoolAllocateResident((buttonCount + 1) * sizeof(HIDButtonCapabilities), true);
+        values  = (HIDValueCapabilitiesPtr)PoolAllocateResident((valueCount + 1) * sizeof(HIDValueCapabilities), true);
+
+        if ( buttons && buttonCount && HIDGetButtonCapabilities(reportTypes[index], buttons, &buttonCount, parseData) == kHIDSuccess ) {
+            for ( UInt32 cap=0; cap<buttonCount; cap++ )
+                result->elements += countElements(buttons[cap].isRange, buttons[cap].u.range.usageMin, buttons[cap].u.range.usageMax);
+        }
+
+        if ( values && valueCount && HIDGetValueCapabilities(reportTypes[index], values, &valueCount, parseData) == kHIDSuccess ) {
+            for ( UInt32 cap=0; cap<valueCount; cap++ )
+                result->elements += countElements(values[cap].isRange, values[cap].u.range.usageMin, values[cap].u.range.usageMax);
+        }
+
+        PoolDeallocate(buttons, 0);
+        PoolDeallocate(values, 0);
+    }
+}
+
+//------------------------------------------------------------------------------
+// parseDescriptor
+//
+// HIDOpenReportDescriptor, one step at a time so each phase can be timed,
+// followed by the attach time queries and HIDCloseReportDescriptor.
+//------------------------------------------------------------------------------
+static void parseDescriptor(const Descriptor * descriptor, ParseResult * result)
+{
+    HIDPreparsedDataPtr preparsedData;
+    HIDReportDescriptor reportDescriptor;
+    uint64_t            allocateTime;
+    uint64_t            start;
+    uint64_t            time;
+
+    memset(result, 0, sizeof(*result));
+
+    __allocationCount   = 0;
+    __liveBytes         = 0;
+    __peakBytes         = 0;
+    __allocateTime      = 0;
+
+    start = getNanoseconds();
+
+    preparsedData = (HIDPreparsedDataPtr)PoolAllocateResident(sizeof(HIDPreparsedData), kShouldClearMem);
+    if ( !preparsedData ) {
+        result->status = kHIDNotEnoughMemoryErr;
+        return;
+    }
+
+    memset(&reportDescriptor, 0, sizeof(reportDescriptor));
+    reportDescriptor.descriptor         = descriptor->bytes;
+    reportDescriptor.descriptorLength   = descriptor->length;
+
+    allocateTime = __allocateTime;
+    time = getNanoseconds();
+    result->status = HIDCountDescriptorItems(&reportDescriptor, preparsedData);
+    result->phases[kPhaseCount] = (getNanoseconds() - time) - (__allocateTime - allocateTime);
+
+    if ( result->status == kHIDSuccess ) {
+        time = getNanoseconds();
+        result->status = HIDParseDescriptor(&reportDescriptor, preparsedData);
+        result->phases[kPhaseProcessItems] = getNanoseconds() - time;
+    }
+
+    result->phases[kPhaseAllocate] = __allocateTime;
+
+    if ( result->status == kHIDSuccess && preparsedData->rawMemPtr ) {
+        preparsedData->hidTypeIfValid = kHIDOSType;
+
+        allocateTime = __allocateTime;
+        time = getNanoseconds();
+        postProcess((HIDPreparsedDataRef)preparsedData, result);
+        result->phases[kPhasePostProcess] = getNanoseconds() - time;
+
+        HIDCloseReportDescriptor((HIDPreparsedDataRef)preparsedData);
+    } else {
+        if ( preparsedData->rawMemPtr )
+            PoolDeallocate(preparsedData->rawMemPtr, preparsedData->numBytesAllocated);
+        PoolDeallocate(preparsedData, sizeof(HIDPreparsedData));
+
+        if ( result->status == kHIDSuccess )
+            result->status = kHIDNotEnoughMemoryErr;
+    }
+
+    result->phases[kPhaseTotal] = getNanoseconds() - start;
+    result->peakBytes           = __peakBytes;
+    result->allocations         = __allocationCount;
+}
+
+// Repeats the parse until enough time has passed to trust the clock and
+// keeps the fastest run, which is the least disturbed by everything else
+// on the machine.
+static void measureDescriptor(const Descriptor * descriptor, ParseResult * result)
+{
+    ParseResult run;
+    uint64_t    elapsed = 0;
+
+    parseDescriptor(descriptor, result);
+    elapsed += result->phases[kPhaseTotal];
+
+    for ( uint32_t repeat=1; repeat<kMaxMeasureRepeats && elapsed<kMinMeasureDuration; repeat++ ) {
+        parseDescriptor(descriptor, &run);
+        elapsed += run.phases[kPhaseTotal];
+
+        if ( run.phases[kPhaseTotal] < result->phases[kPhaseTotal] )
+            *result = run;
+    }
+}
+
+static void printResultHeader()
+{
+    printf("%-22s %8s %7s", "Descriptor", "Bytes", "Status");
+    for ( uint32_t phase=0; phase<kPhaseCountMax; phase++ )
+        printf(" %10s", __phaseNames[phase]);
+    printf(" %10s %6s %10s\n", "PeakBytes", "Allocs", "Elements");
+}
+
+static void printResult(const char * name, size_t length, const ParseResult * result)
+{
+    printf("%-22s %8zu %7d", name, length, (int)result->status);
+    for ( uint32_t phase=0; phase<kPhaseCountMax; phase++ )
+        printf(" %10llu", (unsigned long long)result->phases[phase]);
+    printf(" %10llu %6llu %10llu\n", (unsigned long long)result->peakBytes, (unsigned long long)result->allocations, (unsigned long long)result->elements);
+}
+
+//------------------------------------------------------------------------------
+// Scaling
+//
+// The growth exponent is the least squares slope of log(cost) against
+// log(size); 1 is linear.
+//------------------------------------------------------------------------------
+static double getGrowthExponent(const double * sizes, const double * costs, uint32_t count)
+{
+    double sumX = 0, sumY = 0, sumXX = 0, sumXY = 0;
+    double denominator;
+
+    for ( uint32_t index=0; index<count; index++ ) {
+        double x = log(sizes[index]);
+        double y = log(costs[index] > 1 ? costs[index] : 1);
+
+        sumX    += x;
+        sumY    += y;
+        sumXX   += x * x;
+        sumXY   += x * y;
+    }
+
+    denominator = (count * sumXX) - (sumX * sumX);
+
+    return denominator != 0 ? ((count * sumXY) - (sumX * sumY)) / denominator : 0;
+}
+
+static uint32_t runScaling(uint32_t scaleLimit)
+{
+    Descriptor  descriptor  = {};
+    uint32_t    flagged     = 0;
+
+    printf("Scaling, ns per phase for sizes 16 to %u\n\n", scaleLimit);
+    printResultHeader();
+
+    for ( uint32_t shape=0; shape<sizeof(__shapes)/sizeof(__shapes[0]); shape++ ) {
+        double      sizes[32];
+        double      times[32];
+        double      bytes[32];
+        uint32_t    count = 0;
+        double      timeExponent;
+        double      bytesExponent;
+
+        for ( uint32_t size=16; size<=scaleLimit && count<32; size*=2 ) {
+            ParseResult result;
+            char        name[64];
+
+            if ( !__shapes[shape].generator(&descriptor, size) || descriptor.length > kMaxDescriptorLength )
+                break;
+
+            measureDescriptor(&descriptor, &result);
+
+            snprintf(name, sizeof(name), "%s/%u", __shapes[shape].name, size);
+            printResult(name, descriptor.length, &result);
+
+            // Size the fit by the generator's size rather than the byte
+            // count so that shapes like usage-range, whose descriptor hardly
+            // grows, still show how their cost follows the parameter.
+            sizes[count] = size;
+            times[count] = (double)result.phases[kPhaseTotal];
+            bytes[count] = (double)result.peakBytes;
+            count++;
+        }
+
+        if ( count < 3 )
+            continue;
+
+        timeExponent    = getGrowthExponent(sizes, times, count);
+        bytesExponent   = getGrowthExponent(sizes, bytes, count);
+
+        printf("%-22s time ~ n^%.2f, memory ~ n^%.2f%s\n\n", __shapes[shape].name, timeExponent, bytesExponent,
+               (timeExponent > kSuperLinearThreshold || bytesExponent > kSuperLinearThreshold) ? "  SUPER-LINEAR" : "");
+
+        if ( timeExponent > kSuperLinearThreshold || bytesExponent > kSuperLinearThreshold )
+            flagged++;
+    }
+
+    descriptorRelease(&descriptor);
+
+    return flagged;
+}
+
+//------------------------------------------------------------------------------
+// Fuzzing
+//------------------------------------------------------------------------------
+static void mutateDescriptor(Descriptor * descriptor, uint64_t * seed)
+{
+    uint32_t mutations = 1 + (uint32_t)(nextRandom(seed) % kMaxMutations);
+
+    for ( uint32_t mutation=0; mutation<mutations; mutation++ ) {
+        size_t length = descriptor->length;
+        size_t offset = length ? nextRandom(seed) % length : 0;
+
+        switch ( nextRandom(seed) % 6 ) {
+            case 0:
+                if ( length )
+                    descriptor->bytes[offset] ^= 1 << (nextRandom(seed) % 8);
+                break;
+            case 1:
+                if ( length )
+                    descriptor->bytes[offset] = (uint8_t)nextRandom(seed);
+                break;
+            case 2: {
+                // A random short item with random data.
+                uint8_t item[5];
+                size_t  size = nextRandom(seed) % 4;
+
+                item[0] = (uint8_t)(nextRandom(seed) & 0xfc) | (uint8_t)size;
+                if ( size == 3 )
+                    size = 4;
+                for ( size_t index=1; index<=size; index++ )
+                    item[index] = (uint8_t)nextRandom(seed);
+
+                if ( descriptorAppend(descriptor, item, size + 1) ) {
+                    memmove(descriptor->bytes + offset + size + 1, descriptor->bytes + offset, length - offset);
+                    memcpy(descriptor->bytes + offset, item, size + 1);
+                }
+                break;
+            }
+            case 3: {
+                size_t count = 1 + (nextRandom(seed) % 8);
+
+                if ( count > length - offset )
+                    count = length - offset;
+                memmove(descriptor->bytes + offset, descriptor->bytes + offset + count, length - offset - count);
+                descriptor->length -= count;
+                break;
+            }
+            case 4: {
+                // Repeat a chunk in place, which is how deep nesting and long
+                // item runs come about.
+                size_t count    = 1 + (nextRandom(seed) % 64);
+                size_t repeats  = 1 + (nextRandom(seed) % 16);
+
+                if ( count > length - offset )
+                    count = length - offset;
+
+                for ( size_t repeat=0; repeat<repeats && count && descriptor->length + count <= kMaxMutantLength; repeat++ ) {
+                    if ( !descriptorAppend(descriptor, descriptor->bytes + offset, count) )
+                        break;
+                }
+                break;
+            }
+            default:
+                // Push an item's data to an extreme.
+                for ( size_t index=offset + 1; index<length && index<=offset + 4; index++ )
+                    descriptor->bytes[index] = (nextRandom(seed) & 1) ? 0xff : 0x7f;
+                break;
+        }
+
+        if ( descriptor->length > kMaxMutantLength )
+            descriptor->length = kMaxMutantLength;
+    }
+}
+
+// Cost per descriptor byte above what any descriptor costs, so a mutant is
+// only interesting if it is expensive for its size.
+static double getScore(const Descriptor * descriptor, const ParseResult * result)
+{
+    double length   = descriptor->length ? (double)descriptor->length : 1;
+    double time     = (double)result->phases[kPhaseTotal] - (double)__baseline.phases[kPhaseTotal];
+    double bytes    = (double)result->peakBytes - (double)__baseline.peakBytes;
+
+    return ((time > 0 ? time : 0) + (bytes > 0 ? bytes : 0)) / length;
+}
+
+static void considerOffender(Offender * worst, uint32_t worstCount, const Descriptor * descriptor, const ParseResult * result, double score, uint64_t iteration)
+{
+    uint32_t lowest = 0;
+
+    for ( uint32_t index=1; index<worstCount; index++ ) {
+        if ( worst[index].score < worst[lowest].score )
+            lowest = index;
+    }
+
+    if ( score <= worst[lowest].score )
+        return;
+
+    if ( !descriptorCopy(&worst[lowest].descriptor, descriptor) )
+        return;
+
+    worst[lowest].result    = *result;
+    worst[lowest].score     = score;
+    worst[lowest].iteration = iteration;
+}
+
+static int compareOffenders(const void * a, const void * b)
+{
+    double scoreA = ((const Offender *)a)->score;
+    double scoreB = ((const Offender *)b)->score;
+
+    return (scoreA < scoreB) - (scoreA > scoreB);
+}
+
+static bool writeDescriptor(const Descriptor * descriptor, const char * path)
+{
+    FILE *  file    = fopen(path, "wb");
+    bool    result;
+
+    if ( !file ) {
+        printf("Unable to open %s: %s\n", path, strerror(errno));
+        return false;
+    }
+
+    result = fwrite(descriptor->bytes, 1, descriptor->length, file) == descriptor->length;
+    result &= (fclose(file) == 0);
+
+    return result;
+}
+
+static bool readDescriptor(const char * path, Descriptor * descriptor)
+{
+    uint8_t buffer[4096];
+    FILE *  file = fopen(path, "rb");
+    size_t  length;
+    bool    result = true;
+
+    if ( !file )
+        return false;
+
+    descriptor->length = 0;
+
+    while ( result && (length = fread(buffer, 1, sizeof(buffer), file)) > 0 ) {
+        result = descriptor->length + length <= kMaxDescriptorLength
+              && descriptorAppend(descriptor, buffer, length);
+    }
+
+    fclose(file);
+
+    return result && descriptor->length;
+}
+
+static void runFuzzer(uint64_t iterations, uint64_t seed, uint32_t worstCount, const char * corpusPath)
+{
+    Descriptor *    pool        = (Descriptor *)calloc(kPoolCapacity, sizeof(Descriptor));
+    Offender *      worst       = (Offender *)calloc(worstCount, sizeof(Offender));
+    Descriptor      mutant      = {};
+    uint32_t        poolCount   = 0;
+    uint64_t        failures    = 0;
+
+    if ( !pool || !worst )
+        goto exit;
+
+    // The fixed cost of the smallest sensible descriptor, which getScore
+    // takes off every mutant's.
+    if ( generateMainItems(&mutant, 1) )
+        measureDescriptor(&mutant, &__baseline);
+
+    // Seed with a small instance of every shape.
+    for ( uint32_t shape=0; shape<sizeof(__shapes)/sizeof(__shapes[0]); shape++ ) {
+        if ( __shapes[shape].generator(&pool[poolCount], 4) )
+            poolCount++;
+    }
+
+    for ( uint64_t iteration=0; iteration<iterations; iteration++ ) {
+        ParseResult result;
+        double      score;
+
+        if ( !descriptorCopy(&mutant, &pool[nextRandom(&seed) % poolCount]) )
+            break;
+
+        mutateDescriptor(&mutant, &seed);
+
+        if ( __verbose )
+            printf("iteration %llu: %zu bytes\n", (unsigned long long)iteration, mutant.length);
+
+        parseDescriptor(&mutant, &result);
+
+        if ( result.status != kHIDSuccess ) {
+            failures++;
+            continue;
+        }
+
+        score = getScore(&mutant, &result);
+        considerOffender(worst, worstCount, &mutant, &result, score, iteration);
+
+        // Keep descriptors that still parse so mutations can build on
+        // each other; once the pool is full replace an entry at random.
+        if ( poolCount < kPoolCapacity )
+            descriptorCopy(&pool[poolCount++], &mutant);
+        else
+            descriptorCopy(&pool[nextRandom(&seed) % kPoolCapacity], &mutant);
+    }
+
+    // Single runs are noisy; measure the offenders properly before ranking.
+    for ( uint32_t index=0; index<worstCount; index++ ) {
+        if ( !worst[index].descriptor.length )
+            continue;
+
+        measureDescriptor(&worst[index].descriptor, &worst[index].result);
+        worst[index].score = getScore(&worst[index].descriptor, &worst[index].result);
+    }
+
+    qsort(worst, worstCount, sizeof(Offender), compareOffenders);
+
+    printf("Fuzzed %llu descriptors, %llu rejected by the parser\n\n", (unsigned long long)iterations, (unsigned long long)failures);
+    printf("Worst offenders, ns per phase\n\n");
+    printResultHeader();
+
+    for ( uint32_t index=0; index<worstCount; index++ ) {
+        char name[64];
+
+        if ( !worst[index].descriptor.length )
+            continue;
+
+        snprintf(name, sizeof(name), "worst-%02u (#%llu)", index, (unsigned long long)worst[index].iteration);
+        printResult(name, worst[index].descriptor.length, &worst[index].result);
+
+        if ( corpusPath ) {
+            char path[1024];
+
+            snprintf(path, sizeof(path), "%s/worst-%02u.hid", corpusPath, index);
+            writeDescriptor(&worst[index].descriptor, path);
+        }
+    }
+
+    printf("\n");
+
+exit:
+    for ( uint32_t index=0; pool && index<kPoolCapacity; index++ )
+        descriptorRelease(&pool[index]);
+    for ( uint32_t index=0; worst && index<worstCount; index++ )
+        descriptorRelease(&worst[index].descriptor);
+
+    descriptorRelease(&mutant);
+    free(pool);
+    free(worst);
+}
+
+//------------------------------------------------------------------------------
+// runCorpus
+//
+// Re-measures every descriptor in a regression corpus.  Returns the number
+// that cost more than budget ns per descriptor byte, if a budget is set.
+//------------------------------------------------------------------------------
+static uint32_t runCorpus(const char * corpusPath, double budget)
+{
+    Descriptor      descriptor  = {};
+    struct dirent * entry;
+    uint32_t        overBudget  = 0;
+    DIR *           directory;
+
+    directory = opendir(corpusPath);
+    if ( !directory ) {
+        printf("Unable to open %s: %s\n", corpusPath, strerror(errno));
+        return 1;
+    }
+
+    printf("Corpus %s, ns per phase\n\n", corpusPath);
+    printResultHeader();
+
+    while ( (entry = readdir(directory)) ) {
+        ParseResult result;
+        char        path[1024];
+        double      cost;
+
+        if ( entry->d_name[0] == '.' )
+            continue;
+
+        snprintf(path, sizeof(path), "%s/%s", corpusPath, entry->d_name);
+        if ( !readDescriptor(path, &descriptor) )
+            continue;
+
+        measureDescriptor(&descriptor, &result);
+        printResult(entry->d_name, descriptor.length, &result);
+
+        cost = (double)result.phases[kPhaseTotal] / descriptor.length;
+        if ( budget > 0 && cost > budget ) {
+            printf("%-22s over budget: %.1f ns/byte\n", entry->d_name, cost);
+            overBudget++;
+        }
+    }
+
+    closedir(directory);
+    descriptorRelease(&descriptor);
+
+    return overBudget;
+}
+
+static void printHelp()
+{
+    printf("\n");
+    printf("hidDescriptorFuzzer usage: hidDescriptorFuzzer [options]\n\n");
+    printf("\t-scale <size>\t: Scale each descriptor shape up to size (default %u)\n", kDefaultScaleLimit);
+    printf("\t-fuzz <count>\t: Parse count mutated descriptors (default %u)\n", kDefaultIterations);
+    printf("\t-seed <seed>\t: Seed for -fuzz (default 1)\n");
+    printf("\t-worst <count>\t: Number of worst offenders to keep (default %u)\n", kDefaultWorstCount);
+    printf("\t-o <dir>\t: Write the worst offenders to dir\n");
+    printf("\t-r <dir>\t: Re-measure the descriptors in dir\n");
+    printf("\t-budget <ns>\t: With -r, fail descriptors over ns per byte\n");
+    printf("\t-v\t\t: Print each fuzz iteration before parsing it\n");
+    printf("\n");
+    printf("\tWith no mode options both the scaling and fuzz runs are made.\n");
+    printf("\tThe exit status is non-zero if a shape scales super-linearly or\n");
+    printf("\ta corpus descriptor is over budget.\n");
+    printf("\n");
+}
+
+int main (int argc, const char * argv[])
+{
+    const char *    corpusPath  = NULL;
+    const char *    outputPath  = NULL;
+    uint32_t        scaleLimit  = 0;
+    uint64_t        iterations  = 0;
+    uint64_t        seed        = 1;
+    uint32_t        worstCount  = kDefaultWorstCount;
+    double          budget      = 0;
+    uint32_t        failures    = 0;
+
+    for ( int index=1; index<argc; index++ ) {
+        const char * arg = argv[index];
+
+        if ( !strcmp("-scale", arg) && (index + 1) < argc ) {
+            scaleLimit = (uint32_t)strtoul(argv[++index], NULL, 0);
+        }
+        else if ( !strcmp("-fuzz", arg) && (index + 1) < argc ) {
+            iterations = strtoull(argv[++index], NULL, 0);
+        }
+        else if ( !strcmp("-seed", arg) && (index + 1) < argc ) {
+            seed = strtoull(argv[++index], NULL, 0);
+        }
+        else if ( !strcmp("-worst", arg) && (index + 1) < argc ) {
+            worstCount = (uint32_t)strtoul(argv[++index], NULL, 0);
+        }
+        else if ( !strcmp("-o", arg) && (index + 1) < argc ) {
+            outputPath = argv[++index];
+        }
+        else if ( !strcmp("-r", arg) && (index + 1) < argc ) {
+            corpusPath = argv[++index];
+        }
+        else if ( !strcmp("-budget", arg) && (index + 1) < argc ) {
+            budget = strtod(argv[++index], NULL);
+        }
+        else if ( !strcmp("-v", arg) ) {
+            __verbose = true;
+        }
+        else {
+            printHelp();
+            return !strcmp("-h", arg) ? 0 : 1;
+        }
+    }
+
+    if ( !scaleLimit && !iterations && !corpusPath ) {
+        scaleLimit  = kDefaultScaleLimit;
+        iterations  = kDefaultIterations;
+    }
+
+    if ( !seed )
+        seed = 1;
+
+    if ( !worstCount )
+        worstCount = 1;
+
+    if ( scaleLimit )
+        failures += runScaling(scaleLimit);
+
+    if ( iterations )
+        runFuzzer(iterations, seed, worstCount, outputPath);
+
+    if ( corpusPath )
+        failures += runCorpus(corpusPath, budget);
+
+    return failures ? 1 : 0;
+}
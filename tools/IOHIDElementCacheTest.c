@@ -0,0 +1,202 @@
+//
+//  IOHIDElementCacheTest.c
+//  IOHIDFamily
+//
+//  Exercises IOHIDLib's element cache: round trips, key mismatches, and the
+//  ownership, permission and size checks that keep a tampered entry from
+//  being handed to IOHIDDeviceClass.  IOHIDElementCache.c only depends on
+//  POSIX, so this builds and runs off-device, but it must run as root since
+//  only root owned entries are trusted:
+//
+//      cc -Wall -I IOHIDLib -o hidElementCacheTest
+//          tools/IOHIDElementCacheTest.c IOHIDLib/IOHIDElementCache.c
+//
+
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "IOHIDElementCache.h"
+
+#define kRecordSize         96
+#define kElementCount       5
+#define kReportHandlerCount 2
+#define kVersion            "2.0.0"
+
+static const uint8_t kDescriptor[] = {
+    0x05, 0x01, 0x09, 0x02, 0xa1, 0x01, 0x09, 0x01, 0xa1, 0x00, 0x05, 0x09,
+    0x19, 0x01, 0x29, 0x03, 0x15, 0x00, 0x25, 0x01, 0x95, 0x03, 0x75, 0x01,
+    0x81, 0x02, 0x95, 0x01, 0x75, 0x05, 0x81, 0x01, 0x05, 0x01, 0x09, 0x30,
+    0x09, 0x31, 0x15, 0x81, 0x25, 0x7f, 0x75, 0x08, 0x95, 0x02, 0x81, 0x06,
+    0xc0, 0xc0
+};
+
+static int      gFailures;
+static char     gDirectory[PATH_MAX];
+static uint8_t  gRecords[kRecordSize * (kElementCount + kReportHandlerCount)];
+
+#define check(cond, name) do {                                  \
+    if ( cond ) {                                               \
+        printf("ok    %s\n", name);                             \
+    } else {                                                    \
+        printf("FAIL  %s (%s:%d)\n", name, __FILE__, __LINE__); \
+        gFailures++;                                            \
+    }                                                           \
+} while (0)
+
+static int entryPath(const char * version, const uint8_t * descriptor, size_t length, char * path, size_t pathLength)
+{
+    uint64_t hash = IOHIDElementCacheHashDescriptor(version, descriptor, length);
+
+    return snprintf(path, pathLength, "%s/%016llx.hidelements", gDirectory, (unsigned long long)hash) < (int)pathLength ? 0 : -1;
+}
+
+static int store()
+{
+    IOHIDElementCacheEntry entry;
+
+    entry.records               = gRecords;
+    entry.recordSize            = kRecordSize;
+    entry.elementCount          = kElementCount;
+    entry.reportHandlerCount    = kReportHandlerCount;
+
+    return IOHIDElementCacheStoreEntry(gDirectory, kVersion, kDescriptor, sizeof(kDescriptor), &entry);
+}
+
+static int hits(const char * version, const uint8_t * descriptor, size_t length, uint32_t recordSize)
+{
+    IOHIDElementCacheEntry  entry;
+    int                     hit;
+
+    if ( IOHIDElementCacheCopyEntry(gDirectory, version, descriptor, length, recordSize, &entry) )
+        return 0;
+
+    hit = (entry.recordSize == kRecordSize) &&
+          (entry.elementCount == kElementCount) &&
+          (entry.reportHandlerCount == kReportHandlerCount) &&
+          !memcmp(entry.records, gRecords, sizeof(gRecords));
+
+    IOHIDElementCacheReleaseEntry(&entry);
+
+    return hit ? 1 : -1;
+}
+
+static int hitsDefault()
+{
+    return hits(kVersion, kDescriptor, sizeof(kDescriptor), kRecordSize);
+}
+
+static void testRoundTrip()
+{
+    uint8_t other[sizeof(kDescriptor)];
+
+    check(store() == 0, "store entry");
+    check(hitsDefault() == 1, "copy returns the stored records");
+    check(hits("2.0.1", kDescriptor, sizeof(kDescriptor), kRecordSize) == 0, "other family version misses");
+    check(hits(kVersion, kDescriptor, sizeof(kDescriptor) - 1, kRecordSize) == 0, "shorter descriptor misses");
+    check(hits(kVersion, kDescriptor, sizeof(kDescriptor), kRecordSize + 4) == 0, "other record size misses");
+
+    memcpy(other, kDescriptor, sizeof(other));
+    other[sizeof(other) - 3] ^= 0x01;
+    check(hits(kVersion, other, sizeof(other), kRecordSize) == 0, "other descriptor misses");
+}
+
+static void testCollision()
+{
+    char    path[PATH_MAX];
+    char    otherPath[PATH_MAX];
+    uint8_t other[sizeof(kDescriptor)];
+
+    // put the entry at the path of a different descriptor, as a colliding
+    // hash would; the stored descriptor must still reject it
+    memcpy(other, kDescriptor, sizeof(other));
+    other[0] ^= 0x01;
+
+    check(store() == 0 && !entryPath(kVersion, kDescriptor, sizeof(kDescriptor), path, sizeof(path)) &&
+          !entryPath(kVersion, other, sizeof(other), otherPath, sizeof(otherPath)) && !rename(path, otherPath),
+          "move entry to a colliding path");
+    check(hits(kVersion, other, sizeof(other), kRecordSize) == 0, "colliding entry is rejected");
+    unlink(otherPath);
+}
+
+static void testPermissions()
+{
+    char path[PATH_MAX];
+
+    check(store() == 0 && !entryPath(kVersion, kDescriptor, sizeof(kDescriptor), path, sizeof(path)), "store entry");
+
+    check(!chmod(path, 0664) && hitsDefault() == 0, "group writable entry is rejected");
+    check(!chmod(path, 0646) && hitsDefault() == 0, "world writable entry is rejected");
+    check(!chmod(path, 0644) && hitsDefault() == 1, "read only entry is accepted");
+
+    check(!chown(path, 1, 1) && hitsDefault() == 0, "entry not owned by root is rejected");
+    check(!chown(path, 0, 0) && hitsDefault() == 1, "root owned entry is accepted");
+
+    check(IOHIDElementCacheIsEnabled(gDirectory), "trusted directory enables the cache");
+    check(!IOHIDElementCacheIsEnabled(path), "an entry isn't a cache directory");
+    check(!chmod(gDirectory, 0777) && !IOHIDElementCacheIsEnabled(gDirectory), "world writable directory disables the cache");
+    check(hitsDefault() == 0, "world writable directory is rejected");
+    check(store() != 0, "store into world writable directory fails");
+    check(!chmod(gDirectory, 0755) && !chown(gDirectory, 1, 1) && hitsDefault() == 0, "directory not owned by root is rejected");
+    check(!chown(gDirectory, 0, 0) && hitsDefault() == 1, "root owned directory is accepted");
+}
+
+static void testTampering()
+{
+    char    path[PATH_MAX];
+    char    target[PATH_MAX];
+    int     fd;
+
+    check(store() == 0 && !entryPath(kVersion, kDescriptor, sizeof(kDescriptor), path, sizeof(path)), "store entry");
+
+    // padding the file must not go unnoticed
+    fd = open(path, O_WRONLY | O_APPEND);
+    check(fd >= 0 && write(fd, "x", 1) == 1 && !close(fd) && hitsDefault() == 0, "padded entry is rejected");
+
+    check(store() == 0 && !truncate(path, sizeof(kDescriptor)) && hitsDefault() == 0, "truncated entry is rejected");
+
+    // an otherwise valid entry reached through a symlink isn't trusted
+    check(store() == 0 && snprintf(target, sizeof(target), "%s.target", path) < (int)sizeof(target) &&
+          !rename(path, target) && !symlink(target, path), "replace entry with a symlink");
+    check(hitsDefault() == 0, "symlinked entry is rejected");
+    unlink(path);
+    unlink(target);
+
+    check(store() == 0 && hitsDefault() == 1, "entry is stored again");
+}
+
+int main(void)
+{
+    char        command[PATH_MAX + 16];
+    uint32_t    index;
+
+    if ( geteuid() != 0 ) {
+        printf("skipped: the element cache only trusts root owned entries, run as root\n");
+        return 0;
+    }
+
+    snprintf(gDirectory, sizeof(gDirectory), "/tmp/hidElementCacheTest.XXXXXX");
+    if ( !mkdtemp(gDirectory) || chmod(gDirectory, 0755) ) {
+        perror("mkdtemp");
+        return 1;
+    }
+
+    for ( index = 0; index < sizeof(gRecords); index++ )
+        gRecords[index] = (uint8_t)(index * 7 + 3);
+
+    testRoundTrip();
+    testCollision();
+    testPermissions();
+    testTampering();
+
+    snprintf(command, sizeof(command), "rm -rf %s", gDirectory);
+    if ( system(command) )
+        printf("couldn't remove %s\n", gDirectory);
+
+    printf("%s: %d failure(s)\n", gFailures ? "FAILED" : "passed", gFailures);
+
+    return gFailures ? 1 : 0;
+}
@@ -0,0 +1,572 @@
+//
+//  IOHIDElementMatchingBenchmark.c
+//  IOHIDFamily
+//
+//  Runs the kinds of queries IOHIDDeviceClass::copyMatchingElements gets
+//  over a generated table of element structs (2,000 by default), once with
+//  a full scan, once with the parent cookie, usage page and type indexes
+//  only, and once with the usage index and the cookie slice as well, and
+//  reports the elements visited and the time per query of each.  The
+//  selection and the index building are a user space copy of the ones in
+//  IOHIDLib/IOHIDDeviceClass.cpp, and every strategy has to produce the
+//  same matches in the same order.  It only needs the shims in tools/hosted:
+//
+//      cc -O2 -I tools/hosted -o hidElementMatchingBenchmark
+//          tools/IOHIDElementMatchingBenchmark.c
+//
+//      hidElementMatchingBenchmark [-n elements] [-r rounds]
+//
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <IOKit/IOTypes.h>
+
+#define kDefaultElementCount        2000
+#define kDefaultRounds              20
+#define kElementsPerCollection      40
+#define kDuplicateCount             4
+#define kButtonCount                16
+
+// IOHIDElementType and the usage pages the generated device uses
+#define kTypeInputMisc              1
+#define kTypeInputButton            2
+#define kTypeInputAxis              3
+#define kTypeCollection             513
+#define kPageGenericDesktop         0x01
+#define kPageButton                 0x09
+#define kPageVendor                 0xFF00
+
+enum {
+    kMatchCookie        = 1 << 0,
+    kMatchCookieMin     = 1 << 1,
+    kMatchCookieMax     = 1 << 2,
+    kMatchParent        = 1 << 3,
+    kMatchType          = 1 << 4,
+    kMatchUsagePage     = 1 << 5,
+    kMatchUsage         = 1 << 6
+};
+
+enum {
+    kStrategyScan,
+    kStrategyIndex,
+    kStrategyUsageAndCookie,
+    kStrategyCount
+};
+
+static const char * kStrategyNames[kStrategyCount] = {
+    "full scan",
+    "parent/page/type index",
+    "+ usage index, cookie slice"
+};
+
+// the IOHIDElementStruct fields the queries look at
+typedef struct Element {
+    UInt32  cookieMin;
+    UInt32  cookieMax;
+    UInt32  parentCookie;
+    UInt32  type;
+    UInt32  usagePage;
+    UInt32  usageMin;
+    UInt32  usageMax;
+} Element;
+
+typedef struct IndexEntry {
+    uint32_t    key;
+    uint32_t    index;
+} IndexEntry;
+
+typedef struct Index {
+    const Element * elements;
+    uint32_t        count;
+    IndexEntry *    byParent;
+    IndexEntry *    byUsagePage;
+    IndexEntry *    byType;
+    IndexEntry *    byUsage;
+    uint32_t        byUsageCount;
+    uint32_t *      withUsageRange;
+    uint32_t        withUsageRangeCount;
+    bool            cookieOrdered;
+} Index;
+
+typedef struct Query {
+    const char *    kind;
+    uint32_t        keys;
+    uint32_t        cookieMin;
+    uint32_t        cookieMax;
+    uint32_t        parent;
+    uint32_t        type;
+    uint32_t        usagePage;
+    uint32_t        usage;
+} Query;
+
+typedef struct Candidates {
+    const IndexEntry *  entries;
+    uint32_t            entryCount;
+    uint32_t            entry;
+    const uint32_t *    ranged;
+    uint32_t            rangedCount;
+    uint32_t            rangedEntry;
+    uint32_t            first;
+} Candidates;
+
+typedef struct Result {
+    uint32_t    matched;
+    uint64_t    checksum;
+    uint64_t    visited;
+} Result;
+
+static uint64_t now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+// a device of kElementsPerCollection sized physical collections under one
+// application collection: a few axes, a button range, a duplicate range
+// and vendor values with a usage each
+static uint32_t generateElements(Element * elements, uint32_t count)
+{
+    uint32_t    cookie          = 1;
+    uint32_t    vendorUsage     = 1;
+    uint32_t    collection      = 1;
+    uint32_t    index           = 0;
+    uint32_t    slot            = 0;
+
+    elements[index++] = (Element){ cookie, cookie, 0, kTypeCollection, kPageGenericDesktop, 0x02, 0x02 };
+    cookie++;
+
+    while ( index < count ) {
+        Element * element = &elements[index];
+
+        if ( !(slot % kElementsPerCollection) ) {
+            collection = cookie;
+            *element = (Element){ cookie, cookie, 1, kTypeCollection, kPageGenericDesktop, 0x01, 0x01 };
+        }
+        else if ( (slot % kElementsPerCollection) <= 3 ) {
+            uint32_t usage = 0x30 + (slot % kElementsPerCollection) - 1;
+            *element = (Element){ cookie, cookie, collection, kTypeInputAxis, kPageGenericDesktop, usage, usage };
+        }
+        else if ( (slot % kElementsPerCollection) == 4 ) {
+            *element = (Element){ cookie, cookie + kButtonCount - 1, collection, kTypeInputButton, kPageButton, 1, kButtonCount };
+        }
+        else if ( (slot % kElementsPerCollection) == 5 ) {
+            *element = (Element){ cookie, cookie + kDuplicateCount, collection, kTypeInputMisc, kPageVendor, vendorUsage, vendorUsage };
+            vendorUsage++;
+        }
+        else {
+            *element = (Element){ cookie, cookie, collection, kTypeInputMisc, kPageVendor, vendorUsage, vendorUsage };
+            vendorUsage++;
+        }
+
+        cookie = element->cookieMax + 1;
+        index++;
+        slot++;
+    }
+
+    return cookie;
+}
+
+static int indexEntryCompare(const void * a, const void * b)
+{
+    const IndexEntry * entryA = (const IndexEntry *)a;
+    const IndexEntry * entryB = (const IndexEntry *)b;
+
+    if ( entryA->key != entryB->key )
+        return (entryA->key < entryB->key) ? -1 : 1;
+
+    if ( entryA->index != entryB->index )
+        return (entryA->index < entryB->index) ? -1 : 1;
+
+    return 0;
+}
+
+// IOHIDDeviceClass::buildElementIndex
+static bool buildIndex(Index * idx, const Element * elements, uint32_t count)
+{
+    uint32_t index;
+
+    memset(idx, 0, sizeof(Index));
+
+    idx->elements       = elements;
+    idx->count          = count;
+    idx->byParent       = calloc(count, sizeof(IndexEntry));
+    idx->byUsagePage    = calloc(count, sizeof(IndexEntry));
+    idx->byType         = calloc(count, sizeof(IndexEntry));
+    idx->byUsage        = calloc(count, sizeof(IndexEntry));
+    idx->withUsageRange = calloc(count, sizeof(uint32_t));
+    idx->cookieOrdered  = true;
+
+    if ( !idx->byParent || !idx->byUsagePage || !idx->byType || !idx->byUsage || !idx->withUsageRange )
+        return false;
+
+    for ( index = 0; index < count; index++ ) {
+        idx->byParent[index]    = (IndexEntry){ elements[index].parentCookie, index };
+        idx->byUsagePage[index] = (IndexEntry){ elements[index].usagePage, index };
+        idx->byType[index]      = (IndexEntry){ elements[index].type, index };
+
+        if ( elements[index].usageMin == elements[index].usageMax )
+            idx->byUsage[idx->byUsageCount++] = (IndexEntry){ elements[index].usageMin, index };
+        else
+            idx->withUsageRange[idx->withUsageRangeCount++] = index;
+
+        if ( index && ((elements[index].cookieMin < elements[index-1].cookieMin) ||
+                       (elements[index].cookieMax < elements[index-1].cookieMax)) )
+            idx->cookieOrdered = false;
+    }
+
+    qsort(idx->byParent, count, sizeof(IndexEntry), indexEntryCompare);
+    qsort(idx->byUsagePage, count, sizeof(IndexEntry), indexEntryCompare);
+    qsort(idx->byType, count, sizeof(IndexEntry), indexEntryCompare);
+    qsort(idx->byUsage, idx->byUsageCount, sizeof(IndexEntry), indexEntryCompare);
+
+    return true;
+}
+
+static void freeIndex(Index * idx)
+{
+    free(idx->byParent);
+    free(idx->byUsagePage);
+    free(idx->byType);
+    free(idx->byUsage);
+    free(idx->withUsageRange);
+}
+
+// IOHIDDeviceClass::getElementIndexRange
+static uint32_t getIndexRange(const IndexEntry * entries, uint32_t count, uint32_t key, const IndexEntry ** pFirst)
+{
+    uint32_t low, high, mid, first;
+
+    for ( low = 0, high = count; low < high; ) {
+        mid = low + ((high - low) / 2);
+        if ( entries[mid].key < key )
+            low = mid + 1;
+        else
+            high = mid;
+    }
+    first = low;
+
+    for ( high = count; low < high; ) {
+        mid = low + ((high - low) / 2);
+        if ( entries[mid].key <= key )
+            low = mid + 1;
+        else
+            high = mid;
+    }
+
+    *pFirst = &entries[first];
+
+    return low - first;
+}
+
+// IOHIDDeviceClass::getElementCookieRange
+static uint32_t getCookieRange(const Index * idx, uint32_t cookieMin, bool hasMin, uint32_t cookieMax, bool hasMax, uint32_t * pFirst)
+{
+    uint32_t low, high, mid, first;
+
+    *pFirst = 0;
+
+    if ( !idx->cookieOrdered )
+        return idx->count;
+
+    for ( low = 0, high = idx->count; hasMax && (low < high); ) {
+        mid = low + ((high - low) / 2);
+        if ( idx->elements[mid].cookieMax < cookieMax )
+            low = mid + 1;
+        else
+            high = mid;
+    }
+    first = low;
+
+    for ( high = idx->count; hasMin && (low < high); ) {
+        mid = low + ((high - low) / 2);
+        if ( idx->elements[mid].cookieMin <= cookieMin )
+            low = mid + 1;
+        else
+            high = mid;
+    }
+
+    if ( !hasMin )
+        low = idx->count;
+
+    *pFirst = first;
+
+    return low - first;
+}
+
+static inline uint32_t candidatesCount(const Candidates * candidates)
+{
+    return candidates->entryCount + candidates->rangedCount;
+}
+
+static bool candidatesNext(Candidates * candidates, uint32_t * pIndex)
+{
+    if ( !candidates->entries ) {
+        if ( candidates->entry >= candidates->entryCount )
+            return false;
+
+        *pIndex = candidates->first + candidates->entry++;
+    }
+    else if ( (candidates->entry < candidates->entryCount) &&
+              ((candidates->rangedEntry >= candidates->rangedCount) ||
+               (candidates->entries[candidates->entry].index < candidates->ranged[candidates->rangedEntry])) ) {
+        *pIndex = candidates->entries[candidates->entry++].index;
+    }
+    else if ( candidates->rangedEntry < candidates->rangedCount ) {
+        *pIndex = candidates->ranged[candidates->rangedEntry++];
+    }
+    else {
+        return false;
+    }
+
+    return true;
+}
+
+static void takeEntries(Candidates * candidates, const IndexEntry * first, uint32_t count, const uint32_t * ranged, uint32_t rangedCount)
+{
+    if ( (count + rangedCount) >= candidatesCount(candidates) )
+        return;
+
+    memset(candidates, 0, sizeof(Candidates));
+    candidates->entries     = first;
+    candidates->entryCount  = count;
+    candidates->ranged      = ranged;
+    candidates->rangedCount = rangedCount;
+}
+
+// the selection at the top of IOHIDDeviceClass::copyMatchingElements
+static void selectCandidates(const Index * idx, const Query * query, int strategy, Candidates * candidates)
+{
+    const IndexEntry *  first;
+    uint32_t            firstIndex;
+    uint32_t            count;
+
+    memset(candidates, 0, sizeof(Candidates));
+    candidates->entryCount = idx->count;
+
+    if ( strategy == kStrategyScan )
+        return;
+
+    if ( query->keys & kMatchParent ) {
+        count = getIndexRange(idx->byParent, idx->count, query->parent, &first);
+        takeEntries(candidates, first, count, NULL, 0);
+    }
+
+    if ( query->keys & kMatchUsagePage ) {
+        count = getIndexRange(idx->byUsagePage, idx->count, query->usagePage, &first);
+        takeEntries(candidates, first, count, NULL, 0);
+    }
+
+    if ( query->keys & kMatchType ) {
+        count = getIndexRange(idx->byType, idx->count, query->type, &first);
+        takeEntries(candidates, first, count, NULL, 0);
+    }
+
+    if ( strategy == kStrategyIndex )
+        return;
+
+    if ( query->keys & kMatchUsage ) {
+        count = getIndexRange(idx->byUsage, idx->byUsageCount, query->usage, &first);
+        takeEntries(candidates, first, count, idx->withUsageRange, idx->withUsageRangeCount);
+    }
+
+    if ( query->keys & (kMatchCookie | kMatchCookieMin | kMatchCookieMax) ) {
+        bool hasMin = (query->keys & (kMatchCookie | kMatchCookieMin)) != 0;
+        bool hasMax = (query->keys & (kMatchCookie | kMatchCookieMax)) != 0;
+
+        count = getCookieRange(idx, query->cookieMin, hasMin, query->cookieMax, hasMax, &firstIndex);
+        if ( count < candidatesCount(candidates) ) {
+            memset(candidates, 0, sizeof(Candidates));
+            candidates->first       = firstIndex;
+            candidates->entryCount  = count;
+        }
+    }
+}
+
+// ElementStructMatches for the keys the queries use
+static bool elementMatches(const Element * element, const Query * query)
+{
+    if ( (query->keys & kMatchCookieMin) && (query->cookieMin < element->cookieMin) )
+        return false;
+
+    if ( (query->keys & kMatchCookieMax) && (query->cookieMax > element->cookieMax) )
+        return false;
+
+    if ( (query->keys & kMatchCookie) && ((query->cookieMin < element->cookieMin) || (query->cookieMin > element->cookieMax)) )
+        return false;
+
+    if ( (query->keys & kMatchParent) && (query->parent != element->parentCookie) )
+        return false;
+
+    if ( (query->keys & kMatchType) && (query->type != element->type) )
+        return false;
+
+    if ( (query->keys & kMatchUsagePage) && (query->usagePage != element->usagePage) )
+        return false;
+
+    if ( (query->keys & kMatchUsage) && ((query->usage < element->usageMin) || (query->usage > element->usageMax)) )
+        return false;
+
+    return true;
+}
+
+static void runQuery(const Index * idx, const Query * query, int strategy, Result * result)
+{
+    Candidates  candidates;
+    uint32_t    index;
+
+    selectCandidates(idx, query, strategy, &candidates);
+
+    while ( candidatesNext(&candidates, &index) ) {
+        result->visited++;
+
+        if ( !elementMatches(&idx->elements[index], query) )
+            continue;
+
+        result->matched++;
+        result->checksum = (result->checksum * 31) + index + 1;
+    }
+}
+
+// what a client and createElement's collection walk ask for: the children
+// of every collection, page and usage lookups, single cookies from the
+// element cache misses and cookie ranges inside the duplicate elements
+static uint32_t generateQueries(const Element * elements, uint32_t count, Query * queries)
+{
+    uint32_t index;
+    uint32_t queryCount = 0;
+
+    for ( index = 0; index < count; index++ ) {
+        const Element * element = &elements[index];
+
+        if ( element->type == kTypeCollection )
+            queries[queryCount++] = (Query){ "collection", kMatchParent, 0, 0, element->cookieMin, 0, 0, 0 };
+
+        if ( !(index % 7) )
+            queries[queryCount++] = (Query){ "page and usage", kMatchUsagePage | kMatchUsage, 0, 0, 0, 0, element->usagePage, element->usageMin };
+
+        if ( !(index % 11) )
+            queries[queryCount++] = (Query){ "usage", kMatchUsage, 0, 0, 0, 0, 0, element->usageMax };
+
+        if ( !(index % 5) )
+            queries[queryCount++] = (Query){ "cookie", kMatchCookie, element->cookieMax, element->cookieMax, 0, 0, 0, 0 };
+
+        if ( element->cookieMax - element->cookieMin >= 2 )
+            queries[queryCount++] = (Query){ "cookie range", kMatchCookieMin | kMatchCookieMax, element->cookieMin + 1, element->cookieMax - 1, 0, 0, 0, 0 };
+    }
+
+    return queryCount;
+}
+
+int main(int argc, char ** argv)
+{
+    static const char * kinds[] = { "collection", "page and usage", "usage", "cookie", "cookie range" };
+    uint32_t    elementCount    = kDefaultElementCount;
+    long        rounds          = kDefaultRounds;
+    Element *   elements;
+    Query *     queries;
+    Index       idx;
+    uint32_t    queryCount;
+    uint32_t    query;
+    uint32_t    kind;
+    long        round;
+    int         strategy;
+    int         failed          = 0;
+    int         ch;
+
+    while ( (ch = getopt(argc, argv, "n:r:")) != -1 ) {
+        switch ( ch ) {
+            case 'n':
+                elementCount = (uint32_t)strtoul(optarg, NULL, 0);
+                break;
+            case 'r':
+                rounds = strtol(optarg, NULL, 0);
+                break;
+            default:
+                printf("usage: %s [-n elements] [-r rounds]\n", argv[0]);
+                return 1;
+        }
+    }
+
+    if ( elementCount < 2 || rounds <= 0 ) {
+        printf("need at least two elements and one round\n");
+        return 1;
+    }
+
+    elements    = calloc(elementCount, sizeof(Element));
+    queries     = calloc(elementCount * 5, sizeof(Query));
+
+    if ( !elements || !queries ) {
+        printf("out of memory\n");
+        return 1;
+    }
+
+    generateElements(elements, elementCount);
+
+    if ( !buildIndex(&idx, elements, elementCount) ) {
+        printf("couldn't build the index\n");
+        freeIndex(&idx);
+        return 1;
+    }
+
+    queryCount = generateQueries(elements, elementCount, queries);
+
+    printf("%u elements, %u queries\n", elementCount, queryCount);
+
+    for ( kind = 0; kind < sizeof(kinds) / sizeof(kinds[0]); kind++ ) {
+        Result      expected    = { 0, 0, 0 };
+        uint32_t    kindCount   = 0;
+
+        for ( query = 0; query < queryCount; query++ )
+            if ( queries[query].kind == kinds[kind] )
+                kindCount++;
+
+        printf("\n%s queries: %u\n", kinds[kind], kindCount);
+
+        for ( strategy = 0; strategy < kStrategyCount; strategy++ ) {
+            Result      result  = { 0, 0, 0 };
+            uint64_t    start;
+            uint64_t    elapsed;
+
+            start = now();
+
+            for ( round = 0; round < rounds; round++ ) {
+                Result pass = { 0, 0, 0 };
+
+                for ( query = 0; query < queryCount; query++ )
+                    if ( queries[query].kind == kinds[kind] )
+                        runQuery(&idx, &queries[query], strategy, &pass);
+
+                result = pass;
+            }
+
+            elapsed = now() - start;
+
+            if ( strategy == kStrategyScan ) {
+                expected = result;
+            }
+            else if ( (result.matched != expected.matched) || (result.checksum != expected.checksum) ) {
+                printf("  %s: matches differ from the full scan\n", kStrategyNames[strategy]);
+                failed = 1;
+            }
+
+            printf("  %-28s %8.1f elements visited, %9.1f ns per query\n", kStrategyNames[strategy],
+                   kindCount ? (double)result.visited / kindCount : 0.0,
+                   kindCount ? (double)elapsed / ((double)rounds * kindCount) : 0.0);
+        }
+    }
+
+    printf("\n%s\n", failed ? "failed" : "passed: every strategy returns the full scan's matches in order");
+
+    freeIndex(&idx);
+    free(queries);
+    free(elements);
+
+    return failed;
+}
@@ -7,6 +7,7 @@
 //
 
 #include <AssertMacros.h>
+#include <math.h>
 #include <pthread.h>
 #include <mach/mach.h>
 #include <mach/mach_time.h>
@@ -40,8 +41,116 @@ static struct {
 } __matching[0xff]   = {};
 static uint32_t                     __matchingCount                             = 0;
 static uint32_t                     __matchingInterval                          = -1;
+
+//------------------------------------------------------------------------------
+// Histogram
+//
+// Log-linear histogram in the style of HdrHistogram: values below 32 get a
+// bucket each, and every power of two above that is split into 16 buckets,
+// so a recorded value is off by at most 1/16 of itself.  Memory is fixed no
+// matter how long the monitor runs.
+//------------------------------------------------------------------------------
+#define kHistogramSubBucketBits     4
+#define kHistogramSubBucketCount    (1 << kHistogramSubBucketBits)
+#define kHistogramMaxValueBits      40
+#define kHistogramBucketCount       ((kHistogramMaxValueBits - kHistogramSubBucketBits + 1) * kHistogramSubBucketCount)
+
+typedef struct {
+    uint64_t    count;
+    uint64_t    min;
+    uint64_t    max;
+    uint64_t    total;
+    double      totalSquares;
+    uint64_t    buckets[kHistogramBucketCount];
+} Histogram;
+
+static uint32_t histogramGetBucketIndex(uint64_t value)
+{
+    uint32_t msb;
+    uint32_t shift;
+    
+    if ( value < 2 * kHistogramSubBucketCount )
+        return (uint32_t)value;
+    
+    if ( value >> kHistogramMaxValueBits )
+        value = (1ULL << kHistogramMaxValueBits) - 1;
+    
+    msb     = 63 - __builtin_clzll(value);
+    shift   = msb - kHistogramSubBucketBits;
+    
+    return (shift * kHistogramSubBucketCount) + (uint32_t)(value >> shift);
+}
+
+static uint64_t histogramGetBucketHighValue(uint32_t index)
+{
+    uint32_t shift;
+    
+    if ( index < 2 * kHistogramSubBucketCount )
+        return index;
+    
+    shift = (index / kHistogramSubBucketCount) - 1;
+    
+    return ((uint64_t)((index % kHistogramSubBucketCount) + kHistogramSubBucketCount) << shift) + (1ULL << shift) - 1;
+}
+
+static void histogramRecordValue(Histogram * histogram, uint64_t value)
+{
+    if ( !histogram->count || value < histogram->min )
+        histogram->min = value;
+    
+    if ( value > histogram->max )
+        histogram->max = value;
+    
+    histogram->count++;
+    histogram->total        += value;
+    histogram->totalSquares += (double)value * (double)value;
+    histogram->buckets[histogramGetBucketIndex(value)]++;
+}
+
+static uint64_t histogramGetValueAtPercentile(const Histogram * histogram, double percentile)
+{
+    uint64_t target;
+    uint64_t count = 0;
+    
+    if ( !histogram || !histogram->count )
+        return 0;
+    
+    target = (uint64_t)ceil((percentile / 100.0) * histogram->count);
+    if ( !target )
+        target = 1;
+    
+    for ( uint32_t index=0; index<kHistogramBucketCount; index++ ) {
+        count += histogram->buckets[index];
+        if ( count >= target ) {
+            uint64_t value = histogramGetBucketHighValue(index);
+            return value < histogram->max ? value : histogram->max;
+        }
+    }
+    
+    return histogram->max;
+}
+
+static uint64_t histogramGetMean(const Histogram * histogram)
+{
+    return ( histogram && histogram->count ) ? histogram->total / histogram->count : 0;
+}
+
+static uint64_t histogramGetStandardDeviation(const Histogram * histogram)
+{
+    double mean, variance;
+    
+    if ( !histogram || !histogram->count )
+        return 0;
+    
+    mean        = (double)histogram->total / histogram->count;
+    variance    = (histogram->totalSquares / histogram->count) - (mean * mean);
+    
+    return variance > 0 ? (uint64_t)sqrt(variance) : 0;
+}
+
 static uint64_t                     __eventLastTimestamps[kIOHIDEventTypeCount] = {};
-static CFMutableArrayRef            __eventIntervals[kIOHIDEventTypeCount]      = {};
+static Histogram *                  __eventIntervals[kIOHIDEventTypeCount]      = {};
+static Histogram *                  __eventLatencies[kIOHIDEventTypeCount]      = {};
 static uint64_t                     __eventCounts[kIOHIDEventTypeCount]         = {};
 static uint64_t                     __eventCount                                = 0;
 static uint64_t                     __eventLatencyTotal                         = 0;
@@ -51,6 +160,9 @@ static CFTimeInterval               __timeout
 static mach_timebase_info_data_t    __timeBaseinfo                              = {};
 static bool                         __monitorServices                           = false;
 static bool                         __monitorClients                            = false;
+static CFTimeInterval               __snapshotInterval                          = 0;
+static FILE *                       __csvFile                                   = NULL;
+static FILE *                       __jsonFile                                  = NULL;
 
 
 IOHIDEventBlock eventBlock = ^(void * target, void * refcon, void * sender, IOHIDEventRef event)
@@ -58,16 +170,21 @@ IOHIDEventBlock eventBlock = ^(void * target, void * refcon, void * sender, IOHI
     IOHIDEventType  type        = IOHIDEventGetType(event);
     uint64_t        timestamp   = IOHIDEventGetTimeStamp(event);
     uint64_t        interval    = 0;
+    uint64_t        latency     = IOHIDEventGetLatency(event, kMicrosecondScale);
     
     // RY: This should really be tracked per service, but I'm lazy
     __eventCount++;
     __eventCounts[type]++;
-    __eventLatencyTotal += IOHIDEventGetLatency(event, kMicrosecondScale);
+    __eventLatencyTotal += latency;
+    
+    if ( !__eventLatencies[type] )
+        __eventLatencies[type] = (Histogram *)calloc(1, sizeof(Histogram));
+    
+    if ( __eventLatencies[type] )
+        histogramRecordValue(__eventLatencies[type], latency);
     
     if ( __eventLastTimestamps[type] ) {
         
-        CFNumberRef number = NULL;
-        
         interval = timestamp - __eventLastTimestamps[type];
         
         interval *= __timeBaseinfo.numer;
@@ -75,13 +192,10 @@ IOHIDEventBlock eventBlock = ^(void * target, void * refcon, void * sender, IOHI
         interval /= kMicrosecondScale;
         
         if ( !__eventIntervals[type] )
-            __eventIntervals[type] = CFArrayCreateMutable(kCFAllocatorDefault, 0, &kCFTypeArrayCallBacks);
+            __eventIntervals[type] = (Histogram *)calloc(1, sizeof(Histogram));
         
-        number = CFNumberCreate(kCFAllocatorDefault, kCFNumberSInt64Type, &interval);
-        if ( number ) {
-            CFArrayAppendValue(__eventIntervals[type], number);
-            CFRelease(number);
-        }
+        if ( __eventIntervals[type] )
+            histogramRecordValue(__eventIntervals[type], interval);
     }
     
     __eventLastTimestamps[type] = timestamp;
@@ -709,70 +823,112 @@ exit:
         CFRelease(eventSystem);
 }
 
-static void printStatistics()
+static const double __percentiles[] = {50.0, 90.0, 99.0, 99.9};
+
+static void printHistogram(const char * name, const Histogram * histogram)
+{
+    printf("    %-10.10s: Count = %10llu    Mean = %10llu us    StdDev = %10llu us    Min = %10llu us",
+           name, histogram->count, histogramGetMean(histogram), histogramGetStandardDeviation(histogram), histogram->min);
+    
+    for ( uint32_t index=0; index<sizeof(__percentiles)/sizeof(__percentiles[0]); index++ )
+        printf("    p%g = %10llu us", __percentiles[index], histogramGetValueAtPercentile(histogram, __percentiles[index]));
+    
+    printf("    Max = %10llu us\n", histogram->max);
+}
+
+static void exportHistogramCSV(CFTimeInterval elapsed, uint32_t type, const char * name, const Histogram * histogram)
+{
+    fprintf(__csvFile, "%.3f,%s,%s,%llu,%llu,%llu,%llu", elapsed, IOHIDEventGetTypeString(type), name, histogram->count, histogramGetMean(histogram), histogramGetStandardDeviation(histogram), histogram->min);
+    
+    for ( uint32_t index=0; index<sizeof(__percentiles)/sizeof(__percentiles[0]); index++ )
+        fprintf(__csvFile, ",%llu", histogramGetValueAtPercentile(histogram, __percentiles[index]));
+    
+    fprintf(__csvFile, ",%llu\n", histogram->max);
+}
+
+static void exportHistogramJSON(const char * name, const Histogram * histogram)
+{
+    fprintf(__jsonFile, "\"%s\":{\"count\":%llu,\"mean\":%llu,\"stddev\":%llu,\"min\":%llu", name, histogram->count, histogramGetMean(histogram), histogramGetStandardDeviation(histogram), histogram->min);
+    
+    for ( uint32_t index=0; index<sizeof(__percentiles)/sizeof(__percentiles[0]); index++ )
+        fprintf(__jsonFile, ",\"p%g\":%llu", __percentiles[index], histogramGetValueAtPercentile(histogram, __percentiles[index]));
+    
+    fprintf(__jsonFile, ",\"max\":%llu}", histogram->max);
+}
+
+//------------------------------------------------------------------------------
+// exportStatistics
+//
+// CSV gets one row per event type and histogram for every snapshot, and JSON
+// gets one object per snapshot and line, so periodic output can be appended
+// to either file and read back incrementally.
+//------------------------------------------------------------------------------
+static void exportStatistics(CFTimeInterval elapsed)
 {
-    if ( !__timeout ) {
-        __timeout =  CFAbsoluteTimeGetCurrent() - __startTime;
+    if ( __csvFile ) {
+        for (uint32_t index=0; index<kIOHIDEventTypeCount; index++) {
+            if ( __eventIntervals[index] )
+                exportHistogramCSV(elapsed, index, "interval", __eventIntervals[index]);
+            if ( __eventLatencies[index] )
+                exportHistogramCSV(elapsed, index, "latency", __eventLatencies[index]);
+        }
+        fflush(__csvFile);
     }
     
-    printf("\n");
-    printf("***************************************************************************\n");
-    printf("Event Statistics over %10.3f s\n", __timeout);
-    printf("***************************************************************************\n");
-    for (uint32_t index=0; index<kIOHIDEventTypeCount; index++) {
-        uint64_t stdDevInterval = 0;
-        uint64_t avgInterval    = 0;
-        uint64_t highInterval   = 0;
-        uint64_t lowInterval    = 0;
-        
-        if ( __eventIntervals[index] ) {
-            CFIndex     intervalCount, intervalIndex;
-            uint64_t    intervalTotal=0;
+    if ( __jsonFile ) {
+        bool first = true;
+        
+        fprintf(__jsonFile, "{\"elapsed\":%.3f,\"eventCount\":%llu,\"events\":{", elapsed, __eventCount);
+        
+        for (uint32_t index=0; index<kIOHIDEventTypeCount; index++) {
+            if ( !__eventCounts[index] )
+                continue;
             
-            // calculate avg
-            for (intervalIndex=0,intervalCount=CFArrayGetCount(__eventIntervals[index]); intervalIndex<intervalCount; intervalIndex++) {
-                CFNumberRef number = (CFNumberRef)CFArrayGetValueAtIndex(__eventIntervals[index], intervalIndex);
-                uint64_t value = 0;
-                
-                if ( !number )
-                    continue;
-                
-                CFNumberGetValue(number, kCFNumberSInt64Type, &value);
-                intervalTotal += value;
-                
-                if ( value > highInterval )
-                    highInterval = value;
-                
-                if ( !lowInterval || value < lowInterval )
-                    lowInterval = value;
-                
-                
+            fprintf(__jsonFile, "%s\"%s\":{\"count\":%llu", first ? "" : ",", IOHIDEventGetTypeString(index), __eventCounts[index]);
+            if ( __eventIntervals[index] ) {
+                fprintf(__jsonFile, ",");
+                exportHistogramJSON("interval", __eventIntervals[index]);
             }
-            
-            avgInterval = intervalTotal/intervalCount;
-            
-            // calculate std dev
-            for (intervalIndex=0,intervalCount=CFArrayGetCount(__eventIntervals[index]); intervalIndex<intervalCount; intervalIndex++) {
-                CFNumberRef number = (CFNumberRef)CFArrayGetValueAtIndex(__eventIntervals[index], intervalIndex);
-                int64_t value = 0;
-                
-                if ( !number )
-                    continue;
-                
-                CFNumberGetValue(number, kCFNumberSInt64Type, &value);
-                
-                value = (value-avgInterval);
-                value *= value;
-                intervalTotal += value;
+            if ( __eventLatencies[index] ) {
+                fprintf(__jsonFile, ",");
+                exportHistogramJSON("latency", __eventLatencies[index]);
             }
-            
-            stdDevInterval = sqrt(intervalTotal/intervalCount);
+            fprintf(__jsonFile, "}");
+            first = false;
         }
         
-        printf("%-20.20s: EventCount = %10llu    AverageInterval = %10llu us    StandardDeviation = %10llu us   HighInterval = %10llu us    LowInterval = %10llu us\n", IOHIDEventGetTypeString(index), __eventCounts[index], avgInterval, stdDevInterval, highInterval, lowInterval);
+        fprintf(__jsonFile, "}}\n");
+        fflush(__jsonFile);
+    }
+}
+
+static void printStatistics()
+{
+    CFTimeInterval elapsed = CFAbsoluteTimeGetCurrent() - __startTime;
+    
+    printf("\n");
+    printf("***************************************************************************\n");
+    printf("Event Statistics over %10.3f s\n", elapsed);
+    printf("***************************************************************************\n");
+    for (uint32_t index=0; index<kIOHIDEventTypeCount; index++) {
+        
+        printf("%-20.20s: EventCount = %10llu\n", IOHIDEventGetTypeString(index), __eventCounts[index]);
+        
+        if ( __eventIntervals[index] )
+            printHistogram("Interval", __eventIntervals[index]);
+        
+        if ( __eventLatencies[index] )
+            printHistogram("Latency", __eventLatencies[index]);
     }
     printf("\n");
     printf("Average latency: %10llu us\n", __eventLatencyTotal ? __eventLatencyTotal/__eventCount : 0);
+    
+    exportStatistics(elapsed);
+}
+
+static void snapshotTimerCallback(CFRunLoopTimerRef timer, void *info)
+{
+    printStatistics();
 }
 
 static void exitTimerCallback(CFRunLoopTimerRef timer, void *info)
@@ -803,6 +959,10 @@ static void printHelp()
     printf("\t-d <event type number>\t\t: dispatch event of the passed type\n");
     printf("\t-dm <event type number>\t\t: dispatch events of the passed mask\n");
     printf("\t-p\t\t\t\t: persist event dispatch\n");
+    printf("\t-t <seconds>\t\t\t: print statistics and exit after the passed time\n");
+    printf("\t-si <seconds>\t\t\t: print statistics every passed number of seconds\n");
+    printf("\t-csv <path>\t\t\t: append statistics to the passed file as CSV\n");
+    printf("\t-json <path>\t\t\t: append statistics to the passed file as JSON, one object per line\n");
     printf("\n");
     printf("\t-a\t\t\t\t: Admin (Unfiltered event stream)\n");
     printf("\t-r\t\t\t\t: Rate Controlled\n");
@@ -834,6 +994,9 @@ typedef enum {
     kEventRegistrationTypeBuiltIn,
     kEventRegistrationTypeInterval,
     kEventRegistrationTypeTimeout,
+    kEventRegistrationTypeSnapshotInterval,
+    kEventRegistrationTypeCSV,
+    kEventRegistrationTypeJSON,
 } EventRegistrationType;
 
 int main (int argc __unused, const char * argv[] __unused)
@@ -920,6 +1083,15 @@ int main (int argc __unused, const char * argv[] __unused)
             else if ( !strcmp("-t", arg) ) {
                 registrationType = kEventRegistrationTypeTimeout;
             }
+            else if ( !strcmp("-si", arg) ) {
+                registrationType = kEventRegistrationTypeSnapshotInterval;
+            }
+            else if ( !strcmp("-csv", arg) ) {
+                registrationType = kEventRegistrationTypeCSV;
+            }
+            else if ( !strcmp("-json", arg) ) {
+                registrationType = kEventRegistrationTypeJSON;
+            }
             else if ( !strcmp("-V", arg) ) {
                 printf("Version: %s\n", __version);
             }
@@ -959,6 +1131,24 @@ int main (int argc __unused, const char * argv[] __unused)
             else if ( registrationType == kEventRegistrationTypeTimeout ) {
                 __timeout = (uint32_t)strtoul(arg, NULL, 10);
             }
+            else if ( registrationType == kEventRegistrationTypeSnapshotInterval ) {
+                __snapshotInterval = strtod(arg, NULL);
+            }
+            else if ( registrationType == kEventRegistrationTypeCSV && !__csvFile ) {
+                __csvFile = fopen(arg, "a");
+                require_action(__csvFile, exit, printf("Unable to open %s\n", arg));
+                
+                if ( ftell(__csvFile) == 0 ) {
+                    fprintf(__csvFile, "elapsed,type,histogram,count,mean,stddev,min");
+                    for ( uint32_t p=0; p<sizeof(__percentiles)/sizeof(__percentiles[0]); p++ )
+                        fprintf(__csvFile, ",p%g", __percentiles[p]);
+                    fprintf(__csvFile, ",max\n");
+                }
+            }
+            else if ( registrationType == kEventRegistrationTypeJSON && !__jsonFile ) {
+                __jsonFile = fopen(arg, "a");
+                require_action(__jsonFile, exit, printf("Unable to open %s\n", arg));
+            }
             else if ( !strcmp("-h", arg ) ) {
                 printHelp();
                 return 0;
@@ -966,14 +1156,22 @@ int main (int argc __unused, const char * argv[] __unused)
         }
     }
         
+    __startTime = CFAbsoluteTimeGetCurrent();
+    
     if ( __timeout ) {
-        CFRunLoopTimerRef timer = CFRunLoopTimerCreate(kCFAllocatorDefault, CFAbsoluteTimeGetCurrent() + __timeout, 0, 0, 0, exitTimerCallback, NULL);
+        CFRunLoopTimerRef timer = CFRunLoopTimerCreate(kCFAllocatorDefault, __startTime + __timeout, 0, 0, 0, exitTimerCallback, NULL);
+        if ( timer ) {
+            CFRunLoopAddTimer(CFRunLoopGetCurrent(), timer, kCFRunLoopDefaultMode);
+            CFRelease(timer);
+        }
+    }
+    
+    if ( __snapshotInterval > 0 ) {
+        CFRunLoopTimerRef timer = CFRunLoopTimerCreate(kCFAllocatorDefault, __startTime + __snapshotInterval, __snapshotInterval, 0, 0, snapshotTimerCallback, NULL);
         if ( timer ) {
             CFRunLoopAddTimer(CFRunLoopGetCurrent(), timer, kCFRunLoopDefaultMode);
             CFRelease(timer);
         }
-    } else {
-        __startTime = CFAbsoluteTimeGetCurrent();
     }
     
     if ( runAsClient ) {
@@ -0,0 +1,390 @@
+//
+//  IOHIDLatencyAnalyzer.c
+//  IOHIDFamily
+//
+//  Reconstructs per stage latency distributions of the HID input pipeline
+//  from the kIOHIDDebugCode_LatencyStage trace points in a raw kdebug trace.
+//  Off Darwin it builds against the shims in tools/hosted and takes the
+//  timebase of the traced machine with -timebase:
+//
+//      cc -O2 -I tools/hosted -o hidLatencyAnalyzer tools/IOHIDLatencyAnalyzer.c
+//
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/kdebug.h>
+#if __APPLE__
+#include <mach/mach_time.h>
+#endif
+#include "../IOHIDFamily/IOHIDFamilyTrace.h"
+
+#ifndef DBG_FUNC_MASK
+#define DBG_FUNC_MASK           0xfffffffc
+#endif
+
+#define kRawVersion1            0x55aa0101
+#define kRawPageSize            4096
+#define kTimestampMask          0x00ffffffffffffffULL
+
+// On disk layout of the RAW_VERSION1 header and kd_threadmap/kd_buf records
+// written by the kdebug tools for a 64 bit kernel.
+typedef struct {
+    int32_t     version;
+    int32_t     threadCount;
+    uint64_t    secs;
+    uint32_t    usecs;
+    uint32_t    reserved;
+} RawHeader;
+
+typedef struct {
+    uint64_t    thread;
+    int32_t     valid;
+    char        command[20];
+} RawThreadMap;
+
+typedef struct {
+    uint64_t    timestamp;
+    uint64_t    arg1;
+    uint64_t    arg2;
+    uint64_t    arg3;
+    uint64_t    arg4;
+    uint64_t    arg5;
+    uint32_t    debugid;
+    uint32_t    cpuid;
+    uint64_t    unused;
+} RawRecord;
+
+// A report's path through the pipeline, keyed by correlation ID.  Only the
+// first time each stage is seen is kept; one report can produce several
+// events.
+typedef struct {
+    uint64_t    correlationID;
+    uint64_t    senderID;
+    uint64_t    stageTimes[kIOHIDLatencyStage_Count];
+} Report;
+
+typedef struct {
+    uint64_t *  values;
+    size_t      count;
+    size_t      capacity;
+} Samples;
+
+static const char * __stageNames[kIOHIDLatencyStage_Count] = {
+    "HandleReport",
+    "InterruptReport",
+    "DispatchEvent",
+    "EnqueueEvent",
+    "PostEvent",
+};
+
+static Report *                     __reports           = NULL;
+static size_t                       __reportCount       = 0;
+static size_t                       __reportCapacity    = 0;
+static uint64_t                     __senderID          = 0;
+static bool                         __csv               = false;
+static struct {
+    uint32_t    numer;
+    uint32_t    denom;
+}                                   __timeBaseinfo      = {1, 1};
+
+//------------------------------------------------------------------------------
+// Report table
+//
+// Open addressing on the correlation ID.  Correlation ID 0 never comes from
+// a real report, so it marks an empty slot.
+//------------------------------------------------------------------------------
+static Report * reportTableLookup(Report * table, size_t capacity, uint64_t correlationID)
+{
+    size_t index = (size_t)((correlationID * 0x9e3779b97f4a7c15ULL) >> 20) & (capacity - 1);
+
+    while ( table[index].correlationID && table[index].correlationID != correlationID )
+        index = (index + 1) & (capacity - 1);
+
+    return &table[index];
+}
+
+static Report * copyReport(uint64_t correlationID)
+{
+    Report * report;
+
+    if ( (__reportCount + 1) * 2 > __reportCapacity ) {
+        size_t      capacity    = __reportCapacity ? __reportCapacity * 2 : 4096;
+        Report *    table       = (Report *)calloc(capacity, sizeof(Report));
+
+        if ( !table )
+            return NULL;
+
+        for ( size_t index=0; index<__reportCapacity; index++ ) {
+            if ( __reports[index].correlationID )
+                *reportTableLookup(table, capacity, __reports[index].correlationID) = __reports[index];
+        }
+
+        free(__reports);
+        __reports           = table;
+        __reportCapacity    = capacity;
+    }
+
+    report = reportTableLookup(__reports, __reportCapacity, correlationID);
+    if ( !report->correlationID ) {
+        report->correlationID = correlationID;
+        __reportCount++;
+    }
+
+    return report;
+}
+
+//------------------------------------------------------------------------------
+// Samples
+//------------------------------------------------------------------------------
+static void samplesAppend(Samples * samples, uint64_t value)
+{
+    if ( samples->count == samples->capacity ) {
+        size_t      capacity    = samples->capacity ? samples->capacity * 2 : 1024;
+        uint64_t *  values      = (uint64_t *)realloc(samples->values, capacity * sizeof(uint64_t));
+
+        if ( !values )
+            return;
+
+        samples->values     = values;
+        samples->capacity   = capacity;
+    }
+
+    samples->values[samples->count++] = value;
+}
+
+static int compareValues(const void * a, const void * b)
+{
+    uint64_t valueA = *(const uint64_t *)a;
+    uint64_t valueB = *(const uint64_t *)b;
+
+    return (valueA > valueB) - (valueA < valueB);
+}
+
+static uint64_t samplesGetValueAtPercentile(const Samples * samples, double percentile)
+{
+    size_t index;
+
+    if ( !samples->count )
+        return 0;
+
+    index = (size_t)((percentile / 100.0) * samples->count);
+    if ( index >= samples->count )
+        index = samples->count - 1;
+
+    return samples->values[index];
+}
+
+static uint64_t absoluteToMicroseconds(uint64_t value)
+{
+    return ((value * __timeBaseinfo.numer) / __timeBaseinfo.denom) / 1000;
+}
+
+//------------------------------------------------------------------------------
+// readTrace
+//------------------------------------------------------------------------------
+static int readTrace(const char * path, uint64_t * pRecordCount)
+{
+    RawRecord   records[256];
+    RawHeader   header;
+    uint32_t    code        = IOHID_DEBUG_CODE(kIOHIDDebugCode_LatencyStage);
+    ssize_t     length;
+    int         fd;
+
+    fd = open(path, O_RDONLY);
+    if ( fd < 0 ) {
+        printf("Unable to open %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+
+    // Version 1 files lead with a header and thread map padded out to a
+    // page; anything else is taken to be bare kd_buf records.
+    if ( (read(fd, &header, sizeof(header)) == sizeof(header)) && (header.version == kRawVersion1) ) {
+        off_t offset = sizeof(header) + ((off_t)header.threadCount * sizeof(RawThreadMap));
+
+        offset = (offset + kRawPageSize - 1) & ~((off_t)kRawPageSize - 1);
+        lseek(fd, offset, SEEK_SET);
+    } else {
+        lseek(fd, 0, SEEK_SET);
+    }
+
+    while ( (length = read(fd, records, sizeof(records))) > 0 ) {
+        size_t count = (size_t)length / sizeof(RawRecord);
+
+        for ( size_t index=0; index<count; index++ ) {
+            RawRecord * record = &records[index];
+            Report *    report;
+            uint64_t    stage;
+            uint64_t    timestamp;
+
+            (*pRecordCount)++;
+
+            if ( (record->debugid & DBG_FUNC_MASK) != code )
+                continue;
+
+            stage = record->arg1;
+            if ( stage >= kIOHIDLatencyStage_Count || !record->arg2 )
+                continue;
+
+            report = copyReport(record->arg2);
+            if ( !report )
+                break;
+
+            timestamp = record->timestamp & kTimestampMask;
+
+            if ( !report->stageTimes[stage] || timestamp < report->stageTimes[stage] )
+                report->stageTimes[stage] = timestamp;
+
+            if ( stage == kIOHIDLatencyStage_HandleReport )
+                report->senderID = record->arg3;
+        }
+
+        if ( length % sizeof(RawRecord) )
+            lseek(fd, -(off_t)(length % sizeof(RawRecord)), SEEK_CUR);
+    }
+
+    close(fd);
+
+    return 0;
+}
+
+//------------------------------------------------------------------------------
+// printLatencies
+//
+// Stage latencies are measured from the report's own timestamp, which is
+// the correlation ID, so the HandleReport row shows the time from the
+// transport timestamping the report to the family seeing it.  Reports that
+// never reached IOHIDDevice in the trace window are left out.
+//------------------------------------------------------------------------------
+static void printLatencies()
+{
+    static const double percentiles[] = {50.0, 90.0, 99.0, 99.9};
+    Samples             samples[kIOHIDLatencyStage_Count];
+    uint64_t            reportCount = 0;
+
+    memset(samples, 0, sizeof(samples));
+
+    for ( size_t index=0; index<__reportCapacity; index++ ) {
+        Report * report = &__reports[index];
+
+        if ( !report->correlationID || !report->stageTimes[kIOHIDLatencyStage_HandleReport] )
+            continue;
+
+        if ( __senderID && report->senderID != __senderID )
+            continue;
+
+        reportCount++;
+
+        for ( uint32_t stage=0; stage<kIOHIDLatencyStage_Count; stage++ ) {
+            if ( !report->stageTimes[stage] || report->stageTimes[stage] < report->correlationID )
+                continue;
+
+            samplesAppend(&samples[stage], absoluteToMicroseconds(report->stageTimes[stage] - report->correlationID));
+        }
+    }
+
+    if ( __csv ) {
+        printf("stage,count,min");
+        for ( uint32_t index=0; index<sizeof(percentiles)/sizeof(percentiles[0]); index++ )
+            printf(",p%g", percentiles[index]);
+        printf(",max\n");
+    } else {
+        printf("Reports traced: %llu\n\n", (unsigned long long)reportCount);
+        printf("%-16s %10s %10s", "Stage (us)", "Count", "Min");
+        for ( uint32_t index=0; index<sizeof(percentiles)/sizeof(percentiles[0]); index++ ) {
+            char label[16];
+
+            snprintf(label, sizeof(label), "p%g", percentiles[index]);
+            printf(" %10s", label);
+        }
+        printf(" %10s\n", "Max");
+    }
+
+    for ( uint32_t stage=0; stage<kIOHIDLatencyStage_Count; stage++ ) {
+        Samples * stageSamples = &samples[stage];
+
+        qsort(stageSamples->values, stageSamples->count, sizeof(uint64_t), compareValues);
+
+        printf(__csv ? "%s,%zu,%llu" : "%-16s %10zu %10llu", __stageNames[stage], stageSamples->count, (unsigned long long)(stageSamples->count ? stageSamples->values[0] : 0));
+
+        for ( uint32_t index=0; index<sizeof(percentiles)/sizeof(percentiles[0]); index++ )
+            printf(__csv ? ",%llu" : " %10llu", (unsigned long long)samplesGetValueAtPercentile(stageSamples, percentiles[index]));
+
+        printf(__csv ? ",%llu\n" : " %10llu\n", (unsigned long long)(stageSamples->count ? stageSamples->values[stageSamples->count-1] : 0));
+
+        free(stageSamples->values);
+    }
+}
+
+static void printHelp()
+{
+    printf("\n");
+    printf("hidLatencyAnalyzer usage: hidLatencyAnalyzer [options] <raw trace file>\n\n");
+    printf("\t-s <registry id>\t: Only count reports from the passed IOHIDDevice\n");
+    printf("\t-csv\t\t\t: Print the distributions as CSV\n");
+    printf("\t-timebase <numer/denom>\t: Timebase of the traced machine\n");
+    printf("\t\t\t\t  Defaults to this machine's, or 1/1 off Darwin\n");
+    printf("\n");
+    printf("\tThe trace must include class DBG_IOKIT, subclass DBG_IOHID (0x0523)\n");
+}
+
+int main (int argc, const char * argv[])
+{
+    const char *    path        = NULL;
+    uint64_t        recordCount = 0;
+
+#if __APPLE__
+    mach_timebase_info_data_t timeBaseinfo;
+
+    if ( mach_timebase_info(&timeBaseinfo) == KERN_SUCCESS ) {
+        __timeBaseinfo.numer = timeBaseinfo.numer;
+        __timeBaseinfo.denom = timeBaseinfo.denom;
+    }
+#endif
+
+    for ( int index=1; index<argc; index++ ) {
+        const char * arg = argv[index];
+
+        if ( !strcmp("-s", arg) && (index + 1) < argc ) {
+            __senderID = strtoull(argv[++index], NULL, 0);
+        }
+        else if ( !strcmp("-csv", arg) ) {
+            __csv = true;
+        }
+        else if ( !strcmp("-timebase", arg) && (index + 1) < argc ) {
+            if ( (sscanf(argv[++index], "%u/%u", &__timeBaseinfo.numer, &__timeBaseinfo.denom) != 2) || !__timeBaseinfo.numer || !__timeBaseinfo.denom ) {
+                printHelp();
+                return 1;
+            }
+        }
+        else if ( !strcmp("-h", arg) ) {
+            printHelp();
+            return 0;
+        }
+        else {
+            path = arg;
+        }
+    }
+
+    if ( !path ) {
+        printHelp();
+        return 1;
+    }
+
+    if ( readTrace(path, &recordCount) )
+        return 1;
+
+    if ( !__csv )
+        printf("Trace records read: %llu\n", (unsigned long long)recordCount);
+
+    printLatencies();
+
+    free(__reports);
+
+    return 0;
+}
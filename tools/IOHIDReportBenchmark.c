@@ -0,0 +1,788 @@
+//
+//  IOHIDReportBenchmark.c
+//  IOHIDFamily
+//
+//  Replays a capture of timestamped reports through the HID descriptor
+//  parser (HIDGetUsageValue/HIDGetButtons) and through a user space copy of
+//  IOHIDDevice/IOHIDElementPrivate report processing, and reports the
+//  throughput of each.  The element path extracts values with the kernel's
+//  own readReportBits from IOHIDFamily/IOHIDReportBits.h.  It only needs the
+//  parser sources and the shims in tools/hosted, so it builds and runs
+//  without IOKit:
+//
+//      cc -O2 -I tools/hosted -I IOHIDSystem -I IOHIDFamily -o hidReportBenchmark
+//          tools/IOHIDReportBenchmark.c IOHIDSystem/IOHIDDescriptorParser/HID*.c
+//
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <IOKit/hidsystem/IOHIDDescriptorParser.h>
+#include "IOHIDReportBits.h"
+
+#define kCaptureMagic               0x52444948  /* 'HIDR' */
+#define kCaptureVersion             1
+#define kMaxDescriptorLength        0x10000
+#define kMaxRangeUsages             256
+#define kMaxUsageListLength         256
+#define kGeneratedReportInterval    1000000     /* ns */
+
+// Mirrors IOHIDDevice's report handler dispatch table.
+#define kReportHandlerSlots         8
+#define GetReportHandlerSlot(id)    ((id) & (kReportHandlerSlots - 1))
+
+#define kElementFlagVariable        0x02
+
+#ifndef MIN
+#define MIN(a, b)                   (((a) < (b)) ? (a) : (b))
+#endif
+
+// Capture layout, in host byte order: a header followed by recordCount
+// records, each immediately followed by its report bytes.
+typedef struct {
+    uint32_t    magic;
+    uint32_t    version;
+    uint32_t    recordCount;
+    uint32_t    reserved;
+} CaptureHeader;
+
+typedef struct {
+    uint64_t    timestamp;
+    uint32_t    reportType;
+    uint32_t    length;
+} CaptureRecord;
+
+typedef struct {
+    uint64_t        timestamp;
+    uint32_t        reportType;
+    uint32_t        length;
+    const uint8_t * data;
+} Report;
+
+typedef struct {
+    uint8_t *       buffer;
+    size_t          length;
+    Report *        reports;
+    uint32_t        count;
+} Capture;
+
+// The subset of IOHIDElementPrivate that processReport touches.
+typedef struct Element {
+    struct Element *    next;
+    uint32_t            reportID;
+    uint32_t            reportStartBit;
+    uint32_t            reportBits;
+    uint32_t            reportCount;
+    bool                signExtend;
+    uint32_t *          value;
+} Element;
+
+typedef struct {
+    uint32_t    reportID;
+    HIDUsage    usagePage;
+    uint32_t    collection;
+    HIDUsage    usage;
+} ValueQuery;
+
+typedef struct {
+    HIDPreparsedDataRef parseData;
+    bool                hasReportIDs;
+    Element *           elements[kReportHandlerSlots];
+    uint32_t            elementCount;
+    ValueQuery *        queries;
+    uint32_t            queryCount;
+    uint32_t            queryStart[256];
+    uint32_t            queryEnd[256];
+    bool                hasButtons[256];
+    IOByteCount         reportLengths[256];
+} Device;
+
+typedef uint64_t (*ReportProcessor)(Device * device, const Report * report);
+
+typedef struct {
+    const char *        name;
+    ReportProcessor     processor;
+    uint64_t            reports;
+    uint64_t            duration;
+    uint64_t            allocations;
+    uint64_t            checksum;
+} BenchmarkResult;
+
+// Keyboard (report ID 1) and three button mouse (report ID 2).
+static const uint8_t __defaultDescriptor[] = {
+    0x05, 0x01, 0x09, 0x06, 0xA1, 0x01, 0x85, 0x01, 0x05, 0x07, 0x19, 0xE0,
+    0x29, 0xE7, 0x15, 0x00, 0x25, 0x01, 0x75, 0x01, 0x95, 0x08, 0x81, 0x02,
+    0x95, 0x01, 0x75, 0x08, 0x81, 0x01, 0x95, 0x06, 0x75, 0x08, 0x15, 0x00,
+    0x25, 0x65, 0x05, 0x07, 0x19, 0x00, 0x29, 0x65, 0x81, 0x00, 0xC0,
+    0x05, 0x01, 0x09, 0x02, 0xA1, 0x01, 0x85, 0x02, 0x09, 0x01, 0xA1, 0x00,
+    0x05, 0x09, 0x19, 0x01, 0x29, 0x03, 0x15, 0x00, 0x25, 0x01, 0x95, 0x03,
+    0x75, 0x01, 0x81, 0x02, 0x95, 0x01, 0x75, 0x05, 0x81, 0x01, 0x05, 0x01,
+    0x09, 0x30, 0x09, 0x31, 0x09, 0x38, 0x15, 0x81, 0x25, 0x7F, 0x75, 0x08,
+    0x95, 0x03, 0x81, 0x06, 0xC0, 0xC0,
+};
+
+static uint64_t __allocationCount   = 0;
+static uint64_t __allocationBytes   = 0;
+static bool     __csv               = false;
+
+//------------------------------------------------------------------------------
+// Parser allocator
+//
+// These stand in for PoolAlloc.c so every allocation the parser makes is
+// counted.
+//------------------------------------------------------------------------------
+void * PoolAllocateResident(vm_size_t size, unsigned char clear)
+{
+    __allocationCount++;
+    __allocationBytes += size;
+
+    return clear ? calloc(1, size) : malloc(size);
+}
+
+OSStatus PoolDeallocate(void * ptr, vm_size_t size __attribute__((unused)))
+{
+    free(ptr);
+    return 0;
+}
+
+static uint64_t getNanoseconds()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ((uint64_t)ts.tv_sec * 1000000000ULL) + ts.tv_nsec;
+}
+
+static uint64_t nextRandom(uint64_t * state)
+{
+    uint64_t x = *state;
+
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    *state = x;
+
+    return x * 0x2545F4914F6CDD1DULL;
+}
+
+static uint8_t * copyFile(const char * path, size_t maxLength, size_t * pLength)
+{
+    uint8_t *   buffer  = NULL;
+    FILE *      file;
+    long        length;
+
+    file = fopen(path, "rb");
+    if ( !file ) {
+        printf("Unable to open %s: %s\n", path, strerror(errno));
+        return NULL;
+    }
+
+    if ( fseek(file, 0, SEEK_END) || (length = ftell(file)) <= 0 || (size_t)length > maxLength ) {
+        printf("Unable to use %s: bad length\n", path);
+        goto exit;
+    }
+
+    rewind(file);
+
+    buffer = (uint8_t *)malloc(length);
+    if ( buffer && fread(buffer, 1, length, file) != (size_t)length ) {
+        free(buffer);
+        buffer = NULL;
+    }
+
+    if ( buffer )
+        *pLength = length;
+
+exit:
+    fclose(file);
+    return buffer;
+}
+
+//------------------------------------------------------------------------------
+// Device
+//------------------------------------------------------------------------------
+static bool addElement(Device * device, uint32_t reportID, uint32_t startBit, uint32_t bits, uint32_t count, bool signExtend)
+{
+    Element *   element;
+    uint32_t    words   = ((bits * count) + 31) / 32;
+    uint32_t    slot    = GetReportHandlerSlot(reportID);
+
+    if ( !bits || !count )
+        return true;
+
+    element = (Element *)calloc(1, sizeof(Element));
+    if ( !element )
+        return false;
+
+    element->value = (uint32_t *)calloc(words, sizeof(uint32_t));
+    if ( !element->value ) {
+        free(element);
+        return false;
+    }
+
+    element->reportID       = reportID;
+    element->reportStartBit = startBit;
+    element->reportBits     = bits;
+    element->reportCount    = count;
+    element->signExtend     = signExtend;
+
+    // IOHIDDevice puts the report handler at the head of the chain; append
+    // so the creation order is kept.
+    if ( device->elements[slot] ) {
+        Element * tail = device->elements[slot];
+
+        while ( tail->next )
+            tail = tail->next;
+        tail->next = element;
+    } else {
+        device->elements[slot] = element;
+    }
+
+    device->elementCount++;
+
+    return true;
+}
+
+static bool addQuery(Device * device, uint32_t reportID, HIDUsage usagePage, uint32_t collection, HIDUsage usage, uint32_t * capacity)
+{
+    if ( device->queryCount == *capacity ) {
+        uint32_t        newCapacity = *capacity ? *capacity * 2 : 64;
+        ValueQuery *    queries     = (ValueQuery *)realloc(device->queries, newCapacity * sizeof(ValueQuery));
+
+        if ( !queries )
+            return false;
+
+        device->queries = queries;
+        *capacity       = newCapacity;
+    }
+
+    device->queries[device->queryCount].reportID    = reportID;
+    device->queries[device->queryCount].usagePage   = usagePage;
+    device->queries[device->queryCount].collection  = collection;
+    device->queries[device->queryCount].usage       = usage;
+    device->queryCount++;
+
+    return true;
+}
+
+static int compareQueries(const void * a, const void * b)
+{
+    uint32_t reportIDA = ((const ValueQuery *)a)->reportID;
+    uint32_t reportIDB = ((const ValueQuery *)b)->reportID;
+
+    return (reportIDA > reportIDB) - (reportIDA < reportIDB);
+}
+
+static void releaseDevice(Device * device)
+{
+    for ( uint32_t slot=0; slot<kReportHandlerSlots; slot++ ) {
+        Element * element = device->elements[slot];
+
+        while ( element ) {
+            Element * next = element->next;
+
+            free(element->value);
+            free(element);
+            element = next;
+        }
+    }
+
+    free(device->queries);
+
+    if ( device->parseData )
+        HIDCloseReportDescriptor(device->parseData);
+
+    memset(device, 0, sizeof(*device));
+}
+
+//------------------------------------------------------------------------------
+// createDevice
+//
+// Builds the input elements the way IOHIDDevice does: one report handler
+// per report ID followed by the button and value elements, with ranges
+// split into one element per usage.  Array elements keep a single handler
+// covering the whole array.
+//------------------------------------------------------------------------------
+static bool createDevice(Device * device, const uint8_t * descriptor, size_t length)
+{
+    HIDCapabilities             caps;
+    HIDButtonCapabilitiesPtr    buttons         = NULL;
+    HIDValueCapabilitiesPtr     values          = NULL;
+    UInt32                      buttonCount;
+    UInt32                      valueCount;
+    uint32_t                    queryCapacity   = 0;
+    uint64_t                    allocations     = __allocationCount;
+    uint64_t                    bytes           = __allocationBytes;
+    bool                        result          = false;
+    OSStatus                    status;
+
+    memset(device, 0, sizeof(*device));
+
+    status = HIDOpenReportDescriptor((void *)descriptor, length, &device->parseData, 0);
+    if ( status != kHIDSuccess ) {
+        printf("HIDOpenReportDescriptor failed: %d\n", (int)status);
+        return false;
+    }
+
+    if ( !__csv )
+        printf("HIDOpenReportDescriptor: %llu allocations, %llu bytes\n", (unsigned long long)(__allocationCount - allocations), (unsigned long long)(__allocationBytes - bytes));
+
+    status = HIDGetCapabilities(device->parseData, &caps);
+    if ( status != kHIDSuccess )
+        goto exit;
+
+    buttonCount = caps.numberInputButtonCaps;
+    valueCount  = caps.numberInputValueCaps;
+
+    buttons = (HIDButtonCapabilitiesPtr)calloc(buttonCount + 1, sizeof(HIDButtonCapabilities));
+    values  = (HIDValueCapabilitiesPtr)calloc(valueCount + 1, sizeof(HIDValueCapabilities));
+    if ( !buttons || !values )
+        goto exit;
+
+    if ( buttonCount && HIDGetButtonCapabilities(kHIDInputReport, buttons, &buttonCount, device->parseData) != kHIDSuccess )
+        goto exit;
+
+    if ( valueCount && HIDGetValueCapabilities(kHIDInputReport, values, &valueCount, device->parseData) != kHIDSuccess )
+        goto exit;
+
+    for ( UInt32 index=0; index<buttonCount; index++ )
+        device->hasReportIDs |= (buttons[index].reportID != 0);
+    for ( UInt32 index=0; index<valueCount; index++ )
+        device->hasReportIDs |= (values[index].reportID != 0);
+
+    // Report handlers
+    for ( uint32_t reportID=0; reportID<256; reportID++ ) {
+        IOByteCount reportLength = 0;
+
+        if ( HIDGetReportLength(kHIDInputReport, reportID, &reportLength, device->parseData) != kHIDSuccess || !reportLength )
+            continue;
+
+        device->reportLengths[reportID] = reportLength;
+
+        if ( !addElement(device, reportID, 0, (uint32_t)reportLength << 3, 1, false) )
+            goto exit;
+    }
+
+    for ( UInt32 index=0; index<buttonCount; index++ ) {
+        HIDButtonCapabilitiesPtr    button = &buttons[index];
+        uint32_t                    usages;
+
+        device->hasButtons[button->reportID & 0xff] = true;
+
+        if ( (button->bitField & kElementFlagVariable) == 0 ) {
+            // Array: the parser stashes report size and count in the unit
+            // fields, see IOHIDElementPrivate::buttonElement.
+            if ( !addElement(device, button->reportID, button->startBit, button->unitExponent, button->units, false) )
+                goto exit;
+            continue;
+        }
+
+        usages = button->isRange ? (button->u.range.usageMax - button->u.range.usageMin + 1) : 1;
+        usages = MIN(usages, kMaxRangeUsages);
+
+        for ( uint32_t usage=0; usage<usages; usage++ ) {
+            if ( !addElement(device, button->reportID, button->startBit + usage, 1, 1, false) )
+                goto exit;
+        }
+    }
+
+    for ( UInt32 index=0; index<valueCount; index++ ) {
+        HIDValueCapabilitiesPtr value       = &values[index];
+        bool                    signExtend  = (value->logicalMin < 0) || (value->logicalMax < 0);
+
+        if ( value->isRange ) {
+            uint32_t usages = MIN(value->u.range.usageMax - value->u.range.usageMin + 1, kMaxRangeUsages);
+
+            for ( uint32_t usage=0; usage<usages; usage++ ) {
+                if ( !addElement(device, value->reportID, value->startBit + (usage * value->bitSize), value->bitSize, 1, signExtend) )
+                    goto exit;
+                if ( !addQuery(device, value->reportID, value->usagePage, value->collection, value->u.range.usageMin + usage, &queryCapacity) )
+                    goto exit;
+            }
+        } else {
+            if ( !addElement(device, value->reportID, value->startBit, value->bitSize, value->reportCount, signExtend) )
+                goto exit;
+            if ( !addQuery(device, value->reportID, value->usagePage, value->collection, value->u.notRange.usage, &queryCapacity) )
+                goto exit;
+        }
+    }
+
+    qsort(device->queries, device->queryCount, sizeof(ValueQuery), compareQueries);
+
+    for ( uint32_t index=device->queryCount; index>0; index-- ) {
+        uint32_t reportID = device->queries[index-1].reportID & 0xff;
+
+        device->queryStart[reportID] = index - 1;
+        if ( !device->queryEnd[reportID] )
+            device->queryEnd[reportID] = index;
+    }
+
+    if ( !__csv )
+        printf("Input elements: %u (%u button caps, %u value caps, %u value usages)\n", device->elementCount, (unsigned)buttonCount, (unsigned)valueCount, device->queryCount);
+
+    result = true;
+
+exit:
+    free(buttons);
+    free(values);
+
+    if ( !result )
+        releaseDevice(device);
+
+    return result;
+}
+
+//------------------------------------------------------------------------------
+// Report processors
+//------------------------------------------------------------------------------
+static uint64_t processReportWithParser(Device * device, const Report * report)
+{
+    HIDUsageAndPage usageList[kMaxUsageListLength];
+    uint32_t        reportID    = device->hasReportIDs ? report->data[0] : 0;
+    uint64_t        checksum    = 0;
+
+    for ( uint32_t index=device->queryStart[reportID]; index<device->queryEnd[reportID]; index++ ) {
+        ValueQuery *    query = &device->queries[index];
+        SInt32          value = 0;
+
+        if ( HIDGetUsageValue(kHIDInputReport, query->usagePage, query->collection, query->usage, &value, device->parseData, (void *)report->data, report->length) == kHIDSuccess )
+            checksum += (uint32_t)value;
+    }
+
+    if ( device->hasButtons[reportID] ) {
+        UInt32 usageCount = kMaxUsageListLength;
+
+        if ( HIDGetButtons(kHIDInputReport, 0, usageList, &usageCount, device->parseData, (void *)report->data, report->length) == kHIDSuccess ) {
+            for ( UInt32 index=0; index<usageCount; index++ )
+                checksum += (usageList[index].usagePage << 16) | usageList[index].usage;
+        }
+    }
+
+    return checksum;
+}
+
+// IOHIDDevice::handleReportWithTime and IOHIDElementPrivate::processReport,
+// less the queues and timestamps.
+static uint64_t processReportWithElements(Device * device, const Report * report)
+{
+    uint32_t    reportID    = device->hasReportIDs ? report->data[0] : 0;
+    uint32_t    reportBits  = report->length << 3;
+    uint64_t    checksum    = 0;
+    Element *   element;
+
+    for ( element = device->elements[GetReportHandlerSlot(reportID)]; element; element = element->next ) {
+        bool changed = false;
+
+        if ( element->reportID != reportID )
+            continue;
+
+        if ( (element->reportStartBit + (element->reportBits * element->reportCount)) > reportBits )
+            continue;
+
+        readReportBits(report->data, element->value, element->reportBits * element->reportCount, element->reportStartBit, element->signExtend, &changed);
+
+        if ( changed )
+            checksum += element->value[0] + 1;
+    }
+
+    return checksum;
+}
+
+//------------------------------------------------------------------------------
+// Capture
+//------------------------------------------------------------------------------
+static bool indexCapture(Capture * capture)
+{
+    CaptureHeader   header;
+    size_t          offset = sizeof(CaptureHeader);
+
+    if ( capture->length < sizeof(CaptureHeader) )
+        return false;
+
+    memcpy(&header, capture->buffer, sizeof(header));
+    if ( header.magic != kCaptureMagic || header.version != kCaptureVersion )
+        return false;
+
+    capture->reports = (Report *)calloc(header.recordCount + 1, sizeof(Report));
+    if ( !capture->reports )
+        return false;
+
+    for ( capture->count=0; capture->count<header.recordCount; capture->count++ ) {
+        Report *        report = &capture->reports[capture->count];
+        CaptureRecord   record;
+
+        if ( capture->length - offset < sizeof(CaptureRecord) )
+            break;
+
+        memcpy(&record, capture->buffer + offset, sizeof(record));
+        offset += sizeof(record);
+
+        if ( capture->length - offset < record.length )
+            break;
+
+        report->timestamp   = record.timestamp;
+        report->reportType  = record.reportType;
+        report->length      = record.length;
+        report->data        = capture->buffer + offset;
+
+        offset += record.length;
+    }
+
+    if ( capture->count != header.recordCount )
+        printf("Capture truncated after %u of %u reports\n", capture->count, header.recordCount);
+
+    return capture->count != 0;
+}
+
+//------------------------------------------------------------------------------
+// generateCapture
+//
+// Each report copies the previous report with the same ID and changes one
+// byte, so most elements keep their value from report to report as they
+// do on real devices.  The same seed always produces the same capture.
+//------------------------------------------------------------------------------
+static bool generateCapture(Device * device, uint32_t count, uint64_t seed, Capture * capture)
+{
+    uint8_t *       previous[256]   = {};
+    uint32_t        reportIDs[256];
+    uint32_t        reportIDCount   = 0;
+    CaptureHeader   header          = {kCaptureMagic, kCaptureVersion, count, 0};
+    size_t          maxLength       = 0;
+    size_t          offset;
+    bool            result          = false;
+
+    for ( uint32_t reportID=0; reportID<256; reportID++ ) {
+        if ( !device->reportLengths[reportID] )
+            continue;
+
+        previous[reportID] = (uint8_t *)calloc(1, device->reportLengths[reportID]);
+        if ( !previous[reportID] )
+            goto exit;
+
+        if ( device->hasReportIDs )
+            previous[reportID][0] = reportID;
+
+        reportIDs[reportIDCount++] = reportID;
+        maxLength = device->reportLengths[reportID] > maxLength ? device->reportLengths[reportID] : maxLength;
+    }
+
+    if ( !reportIDCount || !count )
+        goto exit;
+
+    capture->length = sizeof(CaptureHeader) + ((size_t)count * (sizeof(CaptureRecord) + maxLength));
+    capture->buffer = (uint8_t *)malloc(capture->length);
+    if ( !capture->buffer )
+        goto exit;
+
+    memcpy(capture->buffer, &header, sizeof(header));
+    offset = sizeof(header);
+
+    for ( uint32_t index=0; index<count; index++ ) {
+        uint32_t        reportID    = reportIDs[nextRandom(&seed) % reportIDCount];
+        uint32_t        length      = (uint32_t)device->reportLengths[reportID];
+        uint32_t        first       = device->hasReportIDs ? 1 : 0;
+        CaptureRecord   record      = {(uint64_t)index * kGeneratedReportInterval, kHIDInputReport, length};
+
+        if ( length > first )
+            previous[reportID][first + (nextRandom(&seed) % (length - first))] = (uint8_t)nextRandom(&seed);
+
+        memcpy(capture->buffer + offset, &record, sizeof(record));
+        offset += sizeof(record);
+        memcpy(capture->buffer + offset, previous[reportID], length);
+        offset += length;
+    }
+
+    capture->length = offset;
+    result = indexCapture(capture);
+
+exit:
+    for ( uint32_t reportID=0; reportID<256; reportID++ )
+        free(previous[reportID]);
+
+    return result;
+}
+
+static bool writeCapture(const Capture * capture, const char * path)
+{
+    FILE *  file    = fopen(path, "wb");
+    bool    result;
+
+    if ( !file ) {
+        printf("Unable to open %s: %s\n", path, strerror(errno));
+        return false;
+    }
+
+    result = fwrite(capture->buffer, 1, capture->length, file) == capture->length;
+    result &= (fclose(file) == 0);
+
+    return result;
+}
+
+//------------------------------------------------------------------------------
+// runBenchmark
+//------------------------------------------------------------------------------
+static void runBenchmark(Device * device, const Capture * capture, uint32_t passes, BenchmarkResult * result)
+{
+    uint64_t allocations;
+    uint64_t start;
+
+    // One untimed pass so both paths start with warm caches and element
+    // values.
+    for ( uint32_t index=0; index<capture->count; index++ ) {
+        if ( capture->reports[index].reportType == kHIDInputReport && capture->reports[index].length )
+            result->processor(device, &capture->reports[index]);
+    }
+
+    allocations = __allocationCount;
+    start       = getNanoseconds();
+
+    for ( uint32_t pass=0; pass<passes; pass++ ) {
+        for ( uint32_t index=0; index<capture->count; index++ ) {
+            const Report * report = &capture->reports[index];
+
+            if ( report->reportType != kHIDInputReport || !report->length )
+                continue;
+
+            result->checksum += result->processor(device, report);
+            result->reports++;
+        }
+    }
+
+    result->duration    = getNanoseconds() - start;
+    result->allocations = __allocationCount - allocations;
+}
+
+static void printResult(const BenchmarkResult * result)
+{
+    double seconds          = (double)result->duration / 1e9;
+    double reportsPerSecond = seconds > 0 ? result->reports / seconds : 0;
+    double nsPerReport      = result->reports ? (double)result->duration / result->reports : 0;
+    double allocsPerReport  = result->reports ? (double)result->allocations / result->reports : 0;
+
+    if ( __csv )
+        printf("%s,%llu,%.0f,%.1f,%.3f,%016llx\n", result->name, (unsigned long long)result->reports, reportsPerSecond, nsPerReport, allocsPerReport, (unsigned long long)result->checksum);
+    else
+        printf("%-10s %12llu %14.0f %12.1f %14.3f  %016llx\n", result->name, (unsigned long long)result->reports, reportsPerSecond, nsPerReport, allocsPerReport, (unsigned long long)result->checksum);
+}
+
+static void printHelp()
+{
+    printf("\n");
+    printf("hidReportBenchmark usage: hidReportBenchmark [options]\n\n");
+    printf("\t-d <descriptor>\t: Binary report descriptor (default: keyboard and mouse)\n");
+    printf("\t-c <capture>\t: Capture of timestamped reports to replay\n");
+    printf("\t-g <count>\t: Generate a capture of count reports (default 100000)\n");
+    printf("\t-seed <seed>\t: Seed for -g (default 1)\n");
+    printf("\t-w <path>\t: Write the capture being replayed to path\n");
+    printf("\t-n <passes>\t: Timed passes over the capture (default 10)\n");
+    printf("\t-csv\t\t: Print results as CSV\n");
+    printf("\n");
+}
+
+int main (int argc, const char * argv[])
+{
+    BenchmarkResult results[] = {
+        {"parser",      processReportWithParser},
+        {"elements",    processReportWithElements},
+    };
+    const char *    descriptorPath  = NULL;
+    const char *    capturePath     = NULL;
+    const char *    writePath       = NULL;
+    const uint8_t * descriptor      = __defaultDescriptor;
+    uint8_t *       descriptorCopy  = NULL;
+    size_t          descriptorLength= sizeof(__defaultDescriptor);
+    uint32_t        generateCount   = 100000;
+    uint32_t        passes          = 10;
+    uint64_t        seed            = 1;
+    Capture         capture         = {};
+    Device          device;
+    int             status          = 1;
+
+    for ( int index=1; index<argc; index++ ) {
+        const char * arg = argv[index];
+
+        if ( !strcmp("-d", arg) && (index + 1) < argc ) {
+            descriptorPath = argv[++index];
+        }
+        else if ( !strcmp("-c", arg) && (index + 1) < argc ) {
+            capturePath = argv[++index];
+        }
+        else if ( !strcmp("-g", arg) && (index + 1) < argc ) {
+            generateCount = (uint32_t)strtoul(argv[++index], NULL, 0);
+        }
+        else if ( !strcmp("-seed", arg) && (index + 1) < argc ) {
+            seed = strtoull(argv[++index], NULL, 0);
+        }
+        else if ( !strcmp("-w", arg) && (index + 1) < argc ) {
+            writePath = argv[++index];
+        }
+        else if ( !strcmp("-n", arg) && (index + 1) < argc ) {
+            passes = (uint32_t)strtoul(argv[++index], NULL, 0);
+        }
+        else if ( !strcmp("-csv", arg) ) {
+            __csv = true;
+        }
+        else {
+            printHelp();
+            return !strcmp("-h", arg) ? 0 : 1;
+        }
+    }
+
+    if ( !seed )
+        seed = 1;
+
+    if ( descriptorPath ) {
+        descriptorCopy = copyFile(descriptorPath, kMaxDescriptorLength, &descriptorLength);
+        if ( !descriptorCopy )
+            return 1;
+        descriptor = descriptorCopy;
+    }
+
+    if ( !createDevice(&device, descriptor, descriptorLength) )
+        goto exit;
+
+    if ( capturePath ) {
+        capture.buffer = copyFile(capturePath, SIZE_MAX, &capture.length);
+        if ( !capture.buffer || !indexCapture(&capture) ) {
+            printf("Unable to read capture %s\n", capturePath);
+            goto exit;
+        }
+    }
+    else if ( !generateCapture(&device, generateCount, seed, &capture) ) {
+        printf("Unable to generate a capture for this descriptor\n");
+        goto exit;
+    }
+
+    if ( writePath && !writeCapture(&capture, writePath) ) {
+        printf("Unable to write capture to %s\n", writePath);
+        goto exit;
+    }
+
+    if ( !__csv ) {
+        uint64_t span = capture.count ? capture.reports[capture.count-1].timestamp - capture.reports[0].timestamp : 0;
+
+        printf("Capture: %u reports spanning %.3f s\n\n", capture.count, (double)span / 1e9);
+        printf("%-10s %12s %14s %12s %14s %18s\n", "Path", "Reports", "Reports/s", "ns/report", "Allocs/report", "Checksum");
+    } else {
+        printf("path,reports,reports_per_sec,ns_per_report,allocs_per_report,checksum\n");
+    }
+
+    for ( uint32_t index=0; index<sizeof(results)/sizeof(results[0]); index++ ) {
+        runBenchmark(&device, &capture, passes, &results[index]);
+        printResult(&results[index]);
+    }
+
+    status = 0;
+
+exit:
+    releaseDevice(&device);
+    free(capture.reports);
+    free(capture.buffer);
+    free(descriptorCopy);
+
+    return status;
+}
@@ -21,8 +21,14 @@
  */
 
 #include <CoreFoundation/CoreFoundation.h>
+#include <IOKit/IOKitLib.h>
+#include <IOKit/IOCFSerialize.h>
 #include <IOKit/hid/IOHIDUserDevice.h>
 #include <IOKit/hid/IOHIDUsageTables.h>
+#include <IOKit/hid/IOHIDResourceUserClient.h>
+#include <mach/mach_time.h>
+#include <libkern/OSAtomic.h>
+#include <sched.h>
 #include <stdio.h>
 #include <string.h>
 #include <pthread.h>
@@ -707,6 +713,247 @@ finish:
         CFRelease(intervalNumber);
 }
 
+//------------------------------------------------------------------------------
+// benchmarkReports
+//
+// Creates a keyboard directly through IOHIDResource and times how fast input
+// reports can be sent to it.  A batch size of 1 sends one report per call
+// through kIOHIDResourceDeviceUserClientMethodHandleReport; anything larger
+// packs that many records into each kIOHIDResourceDeviceUserClientMethodHandleReports
+// call.  With a ring, reports are written to the shared report ring instead;
+// see ringReports.
+//------------------------------------------------------------------------------
+static bool ringWriteReport(IOHIDResourceReportRing * ring, uint64_t timestamp, const void * report, uint32_t length)
+{
+    IOHIDResourceReportRingEntry *  entry;
+    uint32_t                        entrySize   = (uint32_t)IOHIDResourceReportRingEntrySize(length);
+    uint32_t                        size        = ring->size;
+    uint32_t                        head        = ring->head;
+    uint32_t                        tail        = ring->tail;
+    
+    // head == tail means empty, so the writer never catches up to the
+    // reader: at least 8 bytes stay unused.
+    if ( tail >= head ) {
+        if ( (tail + entrySize) > (head ? size : size - 8) ) {
+            // no room before the end; start over at 0 if the reader has
+            // moved far enough along
+            if ( (entrySize + 8) > head )
+                return false;
+            
+            if ( (size - tail) >= sizeof(IOHIDResourceReportRingEntry) )
+                ((IOHIDResourceReportRingEntry *)(ring->data + tail))->length = kIOHIDResourceReportRingWrap;
+            
+            tail = 0;
+        }
+    } else if ( (tail + entrySize + 8) > head ) {
+        return false;
+    }
+    
+    entry               = (IOHIDResourceReportRingEntry *)(ring->data + tail);
+    entry->timestamp    = timestamp;
+    entry->length       = length;
+    bcopy(report, entry->data, length);
+    
+    tail += entrySize;
+    if ( tail >= size )
+        tail = 0;
+    
+    // publish the entry before the tail that covers it
+    OSMemoryBarrier();
+    ring->tail = tail;
+    
+    return true;
+}
+
+//------------------------------------------------------------------------------
+// ringReports
+//
+// Writes reports to the report ring.  With a drain interval of 0 the ring is
+// drained by hand after every batchSize reports and whenever it fills;
+// otherwise the kernel drains it from its timer and the writer waits for
+// room.  Returns the number of reports the kernel took off the ring.
+//------------------------------------------------------------------------------
+static uint32_t ringReports(io_connect_t connect, const KeyboardInputReport * reports, uint32_t reportCount, uint32_t batchSize, uint32_t drainInterval)
+{
+    IOHIDResourceReportRing *   ring        = NULL;
+    mach_vm_address_t           address     = 0;
+    mach_vm_size_t              size        = 0;
+    uint64_t                    interval    = drainInterval;
+    uint32_t                    written     = 0;
+    uint32_t                    pending     = 0;
+    kern_return_t               kr;
+    
+    kr = IOConnectMapMemory64(connect, kIOHIDResourceUserClientMemoryTypeReportRing, mach_task_self(), &address, &size, kIOMapAnywhere);
+    require_noerr(kr, exit);
+    
+    ring = (IOHIDResourceReportRing *)(uintptr_t)address;
+    require(size >= sizeof(IOHIDResourceReportRing) + ring->size, exit);
+    
+    if ( drainInterval ) {
+        kr = IOConnectCallScalarMethod(connect, kIOHIDResourceDeviceUserClientMethodDrainReportRing, &interval, 1, NULL, NULL);
+        require_noerr(kr, exit);
+    }
+    
+    while ( written < reportCount ) {
+        if ( ringWriteReport(ring, mach_absolute_time(), &reports[written % batchSize], sizeof(KeyboardInputReport)) ) {
+            written++;
+            pending++;
+            
+            if ( drainInterval || pending < batchSize )
+                continue;
+        } else if ( drainInterval ) {
+            sched_yield();
+            continue;
+        }
+        
+        interval = 0;
+        kr = IOConnectCallScalarMethod(connect, kIOHIDResourceDeviceUserClientMethodDrainReportRing, &interval, 1, NULL, NULL);
+        if ( kr != kIOReturnSuccess ) {
+            printf("report ring drain failed: 0x%08x\n", kr);
+            break;
+        }
+        
+        pending = 0;
+    }
+    
+    // Wait for the timer to catch up, or drain what's left by hand.  A
+    // one shot drain also stops the timer.
+    while ( drainInterval && ring->head != ring->tail )
+        sched_yield();
+    
+    interval = 0;
+    IOConnectCallScalarMethod(connect, kIOHIDResourceDeviceUserClientMethodDrainReportRing, &interval, 1, NULL, NULL);
+    
+    if ( ring->head != ring->tail )
+        printf("report ring not empty: head %u tail %u\n", ring->head, ring->tail);
+    
+exit:
+    if ( kr != kIOReturnSuccess )
+        printf("report ring failed: 0x%08x\n", kr);
+    
+    if ( address )
+        IOConnectUnmapMemory64(connect, kIOHIDResourceUserClientMemoryTypeReportRing, mach_task_self(), address);
+    
+    return (ring && kr == kIOReturnSuccess && ring->head == ring->tail) ? written : 0;
+}
+
+static void benchmarkReports(CFMutableDictionaryRef properties, uint32_t reportCount, uint32_t batchSize, int64_t ringInterval)
+{
+    io_service_t        service         = IO_OBJECT_NULL;
+    io_connect_t        connect         = IO_OBJECT_NULL;
+    CFDataRef           descriptorData  = NULL;
+    CFDataRef           propertiesData  = NULL;
+    uint8_t *           records         = NULL;
+    uint32_t            recordSize      = (uint32_t)IOHIDResourceReportRingEntrySize(sizeof(KeyboardInputReport));
+    uint32_t            sent            = 0;
+    uint64_t            start, end;
+    double              seconds;
+    mach_timebase_info_data_t timebase;
+    kern_return_t       kr;
+    
+    if ( !batchSize )
+        batchSize = 1;
+    
+    descriptorData = CFDataCreate(kCFAllocatorDefault, gKeyboardDesc, sizeof(gKeyboardDesc));
+    require(descriptorData && properties, finish);
+    
+    CFDictionarySetValue(properties, CFSTR(kIOHIDReportDescriptorKey), descriptorData);
+    
+    propertiesData = IOCFSerialize(properties, 0);
+    require(propertiesData, finish);
+    
+    service = IOServiceGetMatchingService(kIOMasterPortDefault, IOServiceMatching("IOHIDResource"));
+    require(service, finish);
+    
+    kr = IOServiceOpen(service, mach_task_self(), kIOHIDResourceUserClientTypeDevice, &connect);
+    require_noerr(kr, finish);
+    
+    uint64_t createAsync = 0;
+    kr = IOConnectCallMethod(connect, kIOHIDResourceDeviceUserClientMethodCreate, &createAsync, 1, CFDataGetBytePtr(propertiesData), CFDataGetLength(propertiesData), NULL, NULL, NULL, NULL);
+    require_noerr(kr, finish);
+    
+    records = malloc(recordSize * batchSize);
+    require(records, finish);
+    bzero(records, recordSize * batchSize);
+    
+    // alternate 'a' down and key up so the stream stays balanced
+    for ( uint32_t index = 0; index < batchSize; index++ ) {
+        IOHIDResourceReportRingEntry *  entry   = (IOHIDResourceReportRingEntry *)(records + (index * recordSize));
+        KeyboardInputReport *           report  = (KeyboardInputReport *)entry->data;
+        
+        entry->length   = sizeof(KeyboardInputReport);
+        report->keys[0] = (index & 1) ? 0 : 4;
+    }
+    
+    mach_timebase_info(&timebase);
+    start = mach_absolute_time();
+    
+    if ( ringInterval >= 0 ) {
+        KeyboardInputReport * reports = malloc(sizeof(KeyboardInputReport) * batchSize);
+        
+        require(reports, finish);
+        
+        for ( uint32_t index = 0; index < batchSize; index++ )
+            reports[index] = *(KeyboardInputReport *)((IOHIDResourceReportRingEntry *)(records + (index * recordSize)))->data;
+        
+        sent = ringReports(connect, reports, reportCount, batchSize, (uint32_t)ringInterval);
+        free(reports);
+    }
+    
+    while ( ringInterval < 0 && sent < reportCount ) {
+        uint32_t count = reportCount - sent;
+        
+        if ( count > batchSize )
+            count = batchSize;
+        
+        if ( batchSize == 1 ) {
+            uint64_t timestamp = mach_absolute_time();
+            
+            kr = IOConnectCallMethod(connect, kIOHIDResourceDeviceUserClientMethodHandleReport, &timestamp, 1, ((IOHIDResourceReportRingEntry *)records)->data, sizeof(KeyboardInputReport), NULL, NULL, NULL, NULL);
+        } else {
+            uint64_t    delivered       = 0;
+            uint32_t    deliveredCount  = 1;
+            uint64_t    timestamp       = mach_absolute_time();
+            
+            for ( uint32_t index = 0; index < count; index++ )
+                ((IOHIDResourceReportRingEntry *)(records + (index * recordSize)))->timestamp = timestamp;
+            
+            kr = IOConnectCallMethod(connect, kIOHIDResourceDeviceUserClientMethodHandleReports, NULL, 0, records, recordSize * count, &delivered, &deliveredCount, NULL, NULL);
+            count = (uint32_t)delivered;
+        }
+        
+        if ( kr != kIOReturnSuccess || !count ) {
+            printf("report delivery failed: 0x%08x\n", kr);
+            break;
+        }
+        
+        sent += count;
+    }
+    
+    end     = mach_absolute_time();
+    seconds = (double)(end - start) * timebase.numer / timebase.denom / 1000000000.0;
+    
+    printf("%u reports in %.3f s with batch size %u%s: %.0f reports/sec\n", sent, seconds, batchSize, ringInterval >= 0 ? " through the report ring" : "", seconds > 0 ? sent / seconds : 0);
+    
+    IOConnectCallMethod(connect, kIOHIDResourceDeviceUserClientMethodTerminate, NULL, 0, NULL, 0, NULL, NULL, NULL, NULL);
+    
+finish:
+    if ( records )
+        free(records);
+    
+    if ( connect )
+        IOServiceClose(connect);
+    
+    if ( service )
+        IOObjectRelease(service);
+    
+    if ( propertiesData )
+        CFRelease(propertiesData);
+    
+    if ( descriptorData )
+        CFRelease(descriptorData);
+}
+
 static void printHelp()
 {
     printf("\n");
@@ -719,7 +966,10 @@ static void printHelp()
     printf("\t--pid <product id>\n");
     printf("\t--ri  <report interval us>\n");
     printf("\t--transport <transport string value>\n");
-    printf("\t--rdelay <getReport delay in uS>");
+    printf("\t--rdelay <getReport delay in uS>\n");
+    printf("\t--rps <report count>\t: send reports to a generic keyboard as fast as possible and print reports/sec\n");
+    printf("\t--batch <reports per call>\t: reports per call for --rps; 1 uses a call per report\n");
+    printf("\t--ring <drain interval us>\t: send the --rps reports through the report ring; 0 drains after each batch\n");
     printf("\n");
 }
 
@@ -732,6 +982,9 @@ int main (int argc, const char * argv[])
     uint32_t                        dataSize                = 0;
     uint32_t                        dataIndex               = 0;
     uint32_t                        reportInterval          = 16000;
+    uint32_t                        benchmarkCount          = 0;
+    uint32_t                        benchmarkBatch          = 64;
+    int64_t                         benchmarkRing           = -1;
     UserInputCallback               userInputCallback       = NULL;
     IOHIDUserDeviceReportCallback   outputReportCallback    = NULL;
     IOHIDUserDeviceReportCallback   inputReportCallback     = getReportCallback;
@@ -912,6 +1165,15 @@ int main (int argc, const char * argv[])
             else if ( !strcmp("--ri", argv[argi]) && (argi+1) < argc) {
                 reportInterval = (uint32_t)strtol(argv[++argi], NULL, 10);
             }
+            else if ( !strcmp("--rps", argv[argi]) && (argi+1) < argc) {
+                benchmarkCount = (uint32_t)strtol(argv[++argi], NULL, 10);
+            }
+            else if ( !strcmp("--batch", argv[argi]) && (argi+1) < argc) {
+                benchmarkBatch = (uint32_t)strtol(argv[++argi], NULL, 10);
+            }
+            else if ( !strcmp("--ring", argv[argi]) && (argi+1) < argc) {
+                benchmarkRing = strtol(argv[++argi], NULL, 10);
+            }
         }
         // data
         else if ( !dataString && data && dataIndex < dataSize ) {
@@ -938,7 +1200,10 @@ int main (int argc, const char * argv[])
         
     }
     
-    if ( data ) {
+    if ( benchmarkCount ) {
+        benchmarkReports(properties, benchmarkCount, benchmarkBatch, benchmarkRing);
+    } 
+    else if ( data ) {
         if ( dataSize > dataIndex )
             dataSize = dataIndex;
 
@@ -0,0 +1,222 @@
+//
+//  IOHIDValueSlabBenchmark.c
+//  IOHIDFamily
+//
+//  Drives the IOHIDLib value slab through its CFAllocatorContext the way CF
+//  does for the IOHIDValueRefs a device dequeues, and shows that once the
+//  first burst has been served steady state makes no calls to malloc.  It
+//  also compares the cost of an allocate/deallocate pair with plain
+//  malloc/free, both value by value and with the values of each dequeue
+//  batch reserved up front the way IOHIDQueueClass::copyNextEventValues
+//  does.  CF is stubbed by the shims in tools/hosted, and malloc is
+//  counted by wrapping it at link time:
+//
+//      cc -O2 -I tools/hosted -I IOHIDLib -o hidValueSlabBenchmark
+//          tools/IOHIDValueSlabBenchmark.c IOHIDLib/IOHIDValueSlab.c -lpthread
+//          -Wl,--wrap=malloc,--wrap=calloc,--wrap=realloc
+//
+//      hidValueSlabBenchmark [-v valueSize] [-n valuesPerBurst] [-b valuesPerBatch] [-r rounds]
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "IOHIDValueSlab.h"
+
+#define kDefaultValueSize       8
+#define kDefaultBurst           256
+#define kDefaultBatch           16
+#define kDefaultRounds          10000
+#define kReportedRounds         3
+
+static unsigned long gMallocCount;
+
+void * __real_malloc(size_t size);
+void * __real_calloc(size_t count, size_t size);
+void * __real_realloc(void * ptr, size_t size);
+
+void * __wrap_malloc(size_t size)
+{
+    gMallocCount++;
+    return __real_malloc(size);
+}
+
+void * __wrap_calloc(size_t count, size_t size)
+{
+    gMallocCount++;
+    return __real_calloc(count, size);
+}
+
+void * __wrap_realloc(void * ptr, size_t size)
+{
+    gMallocCount++;
+    return __real_realloc(ptr, size);
+}
+
+static uint64_t now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static int runSlab(uint32_t valueSize, long burst, long batch, long rounds, void ** values, double * nsPerPair)
+{
+    const char *        name        = batch ? "batched slab" : "slab";
+    CFAllocatorContext  context;
+    CFIndex             size        = kIOHIDValueSlabObjectOverhead + valueSize;
+    unsigned long       steadyCount = 0;
+    uint64_t            start       = 0;
+    long                round;
+    long                index;
+
+    if ( IOHIDValueSlabInitContext(valueSize, &context) ) {
+        printf("couldn't create the slab\n");
+        return -1;
+    }
+
+    // what CFAllocatorCreate and the caller do with the slab's references
+    context.retain(context.info);
+    context.release(context.info);
+
+    for ( round = 0; round < rounds; round++ ) {
+        unsigned long before = gMallocCount;
+
+        if ( round == kReportedRounds )
+            start = now();
+
+        // a full queue dequeued in one go, then released by the client
+        for ( index = 0; index < burst; index++ ) {
+            if ( batch && !(index % batch) && !IOHIDValueSlabBeginBatch(context.info, (uint32_t)batch) ) {
+                printf("couldn't start a batch\n");
+                return -1;
+            }
+
+            values[index] = context.allocate(size, 0, context.info);
+            if ( !values[index] ) {
+                printf("allocation failed\n");
+                return -1;
+            }
+            memset(values[index], (int)index, size);
+
+            if ( batch && (!((index + 1) % batch) || (index + 1) == burst) )
+                IOHIDValueSlabEndBatch(context.info);
+        }
+
+        for ( index = 0; index < burst; index++ )
+            context.deallocate(values[index], context.info);
+
+        if ( round < kReportedRounds )
+            printf("%s round %ld: %lu malloc calls\n", name, round, gMallocCount - before);
+        else
+            steadyCount += gMallocCount - before;
+    }
+
+    *nsPerPair = (double)(now() - start) / ((rounds - kReportedRounds) * burst);
+
+    printf("%s rounds %d-%ld: %lu malloc calls\n", name, kReportedRounds, rounds - 1, steadyCount);
+
+    // blocks are size rounded up to 16 bytes; anything larger still goes
+    // to malloc, one call each
+    {
+        unsigned long   before  = gMallocCount;
+        void *          large   = context.allocate(size + 16, 0, context.info);
+
+        printf("oversized value: %lu malloc call(s)\n", gMallocCount - before);
+        if ( large )
+            context.deallocate(large, context.info);
+    }
+
+    // the last object went away with the allocator: the slab is freed here
+    context.release(context.info);
+
+    return steadyCount ? 1 : 0;
+}
+
+static void runMalloc(uint32_t valueSize, long burst, long rounds, void ** values, double * nsPerPair)
+{
+    size_t      size    = kIOHIDValueSlabObjectOverhead + valueSize;
+    uint64_t    start   = 0;
+    long        round;
+    long        index;
+
+    for ( round = 0; round < rounds; round++ ) {
+        if ( round == kReportedRounds )
+            start = now();
+
+        for ( index = 0; index < burst; index++ ) {
+            values[index] = malloc(size);
+            memset(values[index], (int)index, size);
+        }
+
+        for ( index = 0; index < burst; index++ )
+            free(values[index]);
+    }
+
+    *nsPerPair = (double)(now() - start) / ((rounds - kReportedRounds) * burst);
+}
+
+int main(int argc, char ** argv)
+{
+    uint32_t    valueSize   = kDefaultValueSize;
+    long        burst       = kDefaultBurst;
+    long        batch       = kDefaultBatch;
+    long        rounds      = kDefaultRounds;
+    void **     values;
+    double      slabNs;
+    double      batchNs;
+    double      mallocNs;
+    int         result;
+    int         batchResult;
+    int         ch;
+
+    while ( (ch = getopt(argc, argv, "v:n:b:r:")) != -1 ) {
+        switch ( ch ) {
+            case 'v':
+                valueSize = (uint32_t)strtoul(optarg, NULL, 0);
+                break;
+            case 'n':
+                burst = strtol(optarg, NULL, 0);
+                break;
+            case 'b':
+                batch = strtol(optarg, NULL, 0);
+                break;
+            case 'r':
+                rounds = strtol(optarg, NULL, 0);
+                break;
+            default:
+                printf("usage: %s [-v valueSize] [-n valuesPerBurst] [-b valuesPerBatch] [-r rounds]\n", argv[0]);
+                return 1;
+        }
+    }
+
+    if ( burst <= 0 || batch <= 0 || rounds <= kReportedRounds || !(values = calloc(burst, sizeof(void *))) ) {
+        printf("need at least one value per burst and batch, and more than %d rounds\n", kReportedRounds);
+        return 1;
+    }
+
+    printf("%u byte values, %ld per burst, %ld per batch, %ld rounds\n", valueSize, burst, batch, rounds);
+
+    result = runSlab(valueSize, burst, 0, rounds, values, &slabNs);
+    if ( result < 0 )
+        return 1;
+
+    batchResult = runSlab(valueSize, burst, batch, rounds, values, &batchNs);
+    if ( batchResult < 0 )
+        return 1;
+
+    result |= batchResult;
+
+    runMalloc(valueSize, burst, rounds, values, &mallocNs);
+
+    printf("allocate + deallocate: slab %.1f ns, batched slab %.1f ns, malloc/free %.1f ns\n", slabNs, batchNs, mallocNs);
+    printf("%s: steady state %s\n", result ? "FAILED" : "passed", result ? "still calls malloc" : "makes no malloc calls");
+
+    free(values);
+
+    return result;
+}
@@ -0,0 +1,390 @@
+//
+//  IOHIKeyboardMapperTest.c
+//  IOHIDFamily
+//
+//  Checks that the character table IOHIKeyboardMapper::compileKeyMapping
+//  builds gives doCharGen the same (charSet, charCode) as walking the
+//  packed keymapping, for every key of every keymap bundled in the family
+//  and every combination of the 16 modifier bits.  Each keymap is checked
+//  as shipped and re-encoded in shorts.
+//
+//  The keymaps are read out of the family sources rather than copied here,
+//  so run it from the top of the tree or pass its path:
+//
+//      cc -Wall -I tools/hosted -I IOHIDSystem -o hidKeyboardMapperTest
+//          tools/IOHIKeyboardMapperTest.c
+//      ./hidKeyboardMapperTest [srcroot]
+//
+
+#include <ctype.h>
+#include <dirent.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "IOHIKeyboardMapperCompiled.h"
+
+#define kMaxKeyMapLength    8192
+#define kMaxDefines         512
+
+typedef struct {
+    char    name[64];
+    long    value;
+} Define;
+
+static Define   gDefines[kMaxDefines];
+static int      gDefineCount;
+static int      gFailures;
+
+static char * readFile(const char * path)
+{
+    FILE *  file    = fopen(path, "r");
+    char *  text    = NULL;
+    long    length;
+
+    if ( !file )
+        return NULL;
+
+    if ( !fseek(file, 0, SEEK_END) && (length = ftell(file)) >= 0 && !fseek(file, 0, SEEK_SET) &&
+         (text = malloc(length + 1)) ) {
+        text[fread(text, 1, length, file)] = 0;
+    }
+
+    fclose(file);
+
+    return text;
+}
+
+// blank out comments so only the array's values remain
+static void stripComments(char * text)
+{
+    char * p;
+
+    for ( p = text; *p; p++ ) {
+        if ( p[0] == '/' && p[1] == '/' ) {
+            while ( *p && *p != '\n' )
+                *p++ = ' ';
+        } else if ( p[0] == '/' && p[1] == '*' ) {
+            *p++ = ' ';
+            *p++ = ' ';
+            while ( *p && !(p[0] == '*' && p[1] == '/') )
+                *p++ = ' ';
+            if ( *p ) {
+                *p++ = ' ';
+                *p = ' ';
+            }
+        }
+    }
+}
+
+// some keymaps use the NX_ constants from ev_keymap.h
+static int loadDefines(const char * root)
+{
+    char    path[1024];
+    char *  text;
+    char *  line;
+
+    snprintf(path, sizeof(path), "%s/IOHIDSystem/IOKit/hidsystem/ev_keymap.h", root);
+    if ( !(text = readFile(path)) )
+        return -1;
+
+    stripComments(text);
+
+    for ( line = strtok(text, "\n"); line; line = strtok(NULL, "\n") ) {
+        char    name[64];
+        char *  end;
+        char    value[64];
+        long    number;
+
+        if ( sscanf(line, " #define %63s %63s", name, value) != 2 )
+            continue;
+
+        number = strtol(value, &end, 0);
+        if ( *end || gDefineCount == kMaxDefines )
+            continue;
+
+        snprintf(gDefines[gDefineCount].name, sizeof(gDefines[gDefineCount].name), "%s", name);
+        gDefines[gDefineCount++].value = number;
+    }
+
+    free(text);
+
+    return 0;
+}
+
+static int parseValue(const char * token, long * value)
+{
+    char *  end;
+    int     index;
+
+    *value = strtol(token, &end, 0);
+    if ( end != token && !*end )
+        return 0;
+
+    for ( index = 0; index < gDefineCount; index++ ) {
+        if ( !strcmp(gDefines[index].name, token) ) {
+            *value = gDefines[index].value;
+            return 0;
+        }
+    }
+
+    return -1;
+}
+
+// reads the values of the array that follows "name[] =" in text
+static int parseKeyMap(const char * text, const char * name, unsigned char * keyMap, size_t * length)
+{
+    const char *    p;
+    const char *    end;
+    size_t          count = 0;
+
+    if ( !(p = strstr(text, name)) || !(p = strchr(p, '{')) || !(end = strstr(p, "};")) )
+        return -1;
+
+    for ( p++; p < end; ) {
+        char    token[64];
+        size_t  tokenLength = 0;
+        long    value;
+
+        while ( p < end && (isspace((unsigned char)*p) || *p == ',') )
+            p++;
+        while ( p < end && !isspace((unsigned char)*p) && *p != ',' && tokenLength < sizeof(token) - 1 )
+            token[tokenLength++] = *p++;
+        if ( !tokenLength )
+            continue;
+        token[tokenLength] = 0;
+
+        if ( parseValue(token, &value) || count == kMaxKeyMapLength ) {
+            printf("FAIL  %s: can't read %s\n", name, token);
+            return -1;
+        }
+
+        keyMap[count++] = (unsigned char)value;
+    }
+
+    *length = count;
+
+    return 0;
+}
+
+static unsigned nextNum(const unsigned char ** bp, const unsigned char * endPtr, short shorts)
+{
+    if ( *bp >= endPtr )
+        return 0;
+
+    return NEXTNUM((unsigned char **)bp, shorts);
+}
+
+// Only the parts of IOHIKeyboardMapper::parseKeyMapping that
+// locate the key definitions
+static int parseKeyDefs(unsigned char * map, size_t length, NXParsedKeyMapping * parsedMapping)
+{
+    const unsigned char *   bp      = map;
+    const unsigned char *   endPtr  = map + length;
+    unsigned                noop;
+    int                     i, j, k, n;
+
+    memset(parsedMapping, 0, sizeof(*parsedMapping));
+    parsedMapping->maxMod   = -1;
+    parsedMapping->mapping  = map;
+    parsedMapping->mappingLen = (int)length;
+    parsedMapping->shorts   = nextNum(&bp, endPtr, 1);
+
+    noop = parsedMapping->shorts ? 0xFFFF : 0x00FF;
+
+    for ( i = 0, n = nextNum(&bp, endPtr, parsedMapping->shorts); i < n; i++ ) {
+        if ( (j = nextNum(&bp, endPtr, parsedMapping->shorts)) >= NX_NUMMODIFIERS )
+            return -1;
+        if ( j > parsedMapping->maxMod )
+            parsedMapping->maxMod = j;
+        for ( k = nextNum(&bp, endPtr, parsedMapping->shorts); k > 0; k-- )
+            nextNum(&bp, endPtr, parsedMapping->shorts);
+    }
+
+    parsedMapping->numDefs = nextNum(&bp, endPtr, parsedMapping->shorts);
+    for ( i = 0; i < NX_NUMKEYCODES && i < parsedMapping->numDefs; i++ ) {
+        unsigned keyMask;
+
+        parsedMapping->keyDefs[i] = (unsigned char *)bp;
+        if ( (keyMask = nextNum(&bp, endPtr, parsedMapping->shorts)) == noop )
+            continue;
+
+        for ( j = 0, k = 1; j <= parsedMapping->maxMod; j++, keyMask >>= 1 )
+            if ( keyMask & 0x01 )
+                k *= 2;
+        for ( j = 0; j < 2 * k; j++ )
+            nextNum(&bp, endPtr, parsedMapping->shorts);
+    }
+
+    return bp <= endPtr ? 0 : -1;
+}
+
+static void checkKeyMap(const char * name, unsigned char * map, size_t length)
+{
+    NXParsedKeyMapping      parsedMapping;
+    CompiledKeyMapping *    compiled;
+    UInt32                  count;
+    size_t                  size;
+    unsigned                noop;
+    int                     keyCode;
+    int                     keys        = 0;
+    int                     failures    = gFailures;
+    long                    lookups     = 0;
+
+    if ( parseKeyDefs(map, length, &parsedMapping) ) {
+        printf("FAIL  %s: can't parse the key definitions\n", name);
+        gFailures++;
+        return;
+    }
+
+    noop    = parsedMapping.shorts ? 0xFFFF : 0x00FF;
+    count   = CompileKeyDefs(&parsedMapping, NULL);
+    size    = sizeof(CompiledKeyMapping) + (count ? (count - 1) : 0) * sizeof(CompiledCharDef);
+    if ( !(compiled = calloc(1, size)) ) {
+        gFailures++;
+        return;
+    }
+
+    compiled->size = size;
+    if ( CompileKeyDefs(&parsedMapping, compiled) != count ) {
+        printf("FAIL  %s: sizing and filling passes disagree\n", name);
+        gFailures++;
+    }
+
+    for ( keyCode = 0; keyCode < NX_NUMKEYCODES; keyCode++ ) {
+        unsigned char * map = parsedMapping.keyDefs[keyCode];
+        int             modifiers;
+
+        if ( !map || NEXTNUM(&map, parsedMapping.shorts) == (int)noop )
+            continue;
+
+        keys++;
+
+        if ( !compiled->keyDefs[keyCode].compiled ) {
+            printf("FAIL  %s: key 0x%02x wasn't compiled\n", name, keyCode);
+            gFailures++;
+            continue;
+        }
+
+        for ( modifiers = 0; modifiers < (1 << NX_NUMMODIFIERS); modifiers++ ) {
+            unsigned walkSet, walkCode, charSet, charCode;
+
+            KeyDefCharDef(&parsedMapping, keyCode, modifiers, &walkSet, &walkCode);
+            CompiledKeyDefCharDef(compiled, keyCode, modifiers, &charSet, &charCode);
+            lookups++;
+
+            if ( charSet != walkSet || charCode != walkCode ) {
+                printf("FAIL  %s: key 0x%02x modifiers 0x%04x: walk %u/0x%x compiled %u/0x%x\n",
+                       name, keyCode, modifiers, walkSet, walkCode, charSet, charCode);
+                if ( ++gFailures - failures > 10 )
+                    goto done;
+            }
+        }
+    }
+
+done:
+    printf("%s  %s: %d keys, %ld lookups\n", gFailures == failures ? "ok  " : "FAIL", name, keys, lookups);
+
+    free(compiled);
+}
+
+// re-encode a byte keymap in shorts, big endian as parseKeyMapping
+// expects; the leading format short stays a single short and the 0xFF
+// no-op and sequence markers become 0xFFFF
+static size_t widenKeyMap(const unsigned char * map, size_t length, unsigned char * wide)
+{
+    size_t index;
+
+    wide[0] = 0;
+    wide[1] = 1;
+
+    for ( index = 2; index < length; index++ ) {
+        wide[(index - 1) * 2]       = (map[index] == 0xFF) ? 0xFF : 0;
+        wide[(index - 1) * 2 + 1]   = map[index];
+    }
+
+    return (length - 1) * 2;
+}
+
+static void checkSourceFile(const char * root, const char * directory, const char * file)
+{
+    char            path[1024];
+    char *          text;
+    const char *    p;
+
+    snprintf(path, sizeof(path), "%s/%s/%s", root, directory, file);
+    if ( !(text = readFile(path)) )
+        return;
+
+    stripComments(text);
+
+    for ( p = text; (p = strstr(p, "static const unsigned char ")); ) {
+        static unsigned char    map[kMaxKeyMapLength];
+        static unsigned char    wide[kMaxKeyMapLength * 2];
+        char                    name[64];
+        char                    label[128];
+        size_t                  length;
+        size_t                  nameLength;
+
+        p += strlen("static const unsigned char ");
+        for ( nameLength = 0; (isalnum((unsigned char)p[nameLength]) || p[nameLength] == '_') && nameLength < sizeof(name) - 3; nameLength++ )
+            name[nameLength] = p[nameLength];
+        memcpy(&name[nameLength], "[]", 3);
+
+        if ( nameLength < 6 || strncmp(&name[nameLength - 6], "KeyMap", 6) )
+            continue;
+
+        if ( parseKeyMap(p, name, map, &length) || length < 2 ) {
+            gFailures++;
+            continue;
+        }
+
+        name[nameLength] = 0;
+
+        snprintf(label, sizeof(label), "%s %s", file, name);
+        checkKeyMap(label, map, length);
+
+        // every bundled keymap is in bytes; cover the shorts encoding too
+        if ( !map[0] && !map[1] ) {
+            snprintf(label, sizeof(label), "%s %s (shorts)", file, name);
+            checkKeyMap(label, wide, widenKeyMap(map, length, wide));
+        }
+    }
+
+    free(text);
+}
+
+int main(int argc, char ** argv)
+{
+    static const char *     directories[] = { "IOHIDFamily", "IOHIDSystem" };
+    const char *            root = (argc > 1) ? argv[1] : ".";
+    unsigned                index;
+
+    if ( loadDefines(root) ) {
+        printf("can't read ev_keymap.h under %s\n", root);
+        return 1;
+    }
+
+    for ( index = 0; index < sizeof(directories) / sizeof(directories[0]); index++ ) {
+        char            path[1024];
+        DIR *           dir;
+        struct dirent * entry;
+
+        snprintf(path, sizeof(path), "%s/%s", root, directories[index]);
+        if ( !(dir = opendir(path)) )
+            continue;
+
+        while ( (entry = readdir(dir)) ) {
+            size_t length = strlen(entry->d_name);
+
+            if ( length > 4 && !strcmp(&entry->d_name[length - 4], ".cpp") )
+                checkSourceFile(root, directories[index], entry->d_name);
+        }
+
+        closedir(dir);
+    }
+
+    printf("%s: %d failure(s)\n", gFailures ? "FAILED" : "passed", gFailures);
+
+    return gFailures ? 1 : 0;
+}
@@ -0,0 +1,327 @@
+//
+//  IOHIPointingScaleBenchmark.c
+//  IOHIDFamily
+//
+//  Measures pointer scaling throughput against the size of the
+//  acceleration segment table.  A user space copy of IOHIPointing's
+//  ScaleAxes is run over the same stream of deltas twice per table size:
+//  once finding the segment with the linear walk it used to do and once
+//  with FindScaleSegment's lower bound search.  Both have to produce the
+//  same deltas.  The mouse stream is mostly slow movement, the sweep
+//  stream covers every magnitude of the curve evenly.  The tables are
+//  generated the way SetupAcceleration leaves them: devUnits
+//  non-decreasing, a continuous curve, and a MAX_DEVICE_THRESHOLD segment
+//  at the end.  It only needs the shims in tools/hosted:
+//
+//      cc -O2 -I tools/hosted -o hidPointingScaleBenchmark
+//          tools/IOHIPointingScaleBenchmark.c
+//
+//      hidPointingScaleBenchmark [-n events] [-m maxSegments] [-r rounds]
+//
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <IOKit/IOTypes.h>
+
+#define kDefaultEventCount          100000
+#define kDefaultMaxSegments         256
+#define kDefaultRounds              20
+#define kMaxDelta                   127         // 8 bit report deltas
+#define kMaxMagnitude               180         // |(127,127)|
+
+#define MAX_DEVICE_THRESHOLD        0x7fffffff
+
+typedef struct CursorDeviceSegment {
+    SInt32  devUnits;
+    SInt32  slope;
+    SInt32  intercept;
+} CursorDeviceSegment;
+
+typedef struct Delta {
+    int     dx;
+    int     dy;
+} Delta;
+
+static uint64_t now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+// IOLib's fixed point helpers
+static inline IOFixed IOFixedMultiply(IOFixed a, IOFixed b)
+{
+    return (IOFixed)((((SInt64)a) * ((SInt64)b)) >> 16);
+}
+
+static inline IOFixed IOFixedDivide(IOFixed a, IOFixed b)
+{
+    return (IOFixed)((((SInt64)a) << 16) / ((SInt64)b));
+}
+
+// IOHIDSystem/IOFixed64.cpp
+static UInt16 lsqrt(UInt32 x)
+{
+    UInt32 rem = 0;
+    UInt32 root = 0;
+    int i;
+
+    for (i = 0; i < 16; i++) {
+        root <<= 1;
+        rem = ((rem << 2) + (x >> 30));
+        x <<= 2;
+
+        root++;
+
+        if (root <= rem) {
+            rem -=  root;
+            root++;
+        } else {
+            root--;
+        }
+    }
+
+    return (UInt16)(root >> 1);
+}
+
+// the walk ScaleAxes used before the tables were searched
+static inline CursorDeviceSegment * FindScaleSegmentLinear(void * scaleSegments, IOItemCount scaleSegCount __attribute__((unused)), SInt32 mag)
+{
+    CursorDeviceSegment * segment;
+
+    for ( segment = (CursorDeviceSegment *)scaleSegments; mag > segment->devUnits; segment++ )
+        {}
+
+    return segment;
+}
+
+// IOHIPointing's FindScaleSegment
+static inline CursorDeviceSegment * FindScaleSegment(void * scaleSegments, IOItemCount scaleSegCount, SInt32 mag)
+{
+    CursorDeviceSegment *   segments = (CursorDeviceSegment *) scaleSegments;
+    IOItemCount             low = 0;
+    IOItemCount             count = scaleSegCount;
+
+    while( count > 1) {
+        IOItemCount half = count / 2;
+        low = (mag > segments[low + half - 1].devUnits) ? (low + half) : low;
+        count -= half;
+    }
+
+    return &segments[low];
+}
+
+// IOHIPointing's ScaleAxes with the choice of segment lookup
+static inline void ScaleAxes(bool search, void * scaleSegments, IOItemCount scaleSegCount, int * axis1p, IOFixed *axis1Fractp, int * axis2p, IOFixed *axis2Fractp)
+{
+    SInt32                  dx, dy;
+    SInt32                  mag;
+    IOFixed                 scale;
+    CursorDeviceSegment *   segment;
+
+    if( !scaleSegments || !scaleSegCount)
+        return;
+
+    dx = (*axis1p) * 65536;
+    dy = (*axis2p) * 65536;
+
+    mag = (lsqrt(*axis1p * *axis1p + *axis2p * *axis2p)) << 16;
+    if (mag == 0)
+        return;
+
+    if ( search )
+        segment = FindScaleSegment(scaleSegments, scaleSegCount, mag);
+    else
+        segment = FindScaleSegmentLinear(scaleSegments, scaleSegCount, mag);
+
+    scale = IOFixedDivide(
+            segment->intercept + IOFixedMultiply( mag, segment->slope ),
+            mag );
+
+    dx = IOFixedMultiply( dx, scale );
+    dy = IOFixedMultiply( dy, scale );
+
+    dx += *axis1Fractp;
+    dy += *axis2Fractp;
+
+    *axis1p = dx / 65536;
+    *axis2p = dy / 65536;
+
+    if( dx >= 0)
+        *axis1Fractp = dx & 0xffff;
+    else
+        *axis1Fractp = dx | 0xffff0000;
+    if( dy >= 0)
+        *axis2Fractp = dy & 0xffff;
+    else
+        *axis2Fractp = dy | 0xffff0000;
+}
+
+// count segments over magnitudes up to kMaxMagnitude, the slope rising
+// from 1 to 4, each intercept picking up where the previous segment ended
+static void generateSegments(CursorDeviceSegment * segments, IOItemCount count)
+{
+    SInt64      lastX   = 0;
+    SInt64      lastY   = 0;
+    IOItemCount index;
+
+    for ( index = 0; index < count; index++ ) {
+        CursorDeviceSegment *   segment = &segments[index];
+        SInt32                  slope   = (SInt32)(65536 + ((SInt64)3 * 65536 * index) / count);
+        SInt64                  x       = ((SInt64)kMaxMagnitude * 65536 * (index + 1)) / count;
+
+        segment->devUnits   = (index == count - 1) ? MAX_DEVICE_THRESHOLD : (SInt32)x;
+        segment->slope      = slope;
+        segment->intercept  = (SInt32)(lastY - ((lastX * slope) >> 16));
+
+        lastY += ((x - lastX) * slope) >> 16;
+        lastX  = x;
+    }
+}
+
+// mostly slow movement with the odd flick, like a mouse report stream
+static void generateMouseDeltas(Delta * deltas, long count)
+{
+    unsigned int    seed = 0x48494450;
+    long            index;
+
+    for ( index = 0; index < count; index++ ) {
+        int range = ((seed = seed * 1103515245 + 12345) >> 16) % 16 ? 8 : kMaxDelta;
+
+        deltas[index].dx = (int)(((seed = seed * 1103515245 + 12345) >> 16) % (2 * range + 1)) - range;
+        deltas[index].dy = (int)(((seed = seed * 1103515245 + 12345) >> 16) % (2 * range + 1)) - range;
+    }
+}
+
+// every magnitude from 1 to kMaxDelta * sqrt(2) in turn
+static void generateSweepDeltas(Delta * deltas, long count)
+{
+    long index;
+
+    for ( index = 0; index < count; index++ ) {
+        int step = (int)(index % (2 * kMaxDelta)) + 1;
+
+        deltas[index].dx = (step <= kMaxDelta) ? step : kMaxDelta;
+        deltas[index].dy = (step <= kMaxDelta) ? 0 : (step - kMaxDelta);
+
+        if ( index & 1 ) {
+            deltas[index].dx = -deltas[index].dx;
+            deltas[index].dy = -deltas[index].dy;
+        }
+    }
+}
+
+static double runScale(bool search, CursorDeviceSegment * segments, IOItemCount segCount, const Delta * deltas, long count, long rounds, Delta * output)
+{
+    uint64_t    start   = now();
+    IOFixed     fractX  = 0;
+    IOFixed     fractY  = 0;
+    long        round;
+    long        index;
+
+    for ( round = 0; round < rounds; round++ ) {
+        for ( index = 0; index < count; index++ ) {
+            int dx = deltas[index].dx;
+            int dy = deltas[index].dy;
+
+            ScaleAxes(search, segments, segCount, &dx, &fractX, &dy, &fractY);
+
+            output[index].dx = dx;
+            output[index].dy = dy;
+        }
+    }
+
+    return (double)(now() - start) / ((double)rounds * count);
+}
+
+int main(int argc, char ** argv)
+{
+    long                    count       = kDefaultEventCount;
+    long                    rounds      = kDefaultRounds;
+    IOItemCount             maxSegments = kDefaultMaxSegments;
+    IOItemCount             segCount;
+    CursorDeviceSegment *   segments;
+    Delta *                 deltas;
+    Delta *                 sweepDeltas;
+    Delta *                 linearOutput;
+    Delta *                 searchOutput;
+    int                     failed      = 0;
+    int                     ch;
+
+    while ( (ch = getopt(argc, argv, "n:m:r:")) != -1 ) {
+        switch ( ch ) {
+            case 'n':
+                count = strtol(optarg, NULL, 0);
+                break;
+            case 'm':
+                maxSegments = (IOItemCount)strtoul(optarg, NULL, 0);
+                break;
+            case 'r':
+                rounds = strtol(optarg, NULL, 0);
+                break;
+            default:
+                printf("usage: %s [-n events] [-m maxSegments] [-r rounds]\n", argv[0]);
+                return 1;
+        }
+    }
+
+    if ( count <= 0 || rounds <= 0 || maxSegments < 2 ) {
+        printf("need at least one event, one round and two segments\n");
+        return 1;
+    }
+
+    segments        = calloc(maxSegments, sizeof(CursorDeviceSegment));
+    deltas          = calloc(count, sizeof(Delta));
+    sweepDeltas     = calloc(count, sizeof(Delta));
+    linearOutput    = calloc(count, sizeof(Delta));
+    searchOutput    = calloc(count, sizeof(Delta));
+
+    if ( !segments || !deltas || !sweepDeltas || !linearOutput || !searchOutput ) {
+        printf("out of memory\n");
+        return 1;
+    }
+
+    generateMouseDeltas(deltas, count);
+    generateSweepDeltas(sweepDeltas, count);
+
+    printf("%ld events, %ld rounds, ns per event\n", count, rounds);
+    printf("%8s %14s %14s %14s %14s\n", "segments", "mouse linear", "mouse search", "sweep linear", "sweep search");
+
+    for ( segCount = 2; segCount <= maxSegments; segCount *= 2 ) {
+        double  ns[4];
+        int     stream;
+
+        generateSegments(segments, segCount);
+
+        for ( stream = 0; stream < 2; stream++ ) {
+            const Delta * input = stream ? sweepDeltas : deltas;
+
+            ns[stream * 2]      = runScale(false, segments, segCount, input, count, rounds, linearOutput);
+            ns[stream * 2 + 1]  = runScale(true, segments, segCount, input, count, rounds, searchOutput);
+
+            if ( memcmp(linearOutput, searchOutput, count * sizeof(Delta)) ) {
+                printf("scaled deltas differ with %u segments\n", (unsigned)segCount);
+                failed = 1;
+            }
+        }
+
+        printf("%8u %14.2f %14.2f %14.2f %14.2f\n", (unsigned)segCount, ns[0], ns[1], ns[2], ns[3]);
+    }
+
+    printf("%s\n", failed ? "failed" : "passed: both lookups scale every delta the same");
+
+    free(searchOutput);
+    free(linearOutput);
+    free(sweepDeltas);
+    free(deltas);
+    free(segments);
+
+    return failed;
+}
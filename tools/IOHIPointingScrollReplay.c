@@ -0,0 +1,530 @@
+//
+//  IOHIPointingScrollReplay.c
+//  IOHIDFamily
+//
+//  Replays scroll traces through a user space copy of the averaging at the
+//  top of IOHIPointing's AccelerateScrollAxis, once with the walk over the
+//  last SCROLL_TIME_DELTA_COUNT samples it used to do on every event and
+//  once with the running sums ScaleDataState keeps now, and reports the
+//  cost per event of each.  Both have to produce the same average count,
+//  axis delta and time delta for every event.
+//
+//  A trace is a text file with one scroll event per line, the timestamp in
+//  nanoseconds followed by the axis delta in lines, as handed to
+//  IOHIPointing::scrollWheelEvent; '#' starts a comment.  Each trace is
+//  replayed as its own session.  Without traces a wheel session (notches
+//  in bursts with pauses and direction changes) and a continuous session
+//  (8ms reports ramping up and coasting down) are generated.  It only
+//  needs the shims in tools/hosted:
+//
+//      cc -O2 -I tools/hosted -o hidPointingScrollReplay
+//          tools/IOHIPointingScrollReplay.c
+//
+//      hidPointingScrollReplay [-n generatedEvents] [-r rounds] [trace ...]
+//
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <IOKit/IOTypes.h>
+
+#define kDefaultEventCount              100000
+#define kDefaultRounds                  20
+#define kMaxLineLength                  256
+
+// IOHIPointing.cpp
+#define kIOFixedOne                     0x10000ULL
+#define SCROLL_EVENT_THRESHOLD_MS_LL    150ULL
+#define SCROLL_EVENT_THRESHOLD_MS       (SCROLL_EVENT_THRESHOLD_MS_LL * kIOFixedOne)
+#define SCROLL_CLEAR_THRESHOLD_MS_LL    500ULL
+#define SCROLL_TIME_DELTA_COUNT         8
+
+typedef struct ScrollEvent {
+    UInt64  timestampNS;
+    SInt32  delta;
+} ScrollEvent;
+
+typedef struct Session {
+    char *          name;
+    ScrollEvent *   events;
+    long            count;
+    long            capacity;
+} Session;
+
+// what the rest of AccelerateScrollAxis takes from the averaging
+typedef struct Average {
+    IOFixed avgCount;
+    IOFixed avgAxis;
+    IOFixed avgTimeDeltaMS;
+} Average;
+
+// ScaleDataState before and after the running sums
+typedef struct ScaleDataStateWalk {
+    UInt8   deltaIndex;
+    IOFixed deltaTime[SCROLL_TIME_DELTA_COUNT];
+    IOFixed deltaAxis[SCROLL_TIME_DELTA_COUNT];
+    IOFixed fraction;
+} ScaleDataStateWalk;
+
+typedef struct ScaleDataState {
+    UInt8   deltaIndex;
+    UInt8   deltaCount;
+    IOFixed deltaTime[SCROLL_TIME_DELTA_COUNT];
+    IOFixed deltaAxis[SCROLL_TIME_DELTA_COUNT];
+    IOFixed deltaTimeSum;
+    IOFixed deltaAxisSum;
+    IOFixed fraction;
+} ScaleDataState;
+
+// the parts of ScrollAxisAccelInfo and scrollWheelEvent the averaging uses
+typedef struct AxisWalk {
+    UInt64              lastEventTimeNS;
+    SInt32              lastValue;
+    ScaleDataStateWalk  state;
+} AxisWalk;
+
+typedef struct Axis {
+    UInt64              lastEventTimeNS;
+    SInt32              lastValue;
+    ScaleDataState      state;
+} Axis;
+
+static uint64_t now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+// scrollWheelEvent's direction change test, which clears the history
+static inline bool directionChange(SInt32 * lastValue, SInt32 delta)
+{
+    bool change = ((*lastValue == 0) || ((*lastValue < 0) && (delta > 0)) || ((*lastValue > 0) && (delta < 0)));
+
+    *lastValue = delta;
+
+    return change;
+}
+
+// the time delta of AccelerateScrollAxis, clearing the state on a gap
+static inline IOFixed eventTimeDelta(UInt64 timestampNS, UInt64 * lastEventTimeNS, bool clear, void * state, size_t stateSize)
+{
+    UInt64 timeDeltaMSLL = (timestampNS - *lastEventTimeNS) / 1000000;
+
+    *lastEventTimeNS = timestampNS;
+
+    if ((timeDeltaMSLL >= SCROLL_CLEAR_THRESHOLD_MS_LL) || clear) {
+        memset(state, 0, stateSize);
+        timeDeltaMSLL = SCROLL_CLEAR_THRESHOLD_MS_LL;
+    }
+
+    return ((UInt32) timeDeltaMSLL) * kIOFixedOne;
+}
+
+// AccelerateScrollAxis before: walks back over the history every event
+static inline bool averageWalk(AxisWalk * axis, const ScrollEvent * event, Average * average)
+{
+    ScaleDataStateWalk *    state           = &axis->state;
+    bool                    clear           = directionChange(&axis->lastValue, event->delta);
+    IOFixed                 absAxis         = abs(event->delta) * 65536;
+    IOFixed                 avgCount        = 0;
+    IOFixed                 avgAxis         = 0;
+    IOFixed                 avgTimeDeltaMS  = 0;
+    IOFixed                 timeDeltaMS;
+    int                     avgIndex;
+
+    if ( absAxis == 0 )
+        return false;
+
+    timeDeltaMS = eventTimeDelta(event->timestampNS, &axis->lastEventTimeNS, clear, state, sizeof(*state));
+
+    state->deltaTime[state->deltaIndex] = timeDeltaMS;
+    state->deltaAxis[state->deltaIndex] = absAxis;
+
+    for (int index=0; index < SCROLL_TIME_DELTA_COUNT; index++)
+    {
+        avgIndex = (state->deltaIndex + SCROLL_TIME_DELTA_COUNT - index) % SCROLL_TIME_DELTA_COUNT;
+        avgAxis         += state->deltaAxis[avgIndex];
+        avgCount ++;
+
+        if ((state->deltaTime[avgIndex] <= 0) ||
+            (state->deltaTime[avgIndex] >= (IOFixed)SCROLL_EVENT_THRESHOLD_MS)) {
+            avgTimeDeltaMS += SCROLL_EVENT_THRESHOLD_MS;
+            break;
+        }
+
+        avgTimeDeltaMS  += state->deltaTime[avgIndex];
+
+        if (avgTimeDeltaMS >= (IOFixed)(SCROLL_CLEAR_THRESHOLD_MS_LL * kIOFixedOne)) {
+            break;
+        }
+    }
+
+    state->deltaIndex = (state->deltaIndex + 1) % SCROLL_TIME_DELTA_COUNT;
+
+    average->avgCount       = avgCount;
+    average->avgAxis        = avgAxis;
+    average->avgTimeDeltaMS = avgTimeDeltaMS;
+
+    return true;
+}
+
+static inline bool ScrollDeltaTimeEndsWindow(IOFixed deltaTime)
+{
+    return ((deltaTime <= 0) || (deltaTime >= (IOFixed)SCROLL_EVENT_THRESHOLD_MS));
+}
+
+static inline IOFixed ScrollDeltaTimeWeight(IOFixed deltaTime)
+{
+    return ScrollDeltaTimeEndsWindow(deltaTime) ? (IOFixed)SCROLL_EVENT_THRESHOLD_MS : deltaTime;
+}
+
+// AccelerateScrollAxis now: keeps the window's sums up to date
+static inline bool averageRunning(Axis * axis, const ScrollEvent * event, Average * average)
+{
+    ScaleDataState *    state       = &axis->state;
+    bool                clear       = directionChange(&axis->lastValue, event->delta);
+    IOFixed             absAxis     = abs(event->delta) * 65536;
+    IOFixed             timeDeltaMS;
+    int                 oldIndex;
+
+    if ( absAxis == 0 )
+        return false;
+
+    timeDeltaMS = eventTimeDelta(event->timestampNS, &axis->lastEventTimeNS, clear, state, sizeof(*state));
+
+    if (state->deltaCount == SCROLL_TIME_DELTA_COUNT) {
+        oldIndex = state->deltaIndex;
+        state->deltaTimeSum -= ScrollDeltaTimeWeight(state->deltaTime[oldIndex]);
+        state->deltaAxisSum -= state->deltaAxis[oldIndex];
+        state->deltaCount--;
+    }
+
+    state->deltaTime[state->deltaIndex] = timeDeltaMS;
+    state->deltaAxis[state->deltaIndex] = absAxis;
+
+    if (ScrollDeltaTimeEndsWindow(timeDeltaMS)) {
+        state->deltaTimeSum   = SCROLL_EVENT_THRESHOLD_MS;
+        state->deltaAxisSum   = absAxis;
+        state->deltaCount     = 1;
+    }
+    else {
+        state->deltaTimeSum   += timeDeltaMS;
+        state->deltaAxisSum   += absAxis;
+        state->deltaCount++;
+
+        while (state->deltaCount > 1) {
+            oldIndex = (state->deltaIndex + SCROLL_TIME_DELTA_COUNT + 1 - state->deltaCount) % SCROLL_TIME_DELTA_COUNT;
+
+            IOFixed oldWeight = ScrollDeltaTimeWeight(state->deltaTime[oldIndex]);
+
+            if ((state->deltaTimeSum - oldWeight) < (IOFixed)(SCROLL_CLEAR_THRESHOLD_MS_LL * kIOFixedOne))
+                break;
+
+            state->deltaTimeSum -= oldWeight;
+            state->deltaAxisSum -= state->deltaAxis[oldIndex];
+            state->deltaCount--;
+        }
+    }
+
+    state->deltaIndex = (state->deltaIndex + 1) % SCROLL_TIME_DELTA_COUNT;
+
+    average->avgCount       = state->deltaCount;
+    average->avgAxis        = state->deltaAxisSum;
+    average->avgTimeDeltaMS = state->deltaTimeSum;
+
+    return true;
+}
+
+static bool appendEvent(Session * session, UInt64 timestampNS, SInt32 delta)
+{
+    if ( session->count == session->capacity ) {
+        long            capacity    = session->capacity ? session->capacity * 2 : 1024;
+        ScrollEvent *   events      = realloc(session->events, capacity * sizeof(ScrollEvent));
+
+        if ( !events )
+            return false;
+
+        session->events     = events;
+        session->capacity   = capacity;
+    }
+
+    session->events[session->count].timestampNS = timestampNS;
+    session->events[session->count].delta       = delta;
+    session->count++;
+
+    return true;
+}
+
+static bool loadTrace(const char * path, Session * session)
+{
+    char    line[kMaxLineLength];
+    FILE *  file;
+    long    lineNumber = 0;
+    bool    result = true;
+
+    if ( !(file = fopen(path, "r")) ) {
+        printf("couldn't open %s: %s\n", path, strerror(errno));
+        return false;
+    }
+
+    session->name = strdup(path);
+
+    while ( result && fgets(line, sizeof(line), file) ) {
+        unsigned long long  timestampNS;
+        int                 delta;
+        char *              comment = strchr(line, '#');
+
+        lineNumber++;
+
+        if ( comment )
+            *comment = 0;
+
+        if ( strspn(line, " \t\r\n") == strlen(line) )
+            continue;
+
+        if ( sscanf(line, "%llu %d", &timestampNS, &delta) != 2 ) {
+            printf("%s:%ld: expected a timestamp and a delta\n", path, lineNumber);
+            result = false;
+        }
+        else if ( session->count && (timestampNS < session->events[session->count - 1].timestampNS) ) {
+            printf("%s:%ld: timestamp goes backwards\n", path, lineNumber);
+            result = false;
+        }
+        else if ( !appendEvent(session, timestampNS, delta) ) {
+            printf("out of memory\n");
+            result = false;
+        }
+    }
+
+    fclose(file);
+
+    return result && session->name;
+}
+
+static unsigned int nextRandom(unsigned int * seed, unsigned int range)
+{
+    *seed = *seed * 1103515245 + 12345;
+
+    return (*seed >> 16) % range;
+}
+
+// notches a few tens of ms apart in bursts, pauses over the clear
+// threshold between them, and the odd burst in the other direction
+static bool generateWheelSession(Session * session, long count)
+{
+    unsigned int    seed        = 0x5748454c;
+    UInt64          timestamp   = 1000000000ull;
+    SInt32          direction   = 1;
+
+    session->name = strdup("generated wheel session");
+
+    while ( session->count < count ) {
+        long burst = 3 + nextRandom(&seed, 30);
+
+        if ( !nextRandom(&seed, 4) )
+            direction = -direction;
+
+        while ( burst-- && session->count < count ) {
+            timestamp += (UInt64)(10 + nextRandom(&seed, 160)) * 1000000;
+
+            if ( !appendEvent(session, timestamp, direction * (SInt32)(1 + nextRandom(&seed, 3))) )
+                return false;
+        }
+
+        timestamp += (UInt64)(300 + nextRandom(&seed, 1500)) * 1000000;
+    }
+
+    return session->name != NULL;
+}
+
+// 8ms reports ramping up to a flick and coasting back down, with the odd
+// empty report in between
+static bool generateContinuousSession(Session * session, long count)
+{
+    unsigned int    seed        = 0x434f4e54;
+    UInt64          timestamp   = 1000000000ull;
+    SInt32          direction   = -1;
+
+    session->name = strdup("generated continuous session");
+
+    while ( session->count < count ) {
+        int peak    = 5 + nextRandom(&seed, 60);
+        int step;
+
+        direction = -direction;
+
+        for ( step = 0; (step < 2 * peak) && (session->count < count); step++ ) {
+            int magnitude = (step < peak / 4) ? (4 * step) : ((2 * peak - step) / 2);
+
+            timestamp += 8000000;
+
+            if ( !appendEvent(session, timestamp, nextRandom(&seed, 20) ? direction * magnitude : 0) )
+                return false;
+        }
+
+        timestamp += (UInt64)(50 + nextRandom(&seed, 800)) * 1000000;
+    }
+
+    return session->name != NULL;
+}
+
+static double replayWalk(const Session * session, long rounds, Average * averages)
+{
+    uint64_t    start = now();
+    long        round;
+    long        index;
+
+    for ( round = 0; round < rounds; round++ ) {
+        AxisWalk axis;
+
+        memset(&axis, 0, sizeof(axis));
+
+        for ( index = 0; index < session->count; index++ )
+            if ( !averageWalk(&axis, &session->events[index], &averages[index]) )
+                memset(&averages[index], 0, sizeof(Average));
+    }
+
+    return (double)(now() - start) / ((double)rounds * session->count);
+}
+
+static double replayRunning(const Session * session, long rounds, Average * averages)
+{
+    uint64_t    start = now();
+    long        round;
+    long        index;
+
+    for ( round = 0; round < rounds; round++ ) {
+        Axis axis;
+
+        memset(&axis, 0, sizeof(axis));
+
+        for ( index = 0; index < session->count; index++ )
+            if ( !averageRunning(&axis, &session->events[index], &averages[index]) )
+                memset(&averages[index], 0, sizeof(Average));
+    }
+
+    return (double)(now() - start) / ((double)rounds * session->count);
+}
+
+static int replaySession(const Session * session, long rounds)
+{
+    Average *   walkAverages;
+    Average *   runningAverages;
+    double      walkNs;
+    double      runningNs;
+    long        index;
+    int         result = 0;
+
+    if ( !session->count ) {
+        printf("%s: no events\n", session->name);
+        return 0;
+    }
+
+    walkAverages    = calloc(session->count, sizeof(Average));
+    runningAverages = calloc(session->count, sizeof(Average));
+
+    if ( !walkAverages || !runningAverages ) {
+        printf("out of memory\n");
+        free(walkAverages);
+        free(runningAverages);
+        return 1;
+    }
+
+    walkNs      = replayWalk(session, rounds, walkAverages);
+    runningNs   = replayRunning(session, rounds, runningAverages);
+
+    printf("%-32s %9ld events %10.2f ns walk %10.2f ns running sums\n", session->name, session->count, walkNs, runningNs);
+
+    for ( index = 0; index < session->count; index++ ) {
+        if ( memcmp(&walkAverages[index], &runningAverages[index], sizeof(Average)) ) {
+            printf("  event %ld: walk averages %d/%d/%d, running sums %d/%d/%d\n", index,
+                   walkAverages[index].avgCount, walkAverages[index].avgAxis, walkAverages[index].avgTimeDeltaMS,
+                   runningAverages[index].avgCount, runningAverages[index].avgAxis, runningAverages[index].avgTimeDeltaMS);
+            result = 1;
+            break;
+        }
+    }
+
+    free(walkAverages);
+    free(runningAverages);
+
+    return result;
+}
+
+int main(int argc, char ** argv)
+{
+    long        count       = kDefaultEventCount;
+    long        rounds      = kDefaultRounds;
+    Session *   sessions;
+    int         sessionCount;
+    int         index;
+    int         failed      = 0;
+    int         ch;
+
+    while ( (ch = getopt(argc, argv, "n:r:")) != -1 ) {
+        switch ( ch ) {
+            case 'n':
+                count = strtol(optarg, NULL, 0);
+                break;
+            case 'r':
+                rounds = strtol(optarg, NULL, 0);
+                break;
+            default:
+                printf("usage: %s [-n generatedEvents] [-r rounds] [trace ...]\n", argv[0]);
+                return 1;
+        }
+    }
+
+    if ( count <= 0 || rounds <= 0 ) {
+        printf("need at least one event and one round\n");
+        return 1;
+    }
+
+    argc -= optind;
+    argv += optind;
+
+    sessionCount    = argc ? argc : 2;
+    sessions        = calloc(sessionCount, sizeof(Session));
+
+    if ( !sessions ) {
+        printf("out of memory\n");
+        return 1;
+    }
+
+    for ( index = 0; index < sessionCount && !failed; index++ ) {
+        bool loaded;
+
+        if ( argc )
+            loaded = loadTrace(argv[index], &sessions[index]);
+        else if ( index == 0 )
+            loaded = generateWheelSession(&sessions[index], count);
+        else
+            loaded = generateContinuousSession(&sessions[index], count);
+
+        if ( !loaded )
+            failed = 1;
+    }
+
+    for ( index = 0; index < sessionCount && !failed; index++ )
+        failed |= replaySession(&sessions[index], rounds);
+
+    if ( !failed )
+        printf("passed: the running sums average every event the same as the walk\n");
+    else
+        printf("failed\n");
+
+    for ( index = 0; index < sessionCount; index++ ) {
+        free(sessions[index].name);
+        free(sessions[index].events);
+    }
+    free(sessions);
+
+    return failed;
+}
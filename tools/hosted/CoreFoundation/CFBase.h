@@ -0,0 +1,43 @@
+//
+//  CFBase.h
+//  IOHIDFamily
+//
+//  Hosted build shim providing just the CoreFoundation types the IOHIDLib
+//  value slab uses.  There is no CFAllocatorCreate here; the benchmark
+//  calls the CFAllocatorContext callbacks the way CF would.
+//
+
+#ifndef _IOHIDFAMILY_HOSTED_CFBASE_H
+#define _IOHIDFAMILY_HOSTED_CFBASE_H
+
+#include <sys/cdefs.h>
+
+#ifndef __unused
+#define __unused                __attribute__((unused))
+#endif
+
+typedef long                    CFIndex;
+typedef unsigned long           CFOptionFlags;
+typedef const struct __CFString * CFStringRef;
+
+typedef const void *    (*CFAllocatorRetainCallBack)(const void *info);
+typedef void            (*CFAllocatorReleaseCallBack)(const void *info);
+typedef CFStringRef     (*CFAllocatorCopyDescriptionCallBack)(const void *info);
+typedef void *          (*CFAllocatorAllocateCallBack)(CFIndex allocSize, CFOptionFlags hint, void *info);
+typedef void *          (*CFAllocatorReallocateCallBack)(void *ptr, CFIndex newsize, CFOptionFlags hint, void *info);
+typedef void            (*CFAllocatorDeallocateCallBack)(void *ptr, void *info);
+typedef CFIndex         (*CFAllocatorPreferredSizeCallBack)(CFIndex size, CFOptionFlags hint, void *info);
+
+typedef struct {
+    CFIndex                             version;
+    void *                              info;
+    CFAllocatorRetainCallBack           retain;
+    CFAllocatorReleaseCallBack          release;
+    CFAllocatorCopyDescriptionCallBack  copyDescription;
+    CFAllocatorAllocateCallBack         allocate;
+    CFAllocatorReallocateCallBack       reallocate;
+    CFAllocatorDeallocateCallBack       deallocate;
+    CFAllocatorPreferredSizeCallBack    preferredSize;
+} CFAllocatorContext;
+
+#endif /* _IOHIDFAMILY_HOSTED_CFBASE_H */
@@ -0,0 +1,41 @@
+//
+//  IOTypes.h
+//  IOHIDFamily
+//
+//  Hosted build shim providing just the IOKit types the HID descriptor
+//  parser and the tools use, so they can be built on systems without
+//  IOKit headers.
+//
+
+#ifndef _IOHIDFAMILY_HOSTED_IOTYPES_H
+#define _IOHIDFAMILY_HOSTED_IOTYPES_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <strings.h>
+
+typedef uint8_t         UInt8;
+typedef int8_t          SInt8;
+typedef uint16_t        UInt16;
+typedef int16_t         SInt16;
+typedef uint32_t        UInt32;
+typedef int32_t         SInt32;
+typedef uint64_t        UInt64;
+typedef int64_t         SInt64;
+typedef unsigned char   Boolean;
+typedef SInt32          OSStatus;
+typedef size_t          IOByteCount;
+typedef size_t          vm_size_t;
+typedef SInt32          IOFixed;
+typedef UInt32          IOItemCount;
+
+#ifndef true
+#define true            1
+#define false           0
+#endif
+
+#ifndef __private_extern__
+#define __private_extern__
+#endif
+
+#endif /* _IOHIDFAMILY_HOSTED_IOTYPES_H */
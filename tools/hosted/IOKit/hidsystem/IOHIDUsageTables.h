@@ -0,0 +1,8 @@
+//
+//  IOHIDUsageTables.h
+//  IOHIDFamily
+//
+//  Hosted build shim; the usage tables live with IOHIDFamily.
+//
+
+#include "../../../../IOHIDFamily/IOHIDUsageTables.h"
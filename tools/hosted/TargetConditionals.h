@@ -0,0 +1,16 @@
+//
+//  TargetConditionals.h
+//  IOHIDFamily
+//
+//  Hosted build shim for the tools that compile the HID descriptor parser
+//  outside of the kernel.  Claiming an embedded target makes
+//  IOHIDDescriptorParser.h supply the MacTypes it would otherwise expect
+//  from CoreServices.
+//
+
+#ifndef _IOHIDFAMILY_HOSTED_TARGETCONDITIONALS_H
+#define _IOHIDFAMILY_HOSTED_TARGETCONDITIONALS_H
+
+#define TARGET_OS_EMBEDDED      1
+
+#endif /* _IOHIDFAMILY_HOSTED_TARGETCONDITIONALS_H */
@@ -0,0 +1,17 @@
+//
+//  OSAtomic.h
+//  IOHIDFamily
+//
+//  Hosted build shim providing the OSAtomic calls IOHIDLib uses on top of
+//  the compiler's atomic builtins.
+//
+
+#ifndef _IOHIDFAMILY_HOSTED_OSATOMIC_H
+#define _IOHIDFAMILY_HOSTED_OSATOMIC_H
+
+#include <stdint.h>
+
+#define OSAtomicIncrement32Barrier(p)   __atomic_add_fetch((p), 1, __ATOMIC_SEQ_CST)
+#define OSAtomicDecrement32Barrier(p)   __atomic_sub_fetch((p), 1, __ATOMIC_SEQ_CST)
+
+#endif /* _IOHIDFAMILY_HOSTED_OSATOMIC_H */
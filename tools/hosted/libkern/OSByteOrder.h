@@ -0,0 +1,17 @@
+//
+//  OSByteOrder.h
+//  IOHIDFamily
+//
+//  Hosted build shim providing just the byte swapping the keymap decoding
+//  in IOHIKeyboardMapperCompiled.h uses.
+//
+
+#ifndef _IOHIDFAMILY_HOSTED_OSBYTEORDER_H
+#define _IOHIDFAMILY_HOSTED_OSBYTEORDER_H
+
+#include <endian.h>
+
+#define OSSwapBigToHostInt16(x)     be16toh(x)
+#define OSSwapHostToBigInt16(x)     htobe16(x)
+
+#endif /* _IOHIDFAMILY_HOSTED_OSBYTEORDER_H */
@@ -0,0 +1,22 @@
+//
+//  kdebug.h
+//  IOHIDFamily
+//
+//  Hosted build shim providing the kdebug code layout IOHIDFamilyTrace.h
+//  builds its debug IDs from, so the trace tools can decode traces
+//  without the Darwin headers.  Emitting trace points is a no-op.
+//
+
+#ifndef _IOHIDFAMILY_HOSTED_KDEBUG_H
+#define _IOHIDFAMILY_HOSTED_KDEBUG_H
+
+#define DBG_IOKIT                       5
+#define DBG_IOHID                       35
+
+#define KDBG_CODE(Class, SubClass, code) \
+    (((Class & 0xff) << 24) | ((SubClass & 0xff) << 16) | ((code & 0x3fff) << 2))
+#define IOKDBG_CODE(SubClass, code)     KDBG_CODE(DBG_IOKIT, SubClass, code)
+
+#define KERNEL_DEBUG_CONSTANT(x, a, b, c, d, e)     do { } while (0)
+
+#endif /* _IOHIDFAMILY_HOSTED_KDEBUG_H */